@@ -0,0 +1,1016 @@
+#include "matrix.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Benchmarks every public operation over a sweep of shapes and reports
+// time, GFLOP/s and GB/s. Each sample times a batch of calls long enough
+// for the clock (~1ms), after a warmup. Results can be saved as JSON and
+// compared against a saved baseline:
+//   bench_matrix --json base.json
+//   bench_matrix --compare base.json --threshold 10
+// Run with --help for every option.
+
+#define MAX_SAMPLES 1000
+#define MIN_SAMPLE_SECONDS 1e-3
+#define WARMUP_SECONDS 0.05
+
+typedef enum {
+  SHAPE_SQUARE = 1,
+  SHAPE_TALL = 2,
+  SHAPE_ANY = SHAPE_SQUARE | SHAPE_TALL
+} ShapeClass;
+
+typedef struct shape {
+  const char *label;
+  size_t rows;
+  size_t cols;
+  ShapeClass cls;
+  int huge; // only with --huge
+} Shape;
+
+static const Shape shapes[] = {
+    {"tiny", 4, 4, SHAPE_SQUARE, 0},
+    {"small", 64, 64, SHAPE_SQUARE, 0},
+    {"medium", 512, 512, SHAPE_SQUARE, 0},
+    {"large", 2048, 2048, SHAPE_SQUARE, 0},
+    {"huge", 8192, 8192, SHAPE_SQUARE, 1},
+    {"tall", 100000, 64, SHAPE_TALL, 0},
+    {"tall-huge", 1000000, 200, SHAPE_TALL, 1},
+};
+
+// Operands for one shape, shared by every benchmark run on it
+typedef struct bench_ctx {
+  size_t rows;
+  size_t cols;
+  Matrix *A;   // rows x cols, well conditioned when square
+  Matrix *B;   // rows x cols
+  Matrix *S;   // cols x cols, right-hand factor of products
+  Matrix *out; // rows x cols
+  Matrix *outT; // cols x rows
+  Matrix *vec;  // rows x 1
+  LUFactor *lu; // of A, square shapes only
+  StructuredMatrix *band; // A's band of BENCH_BAND diagonals on each side
+  MatrixD *Ad;   // A, S, out and vec in double
+  MatrixD *Sd;
+  MatrixD *outd;
+  MatrixD *vecd;
+  SparseMatrix *sparse; // rows x rows, 5-point stencil
+  MatrixBatch *batch;     // rows * cols / 16 matrices of 4 x 4, from A
+  MatrixBatch *batch_out;
+  MatrixArena *arena;
+  MatrixPool *pool;
+  int saved;  // BENCH_FILE holds A
+  int saved_s; // BENCH_FILE_S holds S
+  float sink; // keeps scalar results alive
+} BenchCtx;
+
+typedef struct bench {
+  const char *name;
+  ShapeClass cls;
+  void (*run)(BenchCtx *c);
+  // Work per call, for GFLOP/s and GB/s
+  double (*flops)(const BenchCtx *c);
+  double (*bytes)(const BenchCtx *c);
+  // Shapes whose smaller side is below this are skipped: the call would
+  // only fail there (0: any size)
+  size_t min_side;
+} Bench;
+
+static double elems(const BenchCtx *c) { return (double)c->rows * c->cols; }
+
+static double n3(const BenchCtx *c) {
+  return (double)c->rows * c->rows * c->rows;
+}
+
+// Work formulas
+static double zero_work(const BenchCtx *c) { return 0.0; }
+static double elems_work(const BenchCtx *c) { return elems(c); }
+static double one_array(const BenchCtx *c) { return 4.0 * elems(c); }
+static double two_arrays(const BenchCtx *c) { return 8.0 * elems(c); }
+static double three_arrays(const BenchCtx *c) { return 12.0 * elems(c); }
+static double four_arrays(const BenchCtx *c) { return 16.0 * elems(c); }
+static double three_elems_work(const BenchCtx *c) { return 3.0 * elems(c); }
+static double mult_flops(const BenchCtx *c) {
+  return 2.0 * c->rows * c->cols * c->cols;
+}
+static double mult_bytes(const BenchCtx *c) {
+  return 4.0 * (2.0 * elems(c) + (double)c->cols * c->cols);
+}
+static double gemm_bytes(const BenchCtx *c) {
+  return mult_bytes(c) + one_array(c);
+}
+static double two_arrays_d(const BenchCtx *c) { return 2.0 * two_arrays(c); }
+static double gemm_bytes_d(const BenchCtx *c) { return 2.0 * gemm_bytes(c); }
+static double sparse_flops(const BenchCtx *c) {
+  return 2.0 * c->sparse->nnz * c->cols;
+}
+static double sparse_bytes(const BenchCtx *c) {
+  return 12.0 * c->sparse->nnz + 8.0 * elems(c);
+}
+// KRYLOV_ITER CG iterations: one SpMV, two dots and three updates each
+#define KRYLOV_ITER 50
+static double krylov_flops(const BenchCtx *c) {
+  return KRYLOV_ITER * (2.0 * c->sparse->nnz + 10.0 * c->rows);
+}
+static double krylov_bytes(const BenchCtx *c) {
+  return KRYLOV_ITER * (12.0 * c->sparse->nnz + 4.0 * 12.0 * c->rows);
+}
+static double batch_mult_flops(const BenchCtx *c) {
+  return 2.0 * 64 * c->batch->count;
+}
+static double batch_inverse_flops(const BenchCtx *c) {
+  return 2.0 * 64 * c->batch->count;
+}
+static double batch_det_flops(const BenchCtx *c) {
+  return 2.0 / 3.0 * 64 * c->batch->count;
+}
+static double lu_flops(const BenchCtx *c) { return 2.0 / 3.0 * n3(c); }
+static double inverse_flops(const BenchCtx *c) { return 2.0 * n3(c); }
+static double solve_flops(const BenchCtx *c) {
+  return 2.0 / 3.0 * n3(c) + 2.0 * elems(c);
+}
+static double lu_solve_flops(const BenchCtx *c) { return 2.0 * elems(c); }
+// Sub- and superdiagonals of structured_solve/band16
+#define BENCH_BAND 16
+static double band_solve_flops(const BenchCtx *c) {
+  return 2.0 * c->band->n * c->band->kl * (c->band->kl + c->band->ku) +
+         2.0 * c->band->n * (2 * c->band->kl + c->band->ku);
+}
+static double band_bytes(const BenchCtx *c) {
+  return 4.0 * c->band->n * (c->band->kl + c->band->ku + 3);
+}
+static double qr_flops(const BenchCtx *c) {
+  double m = c->cols;
+  return 2.0 * c->rows * m * m - 2.0 / 3.0 * m * m * m;
+}
+static double normal_flops(const BenchCtx *c) {
+  double m = c->cols;
+  return c->rows * m * m + m * m * m / 3.0;
+}
+// Eigenpairs wanted by eigen_sym/top16
+#define BENCH_TOP_K 16
+
+// Nominal counts: the reduction to tridiagonal / bidiagonal form, plus
+// the back-transformation of the vectors
+static double eigen_flops(const BenchCtx *c) { return 4.0 / 3.0 * n3(c); }
+static double eigen_vectors_flops(const BenchCtx *c) {
+  return eigen_flops(c) + 2.0 * n3(c);
+}
+static double eigen_top_flops(const BenchCtx *c) {
+  return eigen_flops(c) + 2.0 * c->rows * c->rows * BENCH_TOP_K;
+}
+static double svd_flops(const BenchCtx *c) {
+  double n = c->cols;
+  return 4.0 * c->rows * n * n - 4.0 / 3.0 * n * n * n;
+}
+static double svd_vectors_flops(const BenchCtx *c) {
+  return svd_flops(c) + 2.0 * c->rows * c->cols * c->cols;
+}
+// Randomized SVD: each pass over A is a GEMM with l = k + p columns
+#define BENCH_RSVD_K 16
+#define BENCH_RSVD_P 10
+#define BENCH_RSVD_POWER 2
+static double rsvd_flops(const BenchCtx *c) {
+  double l = BENCH_RSVD_K + BENCH_RSVD_P;
+  return (2.0 * BENCH_RSVD_POWER + 2.0) * 2.0 * elems(c) * l;
+}
+static double sketch_flops(const BenchCtx *c) {
+  double l = BENCH_RSVD_K + BENCH_RSVD_P;
+  return 2.0 * elems(c) * (3.0 * l + 1.0);
+}
+
+// Benchmark bodies
+
+static void run_create_free(BenchCtx *c) {
+  matrix_free(matrix_create(c->rows, c->cols));
+}
+
+static void run_create_arena(BenchCtx *c) {
+  size_t mark = matrix_arena_mark(c->arena);
+  matrix_create_with(matrix_arena_allocator(c->arena), c->rows, c->cols);
+  matrix_arena_reset(c->arena, mark);
+}
+
+static void run_create_pool(BenchCtx *c) {
+  matrix_free(
+      matrix_create_with(matrix_pool_allocator(c->pool), c->rows, c->cols));
+}
+
+static void run_set_get(BenchCtx *c) {
+  for (size_t i = 0; i < c->rows; i++) {
+    for (size_t j = 0; j < c->cols; j++) {
+      matrix_set(c->out, i, j, matrix_get(c->A, i, j));
+    }
+  }
+}
+
+static void run_set_array(BenchCtx *c) {
+  matrix_set_array(c->out, c->A->array, c->rows * c->cols);
+}
+
+static void run_identity(BenchCtx *c) {
+  matrix_free(matrix_identity(c->rows));
+}
+
+static void run_approx_equal(BenchCtx *c) {
+  c->sink += matrices_are_approx_equal(c->A, c->A, 1e-6f);
+}
+
+static void run_scale(BenchCtx *c) { matrix_free(matrix_scale(2.0f, c->A)); }
+static void run_scale_into(BenchCtx *c) {
+  matrix_scale_into(c->out, 2.0f, c->A);
+}
+static void run_scale_inplace(BenchCtx *c) {
+  matrix_scale_inplace(1.0f, c->out);
+}
+
+static void run_add(BenchCtx *c) { matrix_free(matrix_add(c->A, c->B)); }
+static void run_add_into(BenchCtx *c) { matrix_add_into(c->out, c->A, c->B); }
+static void run_add_inplace(BenchCtx *c) { matrix_add_inplace(c->out, c->B); }
+
+static void run_subtract(BenchCtx *c) {
+  matrix_free(matrix_subtract(c->A, c->B));
+}
+static void run_subtract_into(BenchCtx *c) {
+  matrix_subtract_into(c->out, c->A, c->B);
+}
+static void run_subtract_inplace(BenchCtx *c) {
+  matrix_subtract_inplace(c->out, c->B);
+}
+
+static void run_mult(BenchCtx *c) { matrix_free(matrix_mult(c->A, c->S)); }
+static void run_mult_into(BenchCtx *c) {
+  matrix_mult_into(c->out, c->A, c->S);
+}
+static void run_gemm(BenchCtx *c) {
+  matrix_gemm(0.5f, c->A, c->S, 0.5f, c->out);
+}
+
+// run_gemm by Strassen-Winograd, recursing down to 1024. Measured on one
+// AVX-512 core: break-even at n ~ 2048-3072, 1.1x faster at 4096 and
+// 1.1-1.3x at 8192 (huge). The price is accuracy. The classic product's
+// max error is ~0.1 u n max|a| max|b|, with u = 2^-24. Here it grows with
+// the depth: ~2 u n at 8192 with this cutoff (three levels), ~6 u n with
+// cutoff 512. Higham's bound for Winograd's variant grows as
+// (n / cutoff)^log2(18), against n for the classic product.
+#define BENCH_STRASSEN_CUTOFF 1024
+
+static void run_gemm_strassen(BenchCtx *c) {
+  matrix_set_strassen_cutoff(BENCH_STRASSEN_CUTOFF);
+  run_gemm(c);
+  matrix_set_strassen_cutoff(0);
+}
+
+// A^T S through a transposed view, against run_gemm's A S
+static void run_gemm_trans_view(BenchCtx *c) {
+  Matrix At = matrix_trans_view(c->A);
+  matrix_gemm(0.5f, &At, c->S, 0.5f, c->out);
+}
+
+// out = 0.5 (A + B) - out, fused by an expression against one call per
+// operation; both are charged the fused traffic
+static void run_expr_elementwise(BenchCtx *c) {
+  MatrixExpr *e = expr_subtract(
+      expr_scale(0.5f, expr_add(expr_matrix(c->A), expr_matrix(c->B))),
+      expr_matrix(c->out));
+  expr_eval_into(c->out, e);
+  expr_free(e);
+}
+static void run_unfused_elementwise(BenchCtx *c) {
+  Matrix *sum = matrix_add(c->A, c->B);
+  Matrix *half = matrix_scale(0.5f, sum);
+  matrix_subtract_into(c->out, half, c->out);
+  matrix_free(sum);
+  matrix_free(half);
+}
+
+// run_gemm as an expression, which must cost the same
+static void run_expr_gemm(BenchCtx *c) {
+  MatrixExpr *e = expr_add(
+      expr_scale(0.5f, expr_mult(expr_matrix(c->A), expr_matrix(c->S))),
+      expr_scale(0.5f, expr_matrix(c->out)));
+  expr_eval_into(c->out, e);
+  expr_free(e);
+}
+
+// Written in the working directory, removed with the context
+#define BENCH_FILE "bench_matrix.bin"
+
+static void save_once(BenchCtx *c) {
+  if (!c->saved)
+    c->saved = matrix_save(BENCH_FILE, c->A) == 0;
+}
+static void run_save(BenchCtx *c) {
+  c->saved = matrix_save(BENCH_FILE, c->A) == 0;
+}
+static void run_load(BenchCtx *c) {
+  save_once(c);
+  matrix_free(matrix_load(BENCH_FILE));
+}
+// Open, touch one element and close: independent of the size
+static void run_file_open(BenchCtx *c) {
+  save_once(c);
+  MatrixFile *file = matrix_file_open(BENCH_FILE, 0);
+  if (file != NULL) {
+    Matrix view = matrix_file_view(file);
+    c->sink += view.array[0];
+    matrix_file_close(file);
+  }
+}
+
+// Out-of-core products and LU stream their operands from the files in a
+// budget below the size of the large shapes
+#define BENCH_FILE_S "bench_matrix_s.bin"
+#define BENCH_FILE_OUT "bench_matrix_out.bin"
+#define BENCH_OOC_BUDGET ((size_t)16 << 20)
+
+static void run_file_mult(BenchCtx *c) {
+  save_once(c);
+  if (!c->saved_s)
+    c->saved_s = matrix_save(BENCH_FILE_S, c->S) == 0;
+  matrix_file_mult(BENCH_FILE_OUT, BENCH_FILE, BENCH_FILE_S,
+                   BENCH_OOC_BUDGET);
+}
+static void run_file_lu(BenchCtx *c) {
+  save_once(c);
+  size_t *pivots = malloc(c->rows * sizeof(size_t));
+  matrix_file_lu(BENCH_FILE_OUT, BENCH_FILE, pivots, BENCH_OOC_BUDGET);
+  free(pivots);
+}
+
+static void run_gemm_d(BenchCtx *c) {
+  matrixd_gemm(0.5, c->Ad, c->Sd, 0.5, c->outd);
+}
+
+static void run_sparse_gemm(BenchCtx *c) {
+  sparse_gemm(1.0f, c->sparse, c->B, 0.0f, c->out);
+}
+
+// A fixed number of iterations from x = 0: the tolerance is out of reach
+static void run_krylov_cg(BenchCtx *c) {
+  Matrix x = matrix_col(c->out, 0);
+  matrix_scale_inplace(0.0f, &x);
+  KrylovOptions options = {0};
+  options.max_iter = KRYLOV_ITER;
+  options.tolerance = 1e-30f;
+  krylov_cg(sparse_operator(c->sparse), c->vec, &x, &options, NULL);
+}
+
+static void run_batch_gemm(BenchCtx *c) {
+  matrix_batch_gemm(1.0f, c->batch, c->batch, 0.0f, c->batch_out);
+}
+static void run_batch_inverse(BenchCtx *c) {
+  matrix_batch_inverse_into(c->batch_out, c->batch, NULL);
+}
+static void run_batch_determinant(BenchCtx *c) {
+  matrix_batch_determinant(c->batch, c->out->array);
+}
+
+// The fixed-size types on the same matrices as the batched ones, one call
+// each, read from and written to A and out
+static void run_fixed_mult(BenchCtx *c) {
+  Matrix4 *a = (Matrix4 *)c->A->array, *out = (Matrix4 *)c->out->array;
+  for (size_t e = 0; e < c->batch->count; e++) {
+    matrix4_mult(&out[e], &a[e], &a[e]);
+  }
+}
+static void run_fixed_inverse(BenchCtx *c) {
+  Matrix4 *a = (Matrix4 *)c->A->array, *out = (Matrix4 *)c->out->array;
+  for (size_t e = 0; e < c->batch->count; e++) {
+    matrix4_inverse(&out[e], &a[e]);
+  }
+}
+static void run_fixed_determinant(BenchCtx *c) {
+  Matrix4 *a = (Matrix4 *)c->A->array;
+  for (size_t e = 0; e < c->batch->count; e++) {
+    c->out->array[e] = matrix4_determinant(&a[e]);
+  }
+}
+
+static void run_trans(BenchCtx *c) { matrix_free(matrix_trans(c->A)); }
+static void run_trans_into(BenchCtx *c) { matrix_trans_into(c->outT, c->A); }
+static void run_trans_inplace(BenchCtx *c) { matrix_trans_inplace(c->out); }
+
+static void run_determinant(BenchCtx *c) {
+  c->sink += matrix_determinant(c->A);
+}
+static void run_inverse(BenchCtx *c) { matrix_free(matrix_inverse(c->A)); }
+static void run_inverse_into(BenchCtx *c) {
+  matrix_inverse_into(c->out, c->A);
+}
+static void run_solve_lin_system(BenchCtx *c) {
+  matrix_free(solve_lin_system(c->A, c->vec));
+}
+
+static void run_solve_d(BenchCtx *c) {
+  matrixd_free(matrixd_solve(c->Ad, c->vecd));
+}
+static void run_solve_refined(BenchCtx *c) {
+  matrixd_free(solve_lin_system_refined(c->Ad, c->vecd, 0, NULL));
+}
+
+static void run_lu_factor(BenchCtx *c) { lu_factor_free(lu_factor(c->A)); }
+static void run_lu_solve(BenchCtx *c) {
+  matrix_free(lu_solve(c->lu, c->vec));
+}
+static void run_lu_det(BenchCtx *c) { c->sink += lu_det(c->lu); }
+static void run_band_solve(BenchCtx *c) {
+  matrix_free(structured_solve(c->band, c->vec));
+}
+static void run_lu_inverse(BenchCtx *c) {
+  matrix_free(lu_inverse(c->lu));
+}
+
+static void run_least_squares(BenchCtx *c) {
+  matrix_free(solve_least_squares(c->A, c->vec));
+}
+static void run_normal_equations(BenchCtx *c) {
+  matrix_free(solve_normal_equations(c->A, c->vec));
+}
+
+static void run_eigen_sym(BenchCtx *c) {
+  eigen_sym_free(eigen_sym(c->A, 0, 1));
+}
+static void run_eigen_values(BenchCtx *c) {
+  eigen_sym_free(eigen_sym(c->A, 0, 0));
+}
+static void run_eigen_top(BenchCtx *c) {
+  eigen_sym_free(eigen_sym(c->A, BENCH_TOP_K, 1));
+}
+static void run_svd(BenchCtx *c) { svd_factor_free(svd_factor(c->A, 0, 1)); }
+static void run_svd_values(BenchCtx *c) {
+  svd_factor_free(svd_factor(c->A, 0, 0));
+}
+static void run_randomized_svd(BenchCtx *c) {
+  svd_factor_free(randomized_svd(c->A, BENCH_RSVD_K, BENCH_RSVD_P,
+                                 BENCH_RSVD_POWER, 1));
+}
+static void run_svd_sketch(BenchCtx *c) {
+  SVDSketch *sk = svd_sketch_create(c->cols, BENCH_RSVD_K, BENCH_RSVD_P, 1);
+  if (sk == NULL)
+    return;
+  for (size_t r0 = 0; r0 < c->rows; r0 += 4096) {
+    size_t rows = c->rows - r0 < 4096 ? c->rows - r0 : 4096;
+    Matrix block = matrix_view(c->A, r0, 0, rows, c->cols);
+    svd_sketch_update(sk, &block);
+  }
+  svd_factor_free(svd_sketch_finish(sk));
+}
+
+// matrix_print, the thread and SIMD settings and compare_floats are not
+// timed; the settings are exposed as options instead
+static const Bench benches[] = {
+    {"matrix_create/free", SHAPE_ANY, run_create_free, zero_work, zero_work},
+    {"matrix_create_with/arena", SHAPE_ANY, run_create_arena, zero_work,
+     zero_work},
+    {"matrix_create_with/pool", SHAPE_ANY, run_create_pool, zero_work,
+     zero_work},
+    {"matrix_set/get", SHAPE_ANY, run_set_get, zero_work, two_arrays},
+    {"matrix_set_array", SHAPE_ANY, run_set_array, zero_work, two_arrays},
+    {"matrix_identity", SHAPE_SQUARE, run_identity, zero_work, one_array},
+    {"matrices_are_approx_equal", SHAPE_ANY, run_approx_equal, elems_work,
+     two_arrays},
+    {"matrix_scale", SHAPE_ANY, run_scale, elems_work, two_arrays},
+    {"matrix_scale_into", SHAPE_ANY, run_scale_into, elems_work, two_arrays},
+    {"matrix_scale_inplace", SHAPE_ANY, run_scale_inplace, elems_work,
+     two_arrays},
+    {"matrix_add", SHAPE_ANY, run_add, elems_work, three_arrays},
+    {"matrix_add_into", SHAPE_ANY, run_add_into, elems_work, three_arrays},
+    {"matrix_add_inplace", SHAPE_ANY, run_add_inplace, elems_work,
+     three_arrays},
+    {"matrix_subtract", SHAPE_ANY, run_subtract, elems_work, three_arrays},
+    {"matrix_subtract_into", SHAPE_ANY, run_subtract_into, elems_work,
+     three_arrays},
+    {"matrix_subtract_inplace", SHAPE_ANY, run_subtract_inplace, elems_work,
+     three_arrays},
+    {"matrix_mult", SHAPE_ANY, run_mult, mult_flops, mult_bytes},
+    {"matrix_mult_into", SHAPE_ANY, run_mult_into, mult_flops, mult_bytes},
+    {"matrix_gemm", SHAPE_ANY, run_gemm, mult_flops, gemm_bytes},
+    {"matrix_gemm/strassen", SHAPE_SQUARE, run_gemm_strassen, mult_flops,
+     gemm_bytes},
+    {"matrix_gemm/trans_view", SHAPE_SQUARE, run_gemm_trans_view, mult_flops,
+     gemm_bytes},
+    {"matrixd_gemm", SHAPE_ANY, run_gemm_d, mult_flops, gemm_bytes_d},
+    {"expr_eval/elementwise", SHAPE_ANY, run_expr_elementwise,
+     three_elems_work, four_arrays},
+    {"expr_eval/elementwise_unfused", SHAPE_ANY, run_unfused_elementwise,
+     three_elems_work, four_arrays},
+    {"expr_eval/gemm", SHAPE_ANY, run_expr_gemm, mult_flops, gemm_bytes},
+    {"matrix_save", SHAPE_ANY, run_save, zero_work, one_array},
+    {"matrix_load", SHAPE_ANY, run_load, zero_work, one_array},
+    {"matrix_file_open", SHAPE_ANY, run_file_open, zero_work, zero_work},
+    {"matrix_file_mult", SHAPE_ANY, run_file_mult, mult_flops, mult_bytes},
+    {"matrix_file_lu", SHAPE_SQUARE, run_file_lu, lu_flops, two_arrays},
+    {"sparse_gemm", SHAPE_ANY, run_sparse_gemm, sparse_flops, sparse_bytes},
+    {"krylov_cg", SHAPE_ANY, run_krylov_cg, krylov_flops, krylov_bytes},
+    {"matrix_batch_gemm/4x4", SHAPE_ANY, run_batch_gemm, batch_mult_flops,
+     three_arrays},
+    {"matrix_batch_inverse/4x4", SHAPE_ANY, run_batch_inverse,
+     batch_inverse_flops, two_arrays},
+    {"matrix_batch_determinant/4x4", SHAPE_ANY, run_batch_determinant,
+     batch_det_flops, one_array},
+    {"matrix4_mult", SHAPE_ANY, run_fixed_mult, batch_mult_flops,
+     two_arrays},
+    {"matrix4_inverse", SHAPE_ANY, run_fixed_inverse, batch_inverse_flops,
+     two_arrays},
+    {"matrix4_determinant", SHAPE_ANY, run_fixed_determinant,
+     batch_det_flops, one_array},
+    {"matrix_trans", SHAPE_ANY, run_trans, zero_work, two_arrays},
+    {"matrix_trans_into", SHAPE_ANY, run_trans_into, zero_work, two_arrays},
+    {"matrix_trans_inplace", SHAPE_ANY, run_trans_inplace, zero_work,
+     two_arrays},
+    {"matrix_determinant", SHAPE_SQUARE, run_determinant, lu_flops,
+     two_arrays},
+    {"matrix_inverse", SHAPE_SQUARE, run_inverse, inverse_flops, two_arrays},
+    {"matrix_inverse_into", SHAPE_SQUARE, run_inverse_into, inverse_flops,
+     two_arrays},
+    {"solve_lin_system", SHAPE_SQUARE, run_solve_lin_system, solve_flops,
+     two_arrays},
+    {"matrixd_solve", SHAPE_SQUARE, run_solve_d, solve_flops, two_arrays_d},
+    {"solve_lin_system_refined", SHAPE_SQUARE, run_solve_refined,
+     solve_flops, two_arrays_d},
+    {"lu_factor", SHAPE_SQUARE, run_lu_factor, lu_flops, two_arrays},
+    {"lu_solve", SHAPE_SQUARE, run_lu_solve, lu_solve_flops, one_array},
+    {"lu_det", SHAPE_SQUARE, run_lu_det, zero_work, zero_work},
+    {"lu_inverse", SHAPE_SQUARE, run_lu_inverse, inverse_flops, two_arrays},
+    {"structured_solve/band16", SHAPE_SQUARE, run_band_solve,
+     band_solve_flops, band_bytes},
+    {"solve_least_squares", SHAPE_TALL, run_least_squares, qr_flops,
+     two_arrays},
+    {"solve_normal_equations", SHAPE_TALL, run_normal_equations,
+     normal_flops, one_array},
+    {"eigen_sym", SHAPE_SQUARE, run_eigen_sym, eigen_vectors_flops,
+     two_arrays},
+    {"eigen_sym/values", SHAPE_SQUARE, run_eigen_values, eigen_flops,
+     one_array},
+    {"eigen_sym/top16", SHAPE_SQUARE, run_eigen_top, eigen_top_flops,
+     one_array, BENCH_TOP_K},
+    {"svd_factor", SHAPE_ANY, run_svd, svd_vectors_flops, two_arrays},
+    {"svd_factor/values", SHAPE_ANY, run_svd_values, svd_flops, one_array},
+    {"randomized_svd/k16", SHAPE_ANY, run_randomized_svd, rsvd_flops,
+     one_array, BENCH_RSVD_K + BENCH_RSVD_P},
+    {"svd_sketch/k16", SHAPE_ANY, run_svd_sketch, sketch_flops, one_array,
+     BENCH_RSVD_K + BENCH_RSVD_P},
+};
+
+#define N_BENCHES (sizeof(benches) / sizeof(benches[0]))
+#define N_SHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+static int bench_applies(const Bench *bench, const Shape *shape,
+                         const char *filter) {
+  size_t side = shape->rows < shape->cols ? shape->rows : shape->cols;
+  return (bench->cls & shape->cls) && side >= bench->min_side &&
+         (filter == NULL || strstr(bench->name, filter) != NULL);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_pseudo_random(Matrix *mat, unsigned int seed) {
+  for (size_t i = 0; i < mat->n_rows * mat->n_cols; i++) {
+    seed = seed * 1103515245u + 12345u;
+    mat->array[i] = (float)((seed >> 16) % 2001) / 1000.0f - 1.0f;
+  }
+}
+
+// 5-point stencil of an n-node grid, rows of `side` nodes
+static SparseMatrix *stencil_matrix(size_t n) {
+  size_t side = 1;
+  while (side * side < n) {
+    side++;
+  }
+  size_t *rows = malloc(5 * n * sizeof(size_t));
+  size_t *cols = malloc(5 * n * sizeof(size_t));
+  float *values = malloc(5 * n * sizeof(float));
+  SparseMatrix *sp = NULL;
+  if (rows != NULL && cols != NULL && values != NULL) {
+    long offsets[] = {-(long)side, -1, 0, 1, (long)side};
+    size_t nnz = 0;
+    for (size_t i = 0; i < n; i++) {
+      for (int o = 0; o < 5; o++) {
+        long j = (long)i + offsets[o];
+        if (j < 0 || j >= (long)n)
+          continue;
+        rows[nnz] = i;
+        cols[nnz] = (size_t)j;
+        values[nnz++] = o == 2 ? 4.0f : -1.0f;
+      }
+    }
+    sp = sparse_from_triplets(SPARSE_CSR, n, n, nnz, rows, cols, values);
+  }
+  free(rows);
+  free(cols);
+  free(values);
+  return sp;
+}
+
+static int ctx_create(BenchCtx *c, const Shape *shape) {
+  memset(c, 0, sizeof(BenchCtx));
+  c->rows = shape->rows;
+  c->cols = shape->cols;
+  c->A = matrix_create(c->rows, c->cols);
+  c->B = matrix_create(c->rows, c->cols);
+  c->S = matrix_create(c->cols, c->cols);
+  c->out = matrix_create(c->rows, c->cols);
+  c->outT = matrix_create(c->cols, c->rows);
+  c->vec = matrix_create(c->rows, 1);
+  c->arena = matrix_arena_create(0);
+  c->pool = matrix_pool_create();
+  if (c->A == NULL || c->B == NULL || c->S == NULL || c->out == NULL ||
+      c->outT == NULL || c->vec == NULL || c->arena == NULL ||
+      c->pool == NULL)
+    return -1;
+
+  fill_pseudo_random(c->A, 1);
+  fill_pseudo_random(c->B, 2);
+  fill_pseudo_random(c->S, 3);
+  fill_pseudo_random(c->out, 4);
+  fill_pseudo_random(c->vec, 5);
+  if (c->rows == c->cols) {
+    // Diagonally dominant: invertible, with a determinant in float range
+    for (size_t i = 0; i < c->rows * c->cols; i++) {
+      c->A->array[i] /= c->rows;
+    }
+    for (size_t i = 0; i < c->rows; i++) {
+      c->A->array[i * c->cols + i] = 1.0f;
+    }
+    c->lu = lu_factor(c->A);
+    c->band = structured_from_dense(STRUCT_BANDED, c->A, BENCH_BAND,
+                                    BENCH_BAND);
+  }
+  c->Ad = matrix_to_double(c->A);
+  c->Sd = matrix_to_double(c->S);
+  c->outd = matrix_to_double(c->out);
+  c->vecd = matrix_to_double(c->vec);
+  c->sparse = stencil_matrix(c->rows);
+  size_t count = c->rows * c->cols / 16 > 0 ? c->rows * c->cols / 16 : 1;
+  c->batch = matrix_batch_create(count, 4, 4);
+  c->batch_out = matrix_batch_create(count, 4, 4);
+  if (c->Ad == NULL || c->Sd == NULL || c->outd == NULL || c->vecd == NULL ||
+      c->sparse == NULL || c->batch == NULL || c->batch_out == NULL)
+    return -1;
+  // A's entries, made diagonally dominant matrix by matrix
+  for (size_t e = 0; e < count; e++) {
+    for (size_t i = 0; i < 4; i++) {
+      for (size_t j = 0; j < 4; j++) {
+        MATRIX_BATCH_AT(c->batch, e, i, j) =
+            c->A->array[(e * 16 + i * 4 + j) % (c->rows * c->cols)] +
+            (i == j ? 4.0f : 0.0f);
+      }
+    }
+  }
+  return 0;
+}
+
+static void ctx_free(BenchCtx *c) {
+  matrix_free(c->A);
+  matrix_free(c->B);
+  matrix_free(c->S);
+  matrix_free(c->out);
+  matrix_free(c->outT);
+  matrix_free(c->vec);
+  lu_factor_free(c->lu);
+  structured_free(c->band);
+  matrixd_free(c->Ad);
+  matrixd_free(c->Sd);
+  matrixd_free(c->outd);
+  matrixd_free(c->vecd);
+  sparse_free(c->sparse);
+  matrix_batch_free(c->batch);
+  matrix_batch_free(c->batch_out);
+  matrix_arena_destroy(c->arena);
+  matrix_pool_destroy(c->pool);
+  if (c->saved)
+    remove(BENCH_FILE);
+  if (c->saved_s)
+    remove(BENCH_FILE_S);
+  remove(BENCH_FILE_OUT);
+}
+
+typedef struct result {
+  const char *name;
+  const char *shape;
+  size_t rows;
+  size_t cols;
+  size_t samples;
+  size_t calls_per_sample;
+  double min;
+  double median;
+  double p90;
+  double mean;
+  double gflops; // at the median
+  double gbps;
+} Result;
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static Result measure(const Bench *bench, BenchCtx *c, const Shape *shape,
+                      size_t reps) {
+  static double samples[MAX_SAMPLES];
+  Result r = {bench->name, shape->label, shape->rows, shape->cols};
+
+  // Warmup, and size the batches so one sample lasts MIN_SAMPLE_SECONDS
+  size_t calls = 0;
+  double start = now(), elapsed;
+  do {
+    bench->run(c);
+    calls++;
+    elapsed = now() - start;
+  } while (elapsed < WARMUP_SECONDS && calls < 1000000);
+  double per_call = elapsed / calls;
+  size_t batch = per_call >= MIN_SAMPLE_SECONDS
+                     ? 1
+                     : (size_t)(MIN_SAMPLE_SECONDS / per_call) + 1;
+
+  if (reps > MAX_SAMPLES)
+    reps = MAX_SAMPLES;
+  double sum = 0.0;
+  for (size_t s = 0; s < reps; s++) {
+    double t0 = now();
+    for (size_t i = 0; i < batch; i++) {
+      bench->run(c);
+    }
+    samples[s] = (now() - t0) / batch;
+    sum += samples[s];
+  }
+  qsort(samples, reps, sizeof(double), compare_doubles);
+
+  r.samples = reps;
+  r.calls_per_sample = batch;
+  r.min = samples[0];
+  r.median = samples[reps / 2];
+  r.p90 = samples[(reps * 9) / 10 < reps ? (reps * 9) / 10 : reps - 1];
+  r.mean = sum / reps;
+  r.gflops = bench->flops(c) / r.median / 1e9;
+  r.gbps = bench->bytes(c) / r.median / 1e9;
+  return r;
+}
+
+// Baseline: the JSON written by --json, one result per line
+typedef struct baseline_entry {
+  char name[64];
+  char shape[32];
+  double median;
+} BaselineEntry;
+
+static BaselineEntry *load_baseline(const char *path, size_t *count) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Error: cannot open baseline %s\n", path);
+    return NULL;
+  }
+
+  size_t cap = 64;
+  BaselineEntry *entries = malloc(cap * sizeof(BaselineEntry));
+  char line[512];
+  *count = 0;
+  while (entries != NULL && fgets(line, sizeof(line), f) != NULL) {
+    const char *name = strstr(line, "\"name\": \"");
+    const char *shape = strstr(line, "\"shape\": \"");
+    const char *median = strstr(line, "\"median_s\": ");
+    if (name == NULL || shape == NULL || median == NULL)
+      continue;
+
+    if (*count == cap) {
+      cap *= 2;
+      BaselineEntry *grown = realloc(entries, cap * sizeof(BaselineEntry));
+      if (grown == NULL)
+        break;
+      entries = grown;
+    }
+    BaselineEntry *e = &entries[*count];
+    if (sscanf(name, "\"name\": \"%63[^\"]", e->name) == 1 &&
+        sscanf(shape, "\"shape\": \"%31[^\"]", e->shape) == 1 &&
+        sscanf(median, "\"median_s\": %lf", &e->median) == 1)
+      (*count)++;
+  }
+  fclose(f);
+  return entries;
+}
+
+static const BaselineEntry *find_baseline(const BaselineEntry *entries,
+                                          size_t count, const Result *r) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(entries[i].name, r->name) == 0 &&
+        strcmp(entries[i].shape, r->shape) == 0)
+      return &entries[i];
+  }
+  return NULL;
+}
+
+static void print_time(double seconds) {
+  if (seconds < 1e-6)
+    printf("%9.1fns", seconds * 1e9);
+  else if (seconds < 1e-3)
+    printf("%9.2fus", seconds * 1e6);
+  else if (seconds < 1.0)
+    printf("%9.2fms", seconds * 1e3);
+  else
+    printf("%9.3fs ", seconds);
+}
+
+static void usage(const char *prog) {
+  printf("Usage: %s [options]\n"
+         "  --filter STR      only benchmarks whose name contains STR\n"
+         "  --shape LABEL     only this shape (tiny, small, medium, large,\n"
+         "                    huge, tall, tall-huge)\n"
+         "  --huge            include the huge shapes\n"
+         "  --reps N          samples per benchmark (default 10)\n"
+         "  --threads N       thread count (default: all cores)\n"
+         "  --isa NAME        SIMD path (scalar, sse2, avx2, avx512)\n"
+         "  --json FILE       write the results as JSON\n"
+         "  --compare FILE    compare against a JSON baseline, exit 1 on a\n"
+         "                    regression\n"
+         "  --threshold PCT   slowdown reported as a regression (default 10)\n"
+         "  --tune FILE       autotune block sizes for this machine, save\n"
+         "                    them to FILE and exit (with --huge: at order\n"
+         "                    4096, Strassen included)\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  const char *filter = NULL, *shape_filter = NULL;
+  const char *json_path = NULL, *baseline_path = NULL, *tune_path = NULL;
+  size_t reps = 10;
+  double threshold = 10.0;
+  int huge = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    int takes_value = 1;
+
+    if (strcmp(arg, "--huge") == 0) {
+      huge = 1;
+      takes_value = 0;
+    } else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+      usage(argv[0]);
+      return 0;
+    } else if (value == NULL) {
+      fprintf(stderr, "Error: unknown option or missing value: %s\n", arg);
+      usage(argv[0]);
+      return 2;
+    } else if (strcmp(arg, "--filter") == 0) {
+      filter = value;
+    } else if (strcmp(arg, "--shape") == 0) {
+      shape_filter = value;
+    } else if (strcmp(arg, "--reps") == 0) {
+      reps = strtoul(value, NULL, 10);
+      if (reps == 0)
+        reps = 1;
+    } else if (strcmp(arg, "--threads") == 0) {
+      matrix_set_num_threads(strtoul(value, NULL, 10));
+    } else if (strcmp(arg, "--isa") == 0) {
+      if (matrix_simd_select(value) != 0) {
+        fprintf(stderr, "Error: SIMD path %s is not supported\n", value);
+        return 2;
+      }
+    } else if (strcmp(arg, "--json") == 0) {
+      json_path = value;
+    } else if (strcmp(arg, "--compare") == 0) {
+      baseline_path = value;
+    } else if (strcmp(arg, "--threshold") == 0) {
+      threshold = strtod(value, NULL);
+    } else if (strcmp(arg, "--tune") == 0) {
+      tune_path = value;
+    } else {
+      fprintf(stderr, "Error: unknown option %s\n", arg);
+      usage(argv[0]);
+      return 2;
+    }
+    i += takes_value;
+  }
+
+  if (tune_path != NULL) {
+    if (matrix_autotune(tune_path, huge ? 4096 : 1024, huge) != 0)
+      return 2;
+    MatrixTuning t = matrix_get_tuning();
+    printf("Tuned for %s on %zu threads, saved to %s (load it with "
+           "MATRIX_TUNING=%s)\n"
+           "  gemm mc %zu, kc %zu, nc %zu, %zu tiles per thread, parallel "
+           "from %zu multiply-adds\n"
+           "  lu block %zu, transpose tile %zu, Strassen cutoff %zu\n",
+           matrix_simd_isa(), matrix_get_num_threads(), tune_path, tune_path,
+           t.gemm_mc, t.gemm_kc, t.gemm_nc, t.gemm_tiles_per_thread,
+           t.gemm_parallel_min, t.lu_block, t.trans_tile, t.strassen_cutoff);
+    return 0;
+  }
+
+  BaselineEntry *baseline = NULL;
+  size_t n_baseline = 0;
+  if (baseline_path != NULL) {
+    baseline = load_baseline(baseline_path, &n_baseline);
+    if (baseline == NULL)
+      return 2;
+  }
+
+  FILE *json = NULL;
+  if (json_path != NULL) {
+    json = fopen(json_path, "w");
+    if (json == NULL) {
+      fprintf(stderr, "Error: cannot write %s\n", json_path);
+      free(baseline);
+      return 2;
+    }
+    fprintf(json,
+            "{\n  \"isa\": \"%s\",\n  \"threads\": %zu,\n  \"results\": [\n",
+            matrix_simd_isa(), matrix_get_num_threads());
+  }
+
+  printf("SIMD path: %s, threads: %zu\n", matrix_simd_isa(),
+         matrix_get_num_threads());
+  printf("%-28s %-10s %11s %11s %11s %9s %9s\n", "benchmark", "shape",
+         "median", "min", "p90", "GFLOP/s", "GB/s");
+
+  size_t n_results = 0, n_regressions = 0;
+  for (size_t s = 0; s < N_SHAPES; s++) {
+    const Shape *shape = &shapes[s];
+    if (shape_filter != NULL) {
+      if (strcmp(shape->label, shape_filter) != 0)
+        continue;
+    } else if (shape->huge && !huge) {
+      continue;
+    }
+
+    int any = 0;
+    for (size_t b = 0; b < N_BENCHES; b++) {
+      any |= bench_applies(&benches[b], shape, filter);
+    }
+    if (!any)
+      continue;
+
+    BenchCtx ctx;
+    if (ctx_create(&ctx, shape) != 0) {
+      fprintf(stderr, "Error: out of memory for shape %s\n", shape->label);
+      ctx_free(&ctx);
+      continue;
+    }
+
+    for (size_t b = 0; b < N_BENCHES; b++) {
+      const Bench *bench = &benches[b];
+      if (!bench_applies(bench, shape, filter))
+        continue;
+
+      Result r = measure(bench, &ctx, shape, reps);
+      // The in-place transpose may leave out transposed, strides included
+      ctx.out->n_rows = ctx.rows;
+      ctx.out->n_cols = ctx.cols;
+      ctx.out->row_stride = ctx.cols;
+      ctx.out->col_stride = 1;
+      printf("%-28s %-10s ", r.name, r.shape);
+      print_time(r.median);
+      printf(" ");
+      print_time(r.min);
+      printf(" ");
+      print_time(r.p90);
+      printf(" %9.2f %9.2f", r.gflops, r.gbps);
+
+      const BaselineEntry *base =
+          baseline != NULL ? find_baseline(baseline, n_baseline, &r) : NULL;
+      if (base != NULL) {
+        double change = (r.median / base->median - 1.0) * 100.0;
+        printf("  %+6.1f%%", change);
+        if (change > threshold) {
+          printf(" REGRESSION");
+          n_regressions++;
+        }
+      }
+      printf("\n");
+      fflush(stdout);
+
+      if (json != NULL) {
+        fprintf(json,
+                "%s    {\"name\": \"%s\", \"shape\": \"%s\", \"rows\": %zu, "
+                "\"cols\": %zu, \"samples\": %zu, \"calls_per_sample\": %zu, "
+                "\"median_s\": %.9g, \"min_s\": %.9g, \"p90_s\": %.9g, "
+                "\"mean_s\": %.9g, \"gflops\": %.6g, \"gbps\": %.6g}",
+                n_results > 0 ? ",\n" : "", r.name, r.shape, r.rows, r.cols,
+                r.samples, r.calls_per_sample, r.median, r.min, r.p90,
+                r.mean, r.gflops, r.gbps);
+      }
+      n_results++;
+    }
+
+    ctx_free(&ctx);
+  }
+
+  if (json != NULL) {
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+  }
+  free(baseline);
+
+  if (baseline_path != NULL) {
+    printf("%zu regression(s) over %.1f%% against %s\n", n_regressions,
+           threshold, baseline_path);
+  }
+  return n_regressions > 0;
+}
@@ -1,16 +1,41 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <math.h>
 #include <stddef.h>
 
+// Alignment of every matrix block, and of the data inside it
+#define MATRIX_ALIGNMENT 64
+
+// Memory source for matrices. The struct and its data are carved from one
+// block of `size` bytes, which alloc must align to MATRIX_ALIGNMENT.
+// free receives the same size back and may do nothing (arenas).
+typedef struct matrix_allocator {
+  void *(*alloc)(void *ctx, size_t size);
+  void (*free)(void *ctx, void *block, size_t size);
+  void *ctx;
+} MatrixAllocator;
+
+// Element (i, j) is array[i * row_stride + j * col_stride]. Matrices
+// from matrix_create are dense row-major (row_stride == n_cols,
+// col_stride == 1); views may have any strides.
 typedef struct matrix {
   float *array;
   size_t n_rows;
   size_t n_cols;
+  size_t row_stride;
+  size_t col_stride;
+  const MatrixAllocator *allocator; // the block's owner, NULL for a view
 } Matrix;
 
 Matrix *matrix_create(size_t n_rows, size_t n_cols);
 
+// matrix_create from a given allocator, NULL for the default (the heap).
+// matrix_free hands the block back to the same allocator.
+Matrix *matrix_create_with(const MatrixAllocator *allocator, size_t n_rows,
+                           size_t n_cols);
+
+// Does nothing on a view
 void matrix_free(Matrix *mat);
 
 void matrix_set(Matrix *mat, size_t row, size_t col, float value);
@@ -29,6 +54,9 @@ Matrix *matrix_subtract(Matrix *mat1, Matrix *mat2);
 
 Matrix *matrix_mult(Matrix *mat1, Matrix *mat2);
 
+// C = alpha * A * B + beta * C, returns C (NULL on size mismatch)
+Matrix *matrix_gemm(float alpha, Matrix *A, Matrix *B, float beta, Matrix *C);
+
 Matrix *matrix_trans(Matrix *mat1);
 
 Matrix *matrix_identity(size_t n);
@@ -37,11 +65,798 @@ float matrix_determinant(Matrix *mat1);
 
 Matrix *matrix_inverse(Matrix *mat);
 
+// b may hold several right-hand sides (n x k), x then has k columns too
 Matrix *solve_lin_system(Matrix *A, Matrix *b);
 
+// Least squares: x minimizing ||A x - b|| for A n x m with n >= m, for
+// every column of b. solve_least_squares uses a blocked Householder QR
+// and never forms A^T A. solve_normal_equations solves A^T A x = A^T b by
+// Cholesky: faster and lighter on memory for very tall A, but it squares
+// the condition number. Both return NULL if A is rank deficient.
+Matrix *solve_least_squares(Matrix *A, Matrix *b);
+
+Matrix *solve_normal_equations(Matrix *A, Matrix *b);
+
+// LU factorization with partial pivoting, P A = L U. Factor a system
+// matrix once, then solve against it as often as needed.
+typedef struct lu_factor LUFactor;
+
+// NULL if A is not square. A singular A still factors; lu_det then
+// returns 0 and lu_solve/lu_inverse fail.
+LUFactor *lu_factor(Matrix *A);
+
+void lu_factor_free(LUFactor *lu);
+
+// Solve A x = b for every column of b (n x k), NULL if A is singular
+Matrix *lu_solve(LUFactor *lu, Matrix *b);
+
+// x must have the shape of b and may be b itself
+Matrix *lu_solve_into(Matrix *x, LUFactor *lu, Matrix *b);
+
+float lu_det(LUFactor *lu);
+
+Matrix *lu_inverse(LUFactor *lu);
+
+// Eigenvalues and singular values
+// k selects the k largest (0 for all). Without want_vectors only the
+// values are computed, which skips the costliest phase, and with a small
+// k only k vectors are formed. Both return NULL on bad sizes or if the
+// iteration fails to converge.
+
+// Symmetric A, of which only the lower triangle is read: A V = V diag(values)
+// with V orthonormal
+typedef struct eigen_sym {
+  Matrix *values;  // k x 1, largest first
+  Matrix *vectors; // n x k, column j for values[j]; NULL without vectors
+} EigenSym;
+
+EigenSym *eigen_sym(Matrix *A, size_t k, int want_vectors);
+
+void eigen_sym_free(EigenSym *eig);
+
+// A (m x n) ~ U diag(S) Vt, exact for k = min(m, n)
+typedef struct svd_factor {
+  Matrix *S;  // k x 1, largest first
+  Matrix *U;  // m x k; NULL without vectors
+  Matrix *Vt; // k x n; NULL without vectors
+} SVDFactor;
+
+SVDFactor *svd_factor(Matrix *A, size_t k, int want_vectors);
+
+void svd_factor_free(SVDFactor *svd);
+
+// Randomized low-rank approximation
+// For the top k components of a large matrix, typically tall: A is
+// sampled by l = k + oversample random combinations of its columns, and
+// the SVD is taken within the span of the sample. Each pass over A is one
+// large GEMM. Power iterations cost two more passes each and sharpen the
+// result when the singular values decay slowly. The same seed gives the
+// same random numbers, whatever the thread count.
+
+// m x l with orthonormal columns approximately spanning the range of A,
+// 1 <= l <= min(m, n)
+Matrix *randomized_range(Matrix *A, size_t l, size_t power_iters,
+                         unsigned long long seed);
+
+// The k largest singular triplets, as by svd_factor
+SVDFactor *randomized_svd(Matrix *A, size_t k, size_t oversample,
+                          size_t power_iters, unsigned long long seed);
+
+// Single pass: A is fed once, as consecutive blocks of rows of any height,
+// and need not be stored or even fully known in advance. Less accurate
+// than randomized_svd, which sees A twice or more. finish consumes the
+// sketch, and returns NULL if fewer rows were fed than the sample size,
+// min(k + oversample, n_cols).
+typedef struct svd_sketch SVDSketch;
+
+SVDSketch *svd_sketch_create(size_t n_cols, size_t k, size_t oversample,
+                             unsigned long long seed);
+
+int svd_sketch_update(SVDSketch *sk, Matrix *rows);
+
+SVDFactor *svd_sketch_finish(SVDSketch *sk);
+
+void svd_sketch_free(SVDSketch *sk);
+
+// Caller-provided output
+// The _into variants write into dst, which must already have the shape of
+// the result, and return dst (NULL on a size mismatch). They do not
+// allocate, so loops over preallocated matrices run heap-free.
+// Aliasing: element-wise ops (scale, add, subtract) accept dst equal to
+// any input, but not a view partially overlapping it. matrix_inverse_into
+// accepts dst == mat. matrix_mult_into and matrix_trans_into reject dst
+// overlapping an input; disjoint views of one matrix are fine.
+Matrix *matrix_scale_into(Matrix *dst, float scalar, Matrix *mat);
+
+Matrix *matrix_add_into(Matrix *dst, Matrix *mat1, Matrix *mat2);
+
+Matrix *matrix_subtract_into(Matrix *dst, Matrix *mat1, Matrix *mat2);
+
+Matrix *matrix_mult_into(Matrix *dst, Matrix *mat1, Matrix *mat2);
+
+Matrix *matrix_trans_into(Matrix *dst, Matrix *mat);
+
+// LU factorization plus triangular solves. Its temporaries live in the
+// per-thread scratch arena, so repeated calls do not allocate once it has
+// grown to fit. On failure (singular matrix) dst is left unchanged.
+Matrix *matrix_inverse_into(Matrix *dst, Matrix *mat);
+
+// In place: the first operand is overwritten with the result and returned
+Matrix *matrix_scale_inplace(float scalar, Matrix *mat);
+
+Matrix *matrix_add_inplace(Matrix *mat1, Matrix *mat2);
+
+Matrix *matrix_subtract_inplace(Matrix *mat1, Matrix *mat2);
+
+// Swaps n_rows and n_cols. Square matrices are transposed tile by tile,
+// rectangular ones by following the permutation cycles, with no scratch.
+// Views must be square (use matrix_trans_view otherwise).
+Matrix *matrix_trans_inplace(Matrix *mat);
+
+// Arena: a bump allocator released as a whole. Matrices allocated after a
+// mark are all released by resetting to it, in O(1); matrix_free on them
+// does nothing. Not thread-safe, use one arena per thread.
+typedef struct matrix_arena MatrixArena;
+
+// capacity is the size of the first chunk in bytes (0 for a default), the
+// arena grows by chaining further chunks when it runs out.
+MatrixArena *matrix_arena_create(size_t capacity);
+
+void matrix_arena_destroy(MatrixArena *arena);
+
+const MatrixAllocator *matrix_arena_allocator(MatrixArena *arena);
+
+size_t matrix_arena_mark(MatrixArena *arena);
+
+// Release everything allocated since mark; the memory is kept for reuse
+void matrix_arena_reset(MatrixArena *arena, size_t mark);
+
+// Pool: recycles freed blocks by power-of-two size class, so matrices of a
+// shape created and freed in a loop reuse the same memory. Thread-safe.
+// Destroy it only once every matrix it handed out has been freed.
+typedef struct matrix_pool MatrixPool;
+
+MatrixPool *matrix_pool_create(void);
+
+void matrix_pool_destroy(MatrixPool *pool);
+
+const MatrixAllocator *matrix_pool_allocator(MatrixPool *pool);
+
+// Views
+// A view is a Matrix borrowing the storage of another one: made in O(1),
+// passed by value, and accepted by every operation. Writing through a
+// view writes the parent. A view must not outlive the storage it
+// borrows. Out-of-range requests print an error and return an empty
+// (0 x 0) view.
+
+// The n_rows x n_cols block of mat starting at (row, col)
+Matrix matrix_view(Matrix *mat, size_t row, size_t col, size_t n_rows,
+                   size_t n_cols);
+
+// Row `row` as a 1 x n_cols view, column `col` as an n_rows x 1 view
+Matrix matrix_row(Matrix *mat, size_t row);
+
+Matrix matrix_col(Matrix *mat, size_t col);
+
+// mat^T, by swapping the strides: nothing is moved
+Matrix matrix_trans_view(Matrix *mat);
+
+// Wrap a caller-owned row-major buffer with the given row stride
+// (>= n_cols), e.g. a block of a larger array
+Matrix matrix_view_array(float *array, size_t n_rows, size_t n_cols,
+                         size_t row_stride);
+
 // Utilities
 int matrices_are_approx_equal(Matrix *A, Matrix *B, float tolerance);
 
 int compare_floats(float a, float b, float tolerance);
 
+// Threading
+// Operations split their work over a library-owned thread pool. The thread
+// count defaults to the MATRIX_NUM_THREADS environment variable, else to
+// the number of online cores. 0 restores that default. Changing it or
+// shutting the pool down must not overlap with running operations.
+void matrix_set_num_threads(size_t n_threads);
+
+size_t matrix_get_num_threads(void);
+
+// Join the worker threads. The pool restarts on the next parallel call;
+// this also runs automatically at exit.
+void matrix_threads_shutdown(void);
+
+// Fast multiplication
+// Opt-in Strassen-Winograd for large products in matrix_gemm, and so in
+// matrix_mult and matrix_mult_into. Each level does 7 half-size products
+// instead of 8, recursing while all three dimensions are above cutoff;
+// the classic kernel does the rest. 0 turns it off (the default). It is
+// less accurate than the classic product (see the README), and the
+// solvers and other operations keep using the classic kernel.
+void matrix_set_strassen_cutoff(size_t cutoff);
+
+size_t matrix_get_strassen_cutoff(void);
+
+// SIMD dispatch
+// The instruction-set path (scalar, sse2, avx2, avx512) is chosen once at
+// startup from CPUID, or from the MATRIX_SIMD environment variable.
+const char *matrix_simd_isa(void);
+
+// Force a path by name, NULL restores the best supported one.
+// Returns -1 when the CPU does not support the requested path.
+int matrix_simd_select(const char *isa);
+
+// Profiling
+// Built with cmake -DMATRIX_PROFILE=ON, the library counts the calls, wall
+// time and nominal FLOPs and bytes of its main entry points, plus matrix
+// allocations and the peak scratch arena use. Entries are inclusive:
+// solve_lin_system counts the time of the lu_factor it runs, which is
+// counted again under lu_factor. Without the option the instrumentation
+// compiles to nothing and the counters stay 0.
+typedef struct matrix_profile_entry {
+  const char *name; // of the function
+  unsigned long long calls;
+  unsigned long long nanoseconds;
+  unsigned long long flops;
+  unsigned long long bytes;
+} MatrixProfileEntry;
+
+typedef struct matrix_profile_memory {
+  unsigned long long allocations; // matrix blocks, any allocator
+  unsigned long long bytes_allocated;
+  unsigned long long peak_scratch; // bytes, largest of any thread's arena
+} MatrixProfileMemory;
+
+// 1 when the library was built with MATRIX_PROFILE
+int matrix_profile_enabled(void);
+
+// Entries are numbered 0 .. count - 1
+size_t matrix_profile_count(void);
+
+MatrixProfileEntry matrix_profile_entry(size_t i);
+
+// -1 if name is not a profiled function
+int matrix_profile_find(const char *name, MatrixProfileEntry *entry);
+
+MatrixProfileMemory matrix_profile_memory(void);
+
+void matrix_profile_reset(void);
+
+// The memory counters and every function called at least once, -1 if the
+// file cannot be written
+int matrix_profile_write_json(const char *path);
+
+// Tracing: begin and end run on the calling thread around every profiled
+// call, so spans nest like the calls; end also gets the call's nominal
+// work. Install them before the calls to trace, NULL removes them.
+typedef struct matrix_trace_hooks {
+  void (*begin)(void *ctx, const char *name);
+  void (*end)(void *ctx, const char *name, unsigned long long flops,
+              unsigned long long bytes);
+  void *ctx;
+} MatrixTraceHooks;
+
+void matrix_profile_set_hooks(const MatrixTraceHooks *hooks);
+
+// Tuning
+// Block sizes and cutoffs of the GEMM, LU and transpose kernels. The
+// defaults suit a ~1MB L2 and ~32MB L3; matrix_autotune finds better ones
+// for the host and saves them to a profile. At startup the library loads
+// the profile named by MATRIX_TUNING, if it was made on the same machine
+// type (instruction-set path and cache sizes).
+typedef struct matrix_tuning {
+  size_t gemm_mc; // rows of the packed block of A, sized for L2
+  size_t gemm_kc; // depth of one rank-kc update, sized for L1
+  size_t gemm_nc; // columns of the packed panel of B, sized for L3
+  // Products with fewer row blocks than this per thread also split their
+  // columns over the threads
+  size_t gemm_tiles_per_thread;
+  // Products of fewer multiply-adds run on the calling thread alone
+  size_t gemm_parallel_min;
+  size_t lu_block;        // columns per panel of the LU factorization
+  size_t trans_tile;      // side of the square tiles of the transposes
+  size_t strassen_cutoff; // as matrix_set_strassen_cutoff, 0 is off
+} MatrixTuning;
+
+// Cache sizes in bytes from sysfs (sysconf as a fallback), 0 if unknown
+typedef struct matrix_cache_info {
+  size_t line;
+  size_t l1d;
+  size_t l2;
+  size_t l3;
+} MatrixCacheInfo;
+
+MatrixCacheInfo matrix_cache_info(void);
+
+MatrixTuning matrix_get_tuning(void);
+
+// -1 and nothing changes if a block size is 0. Not to be called while
+// other threads run matrix operations.
+int matrix_set_tuning(const MatrixTuning *tuning);
+
+// The built-in defaults
+MatrixTuning matrix_default_tuning(void);
+
+// The active tuning as a text profile, keyed by the machine type
+int matrix_tuning_save(const char *path);
+
+// -1 and nothing changes if the file cannot be read, is malformed or was
+// made on another machine type
+int matrix_tuning_load(const char *path);
+
+// Times candidate settings derived from the cache sizes on products,
+// factorizations and transposes of order max_n (512-1024 is enough, 0
+// means 1024) with the current threads, keeps the fastest and saves them
+// to path (NULL to only apply them). The Strassen cutoff is only tried
+// with allow_strassen, as it trades accuracy for speed. Takes seconds
+// at max_n = 1024. -1 if a benchmark or the save fails.
+int matrix_autotune(const char *path, size_t max_n, int allow_strassen);
+
+// Sparse matrices
+// Compressed rows (CSR) or columns (CSC): the entries of row (column) i are
+// idx/values[ptr[i] .. ptr[i + 1]), idx holding their column (row) indices
+// in increasing order. Only the entries present are stored, so the size is
+// O(nnz) whatever the shape. Products are fastest on CSR.
+typedef enum { SPARSE_CSR, SPARSE_CSC } SparseFormat;
+
+typedef struct sparse_matrix {
+  SparseFormat format;
+  size_t n_rows;
+  size_t n_cols;
+  size_t nnz;
+  size_t *ptr; // n_rows + 1 (CSR) or n_cols + 1 (CSC) offsets
+  size_t *idx;
+  float *values;
+} SparseMatrix;
+
+// From nnz (rows[i], cols[i], values[i]) triplets in any order; duplicates
+// are summed. NULL if an index is out of range.
+SparseMatrix *sparse_from_triplets(SparseFormat format, size_t n_rows,
+                                   size_t n_cols, size_t nnz,
+                                   const size_t *rows, const size_t *cols,
+                                   const float *values);
+
+// The entries of mat with |value| > drop_tolerance (0 keeps every nonzero)
+SparseMatrix *sparse_from_dense(SparseFormat format, Matrix *mat,
+                                float drop_tolerance);
+
+Matrix *sparse_to_dense(SparseMatrix *sp);
+
+// The same matrix in the other (or the same) format
+SparseMatrix *sparse_convert(SparseMatrix *sp, SparseFormat format);
+
+void sparse_free(SparseMatrix *sp);
+
+// C = alpha * A * B + beta * C for sparse A and dense B, C (SpMM; SpMV
+// when B is a single column). Returns C, NULL on a size mismatch.
+Matrix *sparse_gemm(float alpha, SparseMatrix *A, Matrix *B, float beta,
+                    Matrix *C);
+
+Matrix *sparse_mult(SparseMatrix *A, Matrix *B);
+
+// Sparse LU with partial pivoting. A is first reordered symmetrically by
+// nested dissection of the pattern of A + A^T (reverse Cuthill-McKee on
+// the small parts), which keeps the fill of mesh-like systems low. Pivots
+// favour the diagonal, which preserves the ordering. The factorization
+// runs on one thread, the solves split the right-hand sides. NULL if A is
+// not square or is singular.
+typedef struct sparse_lu SparseLU;
+
+SparseLU *sparse_lu_factor(SparseMatrix *A);
+
+void sparse_lu_free(SparseLU *lu);
+
+// Entries in L and U, to judge the fill
+size_t sparse_lu_nnz(SparseLU *lu);
+
+// A x = b for every column of b (n x k), as lu_solve
+Matrix *sparse_lu_solve(SparseLU *lu, Matrix *b);
+
+// Factor and solve in one call, like solve_lin_system
+Matrix *sparse_solve(SparseMatrix *A, Matrix *b);
+
+// Structured matrices
+// Square n x n matrices whose zeros (or mirrored half) follow a known
+// pattern and are not stored. Entry (i, j) lives in values at:
+// - STRUCT_SYMMETRIC, STRUCT_UPPER: the upper triangle packed by rows,
+//   i * (2 n - i + 1) / 2 + (j - i) for j >= i; symmetric (i, j) with
+//   j < i reads (j, i)
+// - STRUCT_LOWER: the lower triangle packed by rows, i * (i + 1) / 2 + j
+// - STRUCT_TRIDIAGONAL: the diagonal (n values), then the subdiagonal
+//   and the superdiagonal (n - 1 each)
+// - STRUCT_BANDED: kl subdiagonals and ku superdiagonals, row by row,
+//   i * (kl + ku + 1) + (j + kl - i); slots outside the matrix stay 0
+// Solves cost O(n bw^2) for a band of width bw (O(n) for tridiagonal),
+// O(n^2) per right-hand side for triangular and O(n^3 / 3) for symmetric.
+typedef enum {
+  STRUCT_SYMMETRIC,
+  STRUCT_UPPER,
+  STRUCT_LOWER,
+  STRUCT_TRIDIAGONAL,
+  STRUCT_BANDED,
+} StructKind;
+
+typedef struct structured_matrix {
+  StructKind kind;
+  size_t n;
+  size_t kl; // subdiagonals that may hold nonzeros
+  size_t ku; // superdiagonals
+  float *values;
+} StructuredMatrix;
+
+// All zeros. kl and ku are only read for STRUCT_BANDED and are clamped
+// to n - 1.
+StructuredMatrix *structured_create(StructKind kind, size_t n, size_t kl,
+                                    size_t ku);
+
+// The entries of square A that fit the structure; the rest of A is not
+// read. A symmetric matrix is taken from the lower triangle, as by
+// eigen_sym.
+StructuredMatrix *structured_from_dense(StructKind kind, Matrix *A,
+                                        size_t kl, size_t ku);
+
+// A structured copy of square A when that makes solving it cheaper: A is
+// triangular, or its nonzeros fit a band narrow next to n. NULL otherwise
+// (dense A, or not square). solve_lin_system and matrix_determinant use
+// it to dispatch.
+StructuredMatrix *structured_detect(Matrix *A);
+
+Matrix *structured_to_dense(StructuredMatrix *S);
+
+void structured_free(StructuredMatrix *S);
+
+float structured_get(StructuredMatrix *S, size_t i, size_t j);
+
+// -1 if (i, j) is outside the structure (a known zero)
+int structured_set(StructuredMatrix *S, size_t i, size_t j, float value);
+
+// S * B, NULL on a size mismatch
+Matrix *structured_mult(StructuredMatrix *S, Matrix *B);
+
+// S x = b for every column of b (n x k), NULL if S is singular.
+// Tridiagonal: the Thomas algorithm, with a row swap wherever a pivot is
+// smaller than the entry below it (never for diagonally dominant S).
+// Banded: LU with partial pivoting confined to the band. Symmetric:
+// Cholesky, or LU on the unpacked matrix if S is not positive definite.
+// Triangular: substitution.
+Matrix *structured_solve(StructuredMatrix *S, Matrix *b);
+
+float structured_determinant(StructuredMatrix *S);
+
+// Krylov solvers
+// Iterative solvers for A x = b that only touch A through y = A x, so the
+// cost per iteration is one product: O(nnz) for a sparse A. A is an
+// operator callback on contiguous n-vectors; adapters cover Matrix and
+// SparseMatrix.
+typedef struct linear_operator {
+  size_t n;
+  void (*apply)(void *ctx, const float *x, float *y); // y = A x
+  void *ctx;
+} LinearOperator;
+
+// A must outlive the operator
+LinearOperator matrix_operator(Matrix *A);
+
+LinearOperator sparse_operator(SparseMatrix *A);
+
+// z = M^-1 r, with M ~ A cheap to invert; z never aliases r. Any callback
+// will do; the built-in ones below are released with precond_free.
+typedef struct preconditioner {
+  void (*apply)(void *ctx, const float *r, float *z);
+  void *ctx;
+  void (*destroy)(void *ctx); // releases ctx, may be NULL
+} Preconditioner;
+
+// M = diag(A)
+Preconditioner *precond_jacobi(SparseMatrix *A);
+
+// Incomplete LU with the sparsity pattern of A (no fill). NULL if a zero
+// pivot is met.
+Preconditioner *precond_ilu0(SparseMatrix *A);
+
+// M = the block_size x block_size diagonal blocks of A, each factored
+// densely; the blocks are applied in parallel. NULL if a block is
+// singular.
+Preconditioner *precond_block_jacobi(SparseMatrix *A, size_t block_size);
+
+void precond_free(Preconditioner *M);
+
+// Zeroed options select the defaults
+typedef struct krylov_options {
+  size_t max_iter; // default 10 n
+  float tolerance; // on ||b - A x|| / ||b||, default 1e-6
+  size_t restart;  // GMRES basis size, default 30
+  const Preconditioner *precond; // NULL for none
+  // Called after every iteration with the relative residual estimate the
+  // solver tracks; a nonzero return stops the solve
+  int (*monitor)(void *ctx, size_t iteration, float residual);
+  void *monitor_ctx;
+} KrylovOptions;
+
+typedef struct krylov_info {
+  size_t iterations;
+  float residual; // ||b - A x|| / ||b||, recomputed at the end
+  int converged;
+} KrylovInfo;
+
+// Solve A x = b for the n x 1 vector b. x holds the initial guess and is
+// overwritten. Returns x, or NULL if the solve did not converge (x then
+// holds the last iterate) or broke down. options and info may be NULL.
+// CG needs A (and M) symmetric positive definite; GMRES (restarted, right
+// preconditioned) and BiCGSTAB take any nonsingular A.
+Matrix *krylov_cg(LinearOperator A, Matrix *b, Matrix *x,
+                  const KrylovOptions *options, KrylovInfo *info);
+
+Matrix *krylov_gmres(LinearOperator A, Matrix *b, Matrix *x,
+                     const KrylovOptions *options, KrylovInfo *info);
+
+Matrix *krylov_bicgstab(LinearOperator A, Matrix *b, Matrix *x,
+                        const KrylovOptions *options, KrylovInfo *info);
+
+// Lazy expressions
+// An expression tree over matrices, evaluated in as few passes as its
+// shape allows: the sum of its scaled and transposed matrices is one
+// fused element-wise pass over the result, and each product one
+// matrix_gemm call accumulating into it, so alpha A B + beta C is a single
+// GEMM and only the result is allocated. A product operand that is more
+// than a scaled or transposed matrix is evaluated first, into scratch.
+// The constructors take ownership of their operands. On error, or when an
+// operand is NULL, they free them and return NULL, so calls nest:
+//   MatrixExpr *e = expr_add(expr_scale(0.5f, expr_mult(expr_matrix(A),
+//                                                       expr_matrix(B))),
+//                            expr_matrix(C));
+//   Matrix *res = expr_eval(e);
+//   expr_free(e);
+// Each expression can be the operand of only one other. Leaves point to
+// their matrices, read at every evaluation, so one tree can be evaluated
+// again as their contents change.
+typedef struct matrix_expr MatrixExpr;
+
+MatrixExpr *expr_matrix(Matrix *mat);
+
+MatrixExpr *expr_add(MatrixExpr *a, MatrixExpr *b);
+
+MatrixExpr *expr_subtract(MatrixExpr *a, MatrixExpr *b);
+
+MatrixExpr *expr_scale(float scalar, MatrixExpr *a);
+
+MatrixExpr *expr_mult(MatrixExpr *a, MatrixExpr *b);
+
+MatrixExpr *expr_trans(MatrixExpr *a);
+
+// A new matrix holding the value of e
+Matrix *expr_eval(MatrixExpr *e);
+
+// Into dst, which must have the shape of e. dst may be one of the leaves:
+// C = alpha A B + beta C runs in place as one GEMM; when dst would be
+// overwritten while it is still read, the result goes through a temporary.
+Matrix *expr_eval_into(Matrix *dst, MatrixExpr *e);
+
+// The whole tree, not the matrices
+void expr_free(MatrixExpr *e);
+
+// Batched small matrices
+// count matrices of one n_rows x n_cols shape, up to MATRIX_BATCH_MAX_DIM
+// a side, interleaved so that each element of every matrix is contiguous:
+// the kernels run one matrix per SIMD lane, their loops fully unrolled
+// for each size, and split the batch over the thread pool. This replaces
+// millions of calls on 3 x 3 matrices, each with its allocations and
+// checks, by a few passes over the batch.
+#define MATRIX_BATCH_MAX_DIM 16
+#define MATRIX_BATCH_LANES 16
+
+// Element (i, j) of matrix b is data[(i * n_cols + j) * stride + b]
+typedef struct matrix_batch {
+  size_t count;
+  size_t n_rows;
+  size_t n_cols;
+  size_t stride; // count rounded up to a multiple of MATRIX_BATCH_LANES
+  float *data;   // aligned to MATRIX_ALIGNMENT
+} MatrixBatch;
+
+#define MATRIX_BATCH_AT(batch, b, i, j)                                       \
+  ((batch)->data[((i) * (batch)->n_cols + (j)) * (batch)->stride + (b)])
+
+// Zero-filled. NULL if a side is 0 or above MATRIX_BATCH_MAX_DIM.
+MatrixBatch *matrix_batch_create(size_t count, size_t n_rows, size_t n_cols);
+
+void matrix_batch_free(MatrixBatch *batch);
+
+// Copy matrix b of the batch from or to mat, which must have its shape.
+// NULL on a size mismatch or b out of range.
+MatrixBatch *matrix_batch_set(MatrixBatch *batch, size_t b, Matrix *mat);
+
+Matrix *matrix_batch_get(MatrixBatch *batch, size_t b, Matrix *dst);
+
+// C_b = alpha * A_b * B_b + beta * C_b for every b. C must not be A or B.
+// Returns C, NULL on a size mismatch.
+MatrixBatch *matrix_batch_gemm(float alpha, MatrixBatch *A, MatrixBatch *B,
+                               float beta, MatrixBatch *C);
+
+MatrixBatch *matrix_batch_mult(MatrixBatch *A, MatrixBatch *B);
+
+// det[b] = det(A_b); det holds count floats. Returns det, NULL if A is
+// not square.
+float *matrix_batch_determinant(MatrixBatch *A, float *det);
+
+// Gauss-Jordan with partial pivoting on every square A_b. A singular A_b
+// does not fail the batch: its result is not finite. det (count floats,
+// may be NULL) receives every det(A_b) from the same pass, 0 flagging the
+// singular ones.
+MatrixBatch *matrix_batch_inverse(MatrixBatch *A, float *det);
+
+// dst may be A
+MatrixBatch *matrix_batch_inverse_into(MatrixBatch *dst, MatrixBatch *A,
+                                       float *det);
+
+// X_b = A_b^-1 B_b, B_b n x k with k <= MATRIX_BATCH_MAX_DIM
+MatrixBatch *matrix_batch_solve(MatrixBatch *A, MatrixBatch *B, float *det);
+
+// x may be B
+MatrixBatch *matrix_batch_solve_into(MatrixBatch *x, MatrixBatch *A,
+                                     MatrixBatch *B, float *det);
+
+// Fixed-size matrices
+// Matrix2 .. Matrix8: n x n floats by value, for shapes known at compile
+// time (geometry, kinematics). The operations are static inline and
+// generated per size from matrix_fixed.h, so they unroll, never allocate
+// and mix freely with Matrix through matrixN_view:
+//   matrixN_identity, _mult, _mult_vec, _trans, _determinant, _inverse,
+//   _solve, _view, _from_matrix
+// Determinant and inverse are closed forms up to 4 x 4. inverse and solve
+// return NULL when the matrix is singular.
+
+#define MF_N 2
+#define MF_TYPE Matrix2
+#define MF_TAG matrix2
+#define MF_FN(name) matrix2_##name
+#include "matrix_fixed.h"
+
+#define MF_N 3
+#define MF_TYPE Matrix3
+#define MF_TAG matrix3
+#define MF_FN(name) matrix3_##name
+#include "matrix_fixed.h"
+
+#define MF_N 4
+#define MF_TYPE Matrix4
+#define MF_TAG matrix4
+#define MF_FN(name) matrix4_##name
+#include "matrix_fixed.h"
+
+#define MF_N 5
+#define MF_TYPE Matrix5
+#define MF_TAG matrix5
+#define MF_FN(name) matrix5_##name
+#include "matrix_fixed.h"
+
+#define MF_N 6
+#define MF_TYPE Matrix6
+#define MF_TAG matrix6
+#define MF_FN(name) matrix6_##name
+#include "matrix_fixed.h"
+
+#define MF_N 7
+#define MF_TYPE Matrix7
+#define MF_TAG matrix7
+#define MF_FN(name) matrix7_##name
+#include "matrix_fixed.h"
+
+#define MF_N 8
+#define MF_TYPE Matrix8
+#define MF_TAG matrix8
+#define MF_FN(name) matrix8_##name
+#include "matrix_fixed.h"
+
+// Binary files
+// A versioned format: a 64-byte header (element type, shape, layout,
+// alignment and a checksum of the data) followed by the elements laid out
+// as in a Matrix. matrix_file_open maps a file read-only and the
+// file_view functions return a view of the mapping itself, so opening
+// neither copies nor parses and costs the same at any size; pages are
+// read from disk as they are touched. Writing through such a view faults.
+typedef enum {
+  MATRIX_ELEM_FLOAT = 1,
+  MATRIX_ELEM_DOUBLE,
+  MATRIX_ELEM_COMPLEX,
+  MATRIX_ELEM_COMPLEX_DOUBLE
+} MatrixElemType;
+
+typedef struct matrix_file MatrixFile;
+
+// 0 on success, -1 on failure. mat may have any strides, the file is
+// written dense.
+int matrix_save(const char *path, Matrix *mat);
+
+// A new matrix holding a copy of the file, once its checksum is verified
+Matrix *matrix_load(const char *path);
+
+// Only the header is checked unless verify is set, which reads the whole
+// file to check the checksum. NULL if it is not a valid matrix file.
+MatrixFile *matrix_file_open(const char *path, int verify);
+
+MatrixElemType matrix_file_elem_type(MatrixFile *file);
+
+// Valid until matrix_file_close. An empty view if the file does not hold
+// floats (see matrixd_file_view and the other types).
+Matrix matrix_file_view(MatrixFile *file);
+
+void matrix_file_close(MatrixFile *file);
+
+// Out-of-core
+// GEMM and LU on float matrix files too large for memory. Only tiles of
+// the operands are in memory at a time, at most memory_budget bytes of
+// them (0 for 256 MB), and a helper thread reads the next tile while the
+// current one is computed on. The results are written as matrix files.
+
+// C = A * B. 0 on success, -1 on failure.
+int matrix_file_mult(const char *c_path, const char *a_path,
+                     const char *b_path, size_t memory_budget);
+
+// P A = L U of the square A, written to lu_path packed as by lu_factor,
+// with the n interchanges in pivots. 0 on success, -1 on failure or if A
+// is singular.
+int matrix_file_lu(const char *lu_path, const char *a_path, size_t *pivots,
+                   size_t memory_budget);
+
+// A new matrix x with A x = b, from the output of matrix_file_lu
+Matrix *matrix_file_lu_solve(const char *lu_path, const size_t *pivots,
+                             Matrix *b, size_t memory_budget);
+
+// Element types
+// Everything above is float, written out by hand in matrix.c and its
+// neighbours. The core of that API (create through solve, declared in
+// matrix_tmpl.h) is generated from one template for double, complex float
+// and complex double, prefixed matrixd_, matrixc_ and matrixz_; their
+// solve dispatches to structured and least-squares solves as
+// solve_lin_system does. Each type runs its own kernels: double has its
+// own SIMD micro-kernels, complex products are four real products (4M) on
+// the kernels of the real type. Precision is fixed by the type at the
+// call site, nothing is dispatched per element.
+
+#define MT_TYPE MatrixD
+#define MT_TAG matrixd
+#define MT_ELEM double
+#define MT_REAL double
+#define MT_FN(name) matrixd_##name
+#include "matrix_tmpl.h"
+
+#define MT_TYPE MatrixC
+#define MT_TAG matrixc
+#define MT_ELEM float _Complex
+#define MT_REAL float
+#define MT_FN(name) matrixc_##name
+#include "matrix_tmpl.h"
+
+#define MT_TYPE MatrixZ
+#define MT_TAG matrixz
+#define MT_ELEM double _Complex
+#define MT_REAL double
+#define MT_FN(name) matrixz_##name
+#include "matrix_tmpl.h"
+
+// Conversions between float and double, any strides
+MatrixD *matrix_to_double(Matrix *mat);
+
+Matrix *matrixd_to_float(MatrixD *mat);
+
+MatrixD *matrix_to_double_into(MatrixD *dst, Matrix *mat);
+
+Matrix *matrixd_to_float_into(Matrix *dst, MatrixD *mat);
+
+// Mixed-precision iterative refinement
+typedef struct refine_info {
+  size_t iterations;     // refinement steps taken in float
+  double backward_error; // max over columns of ||b - A x|| /
+                         // (||A|| ||x|| + ||b||), max-norms
+  int fell_back;         // 1 if x came from a double factorization
+} RefineInfo;
+
+// A x = b for square A, every column of b, to double accuracy at close to
+// the cost of a float solve: A is factored once in float, then x is
+// refined with residuals computed in double until the backward error is
+// at most tolerance (<= 0 for eps(double) * sqrt(n)). If refinement does
+// not converge (cond(A) beyond ~1e7, or A overflows float) it falls back
+// to matrixd_solve. info may be NULL. NULL if A is singular.
+MatrixD *solve_lin_system_refined(MatrixD *A, MatrixD *b, double tolerance,
+                                  RefineInfo *info);
+
 #endif // !LINALGLIB_H
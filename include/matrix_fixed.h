@@ -0,0 +1,308 @@
+// A fixed-size square matrix type and its operations, included by
+// matrix.h once per size. The includer defines:
+//   MF_N      the size, an integer literal (3)
+//   MF_TYPE   the matrix type (Matrix3)
+//   MF_TAG    its struct tag (matrix3)
+//   MF_FN     MF_FN(name) is the function name (matrix3_##name)
+// All of them are undefined again at the end. Everything is static inline
+// on a by-value struct: the size is a constant at every call site, so the
+// loops unroll and nothing is allocated or checked at run time. Outputs
+// may alias the inputs.
+
+typedef struct MF_TAG {
+  float m[MF_N][MF_N];
+} MF_TYPE;
+
+static inline MF_TYPE *MF_FN(identity)(MF_TYPE *dst) {
+  for (int i = 0; i < MF_N; i++) {
+    for (int j = 0; j < MF_N; j++) {
+      dst->m[i][j] = i == j ? 1.0f : 0.0f;
+    }
+  }
+  return dst;
+}
+
+// dst = a b
+static inline MF_TYPE *MF_FN(mult)(MF_TYPE *dst, const MF_TYPE *a,
+                                   const MF_TYPE *b) {
+  MF_TYPE res;
+  for (int i = 0; i < MF_N; i++) {
+    for (int j = 0; j < MF_N; j++) {
+      float sum = 0;
+      for (int k = 0; k < MF_N; k++) {
+        sum += a->m[i][k] * b->m[k][j];
+      }
+      res.m[i][j] = sum;
+    }
+  }
+  *dst = res;
+  return dst;
+}
+
+// y = a x for MF_N-vectors
+static inline float *MF_FN(mult_vec)(float *y, const MF_TYPE *a,
+                                     const float *x) {
+  float res[MF_N];
+  for (int i = 0; i < MF_N; i++) {
+    float sum = 0;
+    for (int k = 0; k < MF_N; k++) {
+      sum += a->m[i][k] * x[k];
+    }
+    res[i] = sum;
+  }
+  for (int i = 0; i < MF_N; i++) {
+    y[i] = res[i];
+  }
+  return y;
+}
+
+static inline MF_TYPE *MF_FN(trans)(MF_TYPE *dst, const MF_TYPE *a) {
+  MF_TYPE res;
+  for (int i = 0; i < MF_N; i++) {
+    for (int j = 0; j < MF_N; j++) {
+      res.m[j][i] = a->m[i][j];
+    }
+  }
+  *dst = res;
+  return dst;
+}
+
+// Gauss-Jordan with partial pivoting on [a | b], b MF_N x k: leaves
+// a^-1 b in b and destroys a. 0 if a is singular.
+static inline int MF_FN(gauss_jordan)(float a[MF_N][MF_N], float *b,
+                                      int k) {
+  for (int c = 0; c < MF_N; c++) {
+    int p = c;
+    for (int i = c + 1; i < MF_N; i++) {
+      if (fabsf(a[i][c]) > fabsf(a[p][c]))
+        p = i;
+    }
+    if (a[p][c] == 0)
+      return 0;
+    if (p != c) {
+      for (int j = c; j < MF_N; j++) {
+        float t = a[c][j];
+        a[c][j] = a[p][j];
+        a[p][j] = t;
+      }
+      for (int j = 0; j < k; j++) {
+        float t = b[c * k + j];
+        b[c * k + j] = b[p * k + j];
+        b[p * k + j] = t;
+      }
+    }
+
+    float inv = 1.0f / a[c][c];
+    for (int j = c + 1; j < MF_N; j++) {
+      a[c][j] *= inv;
+    }
+    for (int j = 0; j < k; j++) {
+      b[c * k + j] *= inv;
+    }
+    for (int i = 0; i < MF_N; i++) {
+      if (i == c)
+        continue;
+      float f = a[i][c];
+      for (int j = c + 1; j < MF_N; j++) {
+        a[i][j] -= f * a[c][j];
+      }
+      for (int j = 0; j < k; j++) {
+        b[i * k + j] -= f * b[c * k + j];
+      }
+    }
+  }
+  return 1;
+}
+
+#if MF_N <= 4
+// Up to 4 x 4, the determinant and the inverse are closed forms over the
+// 2 x 2 minors of the top and bottom row pairs (Laplace expansion); no
+// pivoting and no branches
+#if MF_N == 2
+static inline float MF_FN(determinant)(const MF_TYPE *a) {
+  return a->m[0][0] * a->m[1][1] - a->m[0][1] * a->m[1][0];
+}
+
+static inline MF_TYPE *MF_FN(inverse)(MF_TYPE *dst, const MF_TYPE *a) {
+  float det = MF_FN(determinant)(a);
+  if (det == 0)
+    return NULL;
+  float inv = 1.0f / det;
+  MF_TYPE res = {{{a->m[1][1] * inv, -a->m[0][1] * inv},
+                  {-a->m[1][0] * inv, a->m[0][0] * inv}}};
+  *dst = res;
+  return dst;
+}
+#elif MF_N == 3
+static inline float MF_FN(determinant)(const MF_TYPE *a) {
+  return a->m[0][0] * (a->m[1][1] * a->m[2][2] - a->m[1][2] * a->m[2][1]) -
+         a->m[0][1] * (a->m[1][0] * a->m[2][2] - a->m[1][2] * a->m[2][0]) +
+         a->m[0][2] * (a->m[1][0] * a->m[2][1] - a->m[1][1] * a->m[2][0]);
+}
+
+static inline MF_TYPE *MF_FN(inverse)(MF_TYPE *dst, const MF_TYPE *a) {
+  MF_TYPE adj;
+  // adj[j][i] is the cofactor of a[i][j]; rows i + 1, i + 2 (mod 3) in
+  // order give the signs for free
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+      int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+      adj.m[j][i] = a->m[i1][j1] * a->m[i2][j2] - a->m[i1][j2] * a->m[i2][j1];
+    }
+  }
+  float det = a->m[0][0] * adj.m[0][0] + a->m[0][1] * adj.m[1][0] +
+              a->m[0][2] * adj.m[2][0];
+  if (det == 0)
+    return NULL;
+  float inv = 1.0f / det;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      dst->m[i][j] = adj.m[i][j] * inv;
+    }
+  }
+  return dst;
+}
+#else
+// s[] are the 2 x 2 minors of rows 0-1, c[] those of rows 2-3. They are
+// spelled out in both functions so that no helper joins the API.
+static inline float MF_FN(determinant)(const MF_TYPE *a) {
+  float s[6], c[6];
+  s[0] = a->m[0][0] * a->m[1][1] - a->m[1][0] * a->m[0][1];
+  s[1] = a->m[0][0] * a->m[1][2] - a->m[1][0] * a->m[0][2];
+  s[2] = a->m[0][0] * a->m[1][3] - a->m[1][0] * a->m[0][3];
+  s[3] = a->m[0][1] * a->m[1][2] - a->m[1][1] * a->m[0][2];
+  s[4] = a->m[0][1] * a->m[1][3] - a->m[1][1] * a->m[0][3];
+  s[5] = a->m[0][2] * a->m[1][3] - a->m[1][2] * a->m[0][3];
+  c[5] = a->m[2][2] * a->m[3][3] - a->m[3][2] * a->m[2][3];
+  c[4] = a->m[2][1] * a->m[3][3] - a->m[3][1] * a->m[2][3];
+  c[3] = a->m[2][1] * a->m[3][2] - a->m[3][1] * a->m[2][2];
+  c[2] = a->m[2][0] * a->m[3][3] - a->m[3][0] * a->m[2][3];
+  c[1] = a->m[2][0] * a->m[3][2] - a->m[3][0] * a->m[2][2];
+  c[0] = a->m[2][0] * a->m[3][1] - a->m[3][0] * a->m[2][1];
+  return s[0] * c[5] - s[1] * c[4] + s[2] * c[3] + s[3] * c[2] -
+         s[4] * c[1] + s[5] * c[0];
+}
+
+static inline MF_TYPE *MF_FN(inverse)(MF_TYPE *dst, const MF_TYPE *a) {
+  float s[6], c[6];
+  s[0] = a->m[0][0] * a->m[1][1] - a->m[1][0] * a->m[0][1];
+  s[1] = a->m[0][0] * a->m[1][2] - a->m[1][0] * a->m[0][2];
+  s[2] = a->m[0][0] * a->m[1][3] - a->m[1][0] * a->m[0][3];
+  s[3] = a->m[0][1] * a->m[1][2] - a->m[1][1] * a->m[0][2];
+  s[4] = a->m[0][1] * a->m[1][3] - a->m[1][1] * a->m[0][3];
+  s[5] = a->m[0][2] * a->m[1][3] - a->m[1][2] * a->m[0][3];
+  c[5] = a->m[2][2] * a->m[3][3] - a->m[3][2] * a->m[2][3];
+  c[4] = a->m[2][1] * a->m[3][3] - a->m[3][1] * a->m[2][3];
+  c[3] = a->m[2][1] * a->m[3][2] - a->m[3][1] * a->m[2][2];
+  c[2] = a->m[2][0] * a->m[3][3] - a->m[3][0] * a->m[2][3];
+  c[1] = a->m[2][0] * a->m[3][2] - a->m[3][0] * a->m[2][2];
+  c[0] = a->m[2][0] * a->m[3][1] - a->m[3][0] * a->m[2][1];
+  float det = s[0] * c[5] - s[1] * c[4] + s[2] * c[3] + s[3] * c[2] -
+              s[4] * c[1] + s[5] * c[0];
+  if (det == 0)
+    return NULL;
+  float inv = 1.0f / det;
+  const float(*m)[4] = a->m;
+  MF_TYPE res = {{
+      {(m[1][1] * c[5] - m[1][2] * c[4] + m[1][3] * c[3]) * inv,
+       (-m[0][1] * c[5] + m[0][2] * c[4] - m[0][3] * c[3]) * inv,
+       (m[3][1] * s[5] - m[3][2] * s[4] + m[3][3] * s[3]) * inv,
+       (-m[2][1] * s[5] + m[2][2] * s[4] - m[2][3] * s[3]) * inv},
+      {(-m[1][0] * c[5] + m[1][2] * c[2] - m[1][3] * c[1]) * inv,
+       (m[0][0] * c[5] - m[0][2] * c[2] + m[0][3] * c[1]) * inv,
+       (-m[3][0] * s[5] + m[3][2] * s[2] - m[3][3] * s[1]) * inv,
+       (m[2][0] * s[5] - m[2][2] * s[2] + m[2][3] * s[1]) * inv},
+      {(m[1][0] * c[4] - m[1][1] * c[2] + m[1][3] * c[0]) * inv,
+       (-m[0][0] * c[4] + m[0][1] * c[2] - m[0][3] * c[0]) * inv,
+       (m[3][0] * s[4] - m[3][1] * s[2] + m[3][3] * s[0]) * inv,
+       (-m[2][0] * s[4] + m[2][1] * s[2] - m[2][3] * s[0]) * inv},
+      {(-m[1][0] * c[3] + m[1][1] * c[1] - m[1][2] * c[0]) * inv,
+       (m[0][0] * c[3] - m[0][1] * c[1] + m[0][2] * c[0]) * inv,
+       (-m[3][0] * s[3] + m[3][1] * s[1] - m[3][2] * s[0]) * inv,
+       (m[2][0] * s[3] - m[2][1] * s[1] + m[2][2] * s[0]) * inv},
+  }};
+  *dst = res;
+  return dst;
+}
+#endif
+#else
+// Larger sizes eliminate, unrolled all the same
+static inline float MF_FN(determinant)(const MF_TYPE *a) {
+  MF_TYPE lu = *a;
+  float det = 1;
+  for (int c = 0; c < MF_N; c++) {
+    int p = c;
+    for (int i = c + 1; i < MF_N; i++) {
+      if (fabsf(lu.m[i][c]) > fabsf(lu.m[p][c]))
+        p = i;
+    }
+    if (lu.m[p][c] == 0)
+      return 0;
+    if (p != c) {
+      for (int j = c; j < MF_N; j++) {
+        float t = lu.m[c][j];
+        lu.m[c][j] = lu.m[p][j];
+        lu.m[p][j] = t;
+      }
+      det = -det;
+    }
+    det *= lu.m[c][c];
+    float inv = 1.0f / lu.m[c][c];
+    for (int i = c + 1; i < MF_N; i++) {
+      float f = lu.m[i][c] * inv;
+      for (int j = c + 1; j < MF_N; j++) {
+        lu.m[i][j] -= f * lu.m[c][j];
+      }
+    }
+  }
+  return det;
+}
+
+static inline MF_TYPE *MF_FN(inverse)(MF_TYPE *dst, const MF_TYPE *a) {
+  MF_TYPE lu = *a, res;
+  MF_FN(identity)(&res);
+  if (!MF_FN(gauss_jordan)(lu.m, &res.m[0][0], MF_N))
+    return NULL;
+  *dst = res;
+  return dst;
+}
+#endif
+
+// Solve a x = b for the MF_N-vector b; x may be b. NULL if a is singular.
+static inline float *MF_FN(solve)(float *x, const MF_TYPE *a, const float *b) {
+  MF_TYPE lu = *a;
+  float res[MF_N];
+  for (int i = 0; i < MF_N; i++) {
+    res[i] = b[i];
+  }
+  if (!MF_FN(gauss_jordan)(lu.m, res, 1))
+    return NULL;
+  for (int i = 0; i < MF_N; i++) {
+    x[i] = res[i];
+  }
+  return x;
+}
+
+// Interop with Matrix: a zero-copy view of a, usable with every function
+// taking a Matrix, and a copy from an MF_N x MF_N Matrix (NULL if it has
+// another shape)
+static inline Matrix MF_FN(view)(MF_TYPE *a) {
+  return matrix_view_array(&a->m[0][0], MF_N, MF_N, MF_N);
+}
+
+static inline MF_TYPE *MF_FN(from_matrix)(MF_TYPE *dst, Matrix *mat) {
+  if (mat->n_rows != MF_N || mat->n_cols != MF_N)
+    return NULL;
+  for (int i = 0; i < MF_N; i++) {
+    for (int j = 0; j < MF_N; j++) {
+      dst->m[i][j] = mat->array[i * mat->row_stride + j * mat->col_stride];
+    }
+  }
+  return dst;
+}
+
+#undef MF_N
+#undef MF_TYPE
+#undef MF_TAG
+#undef MF_FN
@@ -0,0 +1,100 @@
+// Declarations of one element type's matrix API, included by matrix.h once
+// per type. The includer defines:
+//   MT_TYPE   the matrix type (MatrixD)
+//   MT_TAG    its struct tag (matrixd)
+//   MT_ELEM   the element type (double)
+//   MT_REAL   the matching real type, for tolerances (double)
+//   MT_FN     MT_FN(name) is the function name (matrixd_##name)
+// All of them are undefined again at the end. Each function behaves like
+// the float function of the same name in matrix.h.
+
+typedef struct MT_TAG {
+  MT_ELEM *array;
+  size_t n_rows;
+  size_t n_cols;
+  size_t row_stride;
+  size_t col_stride;
+  const MatrixAllocator *allocator; // the block's owner, NULL for a view
+} MT_TYPE;
+
+MT_TYPE *MT_FN(create)(size_t n_rows, size_t n_cols);
+
+MT_TYPE *MT_FN(create_with)(const MatrixAllocator *allocator, size_t n_rows,
+                            size_t n_cols);
+
+void MT_FN(free)(MT_TYPE *mat);
+
+void MT_FN(set)(MT_TYPE *mat, size_t row, size_t col, MT_ELEM value);
+
+void MT_FN(set_array)(MT_TYPE *mat, MT_ELEM array[], size_t size);
+
+MT_ELEM MT_FN(get)(MT_TYPE *mat, size_t row, size_t col);
+
+MT_TYPE MT_FN(view)(MT_TYPE *mat, size_t row, size_t col, size_t n_rows,
+                    size_t n_cols);
+
+MT_TYPE MT_FN(row)(MT_TYPE *mat, size_t row);
+
+MT_TYPE MT_FN(col)(MT_TYPE *mat, size_t col);
+
+MT_TYPE MT_FN(trans_view)(MT_TYPE *mat);
+
+MT_TYPE MT_FN(view_array)(MT_ELEM *array, size_t n_rows, size_t n_cols,
+                          size_t row_stride);
+
+MT_TYPE *MT_FN(scale)(MT_ELEM scalar, MT_TYPE *mat);
+
+MT_TYPE *MT_FN(add)(MT_TYPE *mat1, MT_TYPE *mat2);
+
+MT_TYPE *MT_FN(subtract)(MT_TYPE *mat1, MT_TYPE *mat2);
+
+MT_TYPE *MT_FN(mult)(MT_TYPE *mat1, MT_TYPE *mat2);
+
+MT_TYPE *MT_FN(gemm)(MT_ELEM alpha, MT_TYPE *A, MT_TYPE *B, MT_ELEM beta,
+                     MT_TYPE *C);
+
+MT_TYPE *MT_FN(trans)(MT_TYPE *mat);
+
+MT_TYPE *MT_FN(identity)(size_t n);
+
+MT_ELEM MT_FN(determinant)(MT_TYPE *mat);
+
+MT_TYPE *MT_FN(inverse)(MT_TYPE *mat);
+
+// A x = b for every column of b, dispatched as solve_lin_system: a band
+// or triangular A by a band LU or substitution, other square A by the
+// blocked LU, tall A in the least-squares sense by Householder QR
+MT_TYPE *MT_FN(solve)(MT_TYPE *A, MT_TYPE *b);
+
+MT_TYPE *MT_FN(scale_into)(MT_TYPE *dst, MT_ELEM scalar, MT_TYPE *mat);
+
+MT_TYPE *MT_FN(add_into)(MT_TYPE *dst, MT_TYPE *mat1, MT_TYPE *mat2);
+
+MT_TYPE *MT_FN(subtract_into)(MT_TYPE *dst, MT_TYPE *mat1, MT_TYPE *mat2);
+
+MT_TYPE *MT_FN(mult_into)(MT_TYPE *dst, MT_TYPE *mat1, MT_TYPE *mat2);
+
+MT_TYPE *MT_FN(trans_into)(MT_TYPE *dst, MT_TYPE *mat);
+
+MT_TYPE *MT_FN(inverse_into)(MT_TYPE *dst, MT_TYPE *mat);
+
+MT_TYPE *MT_FN(scale_inplace)(MT_ELEM scalar, MT_TYPE *mat);
+
+MT_TYPE *MT_FN(add_inplace)(MT_TYPE *mat1, MT_TYPE *mat2);
+
+MT_TYPE *MT_FN(subtract_inplace)(MT_TYPE *mat1, MT_TYPE *mat2);
+
+// |A_ij - B_ij| <= tolerance everywhere (the modulus for complex types)
+int MT_FN(approx_equal)(MT_TYPE *A, MT_TYPE *B, MT_REAL tolerance);
+
+int MT_FN(save)(const char *path, MT_TYPE *mat);
+
+MT_TYPE *MT_FN(load)(const char *path);
+
+MT_TYPE MT_FN(file_view)(MatrixFile *file);
+
+#undef MT_TYPE
+#undef MT_TAG
+#undef MT_ELEM
+#undef MT_REAL
+#undef MT_FN
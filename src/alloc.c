@@ -0,0 +1,350 @@
+#include "alloc.h"
+#include "matrix.h"
+#include "profile.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t align_up(size_t size) {
+  return (size + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+size_t matrix_block_size(size_t elem_size, size_t n_rows, size_t n_cols) {
+  if (n_cols != 0 &&
+      n_rows > (SIZE_MAX - MATRIX_HEADER_SIZE) / elem_size / n_cols)
+    return 0;
+  return MATRIX_HEADER_SIZE + n_rows * n_cols * elem_size;
+}
+
+// Default allocator: one aligned heap block per matrix
+
+static void *heap_alloc(void *ctx, size_t size) {
+  (void)ctx;
+  void *block = NULL;
+  if (posix_memalign(&block, MATRIX_ALIGNMENT, size) != 0)
+    return NULL;
+  return block;
+}
+
+static void heap_free(void *ctx, void *block, size_t size) {
+  (void)ctx;
+  (void)size;
+  free(block);
+}
+
+static const MatrixAllocator heap_allocator = {heap_alloc, heap_free, NULL};
+
+const MatrixAllocator *
+matrix_allocator_or_default(const MatrixAllocator *allocator) {
+  return allocator != NULL ? allocator : &heap_allocator;
+}
+
+Matrix *matrix_create_with(const MatrixAllocator *allocator, size_t n_rows,
+                           size_t n_cols) {
+  allocator = matrix_allocator_or_default(allocator);
+
+  size_t size = matrix_block_size(sizeof(float), n_rows, n_cols);
+  if (size == 0) {
+    fprintf(stderr, "Error matrix_create: %zu x %zu is too large\n", n_rows,
+            n_cols);
+    return NULL;
+  }
+
+  Matrix *mat = allocator->alloc(allocator->ctx, size);
+  if (mat == NULL)
+    return NULL;
+  PROFILE_ALLOC(size);
+
+  mat->array = (float *)((char *)mat + MATRIX_HEADER_SIZE);
+  mat->n_rows = n_rows;
+  mat->n_cols = n_cols;
+  mat->row_stride = n_cols;
+  mat->col_stride = 1;
+  mat->allocator = allocator;
+  return mat;
+}
+
+void matrix_free(Matrix *mat) {
+  if (mat != NULL && mat->allocator != NULL) {
+    const MatrixAllocator *allocator = mat->allocator;
+    size_t size = matrix_block_size(sizeof(float), mat->n_rows, mat->n_cols);
+    allocator->free(allocator->ctx, mat, size);
+  }
+}
+
+// Arena: chunks are chained and never move. Each chunk covers the arena
+// offsets [start, start + cap), so a mark is a single offset and a reset
+// only has to find the chunk it falls in. Chunks past the reset point are
+// kept and reused by later allocations.
+
+#define ARENA_DEFAULT_CAPACITY (1 << 20)
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t start;
+  size_t cap;
+  char *data;
+} ArenaChunk;
+
+struct matrix_arena {
+  MatrixAllocator allocator;
+  ArenaChunk *first;
+  ArenaChunk *top; // chunk the next allocation is carved from
+  size_t used;     // offset of the next free byte
+  size_t next_cap; // capacity of the next chunk to create
+};
+
+static ArenaChunk *chunk_create(size_t start, size_t cap) {
+  size_t header = align_up(sizeof(ArenaChunk));
+  void *block = NULL;
+  if (cap > SIZE_MAX - header ||
+      posix_memalign(&block, MATRIX_ALIGNMENT, header + cap) != 0)
+    return NULL;
+
+  ArenaChunk *chunk = block;
+  chunk->next = NULL;
+  chunk->start = start;
+  chunk->cap = cap;
+  chunk->data = (char *)block + header;
+  return chunk;
+}
+
+static void chunks_free(ArenaChunk *chunk) {
+  while (chunk != NULL) {
+    ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+static void *arena_alloc(void *ctx, size_t size) {
+  MatrixArena *arena = ctx;
+  ArenaChunk *top = arena->top;
+  size = align_up(size);
+
+  if (size <= top->start + top->cap - arena->used) {
+    void *block = top->data + (arena->used - top->start);
+    arena->used += size;
+    return block;
+  }
+
+  // The rest of top is skipped. A kept chunk too small for this request
+  // is dropped along with the ones after it, so offsets stay contiguous.
+  ArenaChunk *next = top->next;
+  if (next != NULL && next->cap < size) {
+    chunks_free(next);
+    top->next = next = NULL;
+  }
+  if (next == NULL) {
+    size_t cap = arena->next_cap > size ? arena->next_cap : size;
+    next = chunk_create(top->start + top->cap, cap);
+    if (next == NULL)
+      return NULL;
+    top->next = next;
+    if (arena->next_cap <= SIZE_MAX / 4)
+      arena->next_cap *= 2;
+  }
+
+  arena->top = next;
+  arena->used = next->start + size;
+  return next->data;
+}
+
+static void arena_free(void *ctx, void *block, size_t size) {
+  (void)ctx;
+  (void)block;
+  (void)size;
+}
+
+MatrixArena *matrix_arena_create(size_t capacity) {
+  if (capacity == 0)
+    capacity = ARENA_DEFAULT_CAPACITY;
+  capacity = align_up(capacity);
+
+  MatrixArena *arena = malloc(sizeof(MatrixArena));
+  if (arena == NULL)
+    return NULL;
+  arena->first = chunk_create(0, capacity);
+  if (arena->first == NULL) {
+    free(arena);
+    return NULL;
+  }
+
+  arena->allocator = (MatrixAllocator){arena_alloc, arena_free, arena};
+  arena->top = arena->first;
+  arena->used = 0;
+  arena->next_cap = capacity * 2;
+  return arena;
+}
+
+void matrix_arena_destroy(MatrixArena *arena) {
+  if (arena != NULL) {
+    chunks_free(arena->first);
+    free(arena);
+  }
+}
+
+const MatrixAllocator *matrix_arena_allocator(MatrixArena *arena) {
+  return &arena->allocator;
+}
+
+size_t matrix_arena_mark(MatrixArena *arena) {
+  return arena != NULL ? arena->used : 0;
+}
+
+void matrix_arena_reset(MatrixArena *arena, size_t mark) {
+  if (arena == NULL)
+    return;
+  if (mark > arena->used) {
+    fprintf(stderr, "Error matrix_arena_reset: mark (%zu) is past the top "
+                    "of the arena (%zu)\n",
+            mark, arena->used);
+    return;
+  }
+
+  ArenaChunk *chunk = arena->first;
+  while (mark > chunk->start + chunk->cap) {
+    chunk = chunk->next;
+  }
+  arena->top = chunk;
+  arena->used = mark;
+}
+
+// Per-thread scratch arena, freed when the thread exits
+
+static __thread MatrixArena *thread_scratch = NULL;
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_key_once = PTHREAD_ONCE_INIT;
+
+static void free_scratch(void *arg) {
+  matrix_arena_destroy(arg);
+  thread_scratch = NULL;
+}
+
+static void create_scratch_key(void) {
+  pthread_key_create(&scratch_key, free_scratch);
+}
+
+MatrixArena *scratch_arena(void) {
+  if (thread_scratch == NULL) {
+    thread_scratch = matrix_arena_create(0);
+    if (thread_scratch == NULL)
+      return NULL;
+    pthread_once(&scratch_key_once, create_scratch_key);
+    pthread_setspecific(scratch_key, thread_scratch);
+  }
+  return thread_scratch;
+}
+
+Matrix *scratch_matrix(MatrixArena *scratch, size_t n_rows, size_t n_cols) {
+  const MatrixAllocator *allocator =
+      scratch != NULL ? matrix_arena_allocator(scratch) : NULL;
+  Matrix *mat = matrix_create_with(allocator, n_rows, n_cols);
+  PROFILE_SCRATCH(matrix_arena_mark(scratch));
+  return mat;
+}
+
+void *scratch_alloc(MatrixArena *scratch, size_t size) {
+  if (scratch == NULL)
+    return heap_alloc(NULL, size);
+  void *block = arena_alloc(scratch, size);
+  PROFILE_SCRATCH(matrix_arena_mark(scratch));
+  return block;
+}
+
+void scratch_free(MatrixArena *scratch, void *block) {
+  if (scratch == NULL)
+    free(block);
+}
+
+// Pool: one free list per power-of-two size class, threaded through the
+// freed blocks themselves. Blocks above the largest class bypass the pool.
+
+#define POOL_MIN_SHIFT 6  // 64 bytes, one alignment unit
+#define POOL_MAX_SHIFT 30 // 1GB
+#define POOL_N_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+typedef struct pool_block {
+  struct pool_block *next;
+} PoolBlock;
+
+struct matrix_pool {
+  MatrixAllocator allocator;
+  pthread_mutex_t lock;
+  PoolBlock *free_lists[POOL_N_CLASSES];
+};
+
+// Size class of a block, POOL_N_CLASSES when it is too large for the pool
+static size_t size_class(size_t size) {
+  size_t c = 0;
+  while (c < POOL_N_CLASSES && ((size_t)1 << (POOL_MIN_SHIFT + c)) < size) {
+    c++;
+  }
+  return c;
+}
+
+static void *pool_alloc(void *ctx, size_t size) {
+  MatrixPool *pool = ctx;
+  size_t c = size_class(size);
+  if (c == POOL_N_CLASSES)
+    return heap_alloc(NULL, size);
+
+  pthread_mutex_lock(&pool->lock);
+  PoolBlock *block = pool->free_lists[c];
+  if (block != NULL)
+    pool->free_lists[c] = block->next;
+  pthread_mutex_unlock(&pool->lock);
+
+  if (block == NULL)
+    return heap_alloc(NULL, (size_t)1 << (POOL_MIN_SHIFT + c));
+  return block;
+}
+
+static void pool_free(void *ctx, void *block, size_t size) {
+  MatrixPool *pool = ctx;
+  size_t c = size_class(size);
+  if (c == POOL_N_CLASSES) {
+    free(block);
+    return;
+  }
+
+  PoolBlock *pb = block;
+  pthread_mutex_lock(&pool->lock);
+  pb->next = pool->free_lists[c];
+  pool->free_lists[c] = pb;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+MatrixPool *matrix_pool_create(void) {
+  MatrixPool *pool = malloc(sizeof(MatrixPool));
+  if (pool == NULL)
+    return NULL;
+
+  pool->allocator = (MatrixAllocator){pool_alloc, pool_free, pool};
+  pthread_mutex_init(&pool->lock, NULL);
+  for (size_t c = 0; c < POOL_N_CLASSES; c++) {
+    pool->free_lists[c] = NULL;
+  }
+  return pool;
+}
+
+void matrix_pool_destroy(MatrixPool *pool) {
+  if (pool == NULL)
+    return;
+
+  for (size_t c = 0; c < POOL_N_CLASSES; c++) {
+    PoolBlock *block = pool->free_lists[c];
+    while (block != NULL) {
+      PoolBlock *next = block->next;
+      free(block);
+      block = next;
+    }
+  }
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+const MatrixAllocator *matrix_pool_allocator(MatrixPool *pool) {
+  return &pool->allocator;
+}
@@ -0,0 +1,41 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "matrix.h"
+
+// The Matrix struct sits at the start of its block, padded so the data
+// that follows it is aligned too
+#define MATRIX_HEADER_SIZE                                                     \
+  ((sizeof(Matrix) + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT *               \
+   MATRIX_ALIGNMENT)
+
+// Size of the block of an n_rows x n_cols matrix of elem_size-byte
+// elements, any element type: header then data. 0 if it overflows.
+size_t matrix_block_size(size_t elem_size, size_t n_rows, size_t n_cols);
+
+// allocator, or the default (heap) one when it is NULL
+const MatrixAllocator *
+matrix_allocator_or_default(const MatrixAllocator *allocator);
+
+// Per-thread arena for temporaries that do not outlive one operation.
+// Take a mark before allocating and reset to it before returning:
+//   MatrixArena *scratch = scratch_arena();
+//   size_t mark = matrix_arena_mark(scratch);
+//   Matrix *tmp = matrix_create_with(matrix_arena_allocator(scratch), n, n);
+//   ...
+//   matrix_arena_reset(scratch, mark);
+// Returns NULL if the arena could not be created; mark and reset accept it.
+MatrixArena *scratch_arena(void);
+
+// matrix_create_with on the scratch arena, falling back to the default
+// allocator if there is none. Such matrices are released by the reset,
+// matrix_free on them is a no-op.
+Matrix *scratch_matrix(MatrixArena *scratch, size_t n_rows, size_t n_cols);
+
+// Raw scratch memory with the same fallback, released by scratch_free or,
+// when it came from the arena, by the reset
+void *scratch_alloc(MatrixArena *scratch, size_t size);
+
+void scratch_free(MatrixArena *scratch, void *block);
+
+#endif // !ALLOC_H
@@ -0,0 +1,325 @@
+#include "matrix.h"
+#include "profile.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_X86 1
+#endif
+
+#define BATCH_LANES MATRIX_BATCH_LANES
+#define BATCH_MAX MATRIX_BATCH_MAX_DIM
+
+// Sizes with kernels of their own; beyond, the loops are long enough that
+// a runtime bound costs little and unrolling mostly grows the code
+#define BATCH_UNROLLED 8
+
+// One element of BATCH_LANES matrices (a GCC vector: one AVX-512
+// register, two AVX2 ones...) and a lane mask of the same width
+typedef float BatchVec
+    __attribute__((vector_size(BATCH_LANES * sizeof(float))));
+typedef int32_t BatchMask
+    __attribute__((vector_size(BATCH_LANES * sizeof(float))));
+
+typedef struct batch_gemm_args BatchGemmArgs;
+
+// A chunk of systems [A | R] copied out of the batch: L1-resident, and
+// padded to the largest size so that every instance shares the layout
+typedef struct batch_tile {
+  BatchVec a[BATCH_MAX][2 * BATCH_MAX];
+} BatchTile;
+
+typedef void (*BatchGemmKernel)(const BatchGemmArgs *g, size_t b0);
+typedef void (*BatchEliminateKernel)(BatchTile *t, size_t size, size_t width,
+                                     int jordan, float *det);
+
+// The kernels of one instruction set, indexed by size (the inner dimension
+// for GEMM), then the ones for any size
+typedef struct batch_kernels {
+  BatchGemmKernel gemm[BATCH_UNROLLED + 1];
+  BatchEliminateKernel eliminate[BATCH_UNROLLED + 1];
+  BatchGemmKernel gemm_any;
+  BatchEliminateKernel eliminate_any;
+} BatchKernels;
+
+struct batch_gemm_args {
+  float alpha;
+  const MatrixBatch *A;
+  const MatrixBatch *B;
+  float beta;
+  MatrixBatch *C;
+  BatchGemmKernel kernel;
+};
+
+// Portable instance, auto-vectorized for the baseline target
+#define FN(name) name##_generic
+#define TARGET
+#include "batch_tmpl.h"
+
+#ifdef BATCH_X86
+#define FN(name) name##_avx2
+#define TARGET __attribute__((target("avx2,fma")))
+#include "batch_tmpl.h"
+
+#define FN(name) name##_avx512
+#define TARGET __attribute__((target("avx512f")))
+#include "batch_tmpl.h"
+#endif
+
+// Follows the SIMD dispatch, so MATRIX_SIMD selects these too
+static const BatchKernels *batch_kernels(void) {
+#ifdef BATCH_X86
+  const char *isa = simd_kernels()->name;
+  if (strcmp(isa, "avx512") == 0)
+    return &batch_kernels_avx512;
+  if (strcmp(isa, "avx2") == 0)
+    return &batch_kernels_avx2;
+#endif
+  return &batch_kernels_generic;
+}
+
+MatrixBatch *matrix_batch_create(size_t count, size_t n_rows, size_t n_cols) {
+  if (n_rows == 0 || n_cols == 0 || n_rows > BATCH_MAX ||
+      n_cols > BATCH_MAX) {
+    fprintf(stderr, "Error %s: %zu x %zu is outside 1..%d a side\n",
+            __func__, n_rows, n_cols, BATCH_MAX);
+    return NULL;
+  }
+  size_t stride = (count + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES;
+  size_t size = n_rows * n_cols * (stride > 0 ? stride : BATCH_LANES);
+  MatrixBatch *batch = malloc(sizeof(MatrixBatch));
+  void *data = NULL;
+  if (batch == NULL ||
+      posix_memalign(&data, MATRIX_ALIGNMENT, size * sizeof(float)) != 0) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    free(batch);
+    return NULL;
+  }
+  memset(data, 0, size * sizeof(float));
+  batch->count = count;
+  batch->n_rows = n_rows;
+  batch->n_cols = n_cols;
+  batch->stride = stride;
+  batch->data = data;
+  return batch;
+}
+
+void matrix_batch_free(MatrixBatch *batch) {
+  if (batch != NULL) {
+    free(batch->data);
+    free(batch);
+  }
+}
+
+static int check_entry(const char *func, const MatrixBatch *batch, size_t b,
+                       const Matrix *mat) {
+  if (b >= batch->count || mat->n_rows != batch->n_rows ||
+      mat->n_cols != batch->n_cols) {
+    fprintf(stderr,
+            "Error %s: entry %zu of %zu, %zu x %zu, with a %zu x %zu matrix\n",
+            func, b, batch->count, batch->n_rows, batch->n_cols, mat->n_rows,
+            mat->n_cols);
+    return 0;
+  }
+  return 1;
+}
+
+MatrixBatch *matrix_batch_set(MatrixBatch *batch, size_t b, Matrix *mat) {
+  if (!check_entry(__func__, batch, b, mat))
+    return NULL;
+  for (size_t i = 0; i < mat->n_rows; i++) {
+    for (size_t j = 0; j < mat->n_cols; j++) {
+      MATRIX_BATCH_AT(batch, b, i, j) =
+          mat->array[i * mat->row_stride + j * mat->col_stride];
+    }
+  }
+  return batch;
+}
+
+Matrix *matrix_batch_get(MatrixBatch *batch, size_t b, Matrix *dst) {
+  if (!check_entry(__func__, batch, b, dst))
+    return NULL;
+  for (size_t i = 0; i < dst->n_rows; i++) {
+    for (size_t j = 0; j < dst->n_cols; j++) {
+      dst->array[i * dst->row_stride + j * dst->col_stride] =
+          MATRIX_BATCH_AT(batch, b, i, j);
+    }
+  }
+  return dst;
+}
+
+// Products
+
+static void gemm_task(void *arg, size_t begin, size_t end) {
+  const BatchGemmArgs *g = arg;
+  for (size_t c = begin; c < end; c++) {
+    g->kernel(g, c * BATCH_LANES);
+  }
+}
+
+MatrixBatch *matrix_batch_gemm(float alpha, MatrixBatch *A, MatrixBatch *B,
+                               float beta, MatrixBatch *C) {
+  PROFILE_SCOPE(PROF_BATCH_GEMM,
+                2.0 * A->count * A->n_rows * B->n_cols * A->n_cols,
+                4.0 * A->count *
+                    (A->n_rows * A->n_cols + B->n_rows * B->n_cols +
+                     2 * C->n_rows * C->n_cols));
+  if (A->count != B->count || A->count != C->count ||
+      A->n_cols != B->n_rows || C->n_rows != A->n_rows ||
+      C->n_cols != B->n_cols) {
+    fprintf(stderr, "Error: size mismatch\n");
+    return NULL;
+  }
+  if (C == A || C == B) {
+    fprintf(stderr, "Error %s: C must not be A or B\n", __func__);
+    return NULL;
+  }
+
+  size_t m = C->n_rows, p = A->n_cols, n = C->n_cols;
+  const BatchKernels *kernels = batch_kernels();
+  BatchGemmArgs args = {alpha, A, B, beta, C,
+                        p <= BATCH_UNROLLED ? kernels->gemm[p]
+                                            : kernels->gemm_any};
+  parallel_for(C->stride / BATCH_LANES, pool_grain(BATCH_LANES * m * p * n),
+               gemm_task, &args);
+  return C;
+}
+
+MatrixBatch *matrix_batch_mult(MatrixBatch *A, MatrixBatch *B) {
+  if (A->count != B->count || A->n_cols != B->n_rows) {
+    fprintf(stderr, "Error: size mismatch\n");
+    return NULL;
+  }
+  MatrixBatch *C = matrix_batch_create(A->count, A->n_rows, B->n_cols);
+  if (C == NULL)
+    return NULL;
+  return matrix_batch_gemm(1.0f, A, B, 0.0f, C);
+}
+
+// Elimination: determinant, inverse and solve
+
+typedef struct batch_solve_args {
+  const MatrixBatch *A;
+  const MatrixBatch *B; // right-hand sides, NULL for the identity
+  MatrixBatch *X;       // NULL for the determinant alone
+  float *det;           // may be NULL
+  BatchEliminateKernel eliminate;
+} BatchSolveArgs;
+
+static void solve_task(void *arg, size_t begin, size_t end) {
+  const BatchSolveArgs *s = arg;
+  const MatrixBatch *A = s->A, *B = s->B;
+  MatrixBatch *X = s->X;
+  size_t n = A->n_rows, k = X != NULL ? X->n_cols : 0;
+  size_t lane_bytes = BATCH_LANES * sizeof(float);
+  BatchTile tile;
+  float det[BATCH_LANES];
+
+  for (size_t c = begin; c < end; c++) {
+    size_t b0 = c * BATCH_LANES;
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        memcpy(&tile.a[i][j], A->data + (i * n + j) * A->stride + b0,
+               lane_bytes);
+      }
+      for (size_t j = 0; j < k; j++) {
+        if (B != NULL) {
+          memcpy(&tile.a[i][n + j],
+                 B->data + (i * k + j) * B->stride + b0, lane_bytes);
+        } else {
+          tile.a[i][n + j] = (BatchVec){0} + (i == j ? 1.0f : 0.0f);
+        }
+      }
+    }
+
+    s->eliminate(&tile, n, n + k, X != NULL, det);
+
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < k; j++) {
+        memcpy(X->data + (i * k + j) * X->stride + b0, &tile.a[i][n + j],
+               lane_bytes);
+      }
+    }
+    if (s->det != NULL) {
+      size_t lanes = A->count - b0 < BATCH_LANES ? A->count - b0 : BATCH_LANES;
+      memcpy(s->det + b0, det, lanes * sizeof(float));
+    }
+  }
+}
+
+static void batch_eliminate(MatrixBatch *A, MatrixBatch *B, MatrixBatch *X,
+                            float *det) {
+  size_t n = A->n_rows, width = n + (X != NULL ? X->n_cols : 0);
+  const BatchKernels *kernels = batch_kernels();
+  BatchSolveArgs args = {A, B, X, det,
+                         n <= BATCH_UNROLLED ? kernels->eliminate[n]
+                                             : kernels->eliminate_any};
+  parallel_for(A->stride / BATCH_LANES,
+               pool_grain(BATCH_LANES * n * n * width), solve_task, &args);
+}
+
+float *matrix_batch_determinant(MatrixBatch *A, float *det) {
+  if (A->n_rows != A->n_cols) {
+    fprintf(stderr, "Error %s: n_rows(%zu) != n_cols(%zu)\n", __func__,
+            A->n_rows, A->n_cols);
+    return NULL;
+  }
+  batch_eliminate(A, NULL, NULL, det);
+  return det;
+}
+
+MatrixBatch *matrix_batch_inverse_into(MatrixBatch *dst, MatrixBatch *A,
+                                       float *det) {
+  if (A->n_rows != A->n_cols || dst->count != A->count ||
+      dst->n_rows != A->n_rows || dst->n_cols != A->n_cols) {
+    fprintf(stderr, "Error %s: dst is %zu x %zu x %zu, A %zu x %zu x %zu\n",
+            __func__, dst->count, dst->n_rows, dst->n_cols, A->count,
+            A->n_rows, A->n_cols);
+    return NULL;
+  }
+  batch_eliminate(A, NULL, dst, det);
+  return dst;
+}
+
+MatrixBatch *matrix_batch_inverse(MatrixBatch *A, float *det) {
+  MatrixBatch *dst = matrix_batch_create(A->count, A->n_rows, A->n_cols);
+  if (dst == NULL)
+    return NULL;
+  if (matrix_batch_inverse_into(dst, A, det) == NULL) {
+    matrix_batch_free(dst);
+    return NULL;
+  }
+  return dst;
+}
+
+MatrixBatch *matrix_batch_solve_into(MatrixBatch *x, MatrixBatch *A,
+                                     MatrixBatch *B, float *det) {
+  if (A->n_rows != A->n_cols || B->count != A->count ||
+      B->n_rows != A->n_rows || x->count != B->count ||
+      x->n_rows != B->n_rows || x->n_cols != B->n_cols) {
+    fprintf(stderr,
+            "Error %s: A is %zu x %zu x %zu, B %zu x %zu x %zu, "
+            "x %zu x %zu x %zu\n",
+            __func__, A->count, A->n_rows, A->n_cols, B->count, B->n_rows,
+            B->n_cols, x->count, x->n_rows, x->n_cols);
+    return NULL;
+  }
+  batch_eliminate(A, B, x, det);
+  return x;
+}
+
+MatrixBatch *matrix_batch_solve(MatrixBatch *A, MatrixBatch *B, float *det) {
+  MatrixBatch *x = matrix_batch_create(B->count, B->n_rows, B->n_cols);
+  if (x == NULL)
+    return NULL;
+  if (matrix_batch_solve_into(x, A, B, det) == NULL) {
+    matrix_batch_free(x);
+    return NULL;
+  }
+  return x;
+}
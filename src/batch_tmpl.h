@@ -0,0 +1,139 @@
+// Batched kernels for sizes 1..MATRIX_BATCH_MAX_DIM, included by
+// batch.c once per instruction set. The includer defines:
+//   FN(name)   the name of this instance of `name` (name##_avx2, ...)
+//   TARGET     the target attribute of every function (may be empty)
+// Each kernel handles one chunk of BATCH_LANES matrices, one per lane of
+// BatchVec, which the compiler maps onto the registers of TARGET. Up to
+// BATCH_UNROLLED the size is a constant in each instance, so the loops over
+// it unroll fully.
+// All of them are undefined again at the end.
+
+// C = alpha A B + beta C on the chunk of lanes from b0, A m x p, B p x n
+TARGET static inline __attribute__((always_inline)) void
+FN(gemm_chunk)(const BatchGemmArgs *g, size_t b0, size_t p) {
+  const MatrixBatch *A = g->A, *B = g->B;
+  MatrixBatch *C = g->C;
+  size_t m = C->n_rows, n = C->n_cols;
+  float alpha = g->alpha, beta = g->beta;
+
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      BatchVec acc = {0};
+#pragma GCC unroll 16
+      for (size_t q = 0; q < p; q++) {
+        BatchVec a, b;
+        memcpy(&a, A->data + (i * p + q) * A->stride + b0, sizeof(a));
+        memcpy(&b, B->data + (q * n + j) * B->stride + b0, sizeof(b));
+        acc += a * b;
+      }
+      float *c_ptr = C->data + (i * n + j) * C->stride + b0;
+      BatchVec c = alpha * acc;
+      if (beta != 0) {
+        BatchVec c_old;
+        memcpy(&c_old, c_ptr, sizeof(c_old));
+        c += beta * c_old;
+      }
+      memcpy(c_ptr, &c, sizeof(c));
+    }
+  }
+}
+
+// Eliminate the n x width tile, n x n system first, with partial pivoting
+// in every lane: a row with a larger candidate pivot is swapped in under a
+// lane mask, so the lanes never branch apart. Gauss-Jordan (jordan) leaves
+// A^-1 R in columns n.., forward elimination only the pivots. det receives
+// the product of the pivots times the permutation's sign, 0 once a pivot
+// is (the NaNs that follow it do not reach det).
+TARGET static inline __attribute__((always_inline)) void
+FN(eliminate)(BatchTile *t, size_t n, size_t width, int jordan, float *det) {
+  const BatchMask abs_mask = (BatchMask){0} + 0x7fffffff;
+  BatchVec sign = (BatchVec){0} + 1.0f, prod = sign;
+  BatchMask singular = {0};
+
+  for (size_t k = 0; k < n; k++) {
+    for (size_t i = k + 1; i < n; i++) {
+      BatchVec cand = (BatchVec)((BatchMask)t->a[i][k] & abs_mask);
+      BatchVec best = (BatchVec)((BatchMask)t->a[k][k] & abs_mask);
+      BatchMask swap = cand > best;
+      sign = (BatchVec)((BatchMask)sign ^ (swap & ~abs_mask));
+      for (size_t j = k; j < width; j++) {
+        BatchMask x = (BatchMask)t->a[k][j], y = (BatchMask)t->a[i][j];
+        BatchMask d = (x ^ y) & swap;
+        t->a[k][j] = (BatchVec)(x ^ d);
+        t->a[i][j] = (BatchVec)(y ^ d);
+      }
+    }
+
+    BatchVec pivot = t->a[k][k];
+    singular |= pivot == 0;
+    prod *= pivot;
+    BatchVec inv = 1.0f / pivot;
+
+    if (jordan) {
+      for (size_t j = k + 1; j < width; j++) {
+        t->a[k][j] *= inv;
+      }
+      for (size_t i = 0; i < n; i++) {
+        if (i == k)
+          continue;
+        BatchVec f = t->a[i][k];
+        for (size_t j = k + 1; j < width; j++) {
+          t->a[i][j] -= f * t->a[k][j];
+        }
+      }
+    } else {
+      for (size_t i = k + 1; i < n; i++) {
+        BatchVec f = t->a[i][k] * inv;
+        for (size_t j = k + 1; j < width; j++) {
+          t->a[i][j] -= f * t->a[k][j];
+        }
+      }
+    }
+  }
+
+  BatchVec result = (BatchVec)((BatchMask)(sign * prod) & ~singular);
+  memcpy(det, &result, sizeof(result));
+}
+
+// One instance of each kernel per size up to BATCH_UNROLLED, where the
+// unrolled loops pay off; the larger sizes share one with a runtime size
+#define BATCH_SIZE(n)                                                          \
+  TARGET static void FN(gemm_##n)(const BatchGemmArgs *g, size_t b0) {        \
+    FN(gemm_chunk)(g, b0, n);                                                  \
+  }                                                                            \
+  TARGET static void FN(eliminate_##n)(BatchTile * t, size_t size,            \
+                                       size_t width, int jordan, float *det) { \
+    FN(eliminate)(t, n, width, jordan, det);                                   \
+  }
+
+BATCH_SIZE(1)
+BATCH_SIZE(2)
+BATCH_SIZE(3)
+BATCH_SIZE(4)
+BATCH_SIZE(5)
+BATCH_SIZE(6)
+BATCH_SIZE(7)
+BATCH_SIZE(8)
+
+TARGET static void FN(gemm_any)(const BatchGemmArgs *g, size_t b0) {
+  FN(gemm_chunk)(g, b0, g->A->n_cols);
+}
+
+TARGET static void FN(eliminate_any)(BatchTile *t, size_t size, size_t width,
+                                     int jordan, float *det) {
+  FN(eliminate)(t, size, width, jordan, det);
+}
+
+static const BatchKernels FN(batch_kernels) = {
+    {NULL, FN(gemm_1), FN(gemm_2), FN(gemm_3), FN(gemm_4), FN(gemm_5),
+     FN(gemm_6), FN(gemm_7), FN(gemm_8)},
+    {NULL, FN(eliminate_1), FN(eliminate_2), FN(eliminate_3),
+     FN(eliminate_4), FN(eliminate_5), FN(eliminate_6), FN(eliminate_7),
+     FN(eliminate_8)},
+    FN(gemm_any),
+    FN(eliminate_any),
+};
+
+#undef BATCH_SIZE
+#undef FN
+#undef TARGET
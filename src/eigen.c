@@ -0,0 +1,723 @@
+// Symmetric eigensolver: blocked Householder tridiagonalization, then
+// Cuppen's divide and conquer on the tridiagonal matrix (implicit QL when
+// only values are wanted), then the reflectors applied to the wanted
+// eigenvectors in blocks.
+#include "gemm.h"
+#include "householder.h"
+#include "matrix.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Columns per panel of the tridiagonalization. The panel's columns are
+// reduced with matrix-vector products against the not yet updated
+// trailing matrix, which then gets one rank-2 * TRD_BLOCK update in GEMM.
+#define TRD_BLOCK 32
+
+// Tridiagonal problems up to this size are solved by implicit QL
+#define DC_LEAF 32
+
+// Subproblems at least this large are solved concurrently
+#define DC_PARALLEL 256
+
+// QL sweeps allowed per eigenvalue before giving up
+#define QL_MAX_ITER 30
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+// Tridiagonalization
+
+// Reduce the symmetric n x n a (both triangles, row stride lda) to
+// T = Q^T A Q, with diagonal d and subdiagonal e. Reflector j is left in
+// column j of a below the subdiagonal, with tau[j] (n - 1 of them). w
+// holds n x TRD_BLOCK floats, v and t n floats each.
+static void tridiagonalize(float *a, size_t n, size_t lda, float *d,
+                           float *e, float *tau, float *w, float *v,
+                           float *t) {
+  size_t nb = TRD_BLOCK;
+  for (size_t i0 = 0; i0 < n; i0 += nb) {
+    size_t i1 = min_size(i0 + nb, n);
+
+    for (size_t i = i0; i < i1; i++) {
+      size_t c = i - i0, r = n - i - 1;
+      float *col = &a[i * lda + i];
+
+      // Bring column i up to date with the panel's earlier reflectors:
+      // A(i:, i) -= V W(i, :)^T + W V(i, :)^T
+      gemm_strided(n - i, 1, c, -1.0f, &a[i * lda + i0], lda, 1,
+                   &w[i * nb], 1, 1, 1.0f, col, lda, 1);
+      gemm_strided(n - i, 1, c, -1.0f, &w[i * nb], nb, 1, &a[i * lda + i0],
+                   1, 1, 1.0f, col, lda, 1);
+      d[i] = col[0];
+      if (r == 0) {
+        break;
+      }
+
+      tau[i] = householder_make(r - 1, &col[lda], &col[2 * lda], lda);
+      e[i] = col[lda];
+      col[lda] = 1.0f;
+      for (size_t q = 0; q < r; q++) {
+        v[q] = col[(q + 1) * lda];
+      }
+
+      // w = tau (A - V W^T - W V^T) v over the trailing rows, then
+      // w -= tau / 2 (w . v) v, so that the update is A -= v w^T + w v^T
+      float *wc = &w[(i + 1) * nb + c];
+      const float *a_below = &a[(i + 1) * lda + i0];
+      const float *w_below = &w[(i + 1) * nb];
+      gemm_strided(r, 1, r, 1.0f, &a[(i + 1) * lda + i + 1], lda, 1, v, 1,
+                   1, 0.0f, wc, nb, 1);
+      gemm_strided(c, 1, r, 1.0f, w_below, 1, nb, v, 1, 1, 0.0f, t, 1, 1);
+      gemm_strided(r, 1, c, -1.0f, a_below, lda, 1, t, 1, 1, 1.0f, wc, nb,
+                   1);
+      gemm_strided(c, 1, r, 1.0f, a_below, 1, lda, v, 1, 1, 0.0f, t, 1, 1);
+      gemm_strided(r, 1, c, -1.0f, w_below, nb, 1, t, 1, 1, 1.0f, wc, nb,
+                   1);
+      double dot = 0.0;
+      for (size_t q = 0; q < r; q++) {
+        wc[q * nb] *= tau[i];
+        dot += (double)wc[q * nb] * v[q];
+      }
+      float alpha = (float)(-0.5 * tau[i] * dot);
+      for (size_t q = 0; q < r; q++) {
+        wc[q * nb] += alpha * v[q];
+      }
+    }
+
+    // Trailing matrix, both triangles: A -= V W^T + W V^T
+    if (i1 < n) {
+      size_t r = n - i1;
+      float *trail = &a[i1 * lda + i1];
+      gemm_strided(r, r, i1 - i0, -1.0f, &a[i1 * lda + i0], lda, 1,
+                   &w[i1 * nb], 1, nb, 1.0f, trail, lda, 1);
+      gemm_strided(r, r, i1 - i0, -1.0f, &w[i1 * nb], nb, 1,
+                   &a[i1 * lda + i0], 1, lda, 1.0f, trail, lda, 1);
+    }
+  }
+}
+
+// Tridiagonal eigenproblems
+
+// Implicit QL with Wilkinson shifts on the symmetric tridiagonal (d, e),
+// e[i] coupling i and i + 1 and e[n - 1] unused. d gets the eigenvalues,
+// unsorted. With z (n x n, row-major), its columns are rotated along, so
+// starting from I they become the eigenvectors. -1 if it fails to
+// converge.
+static int tridiag_ql(size_t n, double *d, double *e, double *z) {
+  if (n == 0)
+    return 0;
+  e[n - 1] = 0.0;
+  for (size_t l = 0; l < n; l++) {
+    size_t iter = 0, m;
+    do {
+      for (m = l; m + 1 < n; m++) {
+        double dd = fabs(d[m]) + fabs(d[m + 1]);
+        if (fabs(e[m]) <= DBL_EPSILON * dd)
+          break;
+      }
+      if (m == l)
+        break;
+      if (iter++ == QL_MAX_ITER)
+        return -1;
+
+      double g = (d[l + 1] - d[l]) / (2.0 * e[l]);
+      double r = hypot(g, 1.0);
+      g = d[m] - d[l] + e[l] / (g + copysign(r, g));
+      double s = 1.0, c = 1.0, p = 0.0;
+      int underflow = 0;
+      for (size_t i = m; i-- > l;) {
+        double f = s * e[i], b = c * e[i];
+        r = hypot(f, g);
+        e[i + 1] = r;
+        if (r == 0.0) {
+          d[i + 1] -= p;
+          e[m] = 0.0;
+          underflow = 1;
+          break;
+        }
+        s = f / r;
+        c = g / r;
+        g = d[i + 1] - p;
+        r = (d[i] - g) * s + 2.0 * c * b;
+        p = s * r;
+        d[i + 1] = g + p;
+        g = c * r - b;
+        if (z != NULL) {
+          for (size_t k = 0; k < n; k++) {
+            double *zk = &z[k * n];
+            f = zk[i + 1];
+            zk[i + 1] = s * zk[i] + c * f;
+            zk[i] = c * zk[i] - s * f;
+          }
+        }
+      }
+      if (underflow)
+        continue;
+      d[l] -= p;
+      e[l] = g;
+      e[m] = 0.0;
+    } while (1);
+  }
+  return 0;
+}
+
+// The root of the secular equation 1/rho + sum_i z_i^2 / (d_i - x) = 0 in
+// (d_j, d_j+1), or above d_{k-1} for j = k - 1; d ascending and distinct,
+// rho > 0. Returned as d[*origin] + mu with origin the nearer pole, so
+// that d_i - x = (d_i - d[origin]) - mu keeps its relative accuracy.
+static double secular_root(size_t k, const double *d, const double *z,
+                           double rho, size_t j, size_t *origin) {
+  size_t o = j;
+  double lo = 0.0, hi;
+  if (j + 1 < k) {
+    double mid = 0.5 * (d[j + 1] - d[j]), f = 1.0 / rho;
+    for (size_t i = 0; i < k; i++) {
+      f += z[i] * z[i] / ((d[i] - d[j]) - mid);
+    }
+    hi = mid;
+    if (f < 0.0) {
+      o = j + 1;
+      lo = -mid;
+      hi = 0.0;
+    }
+  } else {
+    hi = 0.0;
+    for (size_t i = 0; i < k; i++) {
+      hi += z[i] * z[i];
+    }
+    hi *= rho;
+  }
+
+  // Safeguarded rational steps: psi (poles at and left of j) and phi
+  // (right of j) are each modeled by one pole plus a constant, matching
+  // their values and slopes (Li's "middle way")
+  double x = 0.5 * (lo + hi);
+  for (size_t iter = 0; iter < 100; iter++) {
+    double psi = 0.0, dpsi = 0.0, phi = 0.0, dphi = 0.0;
+    for (size_t i = 0; i < k; i++) {
+      double t = z[i] / ((d[i] - d[o]) - x);
+      if (i <= j) {
+        psi += z[i] * t;
+        dpsi += t * t;
+      } else {
+        phi += z[i] * t;
+        dphi += t * t;
+      }
+    }
+    double w = 1.0 / rho + psi + phi;
+    double scale = 1.0 / rho + fabs(psi) + fabs(phi);
+    if (fabs(w) <= 8.0 * DBL_EPSILON * k * scale)
+      break;
+    if (w < 0.0)
+      lo = x;
+    else
+      hi = x;
+
+    double dj = (d[j] - d[o]) - x, eta;
+    if (j + 1 < k) {
+      double dj1 = (d[j + 1] - d[o]) - x;
+      double c = w - dj * dpsi - dj1 * dphi;
+      double a = (dj + dj1) * w - dj * dj1 * (dpsi + dphi);
+      double b = dj * dj1 * w;
+      double disc = sqrt(fabs(a * a - 4.0 * b * c));
+      if (c == 0.0)
+        eta = b / a;
+      else if (a <= 0.0)
+        eta = (a - disc) / (2.0 * c);
+      else
+        eta = 2.0 * b / (a + disc);
+    } else {
+      // One pole: w ~ c + dj^2 dpsi / (dj - eta)
+      double c = w - dj * dpsi;
+      eta = c != 0.0 ? dj + dj * dj * dpsi / c : hi - x;
+    }
+    double next = x + eta;
+    if (!(next > lo && next < hi))
+      next = 0.5 * (lo + hi);
+    if (next == x)
+      break;
+    x = next;
+  }
+  *origin = o;
+  return x;
+}
+
+// Scratch of one merge of size n
+typedef struct dc_work {
+  double *z;
+  double *dlam; // the kept d, ascending
+  double *w;    // their z
+  double *mu;   // roots, as offsets from dlam[origin]
+  double *zhat;
+  size_t *origin;
+  size_t *perm;
+  size_t *defl;  // deflated indices, ascending by d
+  size_t *keep;  // kept indices, ascending by d
+  size_t *group; // kept indices grouped by type
+  size_t *row;   // row of U for each kept index
+  size_t *pos;   // output column of each root, then of each deflated d
+  int *type; // 1: rows of the top half only, 2: bottom only, 3: both
+  float *Qk; // the kept columns of Q, by group
+  float *U;  // wanted eigenvectors of the rank-one problem
+  float *R;  // Qk U
+} DCWork;
+
+static void *dc_work_alloc(DCWork *ws, size_t n) {
+  size_t doubles = 5 * n, sizes = 8 * n, floats = 3 * n * n;
+  char *block = malloc(doubles * sizeof(double) + sizes * sizeof(size_t) +
+                       n * sizeof(int) + floats * sizeof(float));
+  if (block == NULL)
+    return NULL;
+  ws->z = (double *)block;
+  ws->dlam = ws->z + n;
+  ws->w = ws->dlam + n;
+  ws->mu = ws->w + n;
+  ws->zhat = ws->mu + n;
+  ws->origin = (size_t *)(ws->zhat + n);
+  ws->perm = ws->origin + n;
+  ws->defl = ws->perm + n;
+  ws->keep = ws->defl + n;
+  ws->group = ws->keep + n;
+  ws->row = ws->group + n;
+  ws->pos = ws->row + n; // 2n: roots then deflated
+  ws->type = (int *)(ws->pos + 2 * n);
+  ws->Qk = (float *)(ws->type + n);
+  ws->U = ws->Qk + n * n;
+  ws->R = ws->U + n * n;
+  return block;
+}
+
+typedef struct secular_args {
+  DCWork *ws;
+  size_t k;
+  double rho;
+} SecularArgs;
+
+static void secular_task(void *arg, size_t begin, size_t end) {
+  SecularArgs *s = arg;
+  DCWork *ws = s->ws;
+  for (size_t j = begin; j < end; j++) {
+    ws->mu[j] =
+        secular_root(s->k, ws->dlam, ws->w, s->rho, j, &ws->origin[j]);
+  }
+}
+
+// d_i - lambda_j, accurately
+static double secular_gap(const DCWork *ws, size_t i, size_t j) {
+  return (ws->dlam[i] - ws->dlam[ws->origin[j]]) - ws->mu[j];
+}
+
+typedef struct vector_args {
+  DCWork *ws;
+  size_t k;
+  size_t j0; // first wanted root
+} VectorArgs;
+
+// z^_i, from the computed roots (Gu and Eisenstat), so that the vectors
+// come out orthogonal however close the roots are
+static void zhat_task(void *arg, size_t begin, size_t end) {
+  VectorArgs *v = arg;
+  DCWork *ws = v->ws;
+  for (size_t i = begin; i < end; i++) {
+    double p = -secular_gap(ws, i, i);
+    for (size_t j = 0; j < v->k; j++) {
+      if (j != i)
+        p *= -secular_gap(ws, i, j) / (ws->dlam[j] - ws->dlam[i]);
+    }
+    ws->zhat[i] = copysign(sqrt(fabs(p)), ws->w[i]);
+  }
+}
+
+// Column j - j0 of U: z^_i / (d_i - lambda_j), normalized, in the rows of
+// the grouped order
+static void vector_task(void *arg, size_t begin, size_t end) {
+  VectorArgs *v = arg;
+  DCWork *ws = v->ws;
+  size_t k = v->k, n_cols = k - v->j0;
+  for (size_t c = begin; c < end; c++) {
+    size_t j = v->j0 + c;
+    double norm = 0.0;
+    for (size_t i = 0; i < k; i++) {
+      double u = ws->zhat[i] / secular_gap(ws, i, j);
+      ws->U[ws->row[i] * n_cols + c] = (float)u;
+      norm += u * u;
+    }
+    float scale = (float)(1.0 / sqrt(norm));
+    for (size_t i = 0; i < k; i++) {
+      ws->U[ws->row[i] * n_cols + c] *= scale;
+    }
+  }
+}
+
+// Eigenpairs of diag(d) + rho u u^T in the basis Q = diag(Q1, Q2), the
+// halves of size n1 and n - n1 being solved (d ascending in each) and
+// u = (last row of Q1, sign * first row of Q2). On return d is ascending
+// and columns [want_from, n) of Q hold the matching eigenvectors.
+static int dc_merge(size_t n, size_t n1, double *d, double rho, double sign,
+                    float *Q, size_t ldq, size_t want_from) {
+  DCWork ws;
+  void *block = dc_work_alloc(&ws, n);
+  if (block == NULL)
+    return -1;
+
+  // u in the eigenbasis of the halves, normalized into rho
+  double zz = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    ws.z[i] = i < n1 ? Q[(n1 - 1) * ldq + i] : sign * Q[n1 * ldq + i];
+    zz += ws.z[i] * ws.z[i];
+    ws.type[i] = i < n1 ? 1 : 2;
+  }
+  rho *= zz;
+  double zs = 1.0 / sqrt(zz), zmax = 0.0, dmax = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    ws.z[i] *= zs;
+    zmax = fmax(zmax, fabs(ws.z[i]));
+    dmax = fmax(dmax, fabs(d[i]));
+  }
+
+  // The halves merged into ascending order
+  for (size_t i = 0, a = 0, b = n1; i < n; i++) {
+    ws.perm[i] = b == n || (a < n1 && d[a] <= d[b]) ? a++ : b++;
+  }
+
+  // Deflation, at float accuracy since Q is float: a negligible z_i
+  // leaves (d_i, q_i) an eigenpair, and a rotation zeroes one z of two
+  // close d
+  double tol = 8.0 * FLT_EPSILON * fmax(dmax, zmax);
+  size_t n_defl = 0, k = 0, prev = n;
+  for (size_t p = 0; p < n; p++) {
+    size_t j = ws.perm[p];
+    if (rho * fabs(ws.z[j]) <= tol) {
+      ws.defl[n_defl++] = j;
+      continue;
+    }
+    if (prev == n) {
+      prev = j;
+      continue;
+    }
+    double s = ws.z[prev], c = ws.z[j], tau = hypot(c, s);
+    c /= tau;
+    s = -s / tau;
+    if (fabs((d[j] - d[prev]) * c * s) <= tol) {
+      ws.z[j] = tau;
+      ws.z[prev] = 0.0;
+      for (size_t r = 0; r < n; r++) {
+        float *qr = &Q[r * ldq];
+        float x = qr[prev], y = qr[j];
+        qr[prev] = (float)(c * x + s * y);
+        qr[j] = (float)(c * y - s * x);
+      }
+      if (ws.type[prev] != ws.type[j])
+        ws.type[prev] = ws.type[j] = 3;
+      double t = d[prev] * c * c + d[j] * s * s;
+      d[j] = d[prev] * s * s + d[j] * c * c;
+      d[prev] = t;
+      ws.defl[n_defl++] = prev;
+    } else {
+      ws.keep[k++] = prev;
+    }
+    prev = j;
+  }
+  if (prev != n)
+    ws.keep[k++] = prev;
+
+  // Rotations can leave the deflated d out of order
+  for (size_t i = 1; i < n_defl; i++) {
+    size_t j = ws.defl[i], q = i;
+    for (; q > 0 && d[ws.defl[q - 1]] > d[j]; q--) {
+      ws.defl[q] = ws.defl[q - 1];
+    }
+    ws.defl[q] = j;
+  }
+
+  // The secular equation, its roots in parallel
+  for (size_t i = 0; i < k; i++) {
+    ws.dlam[i] = d[ws.keep[i]];
+    ws.w[i] = ws.z[ws.keep[i]];
+  }
+  SecularArgs sec = {&ws, k, rho};
+  parallel_for(k, 8, secular_task, &sec);
+
+  // Output order: roots and deflated values merged ascending. The roots
+  // are ascending, so the wanted ones are a tail [first_root, k).
+  size_t first_root = k;
+  for (size_t p = 0, a = 0, b = 0; p < n; p++) {
+    double root = a < k ? ws.dlam[ws.origin[a]] + ws.mu[a] : 0.0;
+    if (b == n_defl || (a < k && root <= d[ws.defl[b]])) {
+      if (p >= want_from && first_root == k)
+        first_root = a;
+      ws.pos[a++] = p;
+    } else {
+      ws.pos[n + b++] = p;
+    }
+  }
+  size_t n_roots = k - first_root;
+
+  if (n_roots > 0) {
+    VectorArgs vec = {&ws, k, first_root};
+    parallel_for(k, 8, zhat_task, &vec);
+
+    // Kept columns of Q grouped top-only, both, bottom-only, so that the
+    // product skips the zero blocks of diag(Q1, Q2)
+    size_t n_type[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < k; i++) {
+      n_type[ws.type[ws.keep[i]]]++;
+    }
+    size_t next[4] = {0, 0, n_type[1] + n_type[3], n_type[1]};
+    for (size_t i = 0; i < k; i++) {
+      ws.row[i] = next[ws.type[ws.keep[i]]]++;
+      ws.group[ws.row[i]] = ws.keep[i];
+    }
+    for (size_t r = 0; r < n; r++) {
+      for (size_t g = 0; g < k; g++) {
+        ws.Qk[r * k + g] = Q[r * ldq + ws.group[g]];
+      }
+    }
+    parallel_for(n_roots, 4, vector_task, &vec);
+
+    // R = Qk U: top rows from groups 1 and 3, bottom rows from 3 and 2
+    size_t top = n_type[1] + n_type[3], bottom = n_type[3] + n_type[2];
+    gemm_strided(n1, n_roots, top, 1.0f, ws.Qk, k, 1, ws.U, n_roots, 1,
+                 0.0f, ws.R, n_roots, 1);
+    gemm_strided(n - n1, n_roots, bottom, 1.0f, &ws.Qk[n1 * k + n_type[1]],
+                 k, 1, &ws.U[n_type[1] * n_roots], n_roots, 1, 0.0f,
+                 &ws.R[n1 * n_roots], n_roots, 1);
+  }
+
+  // The wanted deflated columns are saved (into Qk, free by now) before
+  // Q is overwritten
+  size_t n_saved = 0;
+  for (size_t b = 0; b < n_defl; b++) {
+    n_saved += ws.pos[n + b] >= want_from;
+  }
+  for (size_t r = 0, s = 0; r < n; r++, s = 0) {
+    for (size_t b = 0; b < n_defl; b++) {
+      if (ws.pos[n + b] >= want_from)
+        ws.Qk[r * n_saved + s++] = Q[r * ldq + ws.defl[b]];
+    }
+  }
+  for (size_t r = 0; r < n; r++) {
+    float *qr = &Q[r * ldq];
+    for (size_t a = first_root; a < k; a++) {
+      qr[ws.pos[a]] = ws.R[r * n_roots + (a - first_root)];
+    }
+    for (size_t b = 0, s = 0; b < n_defl; b++) {
+      if (ws.pos[n + b] >= want_from)
+        qr[ws.pos[n + b]] = ws.Qk[r * n_saved + s++];
+    }
+  }
+
+  // Values last: the roots are relative to the old d
+  double *out = ws.zhat;
+  for (size_t a = 0; a < k; a++) {
+    out[ws.pos[a]] = ws.dlam[ws.origin[a]] + ws.mu[a];
+  }
+  for (size_t b = 0; b < n_defl; b++) {
+    out[ws.pos[n + b]] = d[ws.defl[b]];
+  }
+  memcpy(d, out, n * sizeof(double));
+
+  free(block);
+  return 0;
+}
+
+// Cuppen's divide and conquer on (d, e) of size n: d gets the eigenvalues
+// ascending and columns [want_from, n) of Q (n x n, row stride ldq) their
+// eigenvectors. The halves are independent and run concurrently when
+// large; only the top-level merge skips unwanted columns.
+typedef struct dc_args {
+  size_t n;
+  double *d;
+  double *e;
+  float *Q;
+  size_t ldq;
+  size_t want_from;
+  int status;
+} DCArgs;
+
+static int tridiag_dc(size_t n, double *d, double *e, float *Q, size_t ldq,
+                      size_t want_from);
+
+static void dc_task(void *arg, size_t begin, size_t end) {
+  DCArgs *halves = arg;
+  for (size_t h = begin; h < end; h++) {
+    DCArgs *a = &halves[h];
+    a->status = tridiag_dc(a->n, a->d, a->e, a->Q, a->ldq, a->want_from);
+  }
+}
+
+static int tridiag_dc(size_t n, double *d, double *e, float *Q, size_t ldq,
+                      size_t want_from) {
+  if (n <= DC_LEAF) {
+    double *z = calloc(n * n + n, sizeof(double));
+    if (z == NULL)
+      return -1;
+    double *sub = z + n * n;
+    memcpy(sub, e, n * sizeof(double));
+    for (size_t i = 0; i < n; i++) {
+      z[i * n + i] = 1.0;
+    }
+    if (tridiag_ql(n, d, sub, z) != 0) {
+      free(z);
+      return -1;
+    }
+    // Selection sort, ascending, columns along
+    for (size_t i = 0; i < n; i++) {
+      size_t min = i;
+      for (size_t j = i + 1; j < n; j++) {
+        if (d[j] < d[min])
+          min = j;
+      }
+      double t = d[i];
+      d[i] = d[min];
+      d[min] = t;
+      for (size_t r = 0; r < n; r++) {
+        t = z[r * n + i];
+        z[r * n + i] = z[r * n + min];
+        z[r * n + min] = t;
+      }
+    }
+    for (size_t r = 0; r < n; r++) {
+      for (size_t c = 0; c < n; c++) {
+        Q[r * ldq + c] = (float)z[r * n + c];
+      }
+    }
+    free(z);
+    return 0;
+  }
+
+  // T = diag(T1, T2) + |b| u u^T with u = e_{n1-1} + sign(b) e_n1
+  size_t n1 = n / 2;
+  double b = e[n1 - 1], rho = fabs(b);
+  d[n1 - 1] -= rho;
+  d[n1] -= rho;
+  DCArgs halves[2] = {{n1, d, e, Q, ldq, 0, 0},
+                      {n - n1, d + n1, e + n1, &Q[n1 * ldq + n1], ldq, 0, 0}};
+  parallel_for(2, n >= DC_PARALLEL ? 1 : 2, dc_task, halves);
+  if (halves[0].status != 0 || halves[1].status != 0)
+    return -1;
+  for (size_t r = 0; r < n; r++) {
+    size_t c0 = r < n1 ? n1 : 0, c1 = r < n1 ? n : n1;
+    memset(&Q[r * ldq + c0], 0, (c1 - c0) * sizeof(float));
+  }
+  return dc_merge(n, n1, d, rho, b < 0.0 ? -1.0 : 1.0, Q, ldq, want_from);
+}
+
+// Public API
+
+static int descending(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x < y) - (x > y);
+}
+
+EigenSym *eigen_sym(Matrix *A, size_t k, int want_vectors) {
+  PROFILE_SCOPE(PROF_EIGEN_SYM,
+                (want_vectors ? 10.0 / 3.0 : 4.0 / 3.0) * A->n_rows *
+                    A->n_rows * A->n_rows,
+                4.0 * A->n_rows * A->n_cols);
+  if (A->n_rows != A->n_cols) {
+    fprintf(stderr, "Error %s: n_rows(%zu) != n_cols(%zu)\n", __func__,
+            A->n_rows, A->n_cols);
+    return NULL;
+  }
+  size_t n = A->n_rows;
+  if (k == 0)
+    k = n;
+  if (k > n) {
+    fprintf(stderr, "Error %s: k(%zu) > n(%zu)\n", __func__, k, n);
+    return NULL;
+  }
+
+  EigenSym *eig = calloc(1, sizeof(EigenSym));
+  Matrix *a = matrix_create(n, n);
+  size_t nb = TRD_BLOCK, floats = n * nb + 5 * n;
+  float *work = malloc((floats > 0 ? floats : 1) * sizeof(float));
+  double *dd = malloc((2 * n + 1) * sizeof(double));
+  float *Q = NULL;
+  if (eig == NULL || a == NULL || work == NULL || dd == NULL)
+    goto oom;
+  eig->values = matrix_create(k, 1);
+  if (want_vectors)
+    eig->vectors = matrix_create(n, k);
+  if (eig->values == NULL || (want_vectors && eig->vectors == NULL))
+    goto oom;
+
+  // The lower triangle defines A
+  matrix_pack(a->array, A);
+  float *s = a->array;
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = i + 1; j < n; j++) {
+      s[i * n + j] = s[j * n + i];
+    }
+  }
+  float *w = work, *d = w + n * nb, *e = d + n, *tau = e + n, *v = tau + n;
+  tridiagonalize(s, n, n, d, e, tau, w, v, v + n);
+  double *de = dd + n;
+  for (size_t i = 0; i < n; i++) {
+    dd[i] = d[i];
+    de[i] = i + 1 < n ? e[i] : 0.0;
+  }
+
+  if (!want_vectors) {
+    if (tridiag_ql(n, dd, de, NULL) != 0)
+      goto diverged;
+    qsort(dd, n, sizeof(double), descending);
+    for (size_t i = 0; i < k; i++) {
+      eig->values->array[i] = (float)dd[i];
+    }
+    goto done;
+  }
+
+  Q = malloc((n > 0 ? n * n : 1) * sizeof(float));
+  if (Q == NULL)
+    goto oom;
+  if (tridiag_dc(n, dd, de, Q, n, n - k) != 0)
+    goto diverged;
+
+  // Largest first, then back to the basis of A: rows 1.. of the vectors
+  // get the n - 1 reflectors, whose unit entries sit on the subdiagonal
+  float *vec = eig->vectors->array;
+  for (size_t c = 0; c < k; c++) {
+    eig->values->array[c] = (float)dd[n - 1 - c];
+    for (size_t r = 0; r < n; r++) {
+      vec[r * k + c] = Q[r * n + (n - 1 - c)];
+    }
+  }
+  if (n > 1 && householder_apply(n - 1, n - 1, &s[n], n, 1, tau, &vec[k],
+                                 k, k) != 0)
+    goto oom;
+
+done:
+  matrix_free(a);
+  free(work);
+  free(dd);
+  free(Q);
+  return eig;
+
+diverged:
+  fprintf(stderr, "Error %s: the tridiagonal iteration did not converge\n",
+          __func__);
+  goto fail;
+oom:
+  fprintf(stderr, "Error: memory allocation failed\n");
+fail:
+  matrix_free(a);
+  free(work);
+  free(dd);
+  free(Q);
+  eigen_sym_free(eig);
+  return NULL;
+}
+
+void eigen_sym_free(EigenSym *eig) {
+  if (eig != NULL) {
+    matrix_free(eig->values);
+    matrix_free(eig->vectors);
+    free(eig);
+  }
+}
@@ -0,0 +1,436 @@
+#include "alloc.h"
+#include "matrix.h"
+#include "profile.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The fused element-wise pass goes over the result in chunks of this many
+// floats, small enough that the accumulator stays in L1 while every term
+// is added to it
+#define EXPR_CHUNK 1024
+
+// Chunks per task, as many floats as ELEMENTWISE_GRAIN in matrix.c
+#define EXPR_GRAIN 64
+
+typedef enum {
+  EXPR_LEAF,
+  EXPR_ADD,
+  EXPR_SCALE,
+  EXPR_MULT,
+  EXPR_TRANS
+} ExprKind;
+
+struct matrix_expr {
+  ExprKind kind;
+  size_t n_rows;
+  size_t n_cols;
+  size_t n_nodes; // in this subtree, a bound on its number of terms
+  float scalar;   // EXPR_SCALE factor, EXPR_ADD sign of b
+  Matrix *mat;    // EXPR_LEAF
+  MatrixExpr *a;
+  MatrixExpr *b;
+};
+
+// Construction
+
+static MatrixExpr *expr_node(ExprKind kind, size_t n_rows, size_t n_cols,
+                             float scalar, MatrixExpr *a, MatrixExpr *b) {
+  MatrixExpr *e = malloc(sizeof(MatrixExpr));
+  if (e == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    expr_free(a);
+    expr_free(b);
+    return NULL;
+  }
+  size_t n_nodes = 1 + (a != NULL ? a->n_nodes : 0) +
+                   (b != NULL ? b->n_nodes : 0);
+  *e = (MatrixExpr){kind, n_rows, n_cols, n_nodes, scalar, NULL, a, b};
+  return e;
+}
+
+MatrixExpr *expr_matrix(Matrix *mat) {
+  if (mat == NULL)
+    return NULL;
+  MatrixExpr *e = expr_node(EXPR_LEAF, mat->n_rows, mat->n_cols, 1, NULL,
+                            NULL);
+  if (e != NULL)
+    e->mat = mat;
+  return e;
+}
+
+static MatrixExpr *expr_sum(const char *caller, MatrixExpr *a, MatrixExpr *b,
+                            float sign) {
+  if (a == NULL || b == NULL) {
+    expr_free(a);
+    expr_free(b);
+    return NULL;
+  }
+  if (a->n_rows != b->n_rows || a->n_cols != b->n_cols) {
+    fprintf(stderr, "Error %s: size mismatch (%zu x %zu) and (%zu x %zu)\n",
+            caller, a->n_rows, a->n_cols, b->n_rows, b->n_cols);
+    expr_free(a);
+    expr_free(b);
+    return NULL;
+  }
+  return expr_node(EXPR_ADD, a->n_rows, a->n_cols, sign, a, b);
+}
+
+MatrixExpr *expr_add(MatrixExpr *a, MatrixExpr *b) {
+  return expr_sum(__func__, a, b, 1.0f);
+}
+
+MatrixExpr *expr_subtract(MatrixExpr *a, MatrixExpr *b) {
+  return expr_sum(__func__, a, b, -1.0f);
+}
+
+MatrixExpr *expr_scale(float scalar, MatrixExpr *a) {
+  if (a == NULL)
+    return NULL;
+  return expr_node(EXPR_SCALE, a->n_rows, a->n_cols, scalar, a, NULL);
+}
+
+MatrixExpr *expr_mult(MatrixExpr *a, MatrixExpr *b) {
+  if (a == NULL || b == NULL) {
+    expr_free(a);
+    expr_free(b);
+    return NULL;
+  }
+  if (a->n_cols != b->n_rows) {
+    fprintf(stderr, "Error %s: size mismatch (%zu x %zu) * (%zu x %zu)\n",
+            __func__, a->n_rows, a->n_cols, b->n_rows, b->n_cols);
+    expr_free(a);
+    expr_free(b);
+    return NULL;
+  }
+  return expr_node(EXPR_MULT, a->n_rows, b->n_cols, 1, a, b);
+}
+
+MatrixExpr *expr_trans(MatrixExpr *a) {
+  if (a == NULL)
+    return NULL;
+  return expr_node(EXPR_TRANS, a->n_cols, a->n_rows, 1, a, NULL);
+}
+
+void expr_free(MatrixExpr *e) {
+  if (e != NULL) {
+    expr_free(e->a);
+    expr_free(e->b);
+    free(e);
+  }
+}
+
+// Evaluation
+//
+// The tree is flattened into a sum of terms coef * op(x), x a leaf or a
+// product and op a transpose or not: scaling multiplies coef, subtraction
+// negates it and a transpose flips op all the way down. The leaf terms are
+// then combined in one pass over the result, and each product added to it
+// by matrix_gemm with beta = 1.
+
+typedef struct expr_term {
+  float coef;
+  int trans;
+  const MatrixExpr *e;
+  // Resolved: the leaf in a, or the product's operands, of which those
+  // that had to be evaluated are in tmp
+  Matrix a;
+  Matrix b;
+  Matrix *tmp[2];
+} ExprTerm;
+
+static void flatten(const MatrixExpr *e, float coef, int trans,
+                    ExprTerm *terms, size_t *n_terms) {
+  switch (e->kind) {
+  case EXPR_ADD:
+    flatten(e->a, coef, trans, terms, n_terms);
+    flatten(e->b, coef * e->scalar, trans, terms, n_terms);
+    break;
+  case EXPR_SCALE:
+    flatten(e->a, coef * e->scalar, trans, terms, n_terms);
+    break;
+  case EXPR_TRANS:
+    flatten(e->a, coef, !trans, terms, n_terms);
+    break;
+  case EXPR_LEAF:
+  case EXPR_MULT:
+    terms[*n_terms] = (ExprTerm){coef, trans, e};
+    ++*n_terms;
+    break;
+  }
+}
+
+static Matrix leaf_view(Matrix *mat, int trans) {
+  return trans ? matrix_trans_view(mat)
+               : matrix_view(mat, 0, 0, mat->n_rows, mat->n_cols);
+}
+
+// Same elements in the same places
+static int same_block(const Matrix *a, const Matrix *b) {
+  return a->array == b->array && a->n_rows == b->n_rows &&
+         a->n_cols == b->n_cols && a->row_stride == b->row_stride &&
+         a->col_stride == b->col_stride;
+}
+
+static Matrix *evaluate(MatrixArena *scratch, Matrix *dst, const MatrixExpr *e,
+                        int trans);
+
+// op(e) as a GEMM operand: a view when e is a leaf up to scaling and
+// transposition, its scale folded into *coef; otherwise e is evaluated
+// into *tmp. 0 on failure.
+static int operand(MatrixArena *scratch, const MatrixExpr *e, int trans,
+                   Matrix *out, Matrix **tmp, float *coef) {
+  const MatrixExpr *x = e;
+  float scale = 1.0f;
+  int t = trans;
+  while (x->kind == EXPR_SCALE || x->kind == EXPR_TRANS) {
+    if (x->kind == EXPR_SCALE)
+      scale *= x->scalar;
+    else
+      t = !t;
+    x = x->a;
+  }
+  if (x->kind == EXPR_LEAF) {
+    *out = leaf_view(x->mat, t);
+    *coef *= scale;
+    return 1;
+  }
+
+  size_t n_rows = trans ? e->n_cols : e->n_rows;
+  size_t n_cols = trans ? e->n_rows : e->n_cols;
+  *tmp = scratch_matrix(scratch, n_rows, n_cols);
+  if (*tmp == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return 0;
+  }
+  if (evaluate(scratch, *tmp, e, trans) == NULL)
+    return 0;
+  *out = matrix_view(*tmp, 0, 0, n_rows, n_cols);
+  return 1;
+}
+
+typedef struct expr_pass_args {
+  Matrix *dst;
+  const ExprTerm *terms;
+  size_t n_terms;
+  size_t row_chunks;
+} ExprPassArgs;
+
+// The n elements of row i of mat from column j0: in place when they are
+// contiguous, else gathered into buf
+static const float *row_span(const Matrix *mat, size_t i, size_t j0, size_t n,
+                             float *buf) {
+  const float *src = mat->array + i * mat->row_stride + j0 * mat->col_stride;
+  if (mat->col_stride == 1)
+    return src;
+  for (size_t j = 0; j < n; j++) {
+    buf[j] = src[j * mat->col_stride];
+  }
+  return buf;
+}
+
+static void expr_pass_task(void *arg, size_t begin, size_t end) {
+  const ExprPassArgs *p = arg;
+  const SimdKernels *simd = simd_kernels();
+  Matrix *dst = p->dst;
+  float acc[EXPR_CHUNK], buf[EXPR_CHUNK];
+
+  for (size_t c = begin; c < end; c++) {
+    size_t i = c / p->row_chunks, j0 = c % p->row_chunks * EXPR_CHUNK;
+    size_t n = dst->n_cols - j0 < EXPR_CHUNK ? dst->n_cols - j0 : EXPR_CHUNK;
+
+    // Every term is read before the chunk is written, so a leaf may be dst
+    int first = 1;
+    for (size_t k = 0; k < p->n_terms; k++) {
+      const ExprTerm *t = &p->terms[k];
+      if (t->e->kind != EXPR_LEAF)
+        continue;
+      const float *src = row_span(&t->a, i, j0, n, buf);
+      if (first)
+        simd->scale(n, t->coef, src, acc);
+      else
+        simd->axpy(n, t->coef, src, acc);
+      first = 0;
+    }
+
+    float *out = dst->array + i * dst->row_stride + j0 * dst->col_stride;
+    if (dst->col_stride == 1) {
+      memcpy(out, acc, n * sizeof(float));
+    } else {
+      for (size_t j = 0; j < n; j++) {
+        out[j * dst->col_stride] = acc[j];
+      }
+    }
+  }
+}
+
+// dst = the sum of the leaf terms, in one pass. When dst and the leaves
+// are all dense they are walked as a single row, so short rows still fill
+// whole chunks.
+static void fused_pass(Matrix *dst, ExprTerm *terms, size_t n_terms) {
+  int dense = matrix_is_dense(dst);
+  for (size_t k = 0; k < n_terms; k++) {
+    if (terms[k].e->kind == EXPR_LEAF)
+      dense = dense && matrix_is_dense(&terms[k].a);
+  }
+  Matrix flat;
+  if (dense) {
+    size_t size = dst->n_rows * dst->n_cols;
+    for (size_t k = 0; k < n_terms; k++) {
+      if (terms[k].e->kind == EXPR_LEAF)
+        terms[k].a = matrix_view_array(terms[k].a.array, 1, size, size);
+    }
+    flat = matrix_view_array(dst->array, 1, size, size);
+    dst = &flat;
+  }
+
+  size_t row_chunks = (dst->n_cols + EXPR_CHUNK - 1) / EXPR_CHUNK;
+  ExprPassArgs args = {dst, terms, n_terms, row_chunks};
+  parallel_for(dst->n_rows * row_chunks, EXPR_GRAIN, expr_pass_task, &args);
+}
+
+// dst = the resolved terms, given that no operand of a product overlaps
+// dst and no leaf does other than dst itself
+static Matrix *combine(Matrix *dst, ExprTerm *terms, size_t n_terms) {
+  size_t n_leaves = 0;
+  const ExprTerm *leaf = NULL;
+  for (size_t k = 0; k < n_terms; k++) {
+    if (terms[k].e->kind == EXPR_LEAF) {
+      leaf = &terms[k];
+      n_leaves++;
+    }
+  }
+
+  // alpha A B + beta dst is matrix_gemm itself, with no pass at all
+  float beta = 0;
+  if (n_leaves == 1 && n_terms > 1 && same_block(&leaf->a, dst)) {
+    beta = leaf->coef;
+  } else if (n_leaves > 0 && dst->n_rows > 0 && dst->n_cols > 0) {
+    fused_pass(dst, terms, n_terms);
+    beta = 1;
+  }
+
+  for (size_t k = 0; k < n_terms; k++) {
+    if (terms[k].e->kind != EXPR_MULT)
+      continue;
+    if (matrix_gemm(terms[k].coef, &terms[k].a, &terms[k].b, beta, dst) ==
+        NULL)
+      return NULL;
+    beta = 1;
+  }
+  return dst;
+}
+
+// dst = op(e), its temporaries in scratch
+static Matrix *evaluate(MatrixArena *scratch, Matrix *dst, const MatrixExpr *e,
+                        int trans) {
+  size_t cap = e->n_nodes;
+  ExprTerm *terms = scratch_alloc(scratch, cap * sizeof(ExprTerm));
+  if (terms == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return NULL;
+  }
+  size_t n_terms = 0;
+  flatten(e, 1.0f, trans, terms, &n_terms);
+
+  Matrix *res = dst;
+  int aliased = 0;
+  for (size_t k = 0; k < n_terms && res != NULL; k++) {
+    ExprTerm *t = &terms[k];
+    t->tmp[0] = t->tmp[1] = NULL;
+    if (t->e->kind == EXPR_LEAF) {
+      t->a = leaf_view(t->e->mat, t->trans);
+      aliased |= matrix_overlaps(dst, &t->a) && !same_block(dst, &t->a);
+      continue;
+    }
+    // (A B)^T = B^T A^T
+    const MatrixExpr *x = t->trans ? t->e->b : t->e->a;
+    const MatrixExpr *y = t->trans ? t->e->a : t->e->b;
+    if (!operand(scratch, x, t->trans, &t->a, &t->tmp[0], &t->coef) ||
+        !operand(scratch, y, t->trans, &t->b, &t->tmp[1], &t->coef)) {
+      res = NULL;
+      n_terms = k + 1;
+      break;
+    }
+    aliased |= matrix_overlaps(dst, &t->a) || matrix_overlaps(dst, &t->b);
+  }
+
+  if (res != NULL && aliased) {
+    // dst is read while it is written: evaluate aside, then copy
+    Matrix *tmp = scratch_matrix(scratch, dst->n_rows, dst->n_cols);
+    if (tmp == NULL) {
+      fprintf(stderr, "Error: memory allocation failed\n");
+      res = NULL;
+    } else if (combine(tmp, terms, n_terms) == NULL) {
+      res = NULL;
+    } else {
+      matrix_copy(dst, tmp);
+    }
+    matrix_free(tmp);
+  } else if (res != NULL) {
+    res = combine(dst, terms, n_terms);
+  }
+
+  for (size_t k = n_terms; k-- > 0;) {
+    matrix_free(terms[k].tmp[1]);
+    matrix_free(terms[k].tmp[0]);
+  }
+  scratch_free(scratch, terms);
+  return res;
+}
+
+#ifdef MATRIX_PROFILE
+// Nominal work of evaluating e, for the profiler: an add or a scale per
+// element of its node, 2 m n k per product
+static double expr_flops(const MatrixExpr *e) {
+  if (e == NULL || e->kind == EXPR_LEAF)
+    return 0;
+  double own = e->kind == EXPR_MULT
+                   ? 2.0 * e->n_rows * e->n_cols * e->a->n_cols
+                   : e->kind == EXPR_TRANS ? 0.0
+                                           : (double)e->n_rows * e->n_cols;
+  return own + expr_flops(e->a) + expr_flops(e->b);
+}
+
+// Every leaf read once, as the fused pass does
+static double expr_bytes(const MatrixExpr *e) {
+  if (e == NULL)
+    return 0;
+  if (e->kind == EXPR_LEAF)
+    return 4.0 * e->n_rows * e->n_cols;
+  return expr_bytes(e->a) + expr_bytes(e->b);
+}
+#endif
+
+Matrix *expr_eval_into(Matrix *dst, MatrixExpr *e) {
+  PROFILE_SCOPE(PROF_EXPR_EVAL, expr_flops(e),
+                expr_bytes(e) + 4.0 * dst->n_rows * dst->n_cols);
+  if (e == NULL)
+    return NULL;
+  if (dst->n_rows != e->n_rows || dst->n_cols != e->n_cols) {
+    fprintf(stderr, "Error %s: dst is %zu x %zu, the expression %zu x %zu\n",
+            __func__, dst->n_rows, dst->n_cols, e->n_rows, e->n_cols);
+    return NULL;
+  }
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  Matrix *res = evaluate(scratch, dst, e, 0);
+  matrix_arena_reset(scratch, mark);
+  return res;
+}
+
+Matrix *expr_eval(MatrixExpr *e) {
+  if (e == NULL)
+    return NULL;
+  Matrix *res = matrix_create(e->n_rows, e->n_cols);
+  if (res == NULL)
+    return NULL;
+  if (expr_eval_into(res, e) == NULL) {
+    matrix_free(res);
+    return NULL;
+  }
+  return res;
+}
@@ -0,0 +1,76 @@
+#include "gemm.h"
+#include "matrix.h"
+#include "profile.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <complex.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Below this many multiply-adds the packing overhead is not worth it.
+#define GEMM_SMALL_THRESHOLD (32 * 32 * 32)
+
+GemmBlocking gemm_get_blocking(void) {
+  MatrixTuning tuning = matrix_get_tuning();
+  GemmBlocking blocking = {tuning.gemm_mc, tuning.gemm_kc, tuning.gemm_nc};
+  return blocking;
+}
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+enum { PACK_A, PACK_B };
+
+// Packing B is spread over the pool in runs of this many NR-slivers
+#define PACK_B_GRAIN 16
+
+// The driver is written once, in gemm_tmpl.h: gemm_strided and its complex
+// counterpart gemm_strided_c on floats, gemm_strided_d/_z on doubles
+#define T float
+#define FN(name) name
+#define GEMM_SIMD SimdKernels
+#define GEMM_KERNELS simd_kernels
+#define CT float _Complex
+#define CFN(name) name##_c
+#include "gemm_tmpl.h"
+
+#define T double
+#define FN(name) name##_d
+#define GEMM_SIMD SimdKernelsD
+#define GEMM_KERNELS simd_kernels_d
+#define CT double _Complex
+#define CFN(name) name##_z
+#include "gemm_tmpl.h"
+
+Matrix *matrix_gemm(float alpha, Matrix *A, Matrix *B, float beta,
+                    Matrix *C) {
+  PROFILE_SCOPE(PROF_MATRIX_GEMM, 2.0 * A->n_rows * B->n_cols * A->n_cols,
+                4.0 * ((double)A->n_rows * A->n_cols +
+                       (double)B->n_rows * B->n_cols +
+                       2.0 * C->n_rows * C->n_cols));
+  if (A->n_cols != B->n_rows || C->n_rows != A->n_rows ||
+      C->n_cols != B->n_cols) {
+    fprintf(stderr,
+            "Error matrix_gemm: size mismatch A(%zu x %zu) * B(%zu x %zu) -> "
+            "C(%zu x %zu)\n",
+            A->n_rows, A->n_cols, B->n_rows, B->n_cols, C->n_rows,
+            C->n_cols);
+    return NULL;
+  }
+  if (matrix_overlaps(C, A) || matrix_overlaps(C, B)) {
+    fprintf(stderr, "Error matrix_gemm: C must not alias A or B\n");
+    return NULL;
+  }
+
+  if (gemm_strassen(A->n_rows, B->n_cols, A->n_cols, alpha, A->array,
+                    A->row_stride, A->col_stride, B->array, B->row_stride,
+                    B->col_stride, beta, C->array, C->row_stride,
+                    C->col_stride) == 0)
+    return C;
+  gemm_strided(A->n_rows, B->n_cols, A->n_cols, alpha, A->array,
+               A->row_stride, A->col_stride, B->array, B->row_stride,
+               B->col_stride, beta, C->array, C->row_stride, C->col_stride);
+  return C;
+}
@@ -0,0 +1,60 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+
+// Cache blocking parameters of the packed GEMM, from matrix_get_tuning.
+// mc x kc is the packed block of A (sized for L2), kc x nc the packed panel
+// of B (sized for L3), kc is also the depth of one micro-kernel call (L1).
+typedef struct gemm_blocking {
+  size_t mc;
+  size_t kc;
+  size_t nc;
+} GemmBlocking;
+
+GemmBlocking gemm_get_blocking(void);
+
+// C = alpha * A * B + beta * C on raw strided storage.
+// Element (i, j) of X lives at X[i * rsx + j * csx], so a transposed operand
+// is just a matter of swapping its strides. C must not alias A or B.
+// When beta == 0, C is not read (it may hold garbage or NaN).
+void gemm_strided(size_t m, size_t n, size_t k, float alpha, const float *A,
+                  size_t rsa, size_t csa, const float *B, size_t rsb,
+                  size_t csb, float beta, float *C, size_t rsc, size_t csc);
+
+// gemm_strided by Strassen-Winograd (strassen.c), when a cutoff is set by
+// matrix_set_strassen_cutoff and m, n and k are all above it. Returns 0
+// when it ran, -1 when the product is left to the caller (mode off, too
+// small, or no memory for the workspace).
+int gemm_strassen(size_t m, size_t n, size_t k, float alpha, const float *A,
+                  size_t rsa, size_t csa, const float *B, size_t rsb,
+                  size_t csb, float beta, float *C, size_t rsc, size_t csc);
+
+// The same for the other element types (gemm_tmpl.h). The complex ones
+// run four real products over the split real and imaginary parts.
+void gemm_strided_d(size_t m, size_t n, size_t k, double alpha,
+                    const double *A, size_t rsa, size_t csa, const double *B,
+                    size_t rsb, size_t csb, double beta, double *C,
+                    size_t rsc, size_t csc);
+
+void gemm_strided_c(size_t m, size_t n, size_t k, float _Complex alpha,
+                    const float _Complex *A, size_t rsa, size_t csa,
+                    const float _Complex *B, size_t rsb, size_t csb,
+                    float _Complex beta, float _Complex *C, size_t rsc,
+                    size_t csc);
+
+void gemm_strided_z(size_t m, size_t n, size_t k, double _Complex alpha,
+                    const double _Complex *A, size_t rsa, size_t csa,
+                    const double _Complex *B, size_t rsb, size_t csb,
+                    double _Complex beta, double _Complex *C, size_t rsc,
+                    size_t csc);
+
+// C = A^T B + beta C for A (rows x p) and B (rows x q), row-major with row
+// strides lda and ldb, rows >> p, q (lstsq.c). GEMM alone would walk the
+// long inner dimension on one thread, so the rows are split over the pool
+// first. With sym, C = A^T A is symmetric and only computed above the
+// diagonal, then mirrored. C is p x q, dense.
+void tall_tn(size_t rows, size_t p, size_t q, const float *A, size_t lda,
+             const float *B, size_t ldb, float beta, float *C, int sym);
+
+#endif // !GEMM_H
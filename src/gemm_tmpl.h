@@ -0,0 +1,427 @@
+// Packed GEMM driver, included by gemm.c once per real element type.
+// The includer defines:
+//   T             float or double
+//   FN(name)      the name of this instance of `name` (name, name##_d)
+//   GEMM_SIMD     kernel table type for T (SimdKernels, SimdKernelsD)
+//   GEMM_KERNELS  function returning the active table
+//   CT, CFN(name) the matching complex type and names, built on top by 4M
+// All of them are undefined again at the end.
+
+static T *FN(alloc_packed)(size_t n_elems) {
+  void *ptr = NULL;
+  if (posix_memalign(&ptr, 64, n_elems * sizeof(T)) != 0)
+    return NULL;
+  return ptr;
+}
+
+// Packing buffers are kept per thread and reused across calls, so repeated
+// products of the same size do not touch the heap. They are freed when the
+// thread exits.
+typedef struct FN(pack_buffer) {
+  T *data;
+  size_t cap;
+  int in_use;
+} FN(PackBuffer);
+
+static __thread FN(PackBuffer) FN(pack_buffers)[2];
+static pthread_key_t FN(pack_key);
+static pthread_once_t FN(pack_key_once) = PTHREAD_ONCE_INIT;
+
+static void FN(free_pack_buffers)(void *arg) {
+  FN(PackBuffer) *buffers = arg;
+  for (size_t i = 0; i < 2; i++) {
+    free(buffers[i].data);
+    buffers[i] = (FN(PackBuffer)){NULL, 0, 0};
+  }
+}
+
+static void FN(create_pack_key)(void) {
+  pthread_key_create(&FN(pack_key), FN(free_pack_buffers));
+}
+
+static T *FN(pack_acquire)(int which, size_t n_elems) {
+  FN(PackBuffer) *buf = &FN(pack_buffers)[which];
+  // Already lent out: a nested product on this thread gets its own
+  if (buf->in_use)
+    return FN(alloc_packed)(n_elems);
+
+  if (buf->cap < n_elems) {
+    T *data = FN(alloc_packed)(n_elems);
+    if (data == NULL)
+      return NULL;
+    free(buf->data);
+    buf->data = data;
+    buf->cap = n_elems;
+    pthread_once(&FN(pack_key_once), FN(create_pack_key));
+    pthread_setspecific(FN(pack_key), FN(pack_buffers));
+  }
+  buf->in_use = 1;
+  return buf->data;
+}
+
+static void FN(pack_release)(int which, T *data) {
+  FN(PackBuffer) *buf = &FN(pack_buffers)[which];
+  if (data == buf->data)
+    buf->in_use = 0;
+  else
+    free(data);
+}
+
+// C = beta * C, without reading C when beta == 0
+static void FN(scale_c)(size_t m, size_t n, T beta, T *C, size_t rsc,
+                        size_t csc) {
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      T *c = &C[i * rsc + j * csc];
+      *c = beta == 0 ? 0 : beta * *c;
+    }
+  }
+}
+
+// Copy an mc x kc block of A into MR-row slivers: sliver s holds rows
+// [s*MR, s*MR + MR) stored column after column, zero padded at the bottom.
+static void FN(pack_a)(size_t MR, size_t mc, size_t kc, const T *A,
+                       size_t rsa, size_t csa, T *Ap) {
+  for (size_t ir = 0; ir < mc; ir += MR) {
+    size_t mr = min_size(MR, mc - ir);
+    for (size_t p = 0; p < kc; p++) {
+      const T *a = &A[ir * rsa + p * csa];
+      size_t i = 0;
+      for (; i < mr; i++)
+        Ap[i] = a[i * rsa];
+      for (; i < MR; i++)
+        Ap[i] = 0;
+      Ap += MR;
+    }
+  }
+}
+
+// Copy a kc x nc panel of B into NR-column slivers: sliver s holds columns
+// [s*NR, s*NR + NR) stored row after row, zero padded on the right.
+static void FN(pack_b)(size_t NR, size_t kc, size_t nc, const T *B,
+                       size_t rsb, size_t csb, T *Bp) {
+  for (size_t jr = 0; jr < nc; jr += NR) {
+    size_t nr = min_size(NR, nc - jr);
+    for (size_t p = 0; p < kc; p++) {
+      const T *b = &B[p * rsb + jr * csb];
+      size_t j = 0;
+      if (csb == 1 && nr == NR) {
+        memcpy(Bp, b, NR * sizeof(T));
+      } else {
+        for (; j < nr; j++)
+          Bp[j] = b[j * csb];
+        for (; j < NR; j++)
+          Bp[j] = 0;
+      }
+      Bp += NR;
+    }
+  }
+}
+
+// Partial tile at the bottom/right edge, or C with a non-unit column
+// stride: run the full kernel into a scratch tile and merge what fits.
+static void FN(micro_kernel_edge)(const GEMM_SIMD *simd, size_t mr,
+                                  size_t nr, size_t kc, const T *Ap,
+                                  const T *Bp, T *C, size_t rsc, size_t csc,
+                                  T alpha, T beta) {
+  T tile[SIMD_MAX_MR * SIMD_MAX_NR];
+  size_t NR = simd->nr;
+  simd->gemm_kernel(kc, Ap, Bp, tile, NR, alpha, 0);
+
+  for (size_t i = 0; i < mr; i++) {
+    for (size_t j = 0; j < nr; j++) {
+      T *c = &C[i * rsc + j * csc];
+      *c = beta == 0 ? tile[i * NR + j] : tile[i * NR + j] + beta * *c;
+    }
+  }
+}
+
+// Straight i-k-j loop for products too small to amortize packing
+static void FN(gemm_small)(size_t m, size_t n, size_t k, T alpha, const T *A,
+                           size_t rsa, size_t csa, const T *B, size_t rsb,
+                           size_t csb, T *C, size_t rsc, size_t csc) {
+  for (size_t i = 0; i < m; i++) {
+    for (size_t p = 0; p < k; p++) {
+      T a = alpha * A[i * rsa + p * csa];
+      for (size_t j = 0; j < n; j++) {
+        C[i * rsc + j * csc] += a * B[p * rsb + j * csb];
+      }
+    }
+  }
+}
+
+// C is a single column and A has contiguous rows: one dot product per row
+// streams A once, where packing would copy all of it for a single column.
+// Four partial sums hide the latency of the additions.
+typedef struct FN(gemv_args) {
+  size_t k;
+  T alpha;
+  const T *A;
+  size_t rsa;
+  const T *x;
+  size_t incx;
+  T beta;
+  T *y;
+  size_t incy;
+} FN(GemvArgs);
+
+static void FN(gemv_task)(void *arg, size_t begin, size_t end) {
+  FN(GemvArgs) *g = arg;
+  size_t k = g->k, incx = g->incx;
+  const T *x = g->x;
+
+  for (size_t i = begin; i < end; i++) {
+    const T *a = &g->A[i * g->rsa];
+    T s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t p = 0;
+    for (; p + 4 <= k; p += 4) {
+      s0 += a[p] * x[p * incx];
+      s1 += a[p + 1] * x[(p + 1) * incx];
+      s2 += a[p + 2] * x[(p + 2) * incx];
+      s3 += a[p + 3] * x[(p + 3) * incx];
+    }
+    for (; p < k; p++) {
+      s0 += a[p] * x[p * incx];
+    }
+    T sum = (s0 + s1) + (s2 + s3);
+    T *y = &g->y[i * g->incy];
+    *y = g->beta == 0 ? g->alpha * sum : g->alpha * sum + g->beta * *y;
+  }
+}
+
+typedef struct FN(pack_b_args) {
+  size_t NR;
+  size_t kc;
+  size_t nc;
+  const T *B;
+  size_t rsb;
+  size_t csb;
+  T *Bp;
+} FN(PackB);
+
+static void FN(pack_b_task)(void *arg, size_t begin, size_t end) {
+  FN(PackB) *p = arg;
+  size_t jr = begin * p->NR;
+  size_t nc = min_size(end * p->NR, p->nc) - jr;
+  FN(pack_b)(p->NR, p->kc, nc, &p->B[jr * p->csb], p->rsb, p->csb,
+             &p->Bp[jr * p->kc]);
+}
+
+// One rank-kc update of C[:, jc:jc+nc], cut into tiles of mc rows by
+// jr_chunk columns. Each tile packs its own block of A; a thread that
+// cannot get a packing buffer runs its tiles unpacked from A and B.
+typedef struct FN(gemm_tiles) {
+  const GEMM_SIMD *simd;
+  size_t mc;
+  size_t kc;
+  size_t nc;
+  T alpha;
+  T beta;
+  const T *A; // at column pc
+  size_t rsa;
+  size_t csa;
+  size_t m;
+  const T *B; // at row pc, column jc
+  size_t rsb;
+  size_t csb;
+  const T *Bp;     // packed kc x nc panel
+  size_t jr_chunk; // multiple of NR
+  size_t n_jr;
+  T *C; // at column jc
+  size_t rsc;
+  size_t csc;
+} FN(GemmTiles);
+
+static void FN(gemm_tile_unpacked)(FN(GemmTiles) *t, size_t ic, size_t mc,
+                                   size_t jr_begin, size_t jr_end) {
+  T *C = &t->C[ic * t->rsc + jr_begin * t->csc];
+  FN(scale_c)(mc, jr_end - jr_begin, t->beta, C, t->rsc, t->csc);
+  FN(gemm_small)(mc, jr_end - jr_begin, t->kc, t->alpha, &t->A[ic * t->rsa],
+                 t->rsa, t->csa, &t->B[jr_begin * t->csb], t->rsb, t->csb,
+                 C, t->rsc, t->csc);
+}
+
+static void FN(gemm_tile_task)(void *arg, size_t begin, size_t end) {
+  FN(GemmTiles) *t = arg;
+  const GEMM_SIMD *simd = t->simd;
+  size_t MR = simd->mr, NR = simd->nr, kc = t->kc;
+
+  T *Ap = FN(pack_acquire)(PACK_A,
+                           min_size(t->mc, (t->m + MR - 1) / MR * MR) * kc);
+
+  size_t packed_ic = (size_t)-1;
+  for (size_t tile = begin; tile < end; tile++) {
+    size_t ic = tile / t->n_jr * t->mc;
+    size_t mc = min_size(t->mc, t->m - ic);
+    size_t jr_begin = tile % t->n_jr * t->jr_chunk;
+    size_t jr_end = min_size(jr_begin + t->jr_chunk, t->nc);
+
+    // Still the right answer, just slowly, as when B cannot be packed
+    if (Ap == NULL) {
+      FN(gemm_tile_unpacked)(t, ic, mc, jr_begin, jr_end);
+      continue;
+    }
+
+    if (ic != packed_ic) {
+      FN(pack_a)(MR, mc, kc, &t->A[ic * t->rsa], t->rsa, t->csa, Ap);
+      packed_ic = ic;
+    }
+
+    for (size_t jr = jr_begin; jr < jr_end; jr += NR) {
+      size_t nr = min_size(NR, t->nc - jr);
+      const T *Bs = &t->Bp[jr * kc];
+
+      for (size_t ir = 0; ir < mc; ir += MR) {
+        size_t mr = min_size(MR, mc - ir);
+        const T *As = &Ap[ir * kc];
+        T *Cs = &t->C[(ic + ir) * t->rsc + jr * t->csc];
+
+        if (mr == MR && nr == NR && t->csc == 1) {
+          simd->gemm_kernel(kc, As, Bs, Cs, t->rsc, t->alpha, t->beta);
+        } else {
+          FN(micro_kernel_edge)(simd, mr, nr, kc, As, Bs, Cs, t->rsc, t->csc,
+                                t->alpha, t->beta);
+        }
+      }
+    }
+  }
+
+  if (Ap != NULL)
+    FN(pack_release)(PACK_A, Ap);
+}
+
+void FN(gemm_strided)(size_t m, size_t n, size_t k, T alpha, const T *A,
+                      size_t rsa, size_t csa, const T *B, size_t rsb,
+                      size_t csb, T beta, T *C, size_t rsc, size_t csc) {
+  if (m == 0 || n == 0)
+    return;
+
+  if (k == 0 || alpha == 0) {
+    FN(scale_c)(m, n, beta, C, rsc, csc);
+    return;
+  }
+
+  if (m * n * k <= GEMM_SMALL_THRESHOLD) {
+    FN(scale_c)(m, n, beta, C, rsc, csc);
+    FN(gemm_small)(m, n, k, alpha, A, rsa, csa, B, rsb, csb, C, rsc, csc);
+    return;
+  }
+
+  if (n == 1 && csa == 1) {
+    FN(GemvArgs) gemv = {k, alpha, A, rsa, B, rsb, beta, C, rsc};
+    parallel_for(m, pool_grain(k), FN(gemv_task), &gemv);
+    return;
+  }
+
+  const GEMM_SIMD *simd = GEMM_KERNELS();
+  size_t MR = simd->mr, NR = simd->nr;
+
+  // Whole register tiles per block so packed slivers never straddle blocks
+  MatrixTuning tuning = matrix_get_tuning();
+  GemmBlocking bs = {tuning.gemm_mc, tuning.gemm_kc, tuning.gemm_nc};
+  bs.mc = bs.mc < MR ? MR : bs.mc / MR * MR;
+  bs.nc = bs.nc < NR ? NR : bs.nc / NR * NR;
+
+  size_t nc_max = min_size(bs.nc, (n + NR - 1) / NR * NR);
+  size_t kc_max = min_size(bs.kc, k);
+
+  T *Bp = FN(pack_acquire)(PACK_B, kc_max * nc_max);
+  if (Bp == NULL) {
+    // Still produce the right answer, just slowly
+    FN(scale_c)(m, n, beta, C, rsc, csc);
+    FN(gemm_small)(m, n, k, alpha, A, rsa, csa, B, rsb, csb, C, rsc, csc);
+    return;
+  }
+
+  // Below the threading cutoff, waking the pool costs more than it saves
+  size_t n_threads =
+      m * n * k < tuning.gemm_parallel_min ? 1 : thread_pool_size();
+  size_t n_ic = (m + bs.mc - 1) / bs.mc;
+
+  FN(GemmTiles) tiles = {.simd = simd, .mc = bs.mc, .alpha = alpha,
+                         .rsa = rsa,   .csa = csa,  .m = m,
+                         .rsb = rsb,   .csb = csb,  .Bp = Bp,
+                         .rsc = rsc,   .csc = csc};
+
+  for (size_t jc = 0; jc < n; jc += bs.nc) {
+    size_t nc = min_size(bs.nc, n - jc);
+
+    // Too few row blocks to feed every thread: also split the columns
+    size_t n_jr = 1, per_thread = tuning.gemm_tiles_per_thread;
+    if (n_threads > 1 && n_ic < per_thread * n_threads) {
+      n_jr = (per_thread * n_threads + n_ic - 1) / n_ic;
+      n_jr = min_size(n_jr, (nc + 4 * NR - 1) / (4 * NR));
+    }
+    tiles.nc = nc;
+    tiles.jr_chunk = ((nc + n_jr - 1) / n_jr + NR - 1) / NR * NR;
+    tiles.n_jr = (nc + tiles.jr_chunk - 1) / tiles.jr_chunk;
+
+    for (size_t pc = 0; pc < k; pc += bs.kc) {
+      size_t kc = min_size(bs.kc, k - pc);
+
+      FN(PackB) pack = {NR, kc, nc, &B[pc * rsb + jc * csb], rsb, csb, Bp};
+      size_t n_slivers = (nc + NR - 1) / NR;
+      parallel_for(n_slivers, n_threads > 1 ? PACK_B_GRAIN : n_slivers,
+                   FN(pack_b_task), &pack);
+
+      tiles.kc = kc;
+      // Only the first rank-kc update applies the caller's beta
+      tiles.beta = pc == 0 ? beta : 1;
+      tiles.A = &A[pc * csa];
+      tiles.B = &B[pc * rsb + jc * csb];
+      tiles.C = &C[jc * csc];
+      size_t n_tiles = n_ic * tiles.n_jr;
+      parallel_for(n_tiles, n_threads > 1 ? 1 : n_tiles, FN(gemm_tile_task),
+                   &tiles);
+    }
+  }
+
+  FN(pack_release)(PACK_B, Bp);
+}
+
+// Complex product by the 4M method. The real and the imaginary parts of a
+// complex matrix are real matrices with doubled strides, so the product is
+// four real products through the packed kernel (eight when alpha is not
+// real), all accumulating into C once beta has been applied.
+void CFN(gemm_strided)(size_t m, size_t n, size_t k, CT alpha, const CT *A,
+                       size_t rsa, size_t csa, const CT *B, size_t rsb,
+                       size_t csb, CT beta, CT *C, size_t rsc, size_t csc) {
+  if (m == 0 || n == 0)
+    return;
+
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      CT *c = &C[i * rsc + j * csc];
+      *c = beta == 0 ? 0 : beta * *c;
+    }
+  }
+  if (k == 0 || alpha == 0)
+    return;
+
+  const T *ar = (const T *)A, *ai = ar + 1;
+  const T *br = (const T *)B, *bi = br + 1;
+  T *cr = (T *)C, *ci = cr + 1;
+  T re = creal(alpha), im = cimag(alpha);
+  rsa *= 2, csa *= 2, rsb *= 2, csb *= 2, rsc *= 2, csc *= 2;
+
+  // alpha (Ar + i Ai)(Br + i Bi), real part of alpha
+  FN(gemm_strided)(m, n, k, re, ar, rsa, csa, br, rsb, csb, 1, cr, rsc, csc);
+  FN(gemm_strided)(m, n, k, -re, ai, rsa, csa, bi, rsb, csb, 1, cr, rsc, csc);
+  FN(gemm_strided)(m, n, k, re, ar, rsa, csa, bi, rsb, csb, 1, ci, rsc, csc);
+  FN(gemm_strided)(m, n, k, re, ai, rsa, csa, br, rsb, csb, 1, ci, rsc, csc);
+  if (im == 0)
+    return;
+
+  // Imaginary part of alpha
+  FN(gemm_strided)(m, n, k, -im, ar, rsa, csa, bi, rsb, csb, 1, cr, rsc, csc);
+  FN(gemm_strided)(m, n, k, -im, ai, rsa, csa, br, rsb, csb, 1, cr, rsc, csc);
+  FN(gemm_strided)(m, n, k, im, ar, rsa, csa, br, rsb, csb, 1, ci, rsc, csc);
+  FN(gemm_strided)(m, n, k, -im, ai, rsa, csa, bi, rsb, csb, 1, ci, rsc, csc);
+}
+
+#undef T
+#undef FN
+#undef GEMM_SIMD
+#undef GEMM_KERNELS
+#undef CT
+#undef CFN
@@ -0,0 +1,87 @@
+#include "householder.h"
+#include "gemm.h"
+#include <math.h>
+#include <stdlib.h>
+
+// Reflectors per block of householder_apply
+#define HH_BLOCK 32
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+float householder_make(size_t n, float *alpha, float *x, size_t incx) {
+  double sigma = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    sigma += (double)x[i * incx] * x[i * incx];
+  }
+  if (sigma == 0.0)
+    return 0.0f;
+
+  double a = *alpha;
+  double beta = -copysign(sqrt(a * a + sigma), a);
+  // In double: for a tiny x, 1 / (a - beta) would overflow a float
+  double scale = 1.0 / (a - beta);
+  for (size_t i = 0; i < n; i++) {
+    x[i * incx] = (float)(x[i * incx] * scale);
+  }
+  *alpha = (float)beta;
+  return (float)((beta - a) / beta);
+}
+
+int householder_apply(size_t m, size_t k, const float *V, size_t rsv,
+                      size_t csv, const float *tau, float *C, size_t ldc,
+                      size_t n_cols) {
+  if (k == 0 || n_cols == 0)
+    return 0;
+
+  size_t nb_max = min_size(HH_BLOCK, k);
+  float *Vb = malloc((m * nb_max + 2 * nb_max * nb_max +
+                      2 * nb_max * n_cols) * sizeof(float));
+  if (Vb == NULL)
+    return -1;
+  float *T = Vb + m * nb_max, *G = T + nb_max * nb_max;
+  float *W = G + nb_max * nb_max, *W2 = W + nb_max * n_cols;
+
+  // H_0 (H_1 (... C)): the last block goes first
+  for (size_t b = (k + HH_BLOCK - 1) / HH_BLOCK; b-- > 0;) {
+    size_t j0 = b * HH_BLOCK, nb = min_size(HH_BLOCK, k - j0);
+    size_t rows = m - j0;
+    float *Cb = &C[j0 * ldc];
+
+    // The block's reflectors as explicit columns, rows [j0, m)
+    for (size_t i = 0; i < rows; i++) {
+      for (size_t c = 0; c < nb; c++) {
+        Vb[i * nb + c] = i < c    ? 0.0f
+                         : i == c ? 1.0f
+                                  : V[(j0 + i) * rsv + (j0 + c) * csv];
+      }
+    }
+
+    // T upper triangular with H_j0 ... H_{j0+nb-1} = I - V T V^T, from
+    // G = V^T V
+    gemm_strided(nb, nb, rows, 1.0f, Vb, 1, nb, Vb, nb, 1, 0.0f, G, nb, 1);
+    for (size_t i = 0; i < nb; i++) {
+      T[i * nb + i] = tau[j0 + i];
+      for (size_t r = 0; r < i; r++) {
+        float t = 0.0f;
+        for (size_t s = r; s < i; s++) {
+          t += T[r * nb + s] * G[s * nb + i];
+        }
+        T[r * nb + i] = -tau[j0 + i] * t;
+      }
+      for (size_t r = i + 1; r < nb; r++) {
+        T[r * nb + i] = 0.0f;
+      }
+    }
+
+    // C -= V (T (V^T C))
+    gemm_strided(nb, n_cols, rows, 1.0f, Vb, 1, nb, Cb, ldc, 1, 0.0f, W,
+                 n_cols, 1);
+    gemm_strided(nb, n_cols, nb, 1.0f, T, nb, 1, W, n_cols, 1, 0.0f, W2,
+                 n_cols, 1);
+    gemm_strided(rows, n_cols, nb, -1.0f, Vb, nb, 1, W2, n_cols, 1, 1.0f, Cb,
+                 ldc, 1);
+  }
+
+  free(Vb);
+  return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef HOUSEHOLDER_H
+#define HOUSEHOLDER_H
+
+#include <stddef.h>
+
+// Householder reflectors H = I - tau v v^T with v[0] = 1, as in LAPACK's
+// larfg and larfb, shared by least squares, the eigensolver and the SVD
+
+// The reflector taking (alpha, x) to (beta, 0), x being n elements at
+// stride incx. alpha becomes beta and x becomes v[1:]. Returns tau, 0
+// when x is already zero (H = I).
+float householder_make(size_t n, float *alpha, float *x, size_t incx);
+
+// C = H_0 H_1 ... H_{k-1} C. Reflector j is column j of the m x k matrix
+// V (element (i, j) at V[i * rsv + j * csv]), with v_j[j] = 1 and zeros
+// above it implied, whatever V holds there. C is m x n_cols with row
+// stride ldc. The reflectors are applied in blocks, I - V T V^T, so the
+// work is in GEMM. 0, or -1 if out of memory.
+int householder_apply(size_t m, size_t k, const float *V, size_t rsv,
+                      size_t csv, const float *tau, float *C, size_t ldc,
+                      size_t n_cols);
+
+// Blocked Householder QR of a (n x m, n >= m) in place (lstsq.c): R on and
+// above the diagonal, reflector j below it in column j. tau_out, if not
+// NULL, gets the m tau. Q^T is applied to the k columns of b as it goes
+// (k may be 0). Returns -1 if out of memory.
+int qr_factor_apply(float *a, size_t n, size_t m, float *tau_out, float *b,
+                    size_t k);
+
+#endif // !HOUSEHOLDER_H
@@ -0,0 +1,498 @@
+#include "io.h"
+#include "matrix.h"
+#include <complex.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout, version 1: a 64-byte header, fields little-endian,
+//    0  magic        "LINALGMX"
+//    8  version      u32, MATRIX_FILE_VERSION
+//   12  elem_type    u32, a MatrixElemType
+//   16  layout       u32, LAYOUT_ROW_MAJOR
+//   20  alignment    u32, a power of two dividing data_offset
+//                     (data_offset must be a multiple of MATRIX_ALIGNMENT
+//                     too, so mapped data is aligned like a Matrix)
+//   24  n_rows       u64
+//   32  n_cols       u64
+//   40  row_stride   u64, elements from a row to the next, >= n_cols
+//   48  data_offset  u64, from the start of the file
+//   56  checksum     u64, of the n_rows * row_stride elements
+// then the elements at data_offset, little-endian IEEE 754 (complex as
+// real then imaginary part), in the layout of a Matrix so that a mapping
+// of the file is one. Big-endian hosts are rejected rather than swapped,
+// which would need a copy.
+#define MATRIX_FILE_VERSION 1
+#define HEADER_SIZE 64
+#define LAYOUT_ROW_MAJOR 0
+
+static const char magic[8] = {'L', 'I', 'N', 'A', 'L', 'G', 'M', 'X'};
+
+// Writes are staged in a buffer of this many bytes, a multiple of 8 so
+// that the checksum sees the same words however the rows split
+#define IO_BUFFER (1 << 20)
+
+// FNV-1a over 64-bit words, then the tail bytes: several GB/s, enough to
+// catch truncation and corruption (it is not an authenticity check)
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+struct matrix_file {
+  const unsigned char *base; // the whole mapped file
+  size_t size;
+  FileLayout layout;
+  const unsigned char *data;
+};
+
+static int host_is_little_endian(void) {
+  const uint16_t one = 1;
+  return *(const unsigned char *)&one == 1;
+}
+
+static size_t elem_size(MatrixElemType type) {
+  switch (type) {
+  case MATRIX_ELEM_FLOAT:
+    return sizeof(float);
+  case MATRIX_ELEM_DOUBLE:
+    return sizeof(double);
+  case MATRIX_ELEM_COMPLEX:
+    return sizeof(float _Complex);
+  case MATRIX_ELEM_COMPLEX_DOUBLE:
+    return sizeof(double _Complex);
+  }
+  return 0;
+}
+
+const char *elem_type_name(MatrixElemType type) {
+  switch (type) {
+  case MATRIX_ELEM_FLOAT:
+    return "float";
+  case MATRIX_ELEM_DOUBLE:
+    return "double";
+  case MATRIX_ELEM_COMPLEX:
+    return "complex float";
+  case MATRIX_ELEM_COMPLEX_DOUBLE:
+    return "complex double";
+  }
+  return "unknown";
+}
+
+static uint64_t checksum_update(uint64_t h, const unsigned char *data,
+                                size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    h = (h ^ word) * FNV_PRIME;
+  }
+  for (; i < size; i++) {
+    h = (h ^ data[i]) * FNV_PRIME;
+  }
+  return h;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= (uint32_t)p[i] << (8 * i);
+  }
+  return v;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v |= (uint64_t)p[i] << (8 * i);
+  }
+  return v;
+}
+
+static void encode_header(unsigned char *h, const FileLayout *layout,
+                          uint64_t checksum) {
+  memset(h, 0, HEADER_SIZE);
+  memcpy(h, magic, sizeof(magic));
+  put_u32(h + 8, MATRIX_FILE_VERSION);
+  put_u32(h + 12, layout->elem_type);
+  put_u32(h + 16, LAYOUT_ROW_MAJOR);
+  put_u32(h + 20, MATRIX_ALIGNMENT);
+  put_u64(h + 24, layout->n_rows);
+  put_u64(h + 32, layout->n_cols);
+  put_u64(h + 40, layout->row_stride);
+  put_u64(h + 48, layout->data_offset);
+  put_u64(h + 56, checksum);
+}
+
+// NULL, with the reason, unless the header of a file of file_size bytes
+// describes data that fits in it
+static const char *parse_header(const unsigned char *h, size_t file_size,
+                                FileLayout *layout) {
+  if (file_size < HEADER_SIZE || memcmp(h, magic, sizeof(magic)) != 0)
+    return "not a matrix file";
+  if (get_u32(h + 8) != MATRIX_FILE_VERSION)
+    return "unsupported version";
+  MatrixElemType type = (MatrixElemType)get_u32(h + 12);
+  size_t es = elem_size(type);
+  if (es == 0)
+    return "unknown element type";
+  if (get_u32(h + 16) != LAYOUT_ROW_MAJOR)
+    return "unknown layout";
+
+  uint64_t alignment = get_u32(h + 20);
+  uint64_t n_rows = get_u64(h + 24), n_cols = get_u64(h + 32);
+  uint64_t row_stride = get_u64(h + 40), offset = get_u64(h + 48);
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0 ||
+      offset % alignment != 0 || offset % MATRIX_ALIGNMENT != 0 ||
+      offset < HEADER_SIZE)
+    return "bad data offset";
+  if (n_rows > 0 && row_stride < n_cols)
+    return "bad row stride";
+  if (offset > file_size || n_rows > SIZE_MAX || n_cols > SIZE_MAX ||
+      (row_stride > 0 && n_rows > (SIZE_MAX - offset) / es / row_stride) ||
+      offset + n_rows * row_stride * es > file_size)
+    return "truncated";
+
+  *layout = (FileLayout){type, n_rows, n_cols, row_stride, offset};
+  return NULL;
+}
+
+static size_t data_size(const FileLayout *layout) {
+  return layout->n_rows * layout->row_stride * elem_size(layout->elem_type);
+}
+
+// Writing
+
+typedef struct file_writer {
+  FILE *f;
+  unsigned char *buf;
+  size_t used;
+  uint64_t checksum;
+  int failed;
+} FileWriter;
+
+static void writer_flush(FileWriter *w) {
+  w->checksum = checksum_update(w->checksum, w->buf, w->used);
+  if (w->used > 0 && fwrite(w->buf, 1, w->used, w->f) != w->used)
+    w->failed = 1;
+  w->used = 0;
+}
+
+static void writer_put(FileWriter *w, const unsigned char *data, size_t size) {
+  while (size > 0) {
+    size_t n = IO_BUFFER - w->used < size ? IO_BUFFER - w->used : size;
+    memcpy(w->buf + w->used, data, n);
+    w->used += n;
+    data += n;
+    size -= n;
+    if (w->used == IO_BUFFER)
+      writer_flush(w);
+  }
+}
+
+// mat is written dense, whatever its strides
+static int file_save(const char *caller, const char *path,
+                     const void *array, size_t n_rows, size_t n_cols,
+                     size_t row_stride, size_t col_stride,
+                     MatrixElemType type) {
+  if (!host_is_little_endian()) {
+    fprintf(stderr, "Error %s: matrix files need a little-endian host\n",
+            caller);
+    return -1;
+  }
+  size_t es = elem_size(type);
+  FileWriter w = {fopen(path, "wb"), malloc(IO_BUFFER), 0, FNV_OFFSET, 0};
+  if (w.f == NULL) {
+    fprintf(stderr, "Error %s: cannot open %s: %s\n", caller, path,
+            strerror(errno));
+    free(w.buf);
+    return -1;
+  }
+  if (w.buf == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    fclose(w.f);
+    return -1;
+  }
+
+  // The header goes last, once the checksum is known
+  unsigned char header[HEADER_SIZE] = {0};
+  w.failed = fwrite(header, 1, HEADER_SIZE, w.f) != HEADER_SIZE;
+  const unsigned char *src = array;
+  for (size_t i = 0; i < n_rows && !w.failed; i++) {
+    const unsigned char *row = src + i * row_stride * es;
+    if (col_stride == 1) {
+      writer_put(&w, row, n_cols * es);
+      continue;
+    }
+    for (size_t j = 0; j < n_cols; j++) {
+      writer_put(&w, row + j * col_stride * es, es);
+    }
+  }
+  writer_flush(&w);
+
+  FileLayout layout = {type, n_rows, n_cols, n_cols, HEADER_SIZE};
+  encode_header(header, &layout, w.checksum);
+  if (!w.failed)
+    w.failed = fseek(w.f, 0, SEEK_SET) != 0 ||
+               fwrite(header, 1, HEADER_SIZE, w.f) != HEADER_SIZE;
+  if (fclose(w.f) != 0)
+    w.failed = 1;
+  free(w.buf);
+  if (w.failed) {
+    fprintf(stderr, "Error %s: cannot write %s: %s\n", caller, path,
+            strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+// Reading
+
+void matrix_file_close(MatrixFile *file) {
+  if (file != NULL) {
+    if (file->size > 0)
+      munmap((void *)file->base, file->size);
+    free(file);
+  }
+}
+
+MatrixFile *matrix_file_open(const char *path, int verify) {
+  if (!host_is_little_endian()) {
+    fprintf(stderr, "Error %s: matrix files need a little-endian host\n",
+            __func__);
+    return NULL;
+  }
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Error %s: cannot open %s: %s\n", __func__, path,
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+  MatrixFile *file = calloc(1, sizeof(MatrixFile));
+  if (file == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    close(fd);
+    return NULL;
+  }
+
+  // The mapping stays valid once the descriptor is closed
+  if (st.st_size > 0) {
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+      fprintf(stderr, "Error %s: cannot map %s: %s\n", __func__, path,
+              strerror(errno));
+      close(fd);
+      free(file);
+      return NULL;
+    }
+    file->base = base;
+    file->size = (size_t)st.st_size;
+  }
+  close(fd);
+
+  const char *problem = parse_header(file->base, file->size, &file->layout);
+  if (problem == NULL) {
+    file->data = file->base + file->layout.data_offset;
+    if (verify && checksum_update(FNV_OFFSET, file->data,
+                                  data_size(&file->layout)) !=
+                      get_u64(file->base + 56))
+      problem = "checksum mismatch";
+  }
+  if (problem != NULL) {
+    fprintf(stderr, "Error %s: %s: %s\n", __func__, path, problem);
+    matrix_file_close(file);
+    return NULL;
+  }
+  return file;
+}
+
+// Descriptor access, for the out-of-core routines
+
+int file_read(int fd, void *buf, size_t size, uint64_t offset) {
+  unsigned char *p = buf;
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, (off_t)offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    size -= (size_t)n;
+    offset += (uint64_t)n;
+  }
+  return 0;
+}
+
+int file_write(int fd, const void *buf, size_t size, uint64_t offset) {
+  const unsigned char *p = buf;
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, (off_t)offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    size -= (size_t)n;
+    offset += (uint64_t)n;
+  }
+  return 0;
+}
+
+int file_open_layout(const char *caller, const char *path, int writable,
+                     FileLayout *layout) {
+  if (!host_is_little_endian()) {
+    fprintf(stderr, "Error %s: matrix files need a little-endian host\n",
+            caller);
+    return -1;
+  }
+  int fd = open(path, writable ? O_RDWR : O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Error %s: cannot open %s: %s\n", caller, path,
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  unsigned char header[HEADER_SIZE];
+  const char *problem = "not a matrix file";
+  if (st.st_size >= HEADER_SIZE &&
+      file_read(fd, header, HEADER_SIZE, 0) == 0)
+    problem = parse_header(header, (size_t)st.st_size, layout);
+  if (problem != NULL) {
+    fprintf(stderr, "Error %s: %s: %s\n", caller, path, problem);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int file_create(const char *caller, const char *path, MatrixElemType type,
+                size_t n_rows, size_t n_cols, FileLayout *layout) {
+  if (!host_is_little_endian()) {
+    fprintf(stderr, "Error %s: matrix files need a little-endian host\n",
+            caller);
+    return -1;
+  }
+  size_t es = elem_size(type);
+  if (n_cols > 0 && n_rows > (SIZE_MAX - HEADER_SIZE) / es / n_cols) {
+    fprintf(stderr, "Error %s: %zu x %zu is too large\n", caller, n_rows,
+            n_cols);
+    return -1;
+  }
+  *layout = (FileLayout){type, n_rows, n_cols, n_cols, HEADER_SIZE};
+
+  // Sized up front: the data reads as zeros until written, sparse on disk
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0 || ftruncate(fd, (off_t)(HEADER_SIZE + data_size(layout))) != 0) {
+    fprintf(stderr, "Error %s: cannot create %s: %s\n", caller, path,
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int file_seal(const char *caller, int fd, const FileLayout *layout) {
+  unsigned char *buf = malloc(IO_BUFFER);
+  if (buf == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return -1;
+  }
+  uint64_t checksum = FNV_OFFSET;
+  size_t size = data_size(layout);
+  int failed = 0;
+  for (size_t done = 0; done < size && !failed;) {
+    size_t n = size - done < IO_BUFFER ? size - done : IO_BUFFER;
+    failed = file_read(fd, buf, n, layout->data_offset + done) != 0;
+    checksum = checksum_update(checksum, buf, n);
+    done += n;
+  }
+  unsigned char header[HEADER_SIZE];
+  encode_header(header, layout, checksum);
+  failed = failed || file_write(fd, header, HEADER_SIZE, 0) != 0;
+  free(buf);
+  if (failed) {
+    fprintf(stderr, "Error %s: cannot write the matrix file: %s\n", caller,
+            strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+MatrixElemType matrix_file_elem_type(MatrixFile *file) {
+  return file->layout.elem_type;
+}
+
+static int check_type(const char *caller, const MatrixFile *file,
+                      MatrixElemType type) {
+  if (file->layout.elem_type != type) {
+    fprintf(stderr, "Error %s: the file holds %s, not %s elements\n", caller,
+            elem_type_name(file->layout.elem_type), elem_type_name(type));
+    return 0;
+  }
+  return 1;
+}
+
+// The API of each element type: save, load (a copy, checksum verified)
+// and file_view (the mapping itself)
+#define FILE_API(T, FN, ELEM, TYPE)                                            \
+  int FN(save)(const char *path, T *mat) {                                     \
+    return file_save(__func__, path, mat->array, mat->n_rows, mat->n_cols,    \
+                     mat->row_stride, mat->col_stride, TYPE);                  \
+  }                                                                            \
+                                                                               \
+  T FN(file_view)(MatrixFile *file) {                                          \
+    if (!check_type(__func__, file, TYPE))                                     \
+      return (T){NULL, 0, 0, 0, 1, NULL};                                      \
+    return FN(view_array)((ELEM *)file->data, file->layout.n_rows,            \
+                          file->layout.n_cols, file->layout.row_stride);       \
+  }                                                                            \
+                                                                               \
+  T *FN(load)(const char *path) {                                              \
+    MatrixFile *file = matrix_file_open(path, 1);                              \
+    if (file == NULL)                                                          \
+      return NULL;                                                             \
+    T *res = NULL;                                                             \
+    if (check_type(__func__, file, TYPE))                                      \
+      res = FN(create)(file->layout.n_rows, file->layout.n_cols);              \
+    if (res != NULL) {                                                         \
+      const ELEM *src = (const ELEM *)file->data;                              \
+      for (size_t i = 0; i < res->n_rows; i++) {                               \
+        memcpy(res->array + i * res->row_stride,                               \
+               src + i * file->layout.row_stride, res->n_cols * sizeof(ELEM)); \
+      }                                                                        \
+    }                                                                          \
+    matrix_file_close(file);                                                   \
+    return res;                                                                \
+  }
+
+#define FLOAT_FN(name) matrix_##name
+FILE_API(Matrix, FLOAT_FN, float, MATRIX_ELEM_FLOAT)
+#define DOUBLE_FN(name) matrixd_##name
+FILE_API(MatrixD, DOUBLE_FN, double, MATRIX_ELEM_DOUBLE)
+#define COMPLEX_FN(name) matrixc_##name
+FILE_API(MatrixC, COMPLEX_FN, float _Complex, MATRIX_ELEM_COMPLEX)
+#define COMPLEX_DOUBLE_FN(name) matrixz_##name
+FILE_API(MatrixZ, COMPLEX_DOUBLE_FN, double _Complex,
+         MATRIX_ELEM_COMPLEX_DOUBLE)
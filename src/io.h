@@ -0,0 +1,39 @@
+#ifndef IO_H
+#define IO_H
+
+#include "matrix.h"
+#include <stdint.h>
+
+// Where the elements of a matrix file are, from its header
+typedef struct file_layout {
+  MatrixElemType elem_type;
+  size_t n_rows;
+  size_t n_cols;
+  size_t row_stride;    // in elements
+  uint64_t data_offset; // in bytes, from the start of the file
+} FileLayout;
+
+// "float", "double", ...
+const char *elem_type_name(MatrixElemType type);
+
+// pread / pwrite of exactly size bytes at offset. 0, or -1 with errno set.
+int file_read(int fd, void *buf, size_t size, uint64_t offset);
+
+int file_write(int fd, const void *buf, size_t size, uint64_t offset);
+
+// Open path, read-only or read-write, and parse its header without
+// verifying the checksum. The descriptor, or -1 after a message naming
+// caller.
+int file_open_layout(const char *caller, const char *path, int writable,
+                     FileLayout *layout);
+
+// Create (or truncate) path as a dense n_rows x n_cols matrix of zeros,
+// open read-write. Its header is only valid once file_seal has run.
+int file_create(const char *caller, const char *path, MatrixElemType type,
+                size_t n_rows, size_t n_cols, FileLayout *layout);
+
+// Checksum the data as it now is and write the header. 0, or -1 after a
+// message.
+int file_seal(const char *caller, int fd, const FileLayout *layout);
+
+#endif // !IO_H
@@ -0,0 +1,501 @@
+#include "alloc.h"
+#include "matrix.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <math.h>
+#include <stdio.h>
+
+// Vector elements per task of the dot products and updates. Dots sum each
+// chunk in double into its own slot, so the result does not depend on the
+// number of threads.
+#define VECTOR_GRAIN (1 << 14)
+
+#define DEFAULT_TOLERANCE 1e-6f
+#define DEFAULT_RESTART 30
+
+// Operators
+
+static void matrix_apply(void *ctx, const float *x, float *y) {
+  Matrix *A = ctx;
+  Matrix xv = matrix_view_array((float *)x, A->n_cols, 1, 1);
+  Matrix yv = matrix_view_array(y, A->n_rows, 1, 1);
+  matrix_gemm(1.0f, A, &xv, 0.0f, &yv);
+}
+
+LinearOperator matrix_operator(Matrix *A) {
+  LinearOperator op = {A->n_rows, matrix_apply, A};
+  return op;
+}
+
+static void sparse_apply(void *ctx, const float *x, float *y) {
+  SparseMatrix *A = ctx;
+  Matrix xv = matrix_view_array((float *)x, A->n_cols, 1, 1);
+  Matrix yv = matrix_view_array(y, A->n_rows, 1, 1);
+  sparse_gemm(1.0f, A, &xv, 0.0f, &yv);
+}
+
+LinearOperator sparse_operator(SparseMatrix *A) {
+  LinearOperator op = {A->n_rows, sparse_apply, A};
+  return op;
+}
+
+// Vector kernels
+
+typedef struct dot_args {
+  size_t n;
+  const float *x, *y;
+  double *partials; // one per VECTOR_GRAIN chunk
+} DotArgs;
+
+static void dot_task(void *arg, size_t begin, size_t end) {
+  DotArgs *a = arg;
+  for (size_t c = begin; c < end; c++) {
+    size_t lo = c * VECTOR_GRAIN;
+    size_t hi = lo + VECTOR_GRAIN < a->n ? lo + VECTOR_GRAIN : a->n;
+    double sum = 0;
+    for (size_t i = lo; i < hi; i++) {
+      sum += (double)a->x[i] * a->y[i];
+    }
+    a->partials[c] = sum;
+  }
+}
+
+// partials holds one double per VECTOR_GRAIN elements of x
+static double dot(size_t n, const float *x, const float *y,
+                  double *partials) {
+  size_t n_chunks = (n + VECTOR_GRAIN - 1) / VECTOR_GRAIN;
+  DotArgs args = {n, x, y, partials};
+  parallel_for(n_chunks, 1, dot_task, &args);
+  double sum = 0;
+  for (size_t c = 0; c < n_chunks; c++) {
+    sum += partials[c];
+  }
+  return sum;
+}
+
+typedef struct axpby_args {
+  float a;
+  const float *x;
+  float b;
+  float *y;
+} AxpbyArgs;
+
+static void axpby_task(void *arg, size_t begin, size_t end) {
+  AxpbyArgs *args = arg;
+  float a = args->a, b = args->b;
+  const float *x = args->x;
+  float *y = args->y;
+  for (size_t i = begin; i < end; i++) {
+    y[i] = a * x[i] + b * y[i];
+  }
+}
+
+// y = a x + b y
+static void axpby(size_t n, float a, const float *x, float b, float *y) {
+  AxpbyArgs args = {a, x, b, y};
+  parallel_for(n, VECTOR_GRAIN, axpby_task, &args);
+}
+
+// r = b - A x
+static void residual(const LinearOperator *A, const float *b, const float *x,
+                     float *r) {
+  A->apply(A->ctx, x, r);
+  axpby(A->n, 1.0f, b, -1.0f, r);
+}
+
+// z = M^-1 r, or z = r without a preconditioner
+static void precondition(const Preconditioner *M, size_t n, const float *r,
+                         float *z) {
+  if (M != NULL) {
+    M->apply(M->ctx, r, z);
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      z[i] = r[i];
+    }
+  }
+}
+
+#ifdef MATRIX_PROFILE
+// Nominal work of applies products y = A x, dots dot products and updates
+// axpbys on n-vectors, for the profiler. A product costs 2 nnz for the
+// built-in operators; a callback's cost is unknown and left out, as is
+// the preconditioner's.
+static double krylov_flops(const LinearOperator *A, double applies,
+                           double dots, double updates) {
+  double nnz = 0;
+  if (A->apply == matrix_apply) {
+    const Matrix *M = A->ctx;
+    nnz = (double)M->n_rows * M->n_cols;
+  } else if (A->apply == sparse_apply) {
+    nnz = ((const SparseMatrix *)A->ctx)->nnz;
+  }
+  return 2.0 * nnz * applies + (2.0 * dots + 3.0 * updates) * A->n;
+}
+
+// The bytes to go with krylov_flops: a float per dense entry, a float and
+// an index per sparse one, and each vector read or written once
+static double krylov_bytes(const LinearOperator *A, double applies,
+                           double dots, double updates) {
+  double per_apply = 0;
+  if (A->apply == matrix_apply) {
+    const Matrix *M = A->ctx;
+    per_apply = 4.0 * M->n_rows * M->n_cols + 8.0 * A->n;
+  } else if (A->apply == sparse_apply) {
+    per_apply = 12.0 * ((const SparseMatrix *)A->ctx)->nnz + 8.0 * A->n;
+  }
+  return per_apply * applies + (8.0 * dots + 12.0 * updates) * A->n;
+}
+
+// Dot products of iter GMRES steps in cycles of m: step j orthogonalizes
+// against j + 1 vectors and takes a norm, (m + 3) / 2 on average. There
+// are as many axpbys, plus one per step for the cycle's update.
+static double gmres_dots(size_t iter, size_t m) {
+  return iter * ((iter < m ? iter : m) + 3) / 2.0;
+}
+#endif
+
+// Shared setup and teardown
+
+// The state every solver starts from: options resolved, b and x packed
+// into contiguous scratch vectors and work holding n_work more of them
+typedef struct krylov_run {
+  size_t n, max_iter;
+  float tolerance;
+  const Preconditioner *precond;
+  int (*monitor)(void *ctx, size_t iteration, float residual);
+  void *monitor_ctx;
+  float *b, *x, *work;
+  double *partials;
+  double b_norm;
+  MatrixArena *scratch;
+  size_t mark;
+} KrylovRun;
+
+static int krylov_begin(KrylovRun *run, const char *caller,
+                        const LinearOperator *A, Matrix *b, Matrix *x,
+                        const KrylovOptions *options, size_t n_work) {
+  size_t n = A->n;
+  if (b->n_rows != n || b->n_cols != 1 || x->n_rows != n || x->n_cols != 1) {
+    fprintf(stderr,
+            "Error %s: A is %zu x %zu, b is %zu x %zu, x is %zu x %zu\n",
+            caller, n, n, b->n_rows, b->n_cols, x->n_rows, x->n_cols);
+    return 0;
+  }
+
+  KrylovOptions defaults = {0};
+  if (options == NULL)
+    options = &defaults;
+  run->n = n;
+  run->tolerance =
+      options->tolerance > 0 ? options->tolerance : DEFAULT_TOLERANCE;
+  run->max_iter = options->max_iter > 0 ? options->max_iter : 10 * n;
+  run->precond = options->precond;
+  run->monitor = options->monitor;
+  run->monitor_ctx = options->monitor_ctx;
+
+  size_t n_chunks = (n + VECTOR_GRAIN - 1) / VECTOR_GRAIN;
+  run->scratch = scratch_arena();
+  run->mark = matrix_arena_mark(run->scratch);
+  run->b = scratch_alloc(run->scratch, (n + 1) * sizeof(float));
+  run->x = scratch_alloc(run->scratch, (n + 1) * sizeof(float));
+  run->work = scratch_alloc(run->scratch, (n_work * n + 1) * sizeof(float));
+  run->partials = scratch_alloc(run->scratch, (n_chunks + 1) * sizeof(double));
+  if (run->b == NULL || run->x == NULL || run->work == NULL ||
+      run->partials == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    scratch_free(run->scratch, run->partials);
+    scratch_free(run->scratch, run->work);
+    scratch_free(run->scratch, run->x);
+    scratch_free(run->scratch, run->b);
+    matrix_arena_reset(run->scratch, run->mark);
+    return 0;
+  }
+
+  matrix_pack(run->b, b);
+  matrix_pack(run->x, x);
+  run->b_norm = sqrt(dot(n, run->b, run->b, run->partials));
+  return 1;
+}
+
+// Report one iteration, 1 if the monitor asked to stop
+static int krylov_monitor(const KrylovRun *run, size_t iteration,
+                          double residual) {
+  return run->monitor != NULL &&
+         run->monitor(run->monitor_ctx, iteration, (float)residual) != 0;
+}
+
+// Write x back, fill info from the true residual (r is n floats of work)
+// and release the scratch. Returns x if converged.
+static Matrix *krylov_end(KrylovRun *run, const LinearOperator *A, Matrix *x,
+                          float *r, size_t iterations, int ok,
+                          KrylovInfo *info) {
+  residual(A, run->b, run->x, r);
+  double r_norm = sqrt(dot(run->n, r, r, run->partials));
+  double rel = run->b_norm > 0 ? r_norm / run->b_norm : r_norm;
+  int converged = ok && rel <= run->tolerance;
+
+  matrix_unpack(x, run->x);
+  if (info != NULL) {
+    info->iterations = iterations;
+    info->residual = (float)rel;
+    info->converged = converged;
+  }
+
+  scratch_free(run->scratch, run->partials);
+  scratch_free(run->scratch, run->work);
+  scratch_free(run->scratch, run->x);
+  scratch_free(run->scratch, run->b);
+  matrix_arena_reset(run->scratch, run->mark);
+  return converged ? x : NULL;
+}
+
+// Solvers
+
+Matrix *krylov_cg(LinearOperator A, Matrix *b, Matrix *x,
+                  const KrylovOptions *options, KrylovInfo *info) {
+  // The setup and the final residual; the iterations are added at the end
+  PROFILE_SCOPE(PROF_KRYLOV_CG, krylov_flops(&A, 1, 2, 1),
+                krylov_bytes(&A, 1, 2, 1));
+  KrylovRun run;
+  if (!krylov_begin(&run, __func__, &A, b, x, options, 4))
+    return NULL;
+  size_t n = run.n;
+  float *r = run.work, *z = r + n, *p = z + n, *q = p + n;
+  double *partials = run.partials;
+  double b_norm = run.b_norm > 0 ? run.b_norm : 1;
+
+  size_t iter = 0;
+  int ok = 1, stop = 0;
+  // The updated r drifts away from b - A x in float, so convergence is
+  // confirmed on the true residual and the iteration restarted from it
+  // if they disagree
+  while (ok && !stop && iter < run.max_iter) {
+    residual(&A, run.b, run.x, r);
+    double rel = sqrt(dot(n, r, r, partials)) / b_norm;
+    if (rel <= run.tolerance)
+      break;
+    precondition(run.precond, n, r, z);
+    for (size_t i = 0; i < n; i++) {
+      p[i] = z[i];
+    }
+    double rz = dot(n, r, z, partials);
+
+    while (rel > run.tolerance && iter < run.max_iter) {
+      A.apply(A.ctx, p, q);
+      double pq = dot(n, p, q, partials);
+      if (!(pq > 0 && rz > 0)) {
+        fprintf(stderr, "Error %s: A or M is not positive definite\n",
+                __func__);
+        ok = 0;
+        break;
+      }
+      double alpha = rz / pq;
+      axpby(n, (float)alpha, p, 1.0f, run.x);
+      axpby(n, (float)-alpha, q, 1.0f, r);
+      iter++;
+
+      rel = sqrt(dot(n, r, r, partials)) / b_norm;
+      if ((stop = krylov_monitor(&run, iter, rel)))
+        break;
+
+      precondition(run.precond, n, r, z);
+      double rz_next = dot(n, r, z, partials);
+      axpby(n, 1.0f, z, (float)(rz_next / rz), p);
+      rz = rz_next;
+    }
+  }
+
+  PROFILE_WORK(krylov_flops(&A, iter, 3.0 * iter, 3.0 * iter),
+               krylov_bytes(&A, iter, 3.0 * iter, 3.0 * iter));
+  return krylov_end(&run, &A, x, r, iter, ok, info);
+}
+
+Matrix *krylov_bicgstab(LinearOperator A, Matrix *b, Matrix *x,
+                        const KrylovOptions *options, KrylovInfo *info) {
+  PROFILE_SCOPE(PROF_KRYLOV_BICGSTAB, krylov_flops(&A, 1, 2, 1),
+                krylov_bytes(&A, 1, 2, 1));
+  KrylovRun run;
+  if (!krylov_begin(&run, __func__, &A, b, x, options, 7))
+    return NULL;
+  size_t n = run.n;
+  float *r = run.work, *r0 = r + n, *p = r0 + n, *v = p + n, *p_hat = v + n,
+        *s_hat = p_hat + n, *t = s_hat + n;
+  double *partials = run.partials;
+  double b_norm = run.b_norm > 0 ? run.b_norm : 1;
+
+  size_t iter = 0;
+  int ok = 1, stop = 0;
+  // Restarted from the true residual like CG
+  while (ok && !stop && iter < run.max_iter) {
+    residual(&A, run.b, run.x, r);
+    double rel = sqrt(dot(n, r, r, partials)) / b_norm;
+    if (rel <= run.tolerance)
+      break;
+    for (size_t i = 0; i < n; i++) {
+      r0[i] = r[i];
+      p[i] = r[i];
+    }
+    double rho = dot(n, r0, r, partials);
+
+    while (rel > run.tolerance && iter < run.max_iter) {
+      // Right preconditioned: the iteration runs on A M^-1 and
+      // x += M^-1 (alpha p + omega s)
+      precondition(run.precond, n, p, p_hat);
+      A.apply(A.ctx, p_hat, v);
+      double r0v = dot(n, r0, v, partials);
+      if (rho == 0 || r0v == 0) {
+        fprintf(stderr, "Error %s: breakdown at iteration %zu\n", __func__,
+                iter);
+        ok = 0;
+        break;
+      }
+      double alpha = rho / r0v;
+      axpby(n, (float)alpha, p_hat, 1.0f, run.x);
+      axpby(n, (float)-alpha, v, 1.0f, r); // r is now s
+      iter++;
+
+      rel = sqrt(dot(n, r, r, partials)) / b_norm;
+      if (rel <= run.tolerance) {
+        stop = krylov_monitor(&run, iter, rel);
+        break;
+      }
+
+      precondition(run.precond, n, r, s_hat);
+      A.apply(A.ctx, s_hat, t);
+      double tt = dot(n, t, t, partials);
+      double omega = tt > 0 ? dot(n, t, r, partials) / tt : 0;
+      if (omega == 0) {
+        fprintf(stderr, "Error %s: breakdown at iteration %zu\n", __func__,
+                iter);
+        ok = 0;
+        break;
+      }
+      axpby(n, (float)omega, s_hat, 1.0f, run.x);
+      axpby(n, (float)-omega, t, 1.0f, r);
+
+      rel = sqrt(dot(n, r, r, partials)) / b_norm;
+      if ((stop = krylov_monitor(&run, iter, rel)))
+        break;
+
+      double rho_next = dot(n, r0, r, partials);
+      double beta = (rho_next / rho) * (alpha / omega);
+      rho = rho_next;
+      // p = r + beta (p - omega v)
+      axpby(n, (float)-omega, v, 1.0f, p);
+      axpby(n, 1.0f, r, (float)beta, p);
+    }
+  }
+
+  PROFILE_WORK(krylov_flops(&A, 2.0 * iter, 6.0 * iter, 6.0 * iter),
+               krylov_bytes(&A, 2.0 * iter, 6.0 * iter, 6.0 * iter));
+  return krylov_end(&run, &A, x, r, iter, ok, info);
+}
+
+Matrix *krylov_gmres(LinearOperator A, Matrix *b, Matrix *x,
+                     const KrylovOptions *options, KrylovInfo *info) {
+  PROFILE_SCOPE(PROF_KRYLOV_GMRES, krylov_flops(&A, 1, 2, 1),
+                krylov_bytes(&A, 1, 2, 1));
+  KrylovRun run;
+  // The m + 1 basis vectors V, then w and z
+  size_t m = options != NULL && options->restart > 0 ? options->restart
+                                                      : DEFAULT_RESTART;
+  if (m > A.n)
+    m = A.n > 0 ? A.n : 1;
+  if (!krylov_begin(&run, __func__, &A, b, x, options, m + 3))
+    return NULL;
+  size_t n = run.n;
+  float *V = run.work, *w = V + (m + 1) * n, *z = w + n;
+  double *partials = run.partials;
+  double b_norm = run.b_norm > 0 ? run.b_norm : 1;
+
+  // The Hessenberg matrix H ((m + 1) x m, row-major), reduced to upper
+  // triangular by the Givens rotations (cs, sn) as it grows; g is the
+  // rotated right-hand side beta e1 and |g[j]| the residual after j steps
+  double *H = scratch_alloc(run.scratch, ((m + 1) * m + 4 * m + 2) *
+                                             sizeof(double));
+  if (H == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return krylov_end(&run, &A, x, z, 0, 0, info);
+  }
+  double *cs = H + (m + 1) * m, *sn = cs + m, *g = sn + m, *y = g + m + 1;
+
+  size_t iter = 0;
+  int stop = 0;
+  double rel = INFINITY;
+  while (!stop && iter < run.max_iter) {
+    residual(&A, run.b, run.x, V);
+    double beta = sqrt(dot(n, V, V, partials));
+    rel = beta / b_norm;
+    if (rel <= run.tolerance)
+      break;
+    axpby(n, 0.0f, V, (float)(1 / beta), V);
+    g[0] = beta;
+
+    size_t j = 0;
+    while (j < m && iter < run.max_iter) {
+      // w = A M^-1 v_j, orthogonalized against v_0..v_j (modified
+      // Gram-Schmidt) and stored as v_j+1
+      float *v_next = V + (j + 1) * n;
+      precondition(run.precond, n, V + j * n, z);
+      A.apply(A.ctx, z, v_next);
+      for (size_t i = 0; i <= j; i++) {
+        double h = dot(n, v_next, V + i * n, partials);
+        H[i * m + j] = h;
+        axpby(n, (float)-h, V + i * n, 1.0f, v_next);
+      }
+      double h_next = sqrt(dot(n, v_next, v_next, partials));
+      if (h_next > 0)
+        axpby(n, 0.0f, v_next, (float)(1 / h_next), v_next);
+
+      for (size_t i = 0; i < j; i++) {
+        double a = H[i * m + j], c = H[(i + 1) * m + j];
+        H[i * m + j] = cs[i] * a + sn[i] * c;
+        H[(i + 1) * m + j] = -sn[i] * a + cs[i] * c;
+      }
+      double d = hypot(H[j * m + j], h_next);
+      cs[j] = d > 0 ? H[j * m + j] / d : 1;
+      sn[j] = d > 0 ? h_next / d : 0;
+      H[j * m + j] = d;
+      g[j + 1] = -sn[j] * g[j];
+      g[j] *= cs[j];
+      j++;
+      iter++;
+
+      rel = fabs(g[j]) / b_norm;
+      if (krylov_monitor(&run, iter, rel))
+        stop = 1;
+      // h_next == 0: the Krylov space is invariant, x is exact
+      if (stop || rel <= run.tolerance || h_next == 0)
+        break;
+    }
+
+    // x += M^-1 V y with H y = g, skipping a singular tail of H
+    while (j > 0 && H[(j - 1) * m + j - 1] == 0) {
+      j--;
+    }
+    for (size_t i = j; i-- > 0;) {
+      double sum = g[i];
+      for (size_t l = i + 1; l < j; l++) {
+        sum -= H[i * m + l] * y[l];
+      }
+      y[i] = sum / H[i * m + i];
+    }
+    for (size_t k = 0; k < n; k++) {
+      w[k] = 0;
+    }
+    for (size_t i = 0; i < j; i++) {
+      axpby(n, (float)y[i], V + i * n, 1.0f, w);
+    }
+    precondition(run.precond, n, w, z);
+    axpby(n, 1.0f, z, 1.0f, run.x);
+    if (j == 0)
+      break; // no progress possible
+  }
+
+  PROFILE_WORK(
+      krylov_flops(&A, iter, gmres_dots(iter, m), gmres_dots(iter, m) + iter),
+      krylov_bytes(&A, iter, gmres_dots(iter, m), gmres_dots(iter, m) + iter));
+  scratch_free(run.scratch, H);
+  return krylov_end(&run, &A, x, z, iter, 1, info);
+}
@@ -0,0 +1,539 @@
+#include "alloc.h"
+#include "gemm.h"
+#include "householder.h"
+#include "matrix.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "trsm.h"
+#include "view.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Columns per Householder panel. A panel's reflectors are accumulated into
+// a compact WY block I - V T V^T and applied to the rest of A (and to b)
+// with a handful of GEMM calls.
+#define QR_BLOCK 32
+
+// Column blocks of the symmetric rank-k update, only the blocks on and
+// above the diagonal are computed
+#define SYRK_BLOCK 64
+
+// A^T B over tall operands is split into row chunks of at least this many
+// rows, whose partial products are then summed
+#define TALL_MIN_CHUNK 4096
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+// C (p x q) = A^T B + beta C on one run of rows. With sym (A == B) only the
+// upper triangle, by blocks, is computed.
+static void tall_product(size_t rows, size_t p, size_t q, const float *A,
+                         size_t lda, const float *B, size_t ldb, float beta,
+                         float *C, int sym) {
+  if (!sym) {
+    gemm_strided(p, q, rows, 1.0f, A, 1, lda, B, ldb, 1, beta, C, q, 1);
+    return;
+  }
+  for (size_t j0 = 0; j0 < q; j0 += SYRK_BLOCK) {
+    size_t nj = min_size(SYRK_BLOCK, q - j0);
+    gemm_strided(j0 + nj, nj, rows, 1.0f, A, 1, lda, &B[j0], ldb, 1, beta,
+                 &C[j0], q, 1);
+  }
+}
+
+typedef struct tall_args {
+  size_t rows;
+  size_t p;
+  size_t q;
+  size_t chunk;
+  const float *A;
+  size_t lda;
+  const float *B;
+  size_t ldb;
+  float *partials; // p x q per chunk
+  int sym;
+} TallArgs;
+
+static void tall_task(void *arg, size_t begin, size_t end) {
+  TallArgs *t = arg;
+  for (size_t c = begin; c < end; c++) {
+    size_t r0 = c * t->chunk;
+    size_t rows = min_size(t->chunk, t->rows - r0);
+    tall_product(rows, t->p, t->q, &t->A[r0 * t->lda], t->lda,
+                 &t->B[r0 * t->ldb], t->ldb, 0.0f,
+                 &t->partials[c * t->p * t->q], t->sym);
+  }
+}
+
+void tall_tn(size_t rows, size_t p, size_t q, const float *A, size_t lda,
+             const float *B, size_t ldb, float beta, float *C, int sym) {
+  size_t n_threads = thread_pool_size();
+  size_t n_chunks = (rows + TALL_MIN_CHUNK - 1) / TALL_MIN_CHUNK;
+  if (n_chunks > 2 * n_threads)
+    n_chunks = 2 * n_threads;
+
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  float *partials = NULL;
+  if (n_threads > 1 && n_chunks > 1)
+    partials = scratch_alloc(scratch, n_chunks * p * q * sizeof(float));
+
+  if (partials == NULL) {
+    tall_product(rows, p, q, A, lda, B, ldb, beta, C, sym);
+  } else {
+    size_t chunk = (rows + n_chunks - 1) / n_chunks;
+    TallArgs args = {rows, p, q, chunk, A, lda, B, ldb, partials, sym};
+    n_chunks = (rows + chunk - 1) / chunk;
+    parallel_for(n_chunks, 1, tall_task, &args);
+
+    for (size_t i = 0; i < p * q; i++) {
+      float sum = beta == 0.0f ? 0.0f : beta * C[i];
+      for (size_t c = 0; c < n_chunks; c++) {
+        sum += partials[c * p * q + i];
+      }
+      C[i] = sum;
+    }
+  }
+
+  if (sym) {
+    for (size_t i = 0; i < p; i++) {
+      for (size_t j = 0; j < i; j++) {
+        C[i * q + j] = C[j * q + i];
+      }
+    }
+  }
+
+  scratch_free(scratch, partials);
+  matrix_arena_reset(scratch, mark);
+}
+
+// Householder panels take one pass over their rows per column: the pass
+// for column j applies the reflector of column j - 1 to each row, then
+// accumulates the dot products column j needs, in chunks of rows summed
+// afterwards
+#define PANEL_CHUNK 1024
+
+typedef struct panel_pass {
+  float *a;
+  size_t n_cols;
+  size_t n_rows;
+  size_t j; // rows [j, n_rows), columns [j, panel_end)
+  size_t panel_end;
+  int has_prev;
+  float prev_scale;
+  float prev_tau;
+  const float *prev_w; // v^T a_c of the previous reflector, from column j
+  size_t chunk;
+  double *partials; // QR_BLOCK per chunk
+} PanelPass;
+
+static void panel_pass_task(void *arg, size_t begin, size_t end) {
+  PanelPass *p = arg;
+  size_t m = p->n_cols, j = p->j, j1 = p->panel_end;
+
+  for (size_t ch = begin; ch < end; ch++) {
+    double acc[QR_BLOCK] = {0};
+    size_t i0 = j + ch * p->chunk;
+    size_t i1 = min_size(i0 + p->chunk, p->n_rows);
+
+    for (size_t i = i0; i < i1; i++) {
+      float *row = &p->a[i * m];
+      if (p->has_prev) {
+        float v = row[j - 1] * p->prev_scale;
+        row[j - 1] = v;
+        for (size_t c = j; c < j1; c++) {
+          row[c] -= p->prev_tau * v * p->prev_w[c - j];
+        }
+      }
+      if (i > j && j < j1) {
+        float x = row[j];
+        for (size_t c = j; c < j1; c++) {
+          acc[c - j] += (double)x * row[c];
+        }
+      }
+    }
+
+    for (size_t c = 0; c < j1 - j; c++) {
+      p->partials[ch * QR_BLOCK + c] = acc[c];
+    }
+  }
+}
+
+// Run the pass for column j of the panel, return its dot products in dots:
+// dots[c] = x[1:] . a_{j+c}[1:] with x = a_j from its diagonal down
+static void panel_pass(PanelPass *p, size_t j, float *dots) {
+  size_t rows = p->n_rows - j;
+  size_t n_chunks = (rows + PANEL_CHUNK - 1) / PANEL_CHUNK;
+  size_t max_chunks = 4 * thread_pool_size();
+  if (n_chunks > max_chunks)
+    n_chunks = max_chunks;
+  if (n_chunks == 0)
+    n_chunks = 1;
+
+  p->j = j;
+  p->chunk = (rows + n_chunks - 1) / n_chunks;
+  if (p->chunk == 0)
+    p->chunk = 1;
+  parallel_for(n_chunks, 1, panel_pass_task, p);
+
+  for (size_t c = 0; c < p->panel_end - j; c++) {
+    double sum = 0.0;
+    for (size_t ch = 0; ch < n_chunks; ch++) {
+      sum += p->partials[ch * QR_BLOCK + c];
+    }
+    dots[c] = (float)sum;
+  }
+}
+
+// Householder QR of a rows x nb panel P (row stride ld), rows >= nb.
+// Leaves R on and above the diagonal and the reflectors below it, with
+// their unit leading entries implied. partials needs QR_BLOCK doubles per
+// chunk (4 per thread), dots and w QR_BLOCK floats.
+static void qr_panel(float *P, size_t rows, size_t ld, size_t nb, float *tau,
+                     float *dots, float *w, double *partials) {
+  PanelPass pass = {.a = P,          .n_cols = ld, .n_rows = rows,
+                    .panel_end = nb, .prev_w = w,  .partials = partials};
+
+  for (size_t j = 0; j < nb; j++) {
+    float *x = &P[j * ld + j];
+    size_t width = nb - j;
+
+    panel_pass(&pass, j, dots);
+    float x0 = x[0], sigma = dots[0];
+
+    pass.has_prev = 1;
+    if (sigma == 0.0f) {
+      // Already zero below the diagonal: H = I
+      tau[j] = 0.0f;
+      pass.prev_scale = 1.0f;
+      pass.prev_tau = 0.0f;
+      continue;
+    }
+
+    float norm = sqrtf(x0 * x0 + sigma);
+    float beta = x0 >= 0.0f ? -norm : norm;
+    float scale = 1.0f / (x0 - beta);
+    tau[j] = (beta - x0) / beta;
+
+    // w_c = v^T a_c with v = (1, x[1:] * scale); the diagonal row is
+    // updated here, the rows below by the next pass
+    for (size_t c = 1; c < width; c++) {
+      w[c - 1] = x[c] + scale * dots[c];
+      x[c] -= tau[j] * w[c - 1];
+    }
+    x[0] = beta;
+    pass.prev_scale = scale;
+    pass.prev_tau = tau[j];
+  }
+
+  // Last reflector: only its v is left to store
+  panel_pass(&pass, nb, dots);
+}
+
+// Compact WY form of one panel
+typedef struct wy_block {
+  size_t nb;
+  float *V1; // nb x nb unit lower triangle of the reflectors, explicit
+  const float *V2; // rows below the panel, in place in a
+  size_t ldv2;
+  size_t rows2;
+  float *T; // nb x nb upper triangular
+  float *W; // nb x ncols workspaces
+  float *W2;
+} WYBlock;
+
+// T such that H_0 H_1 ... H_{nb-1} = I - V T V^T
+static void wy_build(WYBlock *wy, const float *tau) {
+  size_t nb = wy->nb;
+  float *T = wy->T;
+  float *G = wy->W; // V^T V, nb x nb
+
+  gemm_strided(nb, nb, nb, 1.0f, wy->V1, 1, nb, wy->V1, nb, 1, 0.0f, G, nb,
+               1);
+  tall_tn(wy->rows2, nb, nb, wy->V2, wy->ldv2, wy->V2, wy->ldv2, 1.0f, G, 0);
+
+  for (size_t i = 0; i < nb; i++) {
+    T[i * nb + i] = tau[i];
+    for (size_t r = 0; r < i; r++) {
+      float t = 0.0f;
+      for (size_t s = r; s < i; s++) {
+        t += T[r * nb + s] * G[s * nb + i];
+      }
+      T[r * nb + i] = -tau[i] * t;
+    }
+    for (size_t r = i + 1; r < nb; r++) {
+      T[r * nb + i] = 0.0f;
+    }
+  }
+}
+
+// C = (I - V T^T V^T) C = Q^T C, for C with the panel's rows: nb rows at C
+// followed by rows2 more, ncols columns, row stride ldc
+static void wy_apply(WYBlock *wy, float *C, size_t ldc, size_t ncols) {
+  size_t nb = wy->nb;
+  float *C2 = &C[nb * ldc];
+
+  // W = V^T C, W2 = T^T W, C -= V W2
+  gemm_strided(nb, ncols, nb, 1.0f, wy->V1, 1, nb, C, ldc, 1, 0.0f, wy->W,
+               ncols, 1);
+  tall_tn(wy->rows2, nb, ncols, wy->V2, wy->ldv2, C2, ldc, 1.0f, wy->W, 0);
+  gemm_strided(nb, ncols, nb, 1.0f, wy->T, 1, nb, wy->W, ncols, 1, 0.0f,
+               wy->W2, ncols, 1);
+  gemm_strided(nb, ncols, nb, -1.0f, wy->V1, nb, 1, wy->W2, ncols, 1, 1.0f,
+               C, ldc, 1);
+  gemm_strided(wy->rows2, ncols, nb, -1.0f, wy->V2, wy->ldv2, 1, wy->W2,
+               ncols, 1, 1.0f, C2, ldc, 1);
+}
+
+// Panel rows are copied out to a contiguous buffer while the panel is
+// factored, so its column-by-column passes stream through memory instead of
+// striding over the full rows of a
+typedef struct panel_copy {
+  const float *src;
+  float *dst;
+  size_t lds;
+  size_t ldd;
+  size_t nb;
+} PanelCopy;
+
+static void panel_copy_task(void *arg, size_t begin, size_t end) {
+  PanelCopy *p = arg;
+  for (size_t i = begin; i < end; i++) {
+    memcpy(&p->dst[i * p->ldd], &p->src[i * p->lds], p->nb * sizeof(float));
+  }
+}
+
+static void panel_copy(const float *src, size_t lds, float *dst, size_t ldd,
+                       size_t rows, size_t nb) {
+  PanelCopy args = {src, dst, lds, ldd, nb};
+  parallel_for(rows, 1 << 12, panel_copy_task, &args);
+}
+
+int qr_factor_apply(float *a, size_t n, size_t m, float *tau_out, float *b,
+                    size_t k) {
+  size_t ncols = m > k ? m : k;
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  double *partials =
+      scratch_alloc(scratch, 4 * thread_pool_size() * QR_BLOCK * sizeof(double));
+  float *work = scratch_alloc(
+      scratch, (3 * QR_BLOCK * QR_BLOCK + 2 * QR_BLOCK * ncols + 3 * QR_BLOCK) *
+                   sizeof(float));
+  // As tall as A, too large for the scratch arena to hold on to
+  float *P = malloc(n * QR_BLOCK * sizeof(float));
+  if (partials == NULL || work == NULL || P == NULL) {
+    scratch_free(scratch, partials);
+    scratch_free(scratch, work);
+    matrix_arena_reset(scratch, mark);
+    free(P);
+    return -1;
+  }
+
+  float *tau = work, *dots = tau + QR_BLOCK, *w = dots + QR_BLOCK;
+  WYBlock wy = {.V1 = w + QR_BLOCK};
+  wy.T = wy.V1 + QR_BLOCK * QR_BLOCK;
+  wy.W = wy.T + QR_BLOCK * QR_BLOCK;
+  wy.W2 = wy.W + QR_BLOCK * (ncols > QR_BLOCK ? ncols : QR_BLOCK);
+
+  for (size_t j0 = 0; j0 < m; j0 += QR_BLOCK) {
+    size_t j1 = min_size(j0 + QR_BLOCK, m), nb = j1 - j0;
+    float *panel = &a[j0 * m + j0];
+
+    panel_copy(panel, m, P, nb, n - j0, nb);
+    qr_panel(P, n - j0, nb, nb, tau, dots, w, partials);
+    panel_copy(P, nb, panel, m, n - j0, nb);
+
+    wy.nb = nb;
+    wy.V2 = &P[nb * nb];
+    wy.ldv2 = nb;
+    wy.rows2 = n - j1;
+    for (size_t i = 0; i < nb; i++) {
+      for (size_t c = 0; c < nb; c++) {
+        wy.V1[i * nb + c] = c < i ? P[i * nb + c] : (c == i ? 1.0f : 0.0f);
+      }
+    }
+    wy_build(&wy, tau);
+    if (tau_out != NULL)
+      memcpy(&tau_out[j0], tau, nb * sizeof(float));
+
+    if (j1 < m)
+      wy_apply(&wy, &a[j0 * m + j1], m, m - j1);
+    if (k > 0)
+      wy_apply(&wy, &b[j0 * k], k, k);
+  }
+
+  scratch_free(scratch, partials);
+  scratch_free(scratch, work);
+  matrix_arena_reset(scratch, mark);
+  free(P);
+  return 0;
+}
+
+static int check_least_squares(const char *func, Matrix *A, Matrix *b) {
+  if (A->n_rows != b->n_rows) {
+    fprintf(stderr, "Error %s: size mismatch of A (%zu rows) and b (%zu)\n",
+            func, A->n_rows, b->n_rows);
+    return 0;
+  }
+  if (A->n_rows < A->n_cols) {
+    fprintf(stderr, "Error %s: A is %zu x %zu, underdetermined\n", func,
+            A->n_rows, A->n_cols);
+    return 0;
+  }
+  return 1;
+}
+
+Matrix *solve_least_squares(Matrix *A, Matrix *b) {
+  PROFILE_SCOPE(PROF_SOLVE_LEAST_SQUARES,
+                2.0 * A->n_rows * A->n_cols * (A->n_cols + 2.0 * b->n_cols) -
+                    2.0 / 3.0 * A->n_cols * A->n_cols * A->n_cols,
+                4.0 * A->n_rows * (A->n_cols + 2.0 * b->n_cols));
+  if (!check_least_squares("solve_least_squares", A, b))
+    return NULL;
+
+  size_t n = A->n_rows, m = A->n_cols, k = b->n_cols;
+  // Working copies, too large for the scratch arena to hold on to
+  Matrix *QR = matrix_create(n, m);
+  Matrix *Qtb = matrix_create(n, k);
+  Matrix *x = matrix_create(m, k);
+
+  if (QR == NULL || Qtb == NULL || x == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    goto fail;
+  }
+  matrix_pack(QR->array, A);
+  matrix_pack(Qtb->array, b);
+
+  if (qr_factor_apply(QR->array, n, m, NULL, Qtb->array, k) != 0) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    goto fail;
+  }
+  // A diagonal entry of R lost in rounding noise means a dependent column
+  float max_diag = 0.0f;
+  for (size_t i = 0; i < m; i++) {
+    max_diag = fmaxf(max_diag, fabsf(QR->array[i * m + i]));
+  }
+  for (size_t i = 0; i < m; i++) {
+    if (fabsf(QR->array[i * m + i]) <= max_diag * m * FLT_EPSILON) {
+      fprintf(stderr, "Error solve_least_squares: A is rank deficient\n");
+      goto fail;
+    }
+  }
+
+  // R x = (Q^T b)[:m]
+  trsm_upper(m, k, QR->array, m, Qtb->array, k);
+  memcpy(x->array, Qtb->array, m * k * sizeof(float));
+
+  matrix_free(QR);
+  matrix_free(Qtb);
+  return x;
+
+fail:
+  matrix_free(QR);
+  matrix_free(Qtb);
+  matrix_free(x);
+  return NULL;
+}
+
+// Cholesky factorization G = R^T R in place, R in the upper triangle.
+// Returns -1 if G is not positive definite.
+typedef struct cholesky_args {
+  float *G;
+  size_t n;
+  size_t j;
+} CholeskyArgs;
+
+static void cholesky_task(void *arg, size_t begin, size_t end) {
+  CholeskyArgs *c = arg;
+  size_t n = c->n, j = c->j;
+  const float *r_j = &c->G[j * n];
+
+  for (size_t i = j + 1 + begin; i < j + 1 + end; i++) {
+    float *g_i = &c->G[i * n];
+    for (size_t col = i; col < n; col++) {
+      g_i[col] -= r_j[i] * r_j[col];
+    }
+  }
+}
+
+static int cholesky(float *G, size_t n) {
+  CholeskyArgs args = {G, n, 0};
+  for (size_t j = 0; j < n; j++) {
+    float *r_j = &G[j * n];
+    if (!(r_j[j] > 0.0f))
+      return -1;
+    float d = sqrtf(r_j[j]);
+    r_j[j] = d;
+    for (size_t col = j + 1; col < n; col++) {
+      r_j[col] /= d;
+    }
+
+    args.j = j;
+    parallel_for(n - j - 1, pool_grain(n - j), cholesky_task, &args);
+  }
+  return 0;
+}
+
+// The row-chunked products read whole rows: a view with a unit column
+// stride is used as is, anything else (a transposed view) is packed into
+// *copy first. Returns the rows and their stride in *ld, NULL on failure.
+static const float *unit_cols(const Matrix *mat, size_t *ld, Matrix **copy) {
+  *copy = NULL;
+  *ld = mat->row_stride;
+  if (mat->col_stride == 1 || mat->n_cols == 1)
+    return mat->array;
+
+  *copy = matrix_create(mat->n_rows, mat->n_cols);
+  if (*copy == NULL)
+    return NULL;
+  matrix_pack((*copy)->array, mat);
+  *ld = mat->n_cols;
+  return (*copy)->array;
+}
+
+Matrix *solve_normal_equations(Matrix *A, Matrix *b) {
+  PROFILE_SCOPE(PROF_SOLVE_NORMAL_EQUATIONS,
+                (double)A->n_rows * A->n_cols * (A->n_cols + 2.0 * b->n_cols) +
+                    A->n_cols * A->n_cols * A->n_cols / 3.0,
+                4.0 * A->n_rows * (A->n_cols + b->n_cols));
+  if (!check_least_squares("solve_normal_equations", A, b))
+    return NULL;
+
+  size_t n = A->n_rows, m = A->n_cols, k = b->n_cols;
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  Matrix *G = scratch_matrix(scratch, m, m);
+  Matrix *x = matrix_create(m, k);
+  Matrix *A_copy, *b_copy;
+  size_t lda, ldb;
+  const float *a = unit_cols(A, &lda, &A_copy);
+  const float *rhs = unit_cols(b, &ldb, &b_copy);
+
+  if (G == NULL || x == NULL || a == NULL || rhs == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    matrix_free(x);
+    x = NULL;
+  } else {
+    // A^T A by a symmetric rank-n update, A^T b alongside
+    tall_tn(n, m, m, a, lda, a, lda, 0.0f, G->array, 1);
+    tall_tn(n, m, k, a, lda, rhs, ldb, 0.0f, x->array, 0);
+
+    if (cholesky(G->array, m) != 0) {
+      fprintf(stderr, "Error solve_normal_equations: A^T A is not positive "
+                      "definite, A is rank deficient\n");
+      matrix_free(x);
+      x = NULL;
+    } else {
+      trsm_upper_trans(m, k, G->array, m, x->array, k);
+      trsm_upper(m, k, G->array, m, x->array, k);
+    }
+  }
+
+  matrix_free(A_copy);
+  matrix_free(b_copy);
+  matrix_free(G);
+  matrix_arena_reset(scratch, mark);
+  return x;
+}
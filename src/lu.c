@@ -0,0 +1,152 @@
+#include "lu.h"
+#include "alloc.h"
+#include "gemm.h"
+#include "matrix.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "trsm.h"
+#include "view.h"
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+#define T float
+#define FN(name) name
+#define ABS1(x) fabsf(x)
+#include "lu_tmpl.h"
+
+#define T double
+#define FN(name) name##_d
+#define ABS1(x) fabs(x)
+#include "lu_tmpl.h"
+
+// Complex pivots by |re| + |im|, as LAPACK does, which avoids a sqrt
+#define T float _Complex
+#define FN(name) name##_c
+#define ABS1(x) (fabsf(crealf(x)) + fabsf(cimagf(x)))
+#include "lu_tmpl.h"
+
+#define T double _Complex
+#define FN(name) name##_z
+#define ABS1(x) (fabs(creal(x)) + fabs(cimag(x)))
+#include "lu_tmpl.h"
+
+LUFactor *lu_factor(Matrix *A) {
+  PROFILE_SCOPE(PROF_LU_FACTOR, 2.0 / 3.0 * A->n_rows * A->n_rows * A->n_rows,
+                8.0 * A->n_rows * A->n_rows);
+  if (A->n_rows != A->n_cols) {
+    fprintf(stderr, "Error lu_factor: n_rows(%zu) != n_cols(%zu)\n",
+            A->n_rows, A->n_cols);
+    return NULL;
+  }
+
+  size_t n = A->n_rows;
+  LUFactor *lu = malloc(sizeof(LUFactor));
+  if (lu == NULL)
+    return NULL;
+  lu->LU = matrix_create(n, n);
+  lu->pivots = malloc((n > 0 ? n : 1) * sizeof(size_t));
+  if (lu->LU == NULL || lu->pivots == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    lu_factor_free(lu);
+    return NULL;
+  }
+
+  matrix_pack(lu->LU->array, A);
+  lu->sign = lu_factorize(lu->LU->array, n, lu->pivots);
+  return lu;
+}
+
+void lu_factor_free(LUFactor *lu) {
+  if (lu != NULL) {
+    matrix_free(lu->LU);
+    free(lu->pivots);
+    free(lu);
+  }
+}
+
+Matrix *lu_solve_into(Matrix *x, LUFactor *lu, Matrix *b) {
+  PROFILE_SCOPE(PROF_LU_SOLVE,
+                2.0 * lu->LU->n_rows * lu->LU->n_rows * b->n_cols,
+                4.0 * lu->LU->n_rows * (lu->LU->n_rows + 2.0 * b->n_cols));
+  size_t n = lu->LU->n_rows;
+
+  if (b->n_rows != n) {
+    fprintf(stderr, "Error lu_solve: b has %zu rows, expected %zu\n",
+            b->n_rows, n);
+    return NULL;
+  }
+  if (x->n_rows != b->n_rows || x->n_cols != b->n_cols) {
+    fprintf(stderr, "Error lu_solve_into: x is %zu x %zu, expected %zu x %zu\n",
+            x->n_rows, x->n_cols, b->n_rows, b->n_cols);
+    return NULL;
+  }
+  if (lu->sign == 0) {
+    fprintf(stderr, "Error lu_solve: matrix is singular\n");
+    return NULL;
+  }
+
+  // The solve needs contiguous rows (any single column will do),
+  // otherwise it runs on a scratch copy
+  size_t k = b->n_cols;
+  if (x->col_stride == 1 || k == 1) {
+    matrix_copy(x, b);
+    lu_solve_raw(lu->LU->array, lu->pivots, n, x->array, k, x->row_stride);
+    return x;
+  }
+
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  Matrix *tmp = scratch_matrix(scratch, n, k);
+  if (tmp == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    matrix_arena_reset(scratch, mark);
+    return NULL;
+  }
+  matrix_pack(tmp->array, b);
+  lu_solve_raw(lu->LU->array, lu->pivots, n, tmp->array, k, k);
+  matrix_unpack(x, tmp->array);
+  matrix_free(tmp);
+  matrix_arena_reset(scratch, mark);
+  return x;
+}
+
+Matrix *lu_solve(LUFactor *lu, Matrix *b) {
+  Matrix *x = matrix_create(b->n_rows, b->n_cols);
+  if (x == NULL)
+    return NULL;
+
+  if (lu_solve_into(x, lu, b) == NULL) {
+    matrix_free(x);
+    return NULL;
+  }
+  return x;
+}
+
+float lu_det(LUFactor *lu) {
+  if (lu->sign == 0)
+    return 0.0f;
+
+  size_t n = lu->LU->n_rows;
+  float det = lu->sign;
+  for (size_t i = 0; i < n; i++) {
+    det *= lu->LU->array[i * n + i];
+  }
+  return det;
+}
+
+Matrix *lu_inverse(LUFactor *lu) {
+  Matrix *inv = matrix_identity(lu->LU->n_rows);
+  if (inv == NULL)
+    return NULL;
+
+  if (lu_solve_into(inv, lu, inv) == NULL) {
+    matrix_free(inv);
+    return NULL;
+  }
+  return inv;
+}
@@ -0,0 +1,36 @@
+#ifndef LU_H
+#define LU_H
+
+#include "matrix.h"
+
+// P A = L U, packed: L below the diagonal (unit diagonal implied), U on
+// and above it. Row i was swapped with row pivots[i] at step i.
+struct lu_factor {
+  Matrix *LU;
+  size_t *pivots;
+  int sign; // of the permutation, 0 when A is singular
+};
+
+// Factor the n x n row-major matrix a in place. Returns the sign of the
+// row permutation, or 0 if a zero pivot was met (a is singular).
+int lu_factorize(float *a, size_t n, size_t *pivots);
+
+// Overwrite the n x k matrix X (row-major, row stride ldx >= k) with the
+// solution of A X = X, given the factorization of A from lu_factorize
+void lu_solve_raw(const float *lu, const size_t *pivots, size_t n, float *X,
+                  size_t k, size_t ldx);
+
+// The same for double, complex float and complex double (lu_tmpl.h)
+int lu_factorize_d(double *a, size_t n, size_t *pivots);
+void lu_solve_raw_d(const double *lu, const size_t *pivots, size_t n,
+                    double *X, size_t k, size_t ldx);
+
+int lu_factorize_c(float _Complex *a, size_t n, size_t *pivots);
+void lu_solve_raw_c(const float _Complex *lu, const size_t *pivots, size_t n,
+                    float _Complex *X, size_t k, size_t ldx);
+
+int lu_factorize_z(double _Complex *a, size_t n, size_t *pivots);
+void lu_solve_raw_z(const double _Complex *lu, const size_t *pivots, size_t n,
+                    double _Complex *X, size_t k, size_t ldx);
+
+#endif // !LU_H
@@ -0,0 +1,98 @@
+// Blocked LU with partial pivoting and the solves built on it, included by
+// lu.c once per element type. The includer defines T, FN(name) (the name
+// of this instance of `name`) and ABS1(x), the magnitude pivots are chosen
+// by; all are undefined again at the end.
+
+static void FN(swap_rows)(T *a, size_t n_cols, size_t lda, size_t row1,
+                          size_t row2) {
+  T *r1 = &a[row1 * lda], *r2 = &a[row2 * lda];
+  for (size_t j = 0; j < n_cols; j++) {
+    T tmp = r1[j];
+    r1[j] = r2[j];
+    r2[j] = tmp;
+  }
+}
+
+// Eliminate column j from the rows below it, within the panel
+typedef struct FN(panel_args) {
+  T *a;
+  size_t n;
+  size_t j;
+  size_t panel_end;
+} FN(PanelArgs);
+
+static void FN(panel_task)(void *arg, size_t begin, size_t end) {
+  FN(PanelArgs) *p = arg;
+  size_t n = p->n, j = p->j;
+  const T *pivot_row = &p->a[j * n];
+
+  for (size_t i = j + 1 + begin; i < j + 1 + end; i++) {
+    T *row = &p->a[i * n];
+    T l = row[j] / pivot_row[j];
+    row[j] = l;
+    for (size_t c = j + 1; c < p->panel_end; c++) {
+      row[c] -= l * pivot_row[c];
+    }
+  }
+}
+
+int FN(lu_factorize)(T *a, size_t n, size_t *pivots) {
+  int sign = 1, singular = 0;
+
+  // Each panel of columns is factored column by column, then the trailing
+  // matrix gets one rank-block update through the GEMM kernel, where
+  // nearly all the flops go
+  size_t block = matrix_get_tuning().lu_block;
+  for (size_t k = 0; k < n; k += block) {
+    size_t k_end = min_size(k + block, n);
+
+    // Panel: columns [k, k_end), every row below k
+    FN(PanelArgs) panel = {a, n, 0, k_end};
+    for (size_t j = k; j < k_end; j++) {
+      size_t pivot_index = j;
+      for (size_t i = j + 1; i < n; i++) {
+        if (ABS1(a[i * n + j]) > ABS1(a[pivot_index * n + j]))
+          pivot_index = i;
+      }
+      pivots[j] = pivot_index;
+      if (pivot_index != j) {
+        FN(swap_rows)(a, n, n, j, pivot_index);
+        sign = -sign;
+      }
+      if (a[j * n + j] == 0) {
+        singular = 1; // nothing to eliminate with, move on
+        continue;
+      }
+
+      panel.j = j;
+      parallel_for(n - j - 1, pool_grain(k_end - j), FN(panel_task), &panel);
+    }
+
+    if (k_end == n)
+      break;
+
+    // Block row of U: U12 = L11^-1 A12, then A22 -= L21 * U12
+    FN(trsm_lower_unit)(k_end - k, n - k_end, &a[k * n + k], n,
+                        &a[k * n + k_end], n);
+    FN(gemm_strided)(n - k_end, n - k_end, k_end - k, -1, &a[k_end * n + k],
+                     n, 1, &a[k * n + k_end], n, 1, 1, &a[k_end * n + k_end],
+                     n, 1);
+  }
+
+  return singular ? 0 : sign;
+}
+
+void FN(lu_solve_raw)(const T *lu, const size_t *pivots, size_t n, T *X,
+                      size_t k, size_t ldx) {
+  for (size_t i = 0; i < n; i++) {
+    if (pivots[i] != i)
+      FN(swap_rows)(X, k, ldx, i, pivots[i]);
+  }
+  FN(trsm_lower_unit)(n, k, lu, n, X, ldx);
+  FN(trsm_upper)(n, k, lu, n, X, ldx);
+}
+
+
+#undef T
+#undef FN
+#undef ABS1
@@ -1,4 +1,10 @@
 #include "matrix.h"
+#include "alloc.h"
+#include "lu.h"
+#include "profile.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "view.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,53 +15,127 @@ int compare_floats(float a, float b, float tolerance) {
   return fabsf(a - b) < tolerance;
 }
 
-// Function to check if two matrices are approximately equal
-int matrices_are_approx_equal(Matrix *A, Matrix *B, float tolerance) {
-  size_t n = A->n_rows;
-  size_t m = A->n_cols;
-
-  if (n != B->n_rows || m != B->n_cols) {
-    return 0; // Different dimensions
+// Element-wise kernels are split over the thread pool in chunks of this
+// many floats (256KB), large enough to hide the scheduling cost
+#define ELEMENTWISE_GRAIN (1 << 16)
+
+typedef enum { OP_ADD, OP_SUB, OP_SCALE, OP_APPROX_EQUAL } ElementwiseOp;
+
+typedef struct elementwise_args {
+  ElementwiseOp op;
+  const Matrix *a;
+  const Matrix *b;
+  Matrix *out;
+  float scalar; // scale factor or tolerance
+  int differs;  // set by OP_APPROX_EQUAL
+} ElementwiseArgs;
+
+// n contiguous floats
+static void elementwise_span(ElementwiseArgs *args, size_t n, const float *a,
+                             const float *b, float *out) {
+  const SimdKernels *simd = simd_kernels();
+
+  switch (args->op) {
+  case OP_ADD:
+    simd->add(n, a, b, out);
+    break;
+  case OP_SUB:
+    simd->sub(n, a, b, out);
+    break;
+  case OP_SCALE:
+    simd->scale(n, args->scalar, a, out);
+    break;
+  case OP_APPROX_EQUAL:
+    if (__atomic_load_n(&args->differs, __ATOMIC_RELAXED))
+      return;
+    if (!simd->approx_equal(n, a, b, args->scalar))
+      __atomic_store_n(&args->differs, 1, __ATOMIC_RELAXED);
+    break;
   }
+}
 
-  for (size_t i = 0; i < n; i++) {
-    for (size_t j = 0; j < m; j++) {
-      if (fabs(A->array[i * m + j] - B->array[i * m + j]) > tolerance) {
-        return 0; // Not approximately equal
+static void elementwise_task(void *arg, size_t begin, size_t end) {
+  ElementwiseArgs *args = arg;
+  float *out = args->out != NULL ? args->out->array + begin : NULL;
+  const float *b = args->b != NULL ? args->b->array + begin : NULL;
+
+  elementwise_span(args, end - begin, args->a->array + begin, b, out);
+}
+
+// Views that are not dense go row by row. Rows with a unit column stride
+// still run the SIMD kernels, the others (transposed views) a scalar loop.
+static void elementwise_rows_task(void *arg, size_t begin, size_t end) {
+  ElementwiseArgs *args = arg;
+  const Matrix *a = args->a, *b = args->b;
+  Matrix *out = args->out;
+  size_t n_cols = a->n_cols;
+  int unit = a->col_stride == 1 && (b == NULL || b->col_stride == 1) &&
+             (out == NULL || out->col_stride == 1);
+
+  for (size_t i = begin; i < end; i++) {
+    if (unit) {
+      elementwise_span(args, n_cols, &MATRIX_AT(a, i, 0),
+                       b != NULL ? &MATRIX_AT(b, i, 0) : NULL,
+                       out != NULL ? &MATRIX_AT(out, i, 0) : NULL);
+      continue;
+    }
+    for (size_t j = 0; j < n_cols; j++) {
+      float x = MATRIX_AT(a, i, j);
+      switch (args->op) {
+      case OP_ADD:
+        MATRIX_AT(out, i, j) = x + MATRIX_AT(b, i, j);
+        break;
+      case OP_SUB:
+        MATRIX_AT(out, i, j) = x - MATRIX_AT(b, i, j);
+        break;
+      case OP_SCALE:
+        MATRIX_AT(out, i, j) = args->scalar * x;
+        break;
+      case OP_APPROX_EQUAL:
+        if (fabsf(x - MATRIX_AT(b, i, j)) > args->scalar) {
+          __atomic_store_n(&args->differs, 1, __ATOMIC_RELAXED);
+          return;
+        }
+        break;
       }
     }
   }
-  return 1; // Approximately equal
 }
 
-Matrix *matrix_create(size_t n_rows, size_t n_cols) {
-  Matrix *mat = malloc(sizeof(Matrix));
+static void elementwise(ElementwiseArgs *args) {
+  const Matrix *a = args->a;
+  size_t n_rows = a->n_rows, n_cols = a->n_cols;
 
-  if (mat == NULL)
-    return NULL;
+  if (matrix_is_dense(a) && (args->b == NULL || matrix_is_dense(args->b)) &&
+      (args->out == NULL || matrix_is_dense(args->out))) {
+    parallel_for(n_rows * n_cols, ELEMENTWISE_GRAIN, elementwise_task, args);
+  } else {
+    parallel_for(n_rows, 1 + ELEMENTWISE_GRAIN / (n_cols + 1),
+                 elementwise_rows_task, args);
+  }
+}
 
-  mat->n_rows = n_rows;
-  mat->n_cols = n_cols;
-  mat->array = malloc(n_rows * n_cols * sizeof(float));
+// Function to check if two matrices are approximately equal
+int matrices_are_approx_equal(Matrix *A, Matrix *B, float tolerance) {
+  size_t n = A->n_rows;
+  size_t m = A->n_cols;
 
-  if (mat->array == NULL) {
-    free(mat);
-    return NULL;
+  if (n != B->n_rows || m != B->n_cols) {
+    return 0; // Different dimensions
   }
 
-  return mat;
+  ElementwiseArgs args = {OP_APPROX_EQUAL, A, B, NULL, tolerance};
+  elementwise(&args);
+  return !args.differs;
 }
 
-void matrix_free(Matrix *mat) {
-  if (mat != NULL) {
-    free(mat->array);
-    free(mat);
-  }
+Matrix *matrix_create(size_t n_rows, size_t n_cols) {
+  return matrix_create_with(NULL, n_rows, n_cols);
 }
 
 void matrix_set(Matrix *mat, size_t row, size_t col, float value) {
   if (row < mat->n_rows && col < mat->n_cols) {
-    mat->array[row * mat->n_cols + col] = value;
+    MATRIX_AT(mat, row, col) = value;
   } else {
     fprintf(stderr,
             "Error: row (%zu) or col (%zu) is bigger than n_rows (%zu) or "
@@ -76,12 +156,12 @@ void matrix_set_array(Matrix *mat, float array[], size_t size) {
   }
 
   // Copy the contents of the input array into the matrix's array
-  memcpy(mat->array, array, size * sizeof(float));
+  matrix_unpack(mat, array);
 }
 
 float matrix_get(Matrix *mat, size_t row, size_t col) {
   if (row < mat->n_rows && col < mat->n_cols) {
-    return mat->array[row * mat->n_cols + col];
+    return MATRIX_AT(mat, row, col);
   } else {
     fprintf(stderr,
             "Error: row (%zu) or col (%zu) is bigger than n_rows (%zu) or "
@@ -100,16 +180,57 @@ void matrix_print(Matrix *mat) {
   }
 }
 
+// Shape checks shared by the _into variants
+static int same_shape(const char *func, Matrix *dst, size_t n_rows,
+                      size_t n_cols) {
+  if (dst->n_rows != n_rows || dst->n_cols != n_cols) {
+    fprintf(stderr, "Error %s: dst is %zu x %zu, expected %zu x %zu\n", func,
+            dst->n_rows, dst->n_cols, n_rows, n_cols);
+    return 0;
+  }
+  return 1;
+}
+
+Matrix *matrix_scale_into(Matrix *dst, float scalar, Matrix *mat) {
+  PROFILE_SCOPE(PROF_MATRIX_SCALE, (double)mat->n_rows * mat->n_cols,
+                8.0 * mat->n_rows * mat->n_cols);
+  if (!same_shape("matrix_scale_into", dst, mat->n_rows, mat->n_cols))
+    return NULL;
+
+  ElementwiseArgs args = {OP_SCALE, mat, NULL, dst, scalar};
+  elementwise(&args);
+  return dst;
+}
+
+Matrix *matrix_scale_inplace(float scalar, Matrix *mat) {
+  return matrix_scale_into(mat, scalar, mat);
+}
+
 Matrix *matrix_scale(float scalar, Matrix *mat) {
   Matrix *res = matrix_create(mat->n_rows, mat->n_cols);
   if (res == NULL)
     return NULL;
 
-  for (size_t i = 0; i < mat->n_rows * mat->n_cols; ++i) {
-    res->array[i] = scalar * mat->array[i];
+  return matrix_scale_into(res, scalar, mat);
+}
+
+Matrix *matrix_add_into(Matrix *dst, Matrix *mat1, Matrix *mat2) {
+  PROFILE_SCOPE(PROF_MATRIX_ADD, (double)mat1->n_rows * mat1->n_cols,
+                12.0 * mat1->n_rows * mat1->n_cols);
+  if (mat1->n_rows != mat2->n_rows || mat1->n_cols != mat2->n_cols) {
+    fprintf(stderr, "Error: size mismatch\n");
+    return NULL;
   }
+  if (!same_shape("matrix_add_into", dst, mat1->n_rows, mat1->n_cols))
+    return NULL;
 
-  return res;
+  ElementwiseArgs args = {OP_ADD, mat1, mat2, dst};
+  elementwise(&args);
+  return dst;
+}
+
+Matrix *matrix_add_inplace(Matrix *mat1, Matrix *mat2) {
+  return matrix_add_into(mat1, mat1, mat2);
 }
 
 Matrix *matrix_add(Matrix *mat1, Matrix *mat2) {
@@ -121,11 +242,26 @@ Matrix *matrix_add(Matrix *mat1, Matrix *mat2) {
   if (res == NULL)
     return NULL;
 
-  for (size_t i = 0; i < mat1->n_rows * mat1->n_cols; ++i) {
-    res->array[i] = mat1->array[i] + mat2->array[i];
+  return matrix_add_into(res, mat1, mat2);
+}
+
+Matrix *matrix_subtract_into(Matrix *dst, Matrix *mat1, Matrix *mat2) {
+  PROFILE_SCOPE(PROF_MATRIX_SUBTRACT, (double)mat1->n_rows * mat1->n_cols,
+                12.0 * mat1->n_rows * mat1->n_cols);
+  if (mat1->n_rows != mat2->n_rows || mat1->n_cols != mat2->n_cols) {
+    fprintf(stderr, "Error: size mismatch\n");
+    return NULL;
   }
+  if (!same_shape("matrix_subtract_into", dst, mat1->n_rows, mat1->n_cols))
+    return NULL;
 
-  return res;
+  ElementwiseArgs args = {OP_SUB, mat1, mat2, dst};
+  elementwise(&args);
+  return dst;
+}
+
+Matrix *matrix_subtract_inplace(Matrix *mat1, Matrix *mat2) {
+  return matrix_subtract_into(mat1, mat1, mat2);
 }
 
 Matrix *matrix_subtract(Matrix *mat1, Matrix *mat2) {
@@ -137,11 +273,18 @@ Matrix *matrix_subtract(Matrix *mat1, Matrix *mat2) {
   if (res == NULL)
     return NULL;
 
-  for (size_t i = 0; i < mat1->n_rows * mat1->n_cols; ++i) {
-    res->array[i] = mat1->array[i] - mat2->array[i];
+  return matrix_subtract_into(res, mat1, mat2);
+}
+
+Matrix *matrix_mult_into(Matrix *dst, Matrix *mat1, Matrix *mat2) {
+  if (mat1->n_cols != mat2->n_rows) {
+    fprintf(stderr, "Error: size mismatch\n");
+    return NULL;
   }
+  if (!same_shape("matrix_mult_into", dst, mat1->n_rows, mat2->n_cols))
+    return NULL;
 
-  return res;
+  return matrix_gemm(1.0f, mat1, mat2, 0.0f, dst);
 }
 
 Matrix *matrix_mult(Matrix *mat1, Matrix *mat2) {
@@ -158,78 +301,178 @@ Matrix *matrix_mult(Matrix *mat1, Matrix *mat2) {
     return NULL;
   }
 
-  // Initialize the result matrix with zeros
-  for (size_t i = 0; i < res->n_rows; ++i) {
-    for (size_t j = 0; j < res->n_cols; ++j) {
-      float val = 0.0f; // Initialize val to 0
-      for (size_t k = 0; k < mat1->n_cols; ++k) {
-        val += matrix_get(mat1, i, k) * matrix_get(mat2, k, j);
+  return matrix_mult_into(res, mat1, mat2);
+}
+
+// Transpose works on square tiles (of side trans_tile in the tuning) so
+// both the rows read and the rows written stay in cache; each task
+// handles a stripe of one tile of rows
+typedef struct trans_args {
+  const Matrix *src;
+  Matrix *dst;
+  size_t tile;
+} TransArgs;
+
+static void trans_task(void *arg, size_t begin, size_t end) {
+  TransArgs *t = arg;
+  const Matrix *src = t->src;
+  Matrix *dst = t->dst;
+  size_t n_rows = src->n_rows, n_cols = src->n_cols;
+  size_t tile = t->tile;
+  size_t row_end = end * tile < n_rows ? end * tile : n_rows;
+
+  for (size_t i0 = begin * tile; i0 < row_end; i0 += tile) {
+    size_t i1 = i0 + tile < row_end ? i0 + tile : row_end;
+    for (size_t j0 = 0; j0 < n_cols; j0 += tile) {
+      size_t j1 = j0 + tile < n_cols ? j0 + tile : n_cols;
+      for (size_t i = i0; i < i1; i++) {
+        for (size_t j = j0; j < j1; j++) {
+          MATRIX_AT(dst, j, i) = MATRIX_AT(src, i, j);
+        }
       }
-      matrix_set(res, i, j, val);
     }
   }
+}
 
-  return res;
+Matrix *matrix_trans_into(Matrix *dst, Matrix *mat) {
+  PROFILE_SCOPE(PROF_MATRIX_TRANS, 0.0, 8.0 * mat->n_rows * mat->n_cols);
+  if (!same_shape("matrix_trans_into", dst, mat->n_cols, mat->n_rows))
+    return NULL;
+  if (matrix_overlaps(dst, mat)) {
+    fprintf(stderr, "Error matrix_trans_into: dst must not alias mat, use "
+                    "matrix_trans_inplace\n");
+    return NULL;
+  }
+
+  TransArgs args = {mat, dst, matrix_get_tuning().trans_tile};
+  size_t n_stripes = (mat->n_rows + args.tile - 1) / args.tile;
+  // About 64K elements per task
+  size_t grain = 1 + (1 << 16) / (args.tile * (mat->n_cols + 1));
+  parallel_for(n_stripes, grain, trans_task, &args);
+
+  return dst;
 }
 
 Matrix *matrix_trans(Matrix *mat) {
   Matrix *res = matrix_create(mat->n_cols, mat->n_rows);
+  if (res == NULL)
+    return NULL;
 
-  for (size_t i = 0; i < res->n_rows; ++i) {
-    for (size_t j = 0; j < res->n_cols; ++j) {
-      matrix_set(res, i, j, matrix_get(mat, j, i));
-    }
-  }
-
-  return res;
+  return matrix_trans_into(res, mat);
 }
 
-void lu_decomposition(Matrix *A, Matrix *L, Matrix *U) {
-  size_t n = A->n_rows;
-
-  for (size_t i = 0; i < n; i++) {
-    for (size_t j = i; j < n; j++) {
-      // Upper Triangular
-      U->array[i * n + j] = A->array[i * n + j];
-      for (size_t k = 0; k < i; k++) {
-        U->array[i * n + j] -= L->array[i * n + k] * U->array[k * n + j];
+// Square in-place transpose: stripe I swaps its tiles right of the
+// diagonal with their mirror images below it, so stripes never overlap
+static void trans_square_task(void *arg, size_t begin, size_t end) {
+  TransArgs *t = arg;
+  Matrix *a = t->dst;
+  size_t n = a->n_rows, tile = t->tile;
+
+  for (size_t i0 = begin * tile; i0 < end * tile && i0 < n; i0 += tile) {
+    size_t i1 = i0 + tile < n ? i0 + tile : n;
+    for (size_t j0 = i0; j0 < n; j0 += tile) {
+      size_t j1 = j0 + tile < n ? j0 + tile : n;
+      for (size_t i = i0; i < i1; i++) {
+        for (size_t j = j0 == i0 ? i + 1 : j0; j < j1; j++) {
+          float tmp = MATRIX_AT(a, i, j);
+          MATRIX_AT(a, i, j) = MATRIX_AT(a, j, i);
+          MATRIX_AT(a, j, i) = tmp;
+        }
       }
     }
+  }
+}
 
-    for (size_t j = i; j < n; j++) {
-      if (i == j) {
-        L->array[i * n + i] = 1; // Diagonal as 1
-      } else {
-        // Lower Triangular
-        L->array[j * n + i] = A->array[j * n + i];
-        for (size_t k = 0; k < i; k++) {
-          L->array[j * n + i] -= L->array[j * n + k] * U->array[k * n + i];
-        }
-        L->array[j * n + i] /= U->array[i * n + i];
-      }
+// Rectangular in-place transpose by cycle following. The element at flat
+// index k of an r x c matrix moves to k * r mod (r * c - 1). Each cycle
+// is rotated once, from its smallest index, which is found by walking the
+// cycle instead of keeping a visited bitmap, so no memory is needed.
+static void trans_cycles(float *a, size_t n_rows, size_t n_cols) {
+  size_t last = n_rows * n_cols - 1;
+
+  for (size_t start = 1; start < last; start++) {
+    size_t k = start * n_rows % last;
+    while (k > start) {
+      k = k * n_rows % last;
     }
+    if (k < start)
+      continue; // cycle already rotated from a smaller index
+
+    float carried = a[start];
+    k = start;
+    do {
+      size_t next = k * n_rows % last;
+      float tmp = a[next];
+      a[next] = carried;
+      carried = tmp;
+      k = next;
+    } while (k != start);
   }
 }
 
+Matrix *matrix_trans_inplace(Matrix *mat) {
+  PROFILE_SCOPE(PROF_MATRIX_TRANS_INPLACE, 0.0,
+                8.0 * mat->n_rows * mat->n_cols);
+  size_t n_rows = mat->n_rows, n_cols = mat->n_cols;
+
+  if (n_rows == n_cols) {
+    TransArgs args = {NULL, mat, matrix_get_tuning().trans_tile};
+    size_t n_stripes = (n_rows + args.tile - 1) / args.tile;
+    size_t grain = 1 + (1 << 16) / (args.tile * (n_cols + 1));
+    parallel_for(n_stripes, grain, trans_square_task, &args);
+  } else if (!matrix_is_dense(mat)) {
+    fprintf(stderr, "Error matrix_trans_inplace: a %zu x %zu view is not "
+                    "square, use matrix_trans_view\n",
+            n_rows, n_cols);
+    return NULL;
+  } else {
+    if (n_rows > 1 && n_cols > 1)
+      trans_cycles(mat->array, n_rows, n_cols);
+    mat->row_stride = n_rows;
+    mat->col_stride = 1;
+  }
+
+  mat->n_rows = n_cols;
+  mat->n_cols = n_rows;
+  return mat;
+}
+
 float matrix_determinant(Matrix *mat) {
+  PROFILE_SCOPE(PROF_MATRIX_DETERMINANT,
+                2.0 / 3.0 * mat->n_rows * mat->n_rows * mat->n_rows,
+                8.0 * mat->n_rows * mat->n_rows);
   if (mat->n_rows != mat->n_cols) {
     fprintf(stderr, "Error matrix_determinant: n_rows(%zu) != n_cols(%zu)\n",
             mat->n_rows, mat->n_cols);
     return NAN;
   }
 
-  Matrix *lower = matrix_create(mat->n_rows, mat->n_cols);
-  Matrix *upper = matrix_create(mat->n_rows, mat->n_cols);
-  lu_decomposition(mat, lower, upper);
-
-  float det = 1;
+  StructuredMatrix *S = structured_detect(mat);
+  if (S != NULL) {
+    float det = structured_determinant(S);
+    structured_free(S);
+    return det;
+  }
 
-  for (size_t i = 0; i < upper->n_rows; i++) {
-    det *= matrix_get(upper, i, i);
-  };
+  // Factor a scratch copy, the pivot record lives in the arena too
+  size_t n = mat->n_rows;
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  Matrix *lu = scratch_matrix(scratch, n, n);
+  size_t *pivots = scratch_alloc(scratch, (n + 1) * sizeof(size_t));
+  float det = NAN;
+
+  if (lu != NULL && pivots != NULL) {
+    matrix_pack(lu->array, mat);
+    det = lu_factorize(lu->array, n, pivots);
+    for (size_t i = 0; i < n && det != 0.0f; i++) {
+      det *= lu->array[i * n + i];
+    }
+  }
 
-  matrix_free(lower);
-  matrix_free(upper);
+  matrix_free(lu);
+  scratch_free(scratch, pivots);
+  matrix_arena_reset(scratch, mark);
   return det;
 }
 
@@ -249,141 +492,91 @@ Matrix *matrix_identity(size_t n) {
   return I;
 }
 
-void matrix_swap_rows(Matrix *mat, size_t row1, size_t row2) {
-  if (row1 > mat->n_rows) {
-    fprintf(stderr, "Error matrix_swap_rows: row1 (%zu) > matrix n_rows (%zu)",
-            row1, mat->n_rows);
-  } else if (row2 > mat->n_rows) {
-    fprintf(stderr, "Error matrix_swap_rows: row2 (%zu) > matrix n_rows (%zu)",
-            row2, mat->n_rows);
-  };
-
-  for (size_t j = 0; j < mat->n_cols; j++) {
-    float temp_val = matrix_get(mat, row1, j);
-
-    matrix_set(mat, row1, j, matrix_get(mat, row2, j));
-    matrix_set(mat, row2, j, temp_val);
-  }
-}
-
-Matrix *matrix_inverse(Matrix *mat) {
+// Factor a scratch copy of mat, then solve A X = I with blocked
+// triangular solves. dst is only written once mat has been copied, so it
+// may be mat itself. A dst whose rows are not contiguous is solved in
+// scratch and copied out.
+Matrix *matrix_inverse_into(Matrix *dst, Matrix *mat) {
+  PROFILE_SCOPE(PROF_MATRIX_INVERSE,
+                2.0 * mat->n_rows * mat->n_rows * mat->n_rows,
+                8.0 * mat->n_rows * mat->n_rows);
   if (mat->n_rows != mat->n_cols) {
     fprintf(stderr, "Error matrix_inverse: n_rows(%zu) != n_cols(%zu)\n",
             mat->n_rows, mat->n_cols);
     return NULL;
   }
-
-  if (matrix_determinant(mat) == 0) {
-    fprintf(stderr,
-            "Error matrix_inverse: determinant is zero, no inverse exists\n");
+  if (!same_shape("matrix_inverse_into", dst, mat->n_rows, mat->n_cols))
     return NULL;
-  }
 
   size_t n = mat->n_rows;
-
-  // Copy mat into A
-  Matrix *A = matrix_create(n, n);
-  matrix_set_array(A, mat->array, n * n);
-
-  // Create identity matrix I
-  Matrix *I = matrix_identity(n);
-
-  for (size_t j = 0; j < n; j++) {
-    // Find pivot
-    float pivot = 0.0;
-    size_t pivot_index = j;
-    for (size_t i = j; i < n; i++) {
-      if (fabs(matrix_get(A, i, j)) > fabs(pivot)) {
-        pivot = matrix_get(A, i, j);
-        pivot_index = i;
-      }
-    }
-
-    // Swap rows in A and I if pivot is not on the diagonal
-    if (pivot_index != j) {
-      matrix_swap_rows(A, j, pivot_index);
-      matrix_swap_rows(I, j, pivot_index);
-    }
-
-    // Scale the pivot row
-    float pivot_value = matrix_get(A, j, j);
-    for (size_t k = 0; k < n; k++) {
-      matrix_set(A, j, k, matrix_get(A, j, k) / pivot_value);
-      matrix_set(I, j, k, matrix_get(I, j, k) / pivot_value);
-    }
-
-    // Eliminate the column entries below the pivot
-    for (size_t i = j + 1; i < n; i++) {
-      float factor = matrix_get(A, i, j);
-      for (size_t k = 0; k < n; k++) {
-        matrix_set(A, i, k, matrix_get(A, i, k) - factor * matrix_get(A, j, k));
-        matrix_set(I, i, k, matrix_get(I, i, k) - factor * matrix_get(I, j, k));
-      }
-    }
-  }
-
-  // Back substitution to eliminate upper triangular elements
-  for (size_t j = n; j-- > 0;) {
-    for (size_t i = 0; i < j; i++) {
-      float factor = matrix_get(A, i, j);
-      for (size_t k = 0; k < n; k++) {
-        matrix_set(A, i, k, matrix_get(A, i, k) - factor * matrix_get(A, j, k));
-        matrix_set(I, i, k, matrix_get(I, i, k) - factor * matrix_get(I, j, k));
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  Matrix *lu = scratch_matrix(scratch, n, n);
+  size_t *pivots = scratch_alloc(scratch, (n + 1) * sizeof(size_t));
+  Matrix *x = dst->col_stride == 1 ? dst : scratch_matrix(scratch, n, n);
+  Matrix *res = dst;
+
+  if (lu == NULL || pivots == NULL || x == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    res = NULL;
+  } else {
+    matrix_pack(lu->array, mat);
+    if (lu_factorize(lu->array, n, pivots) == 0) {
+      fprintf(stderr,
+              "Error matrix_inverse: determinant is zero, no inverse exists\n");
+      res = NULL;
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        memset(&MATRIX_AT(x, i, 0), 0, n * sizeof(float));
+        MATRIX_AT(x, i, i) = 1.0f;
       }
+      lu_solve_raw(lu->array, pivots, n, x->array, n, x->row_stride);
+      matrix_copy(dst, x);
     }
   }
 
-  matrix_free(A);
-  return I;
+  if (x != dst)
+    matrix_free(x);
+  matrix_free(lu);
+  scratch_free(scratch, pivots);
+  matrix_arena_reset(scratch, mark);
+  return res;
 }
 
-// Function to solve Ly = b using forward substitution
-void forward_substitution(Matrix *L, Matrix *b, Matrix *y) {
-  size_t n = L->n_rows;
-
-  for (size_t i = 0; i < n; i++) {
-    y->array[i] = b->array[i];
-    for (size_t j = 0; j < i; j++) {
-      y->array[i] -= L->array[i * n + j] * y->array[j];
-    }
-    y->array[i] /= L->array[i * n + i];
+Matrix *matrix_inverse(Matrix *mat) {
+  if (mat->n_rows != mat->n_cols) {
+    fprintf(stderr, "Error matrix_inverse: n_rows(%zu) != n_cols(%zu)\n",
+            mat->n_rows, mat->n_cols);
+    return NULL;
   }
-}
 
-// Function to solve Ux = y using backward substitution
-void backward_substitution(Matrix *U, Matrix *y, Matrix *x) {
-  size_t n = U->n_rows;
+  Matrix *res = matrix_create(mat->n_rows, mat->n_cols);
+  if (res == NULL)
+    return NULL;
 
-  for (int i = n - 1; i >= 0; i--) {
-    x->array[i] = y->array[i];
-    for (int j = i + 1; j < n; j++) {
-      x->array[i] -= U->array[i * n + j] * x->array[j];
-    }
-    x->array[i] /= U->array[i * n + i];
+  if (matrix_inverse_into(res, mat) == NULL) {
+    matrix_free(res);
+    return NULL;
   }
+  return res;
 }
 
 // Function to solve the system Ax = b using LU decomposition
 Matrix *solve_using_LU(Matrix *A, Matrix *b) {
-  size_t n = A->n_rows;
-
-  Matrix *L = matrix_create(n, n);
-  Matrix *U = matrix_create(n, n);
-  Matrix *y = matrix_create(n, 1);
-  Matrix *x = matrix_create(n, 1);
-
-  lu_decomposition(A, L, U);
-  forward_substitution(L, b, y);
-  backward_substitution(U, y, x);
-
-  matrix_free(L);
-  matrix_free(U);
-  matrix_free(y);
+  LUFactor *lu = lu_factor(A);
+  if (lu == NULL)
+    return NULL;
 
+  Matrix *x = lu_solve(lu, b);
+  lu_factor_free(lu);
   return x;
 }
 
 Matrix *solve_lin_system(Matrix *A, Matrix *b) {
+  PROFILE_SCOPE(PROF_SOLVE_LIN_SYSTEM,
+                2.0 / 3.0 * A->n_rows * A->n_cols * A->n_cols +
+                    2.0 * A->n_rows * A->n_cols * b->n_cols,
+                4.0 * A->n_rows * (A->n_cols + 2.0 * b->n_cols));
   size_t n = A->n_rows;
   size_t m = A->n_cols;
 
@@ -393,20 +586,20 @@ Matrix *solve_lin_system(Matrix *A, Matrix *b) {
         "solve_lin_system: Error solve_lin_system: size mismatch of A and b");
     return NULL;
   }
-  if (b->n_cols != 1) {
-    fprintf(stderr, "solve_lin_system: b n_cols > 1, not a vector");
-    return NULL;
-  }
 
   if (n == m) {
+    // Triangular and narrow-banded A skip the O(n^3) dense LU
+    StructuredMatrix *S = structured_detect(A);
+    if (S != NULL) {
+      Matrix *x = structured_solve(S, b);
+      structured_free(S);
+      return x;
+    }
     Matrix *x = solve_using_LU(A, b);
     return x;
   } else if (n > m) {
-    printf("solve_lin_system: Overdetermined solution");
-    Matrix *x =
-        matrix_mult(matrix_mult(matrix_inverse(matrix_mult(matrix_trans(A), A)),
-                                matrix_trans(A)),
-                    b);
+    // Householder QR, never forms A^T A
+    Matrix *x = solve_least_squares(A, b);
     return x;
   } else {
     // Handle underdetermined system or return an error
@@ -0,0 +1,949 @@
+// One element type's matrix API, included by matrix_typed.c once per type.
+// It mirrors the float implementation in matrix.c, view.c and lu.c. The
+// includer defines:
+//   MT_TYPE, MT_ELEM, MT_REAL, MT_FN  as for include/matrix_tmpl.h
+//   MT_K(name)      the name of the type's kernels and local helpers
+//                   (gemm_strided_d, lu_factorize_d, ...)
+//   MT_ADD, MT_SUB  (n, a, b, out) on contiguous elements
+//   MT_SCALE        (n, scalar, a, out)
+//   MT_APPROX       (n, a, b, tolerance), 1 when every |a - b| <= tolerance
+//   MT_ABS(x)       modulus of one element, as MT_REAL
+//   MT_CONJ(x)      complex conjugate of one element (x for real types)
+//   MT_EPSILON      machine epsilon of MT_REAL
+// All of them are undefined again at the end.
+
+MT_TYPE *MT_FN(create_with)(const MatrixAllocator *allocator, size_t n_rows,
+                            size_t n_cols) {
+  allocator = matrix_allocator_or_default(allocator);
+
+  size_t size = matrix_block_size(sizeof(MT_ELEM), n_rows, n_cols);
+  if (size == 0) {
+    fprintf(stderr, "Error %s: %zu x %zu is too large\n", __func__, n_rows,
+            n_cols);
+    return NULL;
+  }
+
+  MT_TYPE *mat = allocator->alloc(allocator->ctx, size);
+  if (mat == NULL)
+    return NULL;
+  PROFILE_ALLOC(size);
+
+  mat->array = (MT_ELEM *)((char *)mat + MATRIX_HEADER_SIZE);
+  mat->n_rows = n_rows;
+  mat->n_cols = n_cols;
+  mat->row_stride = n_cols;
+  mat->col_stride = 1;
+  mat->allocator = allocator;
+  return mat;
+}
+
+MT_TYPE *MT_FN(create)(size_t n_rows, size_t n_cols) {
+  return MT_FN(create_with)(NULL, n_rows, n_cols);
+}
+
+void MT_FN(free)(MT_TYPE *mat) {
+  if (mat != NULL && mat->allocator != NULL) {
+    const MatrixAllocator *allocator = mat->allocator;
+    size_t size = matrix_block_size(sizeof(MT_ELEM), mat->n_rows, mat->n_cols);
+    allocator->free(allocator->ctx, mat, size);
+  }
+}
+
+void MT_FN(set)(MT_TYPE *mat, size_t row, size_t col, MT_ELEM value) {
+  if (row < mat->n_rows && col < mat->n_cols) {
+    MATRIX_AT(mat, row, col) = value;
+  } else {
+    fprintf(stderr,
+            "Error: row (%zu) or col (%zu) is bigger than n_rows (%zu) or "
+            "n_cols (%zu)\n",
+            row, col, mat->n_rows, mat->n_cols);
+  }
+}
+
+MT_ELEM MT_FN(get)(MT_TYPE *mat, size_t row, size_t col) {
+  if (row < mat->n_rows && col < mat->n_cols) {
+    return MATRIX_AT(mat, row, col);
+  } else {
+    fprintf(stderr,
+            "Error: row (%zu) or col (%zu) is bigger than n_rows (%zu) or "
+            "n_cols (%zu)\n",
+            row, col, mat->n_rows, mat->n_cols);
+    return 0;
+  }
+}
+
+// Views
+
+static const MT_TYPE MT_K(empty_view) = {NULL, 0, 0, 0, 1, NULL};
+
+MT_TYPE MT_FN(view)(MT_TYPE *mat, size_t row, size_t col, size_t n_rows,
+                    size_t n_cols) {
+  if (row > mat->n_rows || n_rows > mat->n_rows - row || col > mat->n_cols ||
+      n_cols > mat->n_cols - col) {
+    fprintf(stderr,
+            "Error %s: %zu x %zu block at (%zu, %zu) is outside the %zu x "
+            "%zu matrix\n",
+            __func__, n_rows, n_cols, row, col, mat->n_rows, mat->n_cols);
+    return MT_K(empty_view);
+  }
+
+  MT_TYPE view = *mat;
+  if (n_rows > 0 && n_cols > 0)
+    view.array = &MATRIX_AT(mat, row, col);
+  view.n_rows = n_rows;
+  view.n_cols = n_cols;
+  view.allocator = NULL;
+  return view;
+}
+
+MT_TYPE MT_FN(row)(MT_TYPE *mat, size_t row) {
+  if (row >= mat->n_rows) {
+    fprintf(stderr, "Error %s: row %zu >= n_rows (%zu)\n", __func__, row,
+            mat->n_rows);
+    return MT_K(empty_view);
+  }
+  return MT_FN(view)(mat, row, 0, 1, mat->n_cols);
+}
+
+MT_TYPE MT_FN(col)(MT_TYPE *mat, size_t col) {
+  if (col >= mat->n_cols) {
+    fprintf(stderr, "Error %s: col %zu >= n_cols (%zu)\n", __func__, col,
+            mat->n_cols);
+    return MT_K(empty_view);
+  }
+  return MT_FN(view)(mat, 0, col, mat->n_rows, 1);
+}
+
+MT_TYPE MT_FN(trans_view)(MT_TYPE *mat) {
+  MT_TYPE view = *mat;
+  view.n_rows = mat->n_cols;
+  view.n_cols = mat->n_rows;
+  view.row_stride = mat->col_stride;
+  view.col_stride = mat->row_stride;
+  view.allocator = NULL;
+  return view;
+}
+
+MT_TYPE MT_FN(view_array)(MT_ELEM *array, size_t n_rows, size_t n_cols,
+                          size_t row_stride) {
+  if (row_stride < n_cols && n_rows > 1) {
+    fprintf(stderr, "Error %s: row_stride %zu < n_cols %zu\n", __func__,
+            row_stride, n_cols);
+    return MT_K(empty_view);
+  }
+  MT_TYPE view = {array, n_rows, n_cols, row_stride, 1, NULL};
+  return view;
+}
+
+static int MT_K(is_dense)(const MT_TYPE *mat) {
+  return (mat->n_cols <= 1 || mat->col_stride == 1) &&
+         (mat->n_rows <= 1 || mat->row_stride == mat->n_cols);
+}
+
+static int MT_K(overlaps)(const MT_TYPE *a, const MT_TYPE *b) {
+  return strided_overlaps(STRIDED_BLOCK(a), STRIDED_BLOCK(b),
+                          sizeof(MT_ELEM));
+}
+
+// Copy between two matrices of the same shape, any strides
+static void MT_K(copy)(MT_TYPE *dst, const MT_TYPE *src) {
+  size_t n_rows = src->n_rows, n_cols = src->n_cols;
+  if (n_rows == 0 || n_cols == 0 ||
+      (dst->array == src->array && dst->row_stride == src->row_stride &&
+       dst->col_stride == src->col_stride))
+    return;
+
+  if (MT_K(is_dense)(dst) && MT_K(is_dense)(src)) {
+    memcpy(dst->array, src->array, n_rows * n_cols * sizeof(MT_ELEM));
+    return;
+  }
+  for (size_t i = 0; i < n_rows; i++) {
+    for (size_t j = 0; j < n_cols; j++) {
+      MATRIX_AT(dst, i, j) = MATRIX_AT(src, i, j);
+    }
+  }
+}
+
+// Dense row-major buffer <-> matrix
+static void MT_K(pack)(MT_ELEM *dst, const MT_TYPE *mat) {
+  MT_TYPE packed = {dst, mat->n_rows, mat->n_cols, mat->n_cols, 1, NULL};
+  MT_K(copy)(&packed, mat);
+}
+
+static void MT_K(unpack)(MT_TYPE *mat, const MT_ELEM *src) {
+  MT_TYPE packed = {(MT_ELEM *)src, mat->n_rows, mat->n_cols, mat->n_cols, 1,
+                    NULL};
+  MT_K(copy)(mat, &packed);
+}
+
+void MT_FN(set_array)(MT_TYPE *mat, MT_ELEM array[], size_t size) {
+  if (size != mat->n_rows * mat->n_cols) {
+    fprintf(stderr,
+            "Error %s: mat array size %zu != input array size %zu\n",
+            __func__, mat->n_rows * mat->n_cols, size);
+    return;
+  }
+  MT_K(unpack)(mat, array);
+}
+
+// Element-wise operations, split over the thread pool like the float ones
+
+typedef struct MT_K(elementwise_args) {
+  ElementwiseOp op;
+  const MT_TYPE *a;
+  const MT_TYPE *b;
+  MT_TYPE *out;
+  MT_ELEM scalar;
+  MT_REAL tolerance;
+  int differs;
+} MT_K(ElementwiseArgs);
+
+static void MT_K(elementwise_span)(MT_K(ElementwiseArgs) *args, size_t n,
+                                   const MT_ELEM *a, const MT_ELEM *b,
+                                   MT_ELEM *out) {
+  switch (args->op) {
+  case OP_ADD:
+    MT_ADD(n, a, b, out);
+    break;
+  case OP_SUB:
+    MT_SUB(n, a, b, out);
+    break;
+  case OP_SCALE:
+    MT_SCALE(n, args->scalar, a, out);
+    break;
+  case OP_APPROX_EQUAL:
+    if (__atomic_load_n(&args->differs, __ATOMIC_RELAXED))
+      return;
+    if (!MT_APPROX(n, a, b, args->tolerance))
+      __atomic_store_n(&args->differs, 1, __ATOMIC_RELAXED);
+    break;
+  }
+}
+
+static void MT_K(elementwise_task)(void *arg, size_t begin, size_t end) {
+  MT_K(ElementwiseArgs) *args = arg;
+  MT_ELEM *out = args->out != NULL ? args->out->array + begin : NULL;
+  const MT_ELEM *b = args->b != NULL ? args->b->array + begin : NULL;
+
+  MT_K(elementwise_span)(args, end - begin, args->a->array + begin, b, out);
+}
+
+static void MT_K(elementwise_rows_task)(void *arg, size_t begin,
+                                        size_t end) {
+  MT_K(ElementwiseArgs) *args = arg;
+  const MT_TYPE *a = args->a, *b = args->b;
+  MT_TYPE *out = args->out;
+  size_t n_cols = a->n_cols;
+  int unit = a->col_stride == 1 && (b == NULL || b->col_stride == 1) &&
+             (out == NULL || out->col_stride == 1);
+
+  for (size_t i = begin; i < end; i++) {
+    if (unit) {
+      MT_K(elementwise_span)(args, n_cols, &MATRIX_AT(a, i, 0),
+                             b != NULL ? &MATRIX_AT(b, i, 0) : NULL,
+                             out != NULL ? &MATRIX_AT(out, i, 0) : NULL);
+      continue;
+    }
+    for (size_t j = 0; j < n_cols; j++) {
+      MT_ELEM x = MATRIX_AT(a, i, j);
+      switch (args->op) {
+      case OP_ADD:
+        MATRIX_AT(out, i, j) = x + MATRIX_AT(b, i, j);
+        break;
+      case OP_SUB:
+        MATRIX_AT(out, i, j) = x - MATRIX_AT(b, i, j);
+        break;
+      case OP_SCALE:
+        MATRIX_AT(out, i, j) = args->scalar * x;
+        break;
+      case OP_APPROX_EQUAL:
+        if (MT_ABS(x - MATRIX_AT(b, i, j)) > args->tolerance) {
+          __atomic_store_n(&args->differs, 1, __ATOMIC_RELAXED);
+          return;
+        }
+        break;
+      }
+    }
+  }
+}
+
+static void MT_K(elementwise)(MT_K(ElementwiseArgs) *args) {
+  const MT_TYPE *a = args->a;
+  size_t n_rows = a->n_rows, n_cols = a->n_cols;
+
+  if (MT_K(is_dense)(a) && (args->b == NULL || MT_K(is_dense)(args->b)) &&
+      (args->out == NULL || MT_K(is_dense)(args->out))) {
+    parallel_for(n_rows * n_cols, ELEMENTWISE_GRAIN, MT_K(elementwise_task),
+                 args);
+  } else {
+    parallel_for(n_rows, 1 + ELEMENTWISE_GRAIN / (n_cols + 1),
+                 MT_K(elementwise_rows_task), args);
+  }
+}
+
+int MT_FN(approx_equal)(MT_TYPE *A, MT_TYPE *B, MT_REAL tolerance) {
+  if (A->n_rows != B->n_rows || A->n_cols != B->n_cols)
+    return 0;
+
+  MT_K(ElementwiseArgs) args = {OP_APPROX_EQUAL, A, B, NULL, 0, tolerance};
+  MT_K(elementwise)(&args);
+  return !args.differs;
+}
+
+static int MT_K(same_shape)(const char *func, MT_TYPE *dst, size_t n_rows,
+                            size_t n_cols) {
+  if (dst->n_rows != n_rows || dst->n_cols != n_cols) {
+    fprintf(stderr, "Error %s: dst is %zu x %zu, expected %zu x %zu\n", func,
+            dst->n_rows, dst->n_cols, n_rows, n_cols);
+    return 0;
+  }
+  return 1;
+}
+
+MT_TYPE *MT_FN(scale_into)(MT_TYPE *dst, MT_ELEM scalar, MT_TYPE *mat) {
+  if (!MT_K(same_shape)(__func__, dst, mat->n_rows, mat->n_cols))
+    return NULL;
+
+  MT_K(ElementwiseArgs) args = {OP_SCALE, mat, NULL, dst, scalar};
+  MT_K(elementwise)(&args);
+  return dst;
+}
+
+MT_TYPE *MT_FN(scale_inplace)(MT_ELEM scalar, MT_TYPE *mat) {
+  return MT_FN(scale_into)(mat, scalar, mat);
+}
+
+MT_TYPE *MT_FN(scale)(MT_ELEM scalar, MT_TYPE *mat) {
+  MT_TYPE *res = MT_FN(create)(mat->n_rows, mat->n_cols);
+  if (res == NULL)
+    return NULL;
+
+  return MT_FN(scale_into)(res, scalar, mat);
+}
+
+static MT_TYPE *MT_K(add_sub_into)(const char *func, ElementwiseOp op,
+                                   MT_TYPE *dst, MT_TYPE *mat1,
+                                   MT_TYPE *mat2) {
+  if (mat1->n_rows != mat2->n_rows || mat1->n_cols != mat2->n_cols) {
+    fprintf(stderr, "Error %s: size mismatch\n", func);
+    return NULL;
+  }
+  if (!MT_K(same_shape)(func, dst, mat1->n_rows, mat1->n_cols))
+    return NULL;
+
+  MT_K(ElementwiseArgs) args = {op, mat1, mat2, dst};
+  MT_K(elementwise)(&args);
+  return dst;
+}
+
+MT_TYPE *MT_FN(add_into)(MT_TYPE *dst, MT_TYPE *mat1, MT_TYPE *mat2) {
+  return MT_K(add_sub_into)(__func__, OP_ADD, dst, mat1, mat2);
+}
+
+MT_TYPE *MT_FN(add_inplace)(MT_TYPE *mat1, MT_TYPE *mat2) {
+  return MT_FN(add_into)(mat1, mat1, mat2);
+}
+
+MT_TYPE *MT_FN(add)(MT_TYPE *mat1, MT_TYPE *mat2) {
+  MT_TYPE *res = MT_FN(create)(mat1->n_rows, mat1->n_cols);
+  if (res == NULL)
+    return NULL;
+
+  if (MT_FN(add_into)(res, mat1, mat2) == NULL) {
+    MT_FN(free)(res);
+    return NULL;
+  }
+  return res;
+}
+
+MT_TYPE *MT_FN(subtract_into)(MT_TYPE *dst, MT_TYPE *mat1, MT_TYPE *mat2) {
+  return MT_K(add_sub_into)(__func__, OP_SUB, dst, mat1, mat2);
+}
+
+MT_TYPE *MT_FN(subtract_inplace)(MT_TYPE *mat1, MT_TYPE *mat2) {
+  return MT_FN(subtract_into)(mat1, mat1, mat2);
+}
+
+MT_TYPE *MT_FN(subtract)(MT_TYPE *mat1, MT_TYPE *mat2) {
+  MT_TYPE *res = MT_FN(create)(mat1->n_rows, mat1->n_cols);
+  if (res == NULL)
+    return NULL;
+
+  if (MT_FN(subtract_into)(res, mat1, mat2) == NULL) {
+    MT_FN(free)(res);
+    return NULL;
+  }
+  return res;
+}
+
+// Products
+
+MT_TYPE *MT_FN(gemm)(MT_ELEM alpha, MT_TYPE *A, MT_TYPE *B, MT_ELEM beta,
+                     MT_TYPE *C) {
+  if (A->n_cols != B->n_rows || C->n_rows != A->n_rows ||
+      C->n_cols != B->n_cols) {
+    fprintf(stderr,
+            "Error %s: size mismatch A(%zu x %zu) * B(%zu x %zu) -> C(%zu x "
+            "%zu)\n",
+            __func__, A->n_rows, A->n_cols, B->n_rows, B->n_cols, C->n_rows,
+            C->n_cols);
+    return NULL;
+  }
+  if (MT_K(overlaps)(C, A) || MT_K(overlaps)(C, B)) {
+    fprintf(stderr, "Error %s: C must not alias A or B\n", __func__);
+    return NULL;
+  }
+
+  MT_K(gemm_strided)(A->n_rows, B->n_cols, A->n_cols, alpha, A->array,
+                     A->row_stride, A->col_stride, B->array, B->row_stride,
+                     B->col_stride, beta, C->array, C->row_stride,
+                     C->col_stride);
+  return C;
+}
+
+MT_TYPE *MT_FN(mult_into)(MT_TYPE *dst, MT_TYPE *mat1, MT_TYPE *mat2) {
+  if (mat1->n_cols != mat2->n_rows) {
+    fprintf(stderr, "Error %s: size mismatch\n", __func__);
+    return NULL;
+  }
+  if (!MT_K(same_shape)(__func__, dst, mat1->n_rows, mat2->n_cols))
+    return NULL;
+
+  return MT_FN(gemm)(1, mat1, mat2, 0, dst);
+}
+
+MT_TYPE *MT_FN(mult)(MT_TYPE *mat1, MT_TYPE *mat2) {
+  if (mat1->n_cols != mat2->n_rows) {
+    fprintf(stderr, "Error %s: size mismatch\n", __func__);
+    return NULL;
+  }
+  MT_TYPE *res = MT_FN(create)(mat1->n_rows, mat2->n_cols);
+  if (res == NULL)
+    return NULL;
+
+  return MT_FN(mult_into)(res, mat1, mat2);
+}
+
+// Transpose
+
+typedef struct MT_K(trans_args) {
+  const MT_TYPE *src;
+  MT_TYPE *dst;
+  size_t tile;
+} MT_K(TransArgs);
+
+static void MT_K(trans_task)(void *arg, size_t begin, size_t end) {
+  MT_K(TransArgs) *t = arg;
+  const MT_TYPE *src = t->src;
+  MT_TYPE *dst = t->dst;
+  size_t n_rows = src->n_rows, n_cols = src->n_cols;
+  size_t tile = t->tile;
+  size_t row_end = end * tile < n_rows ? end * tile : n_rows;
+
+  for (size_t i0 = begin * tile; i0 < row_end; i0 += tile) {
+    size_t i1 = i0 + tile < row_end ? i0 + tile : row_end;
+    for (size_t j0 = 0; j0 < n_cols; j0 += tile) {
+      size_t j1 = j0 + tile < n_cols ? j0 + tile : n_cols;
+      for (size_t i = i0; i < i1; i++) {
+        for (size_t j = j0; j < j1; j++) {
+          MATRIX_AT(dst, j, i) = MATRIX_AT(src, i, j);
+        }
+      }
+    }
+  }
+}
+
+MT_TYPE *MT_FN(trans_into)(MT_TYPE *dst, MT_TYPE *mat) {
+  if (!MT_K(same_shape)(__func__, dst, mat->n_cols, mat->n_rows))
+    return NULL;
+  if (MT_K(overlaps)(dst, mat)) {
+    fprintf(stderr, "Error %s: dst must not alias mat\n", __func__);
+    return NULL;
+  }
+
+  MT_K(TransArgs) args = {mat, dst, matrix_get_tuning().trans_tile};
+  size_t n_stripes = (mat->n_rows + args.tile - 1) / args.tile;
+  size_t grain = 1 + (1 << 16) / (args.tile * (mat->n_cols + 1));
+  parallel_for(n_stripes, grain, MT_K(trans_task), &args);
+  return dst;
+}
+
+MT_TYPE *MT_FN(trans)(MT_TYPE *mat) {
+  MT_TYPE *res = MT_FN(create)(mat->n_cols, mat->n_rows);
+  if (res == NULL)
+    return NULL;
+
+  return MT_FN(trans_into)(res, mat);
+}
+
+MT_TYPE *MT_FN(identity)(size_t n) {
+  MT_TYPE *id = MT_FN(create)(n, n);
+  if (id == NULL)
+    return NULL;
+
+  memset(id->array, 0, n * n * sizeof(MT_ELEM));
+  for (size_t i = 0; i < n; i++) {
+    MATRIX_AT(id, i, i) = 1;
+  }
+  return id;
+}
+
+// Structured A, measured as structured_detect measures it: triangular, or
+// nonzeros in a band at most n / STRUCT_BAND_RATIO wide (STRUCT_BANDED,
+// tridiagonal included). 0 for dense or empty A, which takes the LU.
+static int MT_K(detect)(MT_TYPE *A, StructKind *kind, size_t *kl,
+                        size_t *ku) {
+  size_t n = A->n_rows;
+  if (n == 0)
+    return 0;
+
+  // A dense row is settled after one element on each side
+  *kl = 0;
+  *ku = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t first = 0, last = n - 1;
+    while (first < i && MATRIX_AT(A, i, first) == 0)
+      first++;
+    while (last > i && MATRIX_AT(A, i, last) == 0)
+      last--;
+    if (i - first > *kl)
+      *kl = i - first;
+    if (last - i > *ku)
+      *ku = last - i;
+    if (*kl > 0 && *ku > 0 && (*kl + *ku + 1) * STRUCT_BAND_RATIO > n)
+      return 0;
+  }
+
+  if ((*kl + *ku + 1) * STRUCT_BAND_RATIO <= n)
+    *kind = STRUCT_BANDED;
+  else
+    *kind = *kl == 0 ? STRUCT_UPPER : STRUCT_LOWER;
+  return 1;
+}
+
+// Band LU with partial pivoting confined to the band. Row i of band holds
+// columns i - kl .. i + kl + ku of A (the row swaps widen U by kl), so
+// w = 2 kl + ku + 1 of them, and the multipliers stay where they were
+// eliminated. Returns the sign of the row permutation, 0 if A is singular,
+// as lu_factorize does.
+static int MT_K(band_factor)(MT_ELEM *band, size_t *pivots, MT_TYPE *A,
+                             size_t kl, size_t ku) {
+  size_t n = A->n_rows, w = 2 * kl + ku + 1;
+  memset(band, 0, n * w * sizeof(MT_ELEM));
+  for (size_t i = 0; i < n; i++) {
+    MT_ELEM *row = &band[i * w + kl - i];
+    size_t last = i + ku < n ? i + ku : n - 1;
+    for (size_t j = i > kl ? i - kl : 0; j <= last; j++) {
+      row[j] = MATRIX_AT(A, i, j);
+    }
+  }
+
+  int sign = 1;
+  for (size_t j = 0; j < n; j++) {
+    size_t last = j + kl < n ? j + kl : n - 1;
+    size_t end = j + kl + ku < n ? j + kl + ku : n - 1;
+    size_t p = j;
+    for (size_t i = j + 1; i <= last; i++) {
+      if (MT_ABS(band[i * w + kl - i + j]) > MT_ABS(band[p * w + kl - p + j]))
+        p = i;
+    }
+    pivots[j] = p;
+    MT_ELEM *row_j = &band[j * w + kl - j];
+    MT_ELEM *row_p = &band[p * w + kl - p];
+    if (row_p[j] == 0)
+      return 0;
+    if (p != j) {
+      for (size_t c = j; c <= end; c++) {
+        MT_ELEM t = row_j[c];
+        row_j[c] = row_p[c];
+        row_p[c] = t;
+      }
+      sign = -sign;
+    }
+
+    for (size_t i = j + 1; i <= last; i++) {
+      MT_ELEM *row_i = &band[i * w + kl - i];
+      MT_ELEM l = row_i[j] / row_j[j];
+      row_i[j] = l;
+      if (l == 0)
+        continue;
+      for (size_t c = j + 1; c <= end; c++) {
+        row_i[c] -= l * row_j[c];
+      }
+    }
+  }
+  return sign;
+}
+
+// X = A^-1 X for the n x k row-major X, from band_factor
+static void MT_K(band_solve)(const MT_ELEM *band, const size_t *pivots,
+                             size_t n, size_t kl, size_t ku, MT_ELEM *X,
+                             size_t k) {
+  size_t w = 2 * kl + ku + 1;
+  for (size_t j = 0; j < n; j++) {
+    if (pivots[j] != j) {
+      MT_ELEM *x_j = &X[j * k], *x_p = &X[pivots[j] * k];
+      for (size_t c = 0; c < k; c++) {
+        MT_ELEM t = x_j[c];
+        x_j[c] = x_p[c];
+        x_p[c] = t;
+      }
+    }
+    size_t last = j + kl < n ? j + kl : n - 1;
+    for (size_t i = j + 1; i <= last; i++) {
+      MT_ELEM l = band[i * w + kl - i + j];
+      if (l == 0)
+        continue;
+      for (size_t c = 0; c < k; c++) {
+        X[i * k + c] -= l * X[j * k + c];
+      }
+    }
+  }
+
+  for (size_t i = n; i-- > 0;) {
+    const MT_ELEM *row = &band[i * w + kl - i];
+    size_t end = i + kl + ku < n ? i + kl + ku : n - 1;
+    for (size_t t = i + 1; t <= end; t++) {
+      for (size_t c = 0; c < k; c++) {
+        X[i * k + c] -= row[t] * X[t * k + c];
+      }
+    }
+    for (size_t c = 0; c < k; c++) {
+      X[i * k + c] /= row[i];
+    }
+  }
+}
+
+// Substitution on triangular A where it lies, in place on the n x k
+// row-major X. -1 on a zero on the diagonal.
+static int MT_K(triangular_solve)(MT_TYPE *A, int lower, MT_ELEM *X,
+                                  size_t k) {
+  size_t n = A->n_rows;
+  for (size_t i = 0; i < n; i++) {
+    if (MATRIX_AT(A, i, i) == 0)
+      return -1;
+  }
+
+  for (size_t s = 0; s < n; s++) {
+    size_t i = lower ? s : n - 1 - s;
+    size_t from = lower ? 0 : i + 1, to = lower ? i : n;
+    MT_ELEM *x_i = &X[i * k];
+    for (size_t t = from; t < to; t++) {
+      MT_ELEM a = MATRIX_AT(A, i, t);
+      for (size_t c = 0; c < k; c++) {
+        x_i[c] -= a * X[t * k + c];
+      }
+    }
+    MT_ELEM d = MATRIX_AT(A, i, i);
+    for (size_t c = 0; c < k; c++) {
+      x_i[c] /= d;
+    }
+  }
+  return 0;
+}
+
+// Solve structured A X = B into x, which has the shape of B, in scratch
+static MT_TYPE *MT_K(structured_solve_into)(const char *func, MT_TYPE *x,
+                                            MT_TYPE *A, MT_TYPE *B,
+                                            StructKind kind, size_t kl,
+                                            size_t ku) {
+  size_t n = A->n_rows, k = x->n_cols;
+  int banded = kind == STRUCT_BANDED;
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  MT_ELEM *tmp = scratch_alloc(scratch, (n * k + 1) * sizeof(MT_ELEM));
+  MT_ELEM *band =
+      banded ? scratch_alloc(scratch, (n * (2 * kl + ku + 1) + 1) *
+                                          sizeof(MT_ELEM))
+             : NULL;
+  size_t *pivots =
+      banded ? scratch_alloc(scratch, (n + 1) * sizeof(size_t)) : NULL;
+  MT_TYPE *res = x;
+
+  if (tmp == NULL || (banded && (band == NULL || pivots == NULL))) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    res = NULL;
+  } else {
+    MT_K(pack)(tmp, B);
+    int ok = banded ? MT_K(band_factor)(band, pivots, A, kl, ku) != 0
+                    : MT_K(triangular_solve)(A, kind == STRUCT_LOWER, tmp,
+                                             k) == 0;
+    if (!ok) {
+      fprintf(stderr, "Error %s: matrix is singular\n", func);
+      res = NULL;
+    } else {
+      if (banded)
+        MT_K(band_solve)(band, pivots, n, kl, ku, tmp, k);
+      MT_K(unpack)(x, tmp);
+    }
+  }
+
+  scratch_free(scratch, pivots);
+  scratch_free(scratch, band);
+  scratch_free(scratch, tmp);
+  matrix_arena_reset(scratch, mark);
+  return res;
+}
+
+// Tall A in the least-squares sense by Householder QR, as
+// solve_least_squares: each reflector is applied to b as it is built, then
+// R x = (Q^H b)[:m]
+static MT_TYPE *MT_K(least_squares)(MT_TYPE *A, MT_TYPE *b) {
+  size_t n = A->n_rows, m = A->n_cols, k = b->n_cols;
+  // Working copies, too large for the scratch arena to hold on to
+  MT_TYPE *QR = MT_FN(create)(n, m);
+  MT_TYPE *Qtb = MT_FN(create)(n, k);
+  MT_TYPE *x = MT_FN(create)(m, k);
+
+  if (QR == NULL || Qtb == NULL || x == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    goto fail;
+  }
+  MT_ELEM *qr = QR->array, *qtb = Qtb->array;
+  MT_K(pack)(qr, A);
+  MT_K(pack)(qtb, b);
+
+  for (size_t j = 0; j < m; j++) {
+    MT_REAL norm = 0;
+    for (size_t i = j; i < n; i++) {
+      MT_REAL a = MT_ABS(qr[i * m + j]);
+      norm += a * a;
+    }
+    norm = sqrt(norm);
+    if (norm == 0)
+      continue; // a zero column, caught as rank deficient below
+
+    // alpha has the opposite phase of x0, so v0 = x0 - alpha cannot cancel
+    MT_ELEM x0 = qr[j * m + j];
+    MT_REAL a0 = MT_ABS(x0);
+    MT_ELEM alpha = -(a0 != 0 ? x0 / a0 : 1) * norm;
+    qr[j * m + j] = x0 - alpha;
+    MT_REAL vv = 0;
+    for (size_t i = j; i < n; i++) {
+      MT_REAL a = MT_ABS(qr[i * m + j]);
+      vv += a * a;
+    }
+
+    // H = I - 2 v v^H / (v^H v) on the trailing columns and on b
+    for (size_t c = j + 1; c < m + k; c++) {
+      MT_ELEM *col = c < m ? &qr[c] : &qtb[c - m];
+      size_t ld = c < m ? m : k;
+      MT_ELEM dot = 0;
+      for (size_t i = j; i < n; i++) {
+        dot += MT_CONJ(qr[i * m + j]) * col[i * ld];
+      }
+      MT_ELEM f = 2 * dot / vv;
+      for (size_t i = j; i < n; i++) {
+        col[i * ld] -= f * qr[i * m + j];
+      }
+    }
+    qr[j * m + j] = alpha;
+  }
+
+  // A diagonal entry of R lost in rounding noise means a dependent column
+  MT_REAL max_diag = 0;
+  for (size_t i = 0; i < m; i++) {
+    if (MT_ABS(qr[i * m + i]) > max_diag)
+      max_diag = MT_ABS(qr[i * m + i]);
+  }
+  for (size_t i = 0; i < m; i++) {
+    if (MT_ABS(qr[i * m + i]) <= max_diag * m * MT_EPSILON) {
+      fprintf(stderr, "Error %s: A is rank deficient\n", __func__);
+      goto fail;
+    }
+  }
+
+  MT_K(trsm_upper)(m, k, qr, m, qtb, k);
+  memcpy(x->array, qtb, m * k * sizeof(MT_ELEM));
+
+  MT_FN(free)(QR);
+  MT_FN(free)(Qtb);
+  return x;
+
+fail:
+  MT_FN(free)(QR);
+  MT_FN(free)(Qtb);
+  MT_FN(free)(x);
+  return NULL;
+}
+
+// LU based: factor a scratch copy with the type's blocked LU, or a band
+// copy when A is banded
+
+MT_ELEM MT_FN(determinant)(MT_TYPE *mat) {
+  if (mat->n_rows != mat->n_cols) {
+    fprintf(stderr, "Error %s: n_rows(%zu) != n_cols(%zu)\n", __func__,
+            mat->n_rows, mat->n_cols);
+    return NAN;
+  }
+
+  size_t n = mat->n_rows;
+  StructKind kind = STRUCT_BANDED;
+  size_t kl = 0, ku = 0;
+  int banded = MT_K(detect)(mat, &kind, &kl, &ku);
+  if (banded && kind != STRUCT_BANDED) {
+    // Triangular: the product of the diagonal
+    MT_ELEM det = 1;
+    for (size_t i = 0; i < n; i++) {
+      det *= MATRIX_AT(mat, i, i);
+    }
+    return det;
+  }
+
+  size_t w = 2 * kl + ku + 1;
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  MT_ELEM *lu =
+      scratch_alloc(scratch, ((banded ? n * w : n * n) + 1) * sizeof(MT_ELEM));
+  size_t *pivots = scratch_alloc(scratch, (n + 1) * sizeof(size_t));
+  MT_ELEM det = NAN;
+
+  if (lu != NULL && pivots != NULL && banded) {
+    det = MT_K(band_factor)(lu, pivots, mat, kl, ku);
+    for (size_t i = 0; i < n && det != 0; i++) {
+      det *= lu[i * w + kl];
+    }
+  } else if (lu != NULL && pivots != NULL) {
+    MT_K(pack)(lu, mat);
+    det = MT_K(lu_factorize)(lu, n, pivots);
+    for (size_t i = 0; i < n && det != 0; i++) {
+      det *= lu[i * n + i];
+    }
+  }
+
+  scratch_free(scratch, lu);
+  scratch_free(scratch, pivots);
+  matrix_arena_reset(scratch, mark);
+  return det;
+}
+
+// Solve A X = B into x, which has the shape of B. A is packed before x is
+// written, so x may be A. x with non-contiguous rows is solved in scratch
+// and copied out.
+static MT_TYPE *MT_K(lu_solve_into)(const char *func, MT_TYPE *x, MT_TYPE *A,
+                                    MT_TYPE *B) {
+  size_t n = A->n_rows, k = x->n_cols;
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  MT_ELEM *lu = scratch_alloc(scratch, (n * n + 1) * sizeof(MT_ELEM));
+  size_t *pivots = scratch_alloc(scratch, (n + 1) * sizeof(size_t));
+  int direct = x->col_stride == 1 || k == 1;
+  MT_ELEM *tmp =
+      direct ? NULL : scratch_alloc(scratch, (n * k + 1) * sizeof(MT_ELEM));
+  MT_TYPE *res = x;
+
+  if (lu == NULL || pivots == NULL || (!direct && tmp == NULL)) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    res = NULL;
+  } else {
+    MT_K(pack)(lu, A);
+    if (MT_K(lu_factorize)(lu, n, pivots) == 0) {
+      fprintf(stderr, "Error %s: matrix is singular\n", func);
+      res = NULL;
+    } else if (direct) {
+      MT_K(copy)(x, B);
+      MT_K(lu_solve_raw)(lu, pivots, n, x->array, k, x->row_stride);
+    } else {
+      MT_K(pack)(tmp, B);
+      MT_K(lu_solve_raw)(lu, pivots, n, tmp, k, k);
+      MT_K(unpack)(x, tmp);
+    }
+  }
+
+  scratch_free(scratch, tmp);
+  scratch_free(scratch, lu);
+  scratch_free(scratch, pivots);
+  matrix_arena_reset(scratch, mark);
+  return res;
+}
+
+MT_TYPE *MT_FN(inverse_into)(MT_TYPE *dst, MT_TYPE *mat) {
+  if (mat->n_rows != mat->n_cols) {
+    fprintf(stderr, "Error %s: n_rows(%zu) != n_cols(%zu)\n", __func__,
+            mat->n_rows, mat->n_cols);
+    return NULL;
+  }
+  if (!MT_K(same_shape)(__func__, dst, mat->n_rows, mat->n_cols))
+    return NULL;
+
+  // The identity is the right-hand side, in scratch. lu_solve_into packs
+  // mat before it writes dst, so dst may be mat.
+  size_t n = mat->n_rows;
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  MT_ELEM *id = scratch_alloc(scratch, (n * n + 1) * sizeof(MT_ELEM));
+  MT_TYPE *res = NULL;
+
+  if (id == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+  } else {
+    memset(id, 0, n * n * sizeof(MT_ELEM));
+    for (size_t i = 0; i < n; i++) {
+      id[i * n + i] = 1;
+    }
+    MT_TYPE B = {id, n, n, n, 1, NULL};
+    res = MT_K(lu_solve_into)(__func__, dst, mat, &B);
+  }
+
+  scratch_free(scratch, id);
+  matrix_arena_reset(scratch, mark);
+  return res;
+}
+
+MT_TYPE *MT_FN(inverse)(MT_TYPE *mat) {
+  MT_TYPE *res = MT_FN(create)(mat->n_rows, mat->n_cols);
+  if (res == NULL)
+    return NULL;
+
+  if (MT_FN(inverse_into)(res, mat) == NULL) {
+    MT_FN(free)(res);
+    return NULL;
+  }
+  return res;
+}
+
+// Dispatches as solve_lin_system does: structured square A skips the
+// dense LU, tall A is solved in the least-squares sense
+MT_TYPE *MT_FN(solve)(MT_TYPE *A, MT_TYPE *b) {
+  if (b->n_rows != A->n_rows) {
+    fprintf(stderr, "Error %s: A is %zu x %zu, b is %zu x %zu\n", __func__,
+            A->n_rows, A->n_cols, b->n_rows, b->n_cols);
+    return NULL;
+  }
+  if (A->n_rows < A->n_cols) {
+    fprintf(stderr, "Error %s: underdetermined system is not supported\n",
+            __func__);
+    return NULL;
+  }
+  if (A->n_rows > A->n_cols)
+    return MT_K(least_squares)(A, b);
+
+  MT_TYPE *x = MT_FN(create)(b->n_rows, b->n_cols);
+  if (x == NULL)
+    return NULL;
+
+  StructKind kind;
+  size_t kl, ku;
+  MT_TYPE *res =
+      MT_K(detect)(A, &kind, &kl, &ku)
+          ? MT_K(structured_solve_into)(__func__, x, A, b, kind, kl, ku)
+          : MT_K(lu_solve_into)(__func__, x, A, b);
+  if (res == NULL) {
+    MT_FN(free)(x);
+    return NULL;
+  }
+  return x;
+}
+
+#undef MT_TYPE
+#undef MT_ELEM
+#undef MT_REAL
+#undef MT_FN
+#undef MT_K
+#undef MT_ADD
+#undef MT_SUB
+#undef MT_SCALE
+#undef MT_APPROX
+#undef MT_ABS
+#undef MT_CONJ
+#undef MT_EPSILON
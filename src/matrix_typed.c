@@ -0,0 +1,180 @@
+// The double, complex float and complex double matrix APIs, all generated
+// from matrix_tmpl.h, and the conversions between float and double
+#include "matrix.h"
+#include "alloc.h"
+#include "gemm.h"
+#include "lu.h"
+#include "profile.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "trsm.h"
+#include "view.h"
+#include <complex.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// As in matrix.c, in elements
+#define ELEMENTWISE_GRAIN (1 << 16)
+
+// As in structured.c: solve a band at most n / 4 wide as a band
+#define STRUCT_BAND_RATIO 4
+
+typedef enum { OP_ADD, OP_SUB, OP_SCALE, OP_APPROX_EQUAL } ElementwiseOp;
+
+// Complex spans run on the real kernels over the interleaved parts
+
+static void add_c(size_t n, const float _Complex *a, const float _Complex *b,
+                  float _Complex *out) {
+  simd_kernels()->add(2 * n, (const float *)a, (const float *)b,
+                      (float *)out);
+}
+
+static void sub_c(size_t n, const float _Complex *a, const float _Complex *b,
+                  float _Complex *out) {
+  simd_kernels()->sub(2 * n, (const float *)a, (const float *)b,
+                      (float *)out);
+}
+
+static void scale_c(size_t n, float _Complex scalar, const float _Complex *a,
+                    float _Complex *out) {
+  if (cimagf(scalar) == 0) {
+    simd_kernels()->scale(2 * n, crealf(scalar), (const float *)a,
+                          (float *)out);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    out[i] = scalar * a[i];
+  }
+}
+
+static int approx_equal_c(size_t n, const float _Complex *a,
+                          const float _Complex *b, float tolerance) {
+  for (size_t i = 0; i < n; i++) {
+    if (cabsf(a[i] - b[i]) > tolerance)
+      return 0;
+  }
+  return 1;
+}
+
+static void add_z(size_t n, const double _Complex *a,
+                  const double _Complex *b, double _Complex *out) {
+  simd_kernels_d()->add(2 * n, (const double *)a, (const double *)b,
+                        (double *)out);
+}
+
+static void sub_z(size_t n, const double _Complex *a,
+                  const double _Complex *b, double _Complex *out) {
+  simd_kernels_d()->sub(2 * n, (const double *)a, (const double *)b,
+                        (double *)out);
+}
+
+static void scale_z(size_t n, double _Complex scalar,
+                    const double _Complex *a, double _Complex *out) {
+  if (cimag(scalar) == 0) {
+    simd_kernels_d()->scale(2 * n, creal(scalar), (const double *)a,
+                            (double *)out);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    out[i] = scalar * a[i];
+  }
+}
+
+static int approx_equal_z(size_t n, const double _Complex *a,
+                          const double _Complex *b, double tolerance) {
+  for (size_t i = 0; i < n; i++) {
+    if (cabs(a[i] - b[i]) > tolerance)
+      return 0;
+  }
+  return 1;
+}
+
+#define MT_TYPE MatrixD
+#define MT_ELEM double
+#define MT_REAL double
+#define MT_FN(name) matrixd_##name
+#define MT_K(name) name##_d
+#define MT_ADD simd_kernels_d()->add
+#define MT_SUB simd_kernels_d()->sub
+#define MT_SCALE simd_kernels_d()->scale
+#define MT_APPROX simd_kernels_d()->approx_equal
+#define MT_ABS fabs
+#define MT_CONJ(x) (x)
+#define MT_EPSILON DBL_EPSILON
+#include "matrix_tmpl.h"
+
+#define MT_TYPE MatrixC
+#define MT_ELEM float _Complex
+#define MT_REAL float
+#define MT_FN(name) matrixc_##name
+#define MT_K(name) name##_c
+#define MT_ADD add_c
+#define MT_SUB sub_c
+#define MT_SCALE scale_c
+#define MT_APPROX approx_equal_c
+#define MT_ABS cabsf
+#define MT_CONJ(x) conjf(x)
+#define MT_EPSILON FLT_EPSILON
+#include "matrix_tmpl.h"
+
+#define MT_TYPE MatrixZ
+#define MT_ELEM double _Complex
+#define MT_REAL double
+#define MT_FN(name) matrixz_##name
+#define MT_K(name) name##_z
+#define MT_ADD add_z
+#define MT_SUB sub_z
+#define MT_SCALE scale_z
+#define MT_APPROX approx_equal_z
+#define MT_ABS cabs
+#define MT_CONJ(x) conj(x)
+#define MT_EPSILON DBL_EPSILON
+#include "matrix_tmpl.h"
+
+// Conversions
+
+MatrixD *matrix_to_double_into(MatrixD *dst, Matrix *mat) {
+  if (dst->n_rows != mat->n_rows || dst->n_cols != mat->n_cols) {
+    fprintf(stderr, "Error %s: dst is %zu x %zu, mat is %zu x %zu\n",
+            __func__, dst->n_rows, dst->n_cols, mat->n_rows, mat->n_cols);
+    return NULL;
+  }
+  for (size_t i = 0; i < mat->n_rows; i++) {
+    for (size_t j = 0; j < mat->n_cols; j++) {
+      MATRIX_AT(dst, i, j) = MATRIX_AT(mat, i, j);
+    }
+  }
+  return dst;
+}
+
+MatrixD *matrix_to_double(Matrix *mat) {
+  MatrixD *res = matrixd_create(mat->n_rows, mat->n_cols);
+  if (res == NULL)
+    return NULL;
+
+  return matrix_to_double_into(res, mat);
+}
+
+Matrix *matrixd_to_float_into(Matrix *dst, MatrixD *mat) {
+  if (dst->n_rows != mat->n_rows || dst->n_cols != mat->n_cols) {
+    fprintf(stderr, "Error %s: dst is %zu x %zu, mat is %zu x %zu\n",
+            __func__, dst->n_rows, dst->n_cols, mat->n_rows, mat->n_cols);
+    return NULL;
+  }
+  for (size_t i = 0; i < mat->n_rows; i++) {
+    for (size_t j = 0; j < mat->n_cols; j++) {
+      MATRIX_AT(dst, i, j) = (float)MATRIX_AT(mat, i, j);
+    }
+  }
+  return dst;
+}
+
+Matrix *matrixd_to_float(MatrixD *mat) {
+  Matrix *res = matrix_create(mat->n_rows, mat->n_cols);
+  if (res == NULL)
+    return NULL;
+
+  return matrixd_to_float_into(res, mat);
+}
@@ -0,0 +1,645 @@
+// Out-of-core GEMM and LU on float matrix files: the operands stay on
+// disk and only tiles of them, within a memory budget, are in memory at a
+// time. A helper thread reads the next tile while the current one is
+// computed on, so I/O overlaps the (threaded) kernels.
+#include "gemm.h"
+#include "io.h"
+#include "matrix.h"
+#include "profile.h"
+#include "trsm.h"
+#include "view.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OOC_DEFAULT_BUDGET ((size_t)256 << 20)
+
+// Tile sides are multiples of this, so the GEMM kernels see whole register
+// tiles, and at least this
+#define OOC_TILE_QUANTUM 16
+
+// Panels this narrow or narrower are factored column by column
+#define PANEL_LEAF 16
+
+// Prefetching: one request in flight, run by a dedicated thread
+
+typedef int (*io_request)(void *arg);
+
+typedef struct prefetcher {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  io_request fn; // the request queued or running, NULL when idle
+  void *arg;
+  int busy;
+  int result;
+  int stop;
+} Prefetcher;
+
+static void *prefetch_main(void *arg) {
+  Prefetcher *p = arg;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->fn == NULL && !p->stop) {
+      pthread_cond_wait(&p->cond, &p->lock);
+    }
+    if (p->fn == NULL)
+      break;
+    io_request fn = p->fn;
+    void *fn_arg = p->arg;
+    pthread_mutex_unlock(&p->lock);
+    int result = fn(fn_arg);
+    pthread_mutex_lock(&p->lock);
+    p->fn = NULL;
+    p->busy = 0;
+    p->result = result;
+    pthread_cond_broadcast(&p->cond);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+static int prefetch_start(Prefetcher *p) {
+  memset(p, 0, sizeof(Prefetcher));
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  if (pthread_create(&p->thread, NULL, prefetch_main, p) != 0) {
+    fprintf(stderr, "Error: cannot start the prefetch thread\n");
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    return -1;
+  }
+  return 0;
+}
+
+static void prefetch_submit(Prefetcher *p, io_request fn, void *arg) {
+  pthread_mutex_lock(&p->lock);
+  p->fn = fn;
+  p->arg = arg;
+  p->busy = 1;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+}
+
+// The result of the last request, once it has completed
+static int prefetch_wait(Prefetcher *p) {
+  pthread_mutex_lock(&p->lock);
+  while (p->busy) {
+    pthread_cond_wait(&p->cond, &p->lock);
+  }
+  int result = p->result;
+  pthread_mutex_unlock(&p->lock);
+  return result;
+}
+
+static void prefetch_stop(Prefetcher *p) {
+  prefetch_wait(p);
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->thread, NULL);
+  pthread_cond_destroy(&p->cond);
+  pthread_mutex_destroy(&p->lock);
+}
+
+// Tiles
+
+// Rows [row, row + n_rows) x columns [col, col + n_cols) of a file, in
+// memory as a dense buffer with row stride n_cols
+typedef struct tile {
+  int fd;
+  const FileLayout *layout;
+  size_t row;
+  size_t col;
+  size_t n_rows;
+  size_t n_cols;
+  float *buf;
+} Tile;
+
+static int tile_io(const Tile *t, int write) {
+  const FileLayout *l = t->layout;
+  uint64_t offset =
+      l->data_offset + (t->row * l->row_stride + t->col) * sizeof(float);
+  // Whole rows are one contiguous run
+  size_t runs = t->n_rows, run = t->n_cols;
+  if (t->n_cols == l->row_stride) {
+    runs = 1;
+    run *= t->n_rows;
+  }
+  for (size_t i = 0; i < runs; i++) {
+    float *p = t->buf + i * t->n_cols;
+    int failed = write ? file_write(t->fd, p, run * sizeof(float), offset)
+                       : file_read(t->fd, p, run * sizeof(float), offset);
+    if (failed)
+      return -1;
+    offset += l->row_stride * sizeof(float);
+  }
+  return 0;
+}
+
+static int open_float(const char *caller, const char *path, int writable,
+                      FileLayout *layout) {
+  int fd = file_open_layout(caller, path, writable, layout);
+  if (fd >= 0 && layout->elem_type != MATRIX_ELEM_FLOAT) {
+    fprintf(stderr, "Error %s: %s holds %s, not float elements\n", caller,
+            path, elem_type_name(layout->elem_type));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// -1 after a message if out_path names the file open as input fd: creating
+// the output truncates it before it is read
+static int check_output(const char *caller, const char *out_path, int fd,
+                        const char *in_path) {
+  struct stat out, in;
+  if (stat(out_path, &out) != 0 || fstat(fd, &in) != 0 ||
+      out.st_dev != in.st_dev || out.st_ino != in.st_ino)
+    return 0;
+  fprintf(stderr, "Error %s: output %s is the input %s\n", caller, out_path,
+          in_path);
+  return -1;
+}
+
+// The largest multiple of OOC_TILE_QUANTUM such that n_squares square
+// tiles of that side fit in budget bytes; 0 if none does
+static size_t tile_side(size_t budget, size_t n_squares) {
+  size_t side = (size_t)sqrt((double)budget / (n_squares * sizeof(float)));
+  return side / OOC_TILE_QUANTUM * OOC_TILE_QUANTUM;
+}
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+// GEMM
+
+// C tile (i, j) is the sum over p of A tile (i, p) times B tile (p, j).
+// Step s is one (i, j, p), p fastest, and loads into buffer s % 2.
+typedef struct gemm_plan {
+  int fa, fb;
+  const FileLayout *la, *lb;
+  size_t m, k, n;
+  size_t tm, tk, tn;
+  size_t nj, np;
+  float *a_buf, *b_buf;
+} GemmPlan;
+
+typedef struct gemm_loads {
+  Tile a;
+  Tile b;
+} GemmLoads;
+
+static GemmLoads gemm_step(const GemmPlan *g, size_t s) {
+  size_t p = s % g->np, j = s / g->np % g->nj, i = s / g->np / g->nj;
+  size_t kk = min_size(g->tk, g->k - p * g->tk);
+  GemmLoads l = {
+      {g->fa, g->la, i * g->tm, p * g->tk, min_size(g->tm, g->m - i * g->tm),
+       kk, g->a_buf + s % 2 * g->tm * g->tk},
+      {g->fb, g->lb, p * g->tk, j * g->tn, kk,
+       min_size(g->tn, g->n - j * g->tn), g->b_buf + s % 2 * g->tk * g->tn}};
+  return l;
+}
+
+static int load_gemm_tiles(void *arg) {
+  GemmLoads *loads = arg;
+  return tile_io(&loads->a, 0) == 0 && tile_io(&loads->b, 0) == 0 ? 0 : -1;
+}
+
+int matrix_file_mult(const char *c_path, const char *a_path,
+                     const char *b_path, size_t memory_budget) {
+  // The work is added once the shapes are read from the files
+  PROFILE_SCOPE(PROF_FILE_MULT, 0.0, 0.0);
+  FileLayout la, lb, lc;
+  int fa = open_float(__func__, a_path, 0, &la);
+  int fb = fa < 0 ? -1 : open_float(__func__, b_path, 0, &lb);
+  int fc = -1, ok = 0;
+  float *buffers = NULL;
+  if (fb < 0)
+    goto done;
+  if (la.n_cols != lb.n_rows) {
+    fprintf(stderr, "Error %s: size mismatch A(%zu x %zu) * B(%zu x %zu)\n",
+            __func__, la.n_rows, la.n_cols, lb.n_rows, lb.n_cols);
+    goto done;
+  }
+  size_t m = la.n_rows, k = la.n_cols, n = lb.n_cols;
+
+  // One C tile, and two A and two B tiles to load a pair while the other
+  // is multiplied
+  size_t side =
+      tile_side(memory_budget ? memory_budget : OOC_DEFAULT_BUDGET, 5);
+  if (side == 0) {
+    fprintf(stderr, "Error %s: memory budget too small\n", __func__);
+    goto done;
+  }
+  size_t tm = min_size(side, m), tk = min_size(side, k);
+  size_t tn = min_size(side, n);
+  if (check_output(__func__, c_path, fa, a_path) != 0 ||
+      check_output(__func__, c_path, fb, b_path) != 0)
+    goto done;
+  fc = file_create(__func__, c_path, MATRIX_ELEM_FLOAT, m, n, &lc);
+  if (fc < 0)
+    goto done;
+  if (m == 0 || n == 0 || k == 0) {
+    ok = 1; // C is all zeros already
+    goto done;
+  }
+  buffers = malloc((tm * tn + 2 * tm * tk + 2 * tk * tn) * sizeof(float));
+  Prefetcher prefetch;
+  if (buffers == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    goto done;
+  }
+  if (prefetch_start(&prefetch) != 0)
+    goto done;
+
+  size_t ni = (m + tm - 1) / tm, nj = (n + tn - 1) / tn;
+  size_t np = (k + tk - 1) / tk, n_steps = ni * nj * np;
+  // A is read once per column of C tiles, B once per row of them
+  PROFILE_WORK(2.0 * m * n * k,
+               4.0 * ((double)m * k * nj + (double)k * n * ni + (double)m * n));
+  float *c_buf = buffers;
+  GemmPlan g = {fa, fb, &la, &lb, m, k, n, tm, tk, tn, nj, np,
+                c_buf + tm * tn, c_buf + tm * tn + 2 * tm * tk};
+  GemmLoads loads[2];
+  loads[0] = gemm_step(&g, 0);
+  prefetch_submit(&prefetch, load_gemm_tiles, &loads[0]);
+  size_t s = 0;
+  for (; s < n_steps; s++) {
+    if (prefetch_wait(&prefetch) != 0)
+      break;
+    if (s + 1 < n_steps) {
+      loads[(s + 1) % 2] = gemm_step(&g, s + 1);
+      prefetch_submit(&prefetch, load_gemm_tiles, &loads[(s + 1) % 2]);
+    }
+
+    const GemmLoads *l = &loads[s % 2];
+    size_t p = s % np;
+    Tile c = {fc, &lc, l->a.row, l->b.col, l->a.n_rows, l->b.n_cols, c_buf};
+    gemm_strided(c.n_rows, c.n_cols, l->a.n_cols, 1, l->a.buf, l->a.n_cols,
+                 1, l->b.buf, l->b.n_cols, 1, p == 0 ? 0 : 1, c.buf,
+                 c.n_cols, 1);
+    if (p == np - 1 && tile_io(&c, 1) != 0)
+      break;
+  }
+  prefetch_stop(&prefetch);
+  ok = s == n_steps;
+  if (!ok)
+    fprintf(stderr, "Error %s: I/O failed\n", __func__);
+
+done:
+  free(buffers);
+  if (ok)
+    ok = file_seal(__func__, fc, &lc) == 0;
+  if (fc >= 0)
+    close(fc);
+  if (fb >= 0)
+    close(fb);
+  if (fa >= 0)
+    close(fa);
+  return ok ? 0 : -1;
+}
+
+// LU
+
+static void swap_rows(float *a, size_t n_cols, size_t lda, size_t row1,
+                      size_t row2) {
+  float *r1 = &a[row1 * lda], *r2 = &a[row2 * lda];
+  for (size_t j = 0; j < n_cols; j++) {
+    float tmp = r1[j];
+    r1[j] = r2[j];
+    r2[j] = tmp;
+  }
+}
+
+// Make the interchanges pivots[from, to) on the rows of a, whose row 0 is
+// row `first` of the whole matrix
+static void apply_pivots(float *a, size_t n_cols, size_t lda, size_t first,
+                         const size_t *pivots, size_t from, size_t to) {
+  for (size_t i = from; i < to; i++) {
+    if (pivots[i] != i)
+      swap_rows(a, n_cols, lda, i - first, pivots[i] - first);
+  }
+}
+
+// P A = L U of the tall n_rows x n_cols panel a, in place, with pivots
+// local to the panel. The columns are halved recursively, so most of the
+// work is in trsm and GEMM rather than rank-1 updates. 0, or -1 at a zero
+// pivot.
+static int panel_lu(float *a, size_t n_rows, size_t n_cols, size_t lda,
+                    size_t *pivots) {
+  if (n_cols <= PANEL_LEAF) {
+    for (size_t j = 0; j < n_cols; j++) {
+      size_t pivot_index = j;
+      for (size_t i = j + 1; i < n_rows; i++) {
+        if (fabsf(a[i * lda + j]) > fabsf(a[pivot_index * lda + j]))
+          pivot_index = i;
+      }
+      pivots[j] = pivot_index;
+      if (pivot_index != j)
+        swap_rows(a, n_cols, lda, j, pivot_index);
+      const float *pivot_row = &a[j * lda];
+      if (pivot_row[j] == 0)
+        return -1;
+      for (size_t i = j + 1; i < n_rows; i++) {
+        float *row = &a[i * lda];
+        float l = row[j] / pivot_row[j];
+        row[j] = l;
+        for (size_t c = j + 1; c < n_cols; c++) {
+          row[c] -= l * pivot_row[c];
+        }
+      }
+    }
+    return 0;
+  }
+
+  size_t h = n_cols / 2, n_right = n_cols - h;
+  float *right = a + h;
+  if (panel_lu(a, n_rows, h, lda, pivots) != 0)
+    return -1;
+  apply_pivots(right, n_right, lda, 0, pivots, 0, h);
+  trsm_lower_unit(h, n_right, a, lda, right, lda);
+  gemm_strided(n_rows - h, n_right, h, -1, a + h * lda, lda, 1, right, lda,
+               1, 1, right + h * lda, lda, 1);
+  if (panel_lu(right + h * lda, n_rows - h, n_right, lda, pivots + h) != 0)
+    return -1;
+  for (size_t j = h; j < n_cols; j++) {
+    pivots[j] += h;
+  }
+  apply_pivots(a, h, lda, 0, pivots, h, n_cols);
+  return 0;
+}
+
+// Columns per block such that n_blocks blocks of n rows fit in budget
+// bytes, rounded down to a multiple of OOC_TILE_QUANTUM when above it
+static size_t panel_width(size_t budget, size_t n, size_t n_blocks) {
+  size_t w = budget / (n_blocks * n * sizeof(float));
+  if (w > OOC_TILE_QUANTUM)
+    w = w / OOC_TILE_QUANTUM * OOC_TILE_QUANTUM;
+  return min_size(w, n);
+}
+
+// Rows [r0, n) of the block of L in columns [r0, r0 + w), brought up to
+// date with the interchanges pivots[r0 + w, to) made after it was written
+typedef struct l_load {
+  Tile tile;
+  const size_t *pivots;
+  size_t to;
+} LLoad;
+
+static LLoad l_block(int fd, const FileLayout *layout, const size_t *pivots,
+                     size_t r0, size_t w, size_t to, float *buf) {
+  size_t n = layout->n_rows;
+  LLoad l = {{fd, layout, r0, r0, n - r0, w, buf}, pivots, to};
+  return l;
+}
+
+static int load_l_block(void *arg) {
+  LLoad *l = arg;
+  const Tile *t = &l->tile;
+  if (tile_io(t, 0) != 0)
+    return -1;
+  apply_pivots(t->buf, t->n_cols, t->n_cols, t->row, l->pivots,
+               t->row + t->n_cols, l->to);
+  return 0;
+}
+
+#ifdef MATRIX_PROFILE
+// Bytes matrix_file_lu moves with panels w wide: A read and LU written
+// once, and each panel reading back every block of L to its left
+static double file_lu_bytes(size_t n, size_t w) {
+  double elements = 2.0 * n * n;
+  for (size_t c0 = w; c0 < n; c0 += w) {
+    for (size_t r0 = 0; r0 < c0; r0 += w) {
+      elements += (double)(n - r0) * w;
+    }
+  }
+  return 4.0 * elements;
+}
+#endif
+
+int matrix_file_lu(const char *lu_path, const char *a_path, size_t *pivots,
+                   size_t memory_budget) {
+  // The work is added once the shape is read from the file
+  PROFILE_SCOPE(PROF_FILE_LU, 0.0, 0.0);
+  FileLayout la, llu;
+  int fa = open_float(__func__, a_path, 0, &la);
+  int flu = -1, ok = 0, failed = 0;
+  float *buffers = NULL;
+  if (fa < 0)
+    goto done;
+  if (la.n_rows != la.n_cols) {
+    fprintf(stderr, "Error %s: n_rows(%zu) != n_cols(%zu)\n", __func__,
+            la.n_rows, la.n_cols);
+    goto done;
+  }
+  size_t n = la.n_rows;
+  if (check_output(__func__, lu_path, fa, a_path) != 0)
+    goto done;
+  flu = file_create(__func__, lu_path, MATRIX_ELEM_FLOAT, n, n, &llu);
+  if (flu < 0)
+    goto done;
+  if (n == 0) {
+    ok = 1;
+    goto done;
+  }
+
+  // The panel being factored, and two blocks of L to load one while the
+  // other is applied to the panel
+  size_t w =
+      panel_width(memory_budget ? memory_budget : OOC_DEFAULT_BUDGET, n, 3);
+  if (w == 0) {
+    fprintf(stderr, "Error %s: memory budget too small\n", __func__);
+    goto done;
+  }
+  buffers = malloc(3 * n * w * sizeof(float));
+  Prefetcher prefetch;
+  if (buffers == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    goto done;
+  }
+  if (prefetch_start(&prefetch) != 0)
+    goto done;
+  PROFILE_WORK(2.0 / 3.0 * n * n * n, file_lu_bytes(n, w));
+
+  // Left-looking: panel c0 gets the updates of every block of L before it,
+  // read back from the LU file, then is factored and written out
+  float *panel = buffers, *l_bufs[2] = {buffers + n * w, buffers + 2 * n * w};
+  LLoad loads[2];
+  int singular = 0;
+  for (size_t c0 = 0; c0 < n && !failed && !singular; c0 += w) {
+    size_t wj = min_size(w, n - c0), n_blocks = c0 / w;
+    Tile a = {fa, &la, 0, c0, n, wj, panel};
+    if (tile_io(&a, 0) != 0) {
+      failed = 1;
+      break;
+    }
+    apply_pivots(panel, wj, wj, 0, pivots, 0, c0);
+
+    if (n_blocks > 0) {
+      loads[0] = l_block(flu, &llu, pivots, 0, w, c0, l_bufs[0]);
+      prefetch_submit(&prefetch, load_l_block, &loads[0]);
+    }
+    for (size_t b = 0; b < n_blocks; b++) {
+      if (prefetch_wait(&prefetch) != 0) {
+        failed = 1;
+        break;
+      }
+      if (b + 1 < n_blocks) {
+        loads[(b + 1) % 2] =
+            l_block(flu, &llu, pivots, (b + 1) * w, w, c0, l_bufs[(b + 1) % 2]);
+        prefetch_submit(&prefetch, load_l_block, &loads[(b + 1) % 2]);
+      }
+
+      // U block = L11^-1 (its rows of the panel), then the rows below
+      // -= L21 U block
+      const Tile *l = &loads[b % 2].tile;
+      float *u = panel + l->row * wj;
+      trsm_lower_unit(w, wj, l->buf, w, u, wj);
+      gemm_strided(l->n_rows - w, wj, w, -1, l->buf + w * w, w, 1, u, wj, 1,
+                   1, u + w * wj, wj, 1);
+    }
+    if (failed)
+      break;
+
+    if (panel_lu(panel + c0 * wj, n - c0, wj, wj, pivots + c0) != 0) {
+      fprintf(stderr, "Error %s: matrix is singular\n", __func__);
+      singular = 1;
+      break;
+    }
+    for (size_t q = c0; q < c0 + wj; q++) {
+      pivots[q] += c0;
+    }
+    Tile out = {flu, &llu, 0, c0, n, wj, panel};
+    failed = tile_io(&out, 1) != 0;
+  }
+  prefetch_stop(&prefetch);
+
+  // Each block of L was written before the interchanges of the panels
+  // after it; make them on disk, so the file holds L as lu_factor would
+  for (size_t r0 = 0; r0 + w < n && !failed && !singular; r0 += w) {
+    Tile l = {flu, &llu, r0 + w, r0, n - r0 - w, w, panel};
+    failed = tile_io(&l, 0) != 0;
+    apply_pivots(panel, w, w, r0 + w, pivots, r0 + w, n);
+    failed = failed || tile_io(&l, 1) != 0;
+  }
+  if (failed)
+    fprintf(stderr, "Error %s: I/O failed\n", __func__);
+  ok = !failed && !singular;
+
+done:
+  free(buffers);
+  if (ok)
+    ok = file_seal(__func__, flu, &llu) == 0;
+  if (flu >= 0)
+    close(flu);
+  if (fa >= 0)
+    close(fa);
+  return ok ? 0 : -1;
+}
+
+// Block s of the solve: the blocks of L left to right for the forward
+// substitution, then those of U right to left for the backward one
+static Tile solve_block(int fd, const FileLayout *layout, size_t w,
+                        size_t n_blocks, size_t s, float *buf) {
+  size_t n = layout->n_rows;
+  size_t b = s < n_blocks ? s : 2 * n_blocks - 1 - s;
+  size_t r0 = b * w, wb = min_size(w, n - r0);
+  Tile t = {fd, layout, r0, r0, n - r0, wb, buf};
+  if (s >= n_blocks) {
+    t.row = 0;
+    t.n_rows = r0 + wb;
+  }
+  return t;
+}
+
+static int load_tile(void *arg) { return tile_io(arg, 0); }
+
+Matrix *matrix_file_lu_solve(const char *lu_path, const size_t *pivots,
+                             Matrix *b, size_t memory_budget) {
+  FileLayout llu;
+  int fd = open_float(__func__, lu_path, 0, &llu);
+  if (fd < 0)
+    return NULL;
+  size_t n = llu.n_rows, k = b->n_cols;
+  if (llu.n_cols != n || b->n_rows != n) {
+    fprintf(stderr, "Error %s: LU is %zu x %zu, b has %zu rows\n", __func__,
+            llu.n_rows, llu.n_cols, b->n_rows);
+    close(fd);
+    return NULL;
+  }
+
+  Matrix *x = matrix_create(n, k);
+  float *buffers = NULL;
+  if (x == NULL) {
+    close(fd);
+    return NULL;
+  }
+  matrix_copy(x, b);
+  apply_pivots(x->array, k, k, 0, pivots, 0, n);
+  if (n == 0 || k == 0)
+    goto out;
+
+  // Two blocks of LU, to load one while the other is applied
+  size_t w =
+      panel_width(memory_budget ? memory_budget : OOC_DEFAULT_BUDGET, n, 2);
+  if (w == 0) {
+    fprintf(stderr, "Error %s: memory budget too small\n", __func__);
+    goto fail;
+  }
+  buffers = malloc(2 * n * w * sizeof(float));
+  Prefetcher prefetch;
+  if (buffers == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    goto fail;
+  }
+  if (prefetch_start(&prefetch) != 0)
+    goto fail;
+
+  size_t n_blocks = (n + w - 1) / w, n_steps = 2 * n_blocks, s = 0;
+  Tile tiles[2];
+  tiles[0] = solve_block(fd, &llu, w, n_blocks, 0, buffers);
+  prefetch_submit(&prefetch, load_tile, &tiles[0]);
+  for (; s < n_steps; s++) {
+    if (prefetch_wait(&prefetch) != 0)
+      break;
+    if (s + 1 < n_steps) {
+      tiles[(s + 1) % 2] = solve_block(fd, &llu, w, n_blocks, s + 1,
+                                       buffers + (s + 1) % 2 * n * w);
+      prefetch_submit(&prefetch, load_tile, &tiles[(s + 1) % 2]);
+    }
+
+    const Tile *t = &tiles[s % 2];
+    size_t r0 = t->col, wb = t->n_cols;
+    float *xb = x->array + r0 * k;
+    if (s < n_blocks) {
+      trsm_lower_unit(wb, k, t->buf, wb, xb, k);
+      gemm_strided(n - r0 - wb, k, wb, -1, t->buf + wb * wb, wb, 1, xb, k,
+                   1, 1, xb + wb * k, k, 1);
+    } else {
+      trsm_upper(wb, k, t->buf + r0 * wb, wb, xb, k);
+      gemm_strided(r0, k, wb, -1, t->buf, wb, 1, xb, k, 1, 1, x->array, k,
+                   1);
+    }
+  }
+  prefetch_stop(&prefetch);
+  if (s < n_steps) {
+    fprintf(stderr, "Error %s: I/O failed\n", __func__);
+    goto fail;
+  }
+
+out:
+  free(buffers);
+  close(fd);
+  return x;
+
+fail:
+  free(buffers);
+  matrix_free(x);
+  close(fd);
+  return NULL;
+}
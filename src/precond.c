@@ -0,0 +1,308 @@
+#include "lu.h"
+#include "matrix.h"
+#include "sparse.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Diagonal blocks per task of the block-Jacobi solves
+#define BLOCK_GRAIN(block_size) (1 + 4096 / ((block_size) * (block_size)))
+
+#define NONE ((size_t)-1)
+
+static Preconditioner *precond_create(void (*apply)(void *, const float *,
+                                                    float *),
+                                      void *ctx, void (*destroy)(void *)) {
+  Preconditioner *M = malloc(sizeof(Preconditioner));
+  if (M == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    destroy(ctx);
+    return NULL;
+  }
+  M->apply = apply;
+  M->ctx = ctx;
+  M->destroy = destroy;
+  return M;
+}
+
+void precond_free(Preconditioner *M) {
+  if (M != NULL) {
+    if (M->destroy != NULL)
+      M->destroy(M->ctx);
+    free(M);
+  }
+}
+
+static int check_square(const char *caller, const SparseMatrix *A) {
+  if (A->n_rows != A->n_cols) {
+    fprintf(stderr, "Error %s: A is %zu x %zu, not square\n", caller,
+            A->n_rows, A->n_cols);
+    return 0;
+  }
+  return 1;
+}
+
+// Jacobi
+
+typedef struct jacobi {
+  size_t n;
+  float *inv_diag;
+} Jacobi;
+
+static void jacobi_apply(void *ctx, const float *r, float *z) {
+  Jacobi *J = ctx;
+  for (size_t i = 0; i < J->n; i++) {
+    z[i] = J->inv_diag[i] * r[i];
+  }
+}
+
+static void jacobi_destroy(void *ctx) {
+  Jacobi *J = ctx;
+  if (J != NULL) {
+    free(J->inv_diag);
+    free(J);
+  }
+}
+
+Preconditioner *precond_jacobi(SparseMatrix *A) {
+  if (!check_square(__func__, A))
+    return NULL;
+  size_t n = A->n_rows;
+  Jacobi *J = malloc(sizeof(Jacobi));
+  float *inv_diag = malloc((n + 1) * sizeof(float));
+  if (J == NULL || inv_diag == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    free(inv_diag);
+    free(J);
+    return NULL;
+  }
+  J->n = n;
+  J->inv_diag = inv_diag;
+
+  // A missing or zero diagonal entry leaves that unknown unscaled
+  for (size_t i = 0; i < n; i++) {
+    inv_diag[i] = 1.0f;
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (size_t p = A->ptr[i]; p < A->ptr[i + 1]; p++) {
+      if (A->idx[p] == i && A->values[p] != 0)
+        inv_diag[i] = 1.0f / A->values[p];
+    }
+  }
+  return precond_create(jacobi_apply, J, jacobi_destroy);
+}
+
+// ILU(0)
+
+// L (unit diagonal, not stored) and U share the pattern of A, as CSR with
+// sorted rows; diag[i] is the position of U_ii
+typedef struct ilu0 {
+  SparseMatrix *LU;
+  size_t *diag;
+} Ilu0;
+
+static void ilu0_apply(void *ctx, const float *r, float *z) {
+  Ilu0 *F = ctx;
+  const SparseMatrix *LU = F->LU;
+  size_t n = LU->n_rows;
+
+  // L y = r, then U z = y, both in z
+  for (size_t i = 0; i < n; i++) {
+    float sum = r[i];
+    for (size_t p = LU->ptr[i]; p < F->diag[i]; p++) {
+      sum -= LU->values[p] * z[LU->idx[p]];
+    }
+    z[i] = sum;
+  }
+  for (size_t i = n; i-- > 0;) {
+    float sum = z[i];
+    for (size_t p = F->diag[i] + 1; p < LU->ptr[i + 1]; p++) {
+      sum -= LU->values[p] * z[LU->idx[p]];
+    }
+    z[i] = sum / LU->values[F->diag[i]];
+  }
+}
+
+static void ilu0_destroy(void *ctx) {
+  Ilu0 *F = ctx;
+  if (F != NULL) {
+    sparse_free(F->LU);
+    free(F->diag);
+    free(F);
+  }
+}
+
+Preconditioner *precond_ilu0(SparseMatrix *A) {
+  if (!check_square(__func__, A))
+    return NULL;
+  size_t n = A->n_rows;
+  Ilu0 *F = calloc(1, sizeof(Ilu0));
+  size_t *pos = malloc((n + 1) * sizeof(size_t));
+  if (F == NULL || pos == NULL ||
+      (F->diag = malloc((n + 1) * sizeof(size_t))) == NULL ||
+      (F->LU = sparse_convert(A, SPARSE_CSR)) == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    free(pos);
+    ilu0_destroy(F);
+    return NULL;
+  }
+  SparseMatrix *LU = F->LU;
+  size_t *ptr = LU->ptr, *idx = LU->idx;
+  float *values = LU->values;
+
+  // IKJ Gaussian elimination restricted to the pattern: pos maps a column
+  // to its position in row i, or NONE when it is outside the pattern
+  for (size_t j = 0; j < n; j++) {
+    pos[j] = NONE;
+  }
+  for (size_t i = 0; i < n; i++) {
+    F->diag[i] = NONE;
+    for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+      pos[idx[p]] = p;
+      if (idx[p] == i)
+        F->diag[i] = p;
+    }
+    if (F->diag[i] == NONE) {
+      fprintf(stderr, "Error %s: no diagonal entry in row %zu\n", __func__, i);
+      goto fail;
+    }
+
+    for (size_t p = ptr[i]; p < F->diag[i]; p++) {
+      size_t k = idx[p];
+      float l_ik = values[p] / values[F->diag[k]];
+      values[p] = l_ik;
+      for (size_t q = F->diag[k] + 1; q < ptr[k + 1]; q++) {
+        if (pos[idx[q]] != NONE)
+          values[pos[idx[q]]] -= l_ik * values[q];
+      }
+    }
+
+    for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+      pos[idx[p]] = NONE;
+    }
+    if (values[F->diag[i]] == 0) {
+      fprintf(stderr, "Error %s: zero pivot in row %zu\n", __func__, i);
+      goto fail;
+    }
+  }
+
+  free(pos);
+  return precond_create(ilu0_apply, F, ilu0_destroy);
+
+fail:
+  free(pos);
+  ilu0_destroy(F);
+  return NULL;
+}
+
+// Block-Jacobi
+
+// Block b covers rows [b * block_size, min((b + 1) * block_size, n)); its
+// LU factors and pivots start at offset[b] and b * block_size
+typedef struct block_jacobi {
+  size_t n, block_size, n_blocks;
+  float *blocks;
+  size_t *offset;
+  size_t *pivots;
+} BlockJacobi;
+
+typedef struct block_jacobi_args {
+  const BlockJacobi *B;
+  const float *r;
+  float *z;
+} BlockJacobiArgs;
+
+static void block_jacobi_task(void *arg, size_t begin, size_t end) {
+  BlockJacobiArgs *a = arg;
+  const BlockJacobi *B = a->B;
+  for (size_t b = begin; b < end; b++) {
+    size_t lo = b * B->block_size;
+    size_t size = lo + B->block_size < B->n ? B->block_size : B->n - lo;
+    for (size_t i = lo; i < lo + size; i++) {
+      a->z[i] = a->r[i];
+    }
+    lu_solve_raw(B->blocks + B->offset[b], B->pivots + lo, size, a->z + lo, 1,
+                 1);
+  }
+}
+
+static void block_jacobi_apply(void *ctx, const float *r, float *z) {
+  BlockJacobi *B = ctx;
+  BlockJacobiArgs args = {B, r, z};
+  parallel_for(B->n_blocks, BLOCK_GRAIN(B->block_size), block_jacobi_task,
+               &args);
+}
+
+static void block_jacobi_destroy(void *ctx) {
+  BlockJacobi *B = ctx;
+  if (B != NULL) {
+    free(B->blocks);
+    free(B->offset);
+    free(B->pivots);
+    free(B);
+  }
+}
+
+Preconditioner *precond_block_jacobi(SparseMatrix *A, size_t block_size) {
+  if (!check_square(__func__, A))
+    return NULL;
+  size_t n = A->n_rows;
+  if (block_size == 0 || block_size > n)
+    block_size = n > 0 ? n : 1;
+  size_t n_blocks = (n + block_size - 1) / block_size;
+
+  BlockJacobi *B = calloc(1, sizeof(BlockJacobi));
+  if (B == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return NULL;
+  }
+  B->n = n;
+  B->block_size = block_size;
+  B->n_blocks = n_blocks;
+  B->offset = malloc((n_blocks + 1) * sizeof(size_t));
+  B->pivots = malloc((n + 1) * sizeof(size_t));
+  if (B->offset == NULL || B->pivots == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    block_jacobi_destroy(B);
+    return NULL;
+  }
+  size_t total = 0;
+  for (size_t b = 0; b < n_blocks; b++) {
+    size_t size = (b + 1) * block_size < n ? block_size : n - b * block_size;
+    B->offset[b] = total;
+    total += size * size;
+  }
+  B->blocks = calloc(total + 1, sizeof(float));
+  if (B->blocks == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    block_jacobi_destroy(B);
+    return NULL;
+  }
+
+  // Scatter the entries that fall in a diagonal block; CSR and CSC
+  // differ only in which of (major, minor) is the row
+  for (size_t i = 0; i < sparse_n_major(A); i++) {
+    for (size_t p = A->ptr[i]; p < A->ptr[i + 1]; p++) {
+      size_t row = A->format == SPARSE_CSR ? i : A->idx[p];
+      size_t col = A->format == SPARSE_CSR ? A->idx[p] : i;
+      size_t b = row / block_size;
+      if (col / block_size != b)
+        continue;
+      size_t lo = b * block_size;
+      size_t size = lo + block_size < n ? block_size : n - lo;
+      B->blocks[B->offset[b] + (row - lo) * size + (col - lo)] = A->values[p];
+    }
+  }
+
+  for (size_t b = 0; b < n_blocks; b++) {
+    size_t lo = b * block_size;
+    size_t size = lo + block_size < n ? block_size : n - lo;
+    if (lu_factorize(B->blocks + B->offset[b], size, B->pivots + lo) == 0) {
+      fprintf(stderr, "Error %s: diagonal block %zu is singular\n", __func__,
+              b);
+      block_jacobi_destroy(B);
+      return NULL;
+    }
+  }
+  return precond_create(block_jacobi_apply, B, block_jacobi_destroy);
+}
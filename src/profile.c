@@ -0,0 +1,203 @@
+#include "profile.h"
+#include "matrix.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Counters are updated with relaxed atomics from any thread; a snapshot
+// taken while calls are running may mix counts from before and after them
+typedef struct profile_counter {
+  uint64_t calls;
+  uint64_t nanoseconds;
+  uint64_t flops;
+  uint64_t bytes;
+} ProfileCounter;
+
+static const char *const profile_names[PROF_COUNT] = {
+    [PROF_MATRIX_SCALE] = "matrix_scale",
+    [PROF_MATRIX_ADD] = "matrix_add",
+    [PROF_MATRIX_SUBTRACT] = "matrix_subtract",
+    [PROF_MATRIX_GEMM] = "matrix_gemm",
+    [PROF_MATRIX_TRANS] = "matrix_trans",
+    [PROF_MATRIX_TRANS_INPLACE] = "matrix_trans_inplace",
+    [PROF_MATRIX_DETERMINANT] = "matrix_determinant",
+    [PROF_MATRIX_INVERSE] = "matrix_inverse",
+    [PROF_SOLVE_LIN_SYSTEM] = "solve_lin_system",
+    [PROF_LU_FACTOR] = "lu_factor",
+    [PROF_LU_SOLVE] = "lu_solve",
+    [PROF_SOLVE_LEAST_SQUARES] = "solve_least_squares",
+    [PROF_SOLVE_NORMAL_EQUATIONS] = "solve_normal_equations",
+    [PROF_EIGEN_SYM] = "eigen_sym",
+    [PROF_SVD_FACTOR] = "svd_factor",
+    [PROF_RANDOMIZED_SVD] = "randomized_svd",
+    [PROF_SPARSE_GEMM] = "sparse_gemm",
+    [PROF_SPARSE_LU_FACTOR] = "sparse_lu_factor",
+    [PROF_SPARSE_LU_SOLVE] = "sparse_lu_solve",
+    [PROF_STRUCTURED_SOLVE] = "structured_solve",
+    [PROF_KRYLOV_CG] = "krylov_cg",
+    [PROF_KRYLOV_GMRES] = "krylov_gmres",
+    [PROF_KRYLOV_BICGSTAB] = "krylov_bicgstab",
+    [PROF_BATCH_GEMM] = "matrix_batch_gemm",
+    [PROF_EXPR_EVAL] = "expr_eval",
+    [PROF_FILE_MULT] = "matrix_file_mult",
+    [PROF_FILE_LU] = "matrix_file_lu",
+};
+
+static ProfileCounter counters[PROF_COUNT];
+static uint64_t allocations;
+static uint64_t bytes_allocated;
+static uint64_t peak_scratch;
+
+static MatrixTraceHooks hooks;
+static int hooks_set;
+
+static uint64_t load(const uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+#ifdef MATRIX_PROFILE
+
+static void add(uint64_t *counter, uint64_t value) {
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+ProfileSpan profile_begin(ProfileId id, double flops, double bytes) {
+  if (__atomic_load_n(&hooks_set, __ATOMIC_ACQUIRE) && hooks.begin != NULL)
+    hooks.begin(hooks.ctx, profile_names[id]);
+  ProfileSpan span = {id, now_ns(), flops, bytes};
+  return span;
+}
+
+void profile_end(ProfileSpan *span) {
+  ProfileCounter *c = &counters[span->id];
+  uint64_t flops = (uint64_t)span->flops, bytes = (uint64_t)span->bytes;
+  add(&c->nanoseconds, now_ns() - span->start_ns);
+  add(&c->calls, 1);
+  add(&c->flops, flops);
+  add(&c->bytes, bytes);
+  if (__atomic_load_n(&hooks_set, __ATOMIC_ACQUIRE) && hooks.end != NULL)
+    hooks.end(hooks.ctx, profile_names[span->id], flops, bytes);
+}
+
+void profile_alloc(size_t size) {
+  add(&allocations, 1);
+  add(&bytes_allocated, size);
+}
+
+void profile_scratch(size_t used) {
+  uint64_t peak = load(&peak_scratch);
+  while (used > peak &&
+         !__atomic_compare_exchange_n(&peak_scratch, &peak, used, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+#endif // MATRIX_PROFILE
+
+int matrix_profile_enabled(void) {
+#ifdef MATRIX_PROFILE
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+size_t matrix_profile_count(void) { return PROF_COUNT; }
+
+MatrixProfileEntry matrix_profile_entry(size_t i) {
+  MatrixProfileEntry entry = {NULL, 0, 0, 0, 0};
+  if (i >= PROF_COUNT) {
+    fprintf(stderr, "Error %s: entry %zu of %d\n", __func__, i, PROF_COUNT);
+    return entry;
+  }
+  entry.name = profile_names[i];
+  entry.calls = load(&counters[i].calls);
+  entry.nanoseconds = load(&counters[i].nanoseconds);
+  entry.flops = load(&counters[i].flops);
+  entry.bytes = load(&counters[i].bytes);
+  return entry;
+}
+
+int matrix_profile_find(const char *name, MatrixProfileEntry *entry) {
+  for (size_t i = 0; i < PROF_COUNT; i++) {
+    if (strcmp(profile_names[i], name) == 0) {
+      *entry = matrix_profile_entry(i);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+MatrixProfileMemory matrix_profile_memory(void) {
+  MatrixProfileMemory memory = {load(&allocations), load(&bytes_allocated),
+                                load(&peak_scratch)};
+  return memory;
+}
+
+void matrix_profile_reset(void) {
+  for (size_t i = 0; i < PROF_COUNT; i++) {
+    __atomic_store_n(&counters[i].calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters[i].nanoseconds, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters[i].flops, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters[i].bytes, 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&allocations, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&bytes_allocated, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&peak_scratch, 0, __ATOMIC_RELAXED);
+}
+
+int matrix_profile_write_json(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Error %s: cannot write %s\n", __func__, path);
+    return -1;
+  }
+
+  MatrixProfileMemory memory = matrix_profile_memory();
+  fprintf(f,
+          "{\n  \"enabled\": %s,\n  \"allocations\": %llu,\n"
+          "  \"bytes_allocated\": %llu,\n  \"peak_scratch_bytes\": %llu,\n"
+          "  \"functions\": [",
+          matrix_profile_enabled() ? "true" : "false", memory.allocations,
+          memory.bytes_allocated, memory.peak_scratch);
+  size_t n_written = 0;
+  for (size_t i = 0; i < PROF_COUNT; i++) {
+    MatrixProfileEntry e = matrix_profile_entry(i);
+    if (e.calls == 0)
+      continue;
+    double seconds = e.nanoseconds * 1e-9;
+    fprintf(f,
+            "%s\n    {\"name\": \"%s\", \"calls\": %llu, \"seconds\": %.9g, "
+            "\"flops\": %llu, \"bytes\": %llu",
+            n_written > 0 ? "," : "", e.name, e.calls, seconds, e.flops,
+            e.bytes);
+    // No rate for work that was not estimated, rather than a rate of 0
+    if (e.flops > 0 && seconds > 0)
+      fprintf(f, ", \"gflops\": %.6g", e.flops / seconds * 1e-9);
+    if (e.bytes > 0 && seconds > 0)
+      fprintf(f, ", \"gbps\": %.6g", e.bytes / seconds * 1e-9);
+    fprintf(f, "}");
+    n_written++;
+  }
+  fprintf(f, "\n  ]\n}\n");
+
+  if (fclose(f) != 0) {
+    fprintf(stderr, "Error %s: cannot write %s\n", __func__, path);
+    return -1;
+  }
+  return 0;
+}
+
+void matrix_profile_set_hooks(const MatrixTraceHooks *new_hooks) {
+  __atomic_store_n(&hooks_set, 0, __ATOMIC_RELEASE);
+  if (new_hooks == NULL)
+    return;
+  hooks = *new_hooks;
+  __atomic_store_n(&hooks_set, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,88 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Profiled entry points, reported in this order (names in profile.c)
+typedef enum {
+  PROF_MATRIX_SCALE,
+  PROF_MATRIX_ADD,
+  PROF_MATRIX_SUBTRACT,
+  PROF_MATRIX_GEMM,
+  PROF_MATRIX_TRANS,
+  PROF_MATRIX_TRANS_INPLACE,
+  PROF_MATRIX_DETERMINANT,
+  PROF_MATRIX_INVERSE,
+  PROF_SOLVE_LIN_SYSTEM,
+  PROF_LU_FACTOR,
+  PROF_LU_SOLVE,
+  PROF_SOLVE_LEAST_SQUARES,
+  PROF_SOLVE_NORMAL_EQUATIONS,
+  PROF_EIGEN_SYM,
+  PROF_SVD_FACTOR,
+  PROF_RANDOMIZED_SVD,
+  PROF_SPARSE_GEMM,
+  PROF_SPARSE_LU_FACTOR,
+  PROF_SPARSE_LU_SOLVE,
+  PROF_STRUCTURED_SOLVE,
+  PROF_KRYLOV_CG,
+  PROF_KRYLOV_GMRES,
+  PROF_KRYLOV_BICGSTAB,
+  PROF_BATCH_GEMM,
+  PROF_EXPR_EVAL,
+  PROF_FILE_MULT,
+  PROF_FILE_LU,
+  PROF_COUNT
+} ProfileId;
+
+// Instrumentation points. They compile to nothing unless the library is
+// built with MATRIX_PROFILE (cmake -DMATRIX_PROFILE=ON), and then their
+// arguments are not evaluated either.
+#ifdef MATRIX_PROFILE
+
+typedef struct profile_span {
+  ProfileId id;
+  uint64_t start_ns;
+  double flops;
+  double bytes;
+} ProfileSpan;
+
+ProfileSpan profile_begin(ProfileId id, double flops, double bytes);
+
+void profile_end(ProfileSpan *span);
+
+void profile_alloc(size_t size);
+
+void profile_scratch(size_t used);
+
+// Counts the rest of the enclosing block as one call of id, of nominal
+// work flops and bytes: the span ends on every way out of the block
+#define PROFILE_SCOPE(id, flops, bytes)                                        \
+  ProfileSpan profile_span_ __attribute__((cleanup(profile_end))) =           \
+      profile_begin((id), (flops), (bytes))
+
+// Adds work only known inside the block (an iteration count, shapes read
+// from a file) to the enclosing PROFILE_SCOPE
+#define PROFILE_WORK(more_flops, more_bytes)                                   \
+  do {                                                                         \
+    profile_span_.flops += (more_flops);                                       \
+    profile_span_.bytes += (more_bytes);                                       \
+  } while (0)
+
+// A matrix block of size bytes was allocated
+#define PROFILE_ALLOC(size) profile_alloc(size)
+
+// A per-thread scratch arena now holds used bytes
+#define PROFILE_SCRATCH(used) profile_scratch(used)
+
+#else
+
+#define PROFILE_SCOPE(id, flops, bytes) ((void)0)
+#define PROFILE_WORK(more_flops, more_bytes) ((void)0)
+#define PROFILE_ALLOC(size) ((void)0)
+#define PROFILE_SCRATCH(used) ((void)0)
+
+#endif // MATRIX_PROFILE
+
+#endif // !PROFILE_H
@@ -0,0 +1,353 @@
+// Randomized low-rank approximation (Halko, Martinsson and Tropp): A is
+// sampled by a random test matrix, the sample orthonormalized, and the
+// SVD taken of the small projection of A onto it. Every pass over A is one
+// large GEMM. The single-pass sketch follows Tropp, Yurtsever, Udell and
+// Cevher (2017).
+#include "gemm.h"
+#include "householder.h"
+#include "matrix.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Gaussian numbers per task when filling a test matrix
+#define GAUSSIAN_GRAIN 4096
+
+// Rows per block when the sketch regenerates its row test matrix
+#define SKETCH_ROWS 4096
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+// Test matrices
+
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+typedef struct gaussian_args {
+  float *x;
+  uint64_t key;
+  uint64_t first;
+} GaussianArgs;
+
+// Element i is a function of (seed, first + i) only, so a test matrix is
+// the same whatever the thread count, and any block of it can be
+// regenerated on its own. Each is the sum of four 16-bit uniforms, scaled
+// to unit variance: near-Gaussian, which is all sketching needs (any
+// subgaussian entries do), and several times cheaper than Box-Muller,
+// whose log and cos dominated the single pass.
+static void gaussian_task(void *arg, size_t begin, size_t end) {
+  GaussianArgs *g = arg;
+  for (size_t i = begin; i < end; i++) {
+    uint64_t r = splitmix64(g->key + g->first + i);
+    float sum = (float)(r & 0xffff) + (float)((r >> 16) & 0xffff) +
+                (float)((r >> 32) & 0xffff) + (float)(r >> 48);
+    g->x[i] = (sum * (1.0f / 65536.0f) - 2.0f + 2.0f / 65536.0f) *
+              1.7320508f; // sqrt(12 / 4)
+  }
+}
+
+static void gaussian_fill(float *x, size_t count, uint64_t seed,
+                          uint64_t first) {
+  GaussianArgs args = {x, splitmix64(seed), first};
+  parallel_for(count, GAUSSIAN_GRAIN, gaussian_task, &args);
+}
+
+// Products with A (m x n, any strides)
+
+// Y (m x l) = A X, X n x l
+static void mult_a(const Matrix *A, const float *X, size_t l, float *Y) {
+  gemm_strided(A->n_rows, l, A->n_cols, 1.0f, A->array, A->row_stride,
+               A->col_stride, X, l, 1, 0.0f, Y, l, 1);
+}
+
+// Z (n x p) = A^T X, X m x p. The inner dimension is A's long one, which
+// tall_tn splits over the pool.
+static void mult_at(const Matrix *A, const float *X, size_t p, float *Z) {
+  if (A->col_stride == 1) {
+    tall_tn(A->n_rows, A->n_cols, p, A->array, A->row_stride, X, p, 0.0f, Z,
+            0);
+  } else {
+    gemm_strided(A->n_cols, p, A->n_rows, 1.0f, A->array, A->col_stride,
+                 A->row_stride, X, p, 1, 0.0f, Z, p, 1);
+  }
+}
+
+// Q (m x l) with orthonormal columns spanning those of Y (m x l, m >= l),
+// by Householder QR. Y is overwritten.
+static int orthonormalize(float *Y, size_t m, size_t l, float *Q) {
+  float *tau = malloc((l > 0 ? l : 1) * sizeof(float));
+  if (tau == NULL || qr_factor_apply(Y, m, l, tau, NULL, 0) != 0) {
+    free(tau);
+    return -1;
+  }
+  memset(Q, 0, m * l * sizeof(float));
+  for (size_t i = 0; i < l; i++) {
+    Q[i * l + i] = 1.0f;
+  }
+  int status = householder_apply(m, l, Y, l, 1, tau, Q, l, l);
+  free(tau);
+  return status;
+}
+
+// Q (m x l) spanning the dominant range of A: Q = orth(A Omega), then
+// power_iters rounds of Q = orth(A orth(A^T Q)), which sharpen the decay
+// of the spectrum the sample sees. Re-orthonormalizing between passes
+// keeps the small singular directions from being lost to rounding.
+static int range_finder(const Matrix *A, size_t l, size_t power_iters,
+                        uint64_t seed, float *Q) {
+  size_t m = A->n_rows, n = A->n_cols;
+  float *Y = malloc((m * l + 2 * n * l + 1) * sizeof(float));
+  if (Y == NULL)
+    return -1;
+  float *Z = Y + m * l, *Zq = Z + n * l;
+
+  gaussian_fill(Zq, n * l, seed, 0);
+  mult_a(A, Zq, l, Y);
+  int status = orthonormalize(Y, m, l, Q);
+  for (size_t it = 0; status == 0 && it < power_iters; it++) {
+    mult_at(A, Q, l, Z);
+    status = orthonormalize(Z, n, l, Zq);
+    if (status == 0) {
+      mult_a(A, Zq, l, Y);
+      status = orthonormalize(Y, m, l, Q);
+    }
+  }
+  free(Y);
+  return status;
+}
+
+static int check_rank(const char *func, const Matrix *A, size_t k) {
+  size_t r = min_size(A->n_rows, A->n_cols);
+  if (k == 0 || k > r) {
+    fprintf(stderr, "Error %s: rank(%zu) not in [1, min(n_rows, n_cols)]\n",
+            func, k);
+    return 0;
+  }
+  return 1;
+}
+
+// Public API
+
+Matrix *randomized_range(Matrix *A, size_t l, size_t power_iters,
+                         unsigned long long seed) {
+  if (!check_rank(__func__, A, l))
+    return NULL;
+  Matrix *Q = matrix_create(A->n_rows, l);
+  if (Q == NULL || range_finder(A, l, power_iters, seed, Q->array) != 0) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    matrix_free(Q);
+    return NULL;
+  }
+  return Q;
+}
+
+// U = Q U_small (m x k), in place of the small factor's U
+static int lift_left(SVDFactor *svd, const float *Q, size_t m, size_t l) {
+  size_t k = svd->S->n_rows;
+  Matrix *U = matrix_create(m, k);
+  if (U == NULL)
+    return -1;
+  gemm_strided(m, k, l, 1.0f, Q, l, 1, svd->U->array, k, 1, 0.0f, U->array,
+               k, 1);
+  matrix_free(svd->U);
+  svd->U = U;
+  return 0;
+}
+
+SVDFactor *randomized_svd(Matrix *A, size_t k, size_t oversample,
+                          size_t power_iters, unsigned long long seed) {
+  PROFILE_SCOPE(PROF_RANDOMIZED_SVD,
+                2.0 * A->n_rows * A->n_cols * (k + oversample) *
+                    (2 + 2 * power_iters),
+                4.0 * A->n_rows * A->n_cols * (2 + 2 * power_iters));
+  if (!check_rank(__func__, A, k))
+    return NULL;
+  size_t m = A->n_rows, n = A->n_cols;
+  size_t l = min_size(k + oversample, min_size(m, n));
+
+  // B = Q^T A (l x n), whose SVD is that of A restricted to the range of Q
+  Matrix *Q = randomized_range(A, l, power_iters, seed);
+  Matrix *B = matrix_create(l, n);
+  SVDFactor *svd = NULL;
+  if (Q == NULL || B == NULL)
+    goto fail;
+  if (A->col_stride == 1) {
+    tall_tn(m, l, n, Q->array, l, A->array, A->row_stride, 0.0f, B->array,
+            0);
+  } else {
+    gemm_strided(l, n, m, 1.0f, Q->array, 1, l, A->array, A->row_stride,
+                 A->col_stride, 0.0f, B->array, n, 1);
+  }
+  svd = svd_factor(B, k, 1);
+  if (svd == NULL || lift_left(svd, Q->array, m, l) != 0)
+    goto fail;
+  matrix_free(Q);
+  matrix_free(B);
+  return svd;
+
+fail:
+  matrix_free(Q);
+  matrix_free(B);
+  svd_factor_free(svd);
+  return NULL;
+}
+
+// Single pass
+
+// A (m x n) is seen once, by row blocks, through two sketches: the range
+// sketch Y = A Omega (m x l, its rows appended block by block) and the
+// co-range sketch W = Psi A (l2 x n, summed over the blocks). Omega
+// (n x l) is kept; Psi (l2 x m) is regenerated from the seed block by
+// block, so it never needs m x l2 of memory. Then with Q = orth(Y),
+// A ~ Q X where X solves (Psi Q) X = W in the least squares sense.
+struct svd_sketch {
+  size_t n;
+  size_t k;
+  size_t l;
+  size_t l2;
+  uint64_t seed_psi;
+  float *omega;
+  float *Y;
+  size_t m;
+  size_t capacity; // rows of Y
+  float *W;
+};
+
+SVDSketch *svd_sketch_create(size_t n_cols, size_t k, size_t oversample,
+                             unsigned long long seed) {
+  if (k == 0 || k > n_cols) {
+    fprintf(stderr, "Error %s: rank(%zu) not in [1, n_cols(%zu)]\n",
+            __func__, k, n_cols);
+    return NULL;
+  }
+  SVDSketch *sk = calloc(1, sizeof(SVDSketch));
+  if (sk == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return NULL;
+  }
+  sk->n = n_cols;
+  sk->k = k;
+  sk->l = min_size(k + oversample, n_cols);
+  sk->l2 = 2 * sk->l + 1;
+  sk->seed_psi = splitmix64(seed ^ 0x5ca1ab1eULL);
+  sk->omega = malloc(n_cols * sk->l * sizeof(float));
+  sk->W = calloc(sk->l2 * n_cols, sizeof(float));
+  if (sk->omega == NULL || sk->W == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    svd_sketch_free(sk);
+    return NULL;
+  }
+  gaussian_fill(sk->omega, n_cols * sk->l, seed, 0);
+  return sk;
+}
+
+// Rows [r0, r0 + rows) of Psi^T, as rows x l2
+static void psi_rows(const SVDSketch *sk, size_t r0, size_t rows,
+                     float *psi_t) {
+  gaussian_fill(psi_t, rows * sk->l2, sk->seed_psi, (uint64_t)r0 * sk->l2);
+}
+
+int svd_sketch_update(SVDSketch *sk, Matrix *rows) {
+  if (rows->n_cols != sk->n) {
+    fprintf(stderr, "Error %s: n_cols(%zu) != %zu\n", __func__,
+            rows->n_cols, sk->n);
+    return -1;
+  }
+  size_t b = rows->n_rows, l = sk->l, l2 = sk->l2;
+  if (sk->m + b > sk->capacity) {
+    size_t capacity = sk->capacity > 0 ? 2 * sk->capacity : SKETCH_ROWS;
+    while (capacity < sk->m + b) {
+      capacity *= 2;
+    }
+    float *Y = realloc(sk->Y, capacity * l * sizeof(float));
+    if (Y == NULL) {
+      fprintf(stderr, "Error: memory allocation failed\n");
+      return -1;
+    }
+    sk->Y = Y;
+    sk->capacity = capacity;
+  }
+  float *psi_t = malloc((b * l2 + 1) * sizeof(float));
+  if (psi_t == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return -1;
+  }
+
+  // Y's new rows = rows Omega, W += Psi(:, block) rows
+  mult_a(rows, sk->omega, l, &sk->Y[sk->m * l]);
+  psi_rows(sk, sk->m, b, psi_t);
+  if (rows->col_stride == 1) {
+    tall_tn(b, l2, sk->n, psi_t, l2, rows->array, rows->row_stride, 1.0f,
+            sk->W, 0);
+  } else {
+    gemm_strided(l2, sk->n, b, 1.0f, psi_t, 1, l2, rows->array,
+                 rows->row_stride, rows->col_stride, 1.0f, sk->W, sk->n, 1);
+  }
+  sk->m += b;
+  free(psi_t);
+  return 0;
+}
+
+SVDFactor *svd_sketch_finish(SVDSketch *sk) {
+  size_t m = sk->m, n = sk->n, l = sk->l, l2 = sk->l2;
+  if (m < l) {
+    fprintf(stderr, "Error %s: %zu rows seen, at least %zu needed\n",
+            __func__, m, l);
+    svd_sketch_free(sk);
+    return NULL;
+  }
+
+  Matrix *PsiQ = matrix_create(l2, l);
+  Matrix W = matrix_view_array(sk->W, l2, n, n);
+  float *Q = malloc(m * l * sizeof(float));
+  float *psi_t = malloc(SKETCH_ROWS * l2 * sizeof(float));
+  Matrix *X = NULL;
+  SVDFactor *svd = NULL;
+  if (PsiQ == NULL || Q == NULL || psi_t == NULL ||
+      orthonormalize(sk->Y, m, l, Q) != 0) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    goto done;
+  }
+
+  // Psi Q, with Psi regenerated block by block
+  for (size_t r0 = 0; r0 < m; r0 += SKETCH_ROWS) {
+    size_t rows = min_size(SKETCH_ROWS, m - r0);
+    psi_rows(sk, r0, rows, psi_t);
+    tall_tn(rows, l2, l, psi_t, l2, &Q[r0 * l], l, r0 > 0 ? 1.0f : 0.0f,
+            PsiQ->array, 0);
+  }
+  X = solve_least_squares(PsiQ, &W);
+  if (X == NULL)
+    goto done;
+  svd = svd_factor(X, sk->k, 1);
+  if (svd != NULL && lift_left(svd, Q, m, l) != 0) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    svd_factor_free(svd);
+    svd = NULL;
+  }
+
+done:
+  matrix_free(PsiQ);
+  matrix_free(X);
+  free(Q);
+  free(psi_t);
+  svd_sketch_free(sk);
+  return svd;
+}
+
+void svd_sketch_free(SVDSketch *sk) {
+  if (sk != NULL) {
+    free(sk->omega);
+    free(sk->Y);
+    free(sk->W);
+    free(sk);
+  }
+}
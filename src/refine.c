@@ -0,0 +1,162 @@
+#include "alloc.h"
+#include "lu.h"
+#include "matrix.h"
+#include "view.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
+// Refinement gives up after this many steps, or as soon as one step fails
+// to halve the backward error, and falls back to a double factorization.
+// Each step gains ~log10(1 / (cond(A) * FLT_EPSILON)) digits, so a system
+// float can factor at all converges in a handful.
+#define REFINE_MAX_ITER 30
+
+// max_i sum_j |A_ij|
+static double norm_inf(const MatrixD *A) {
+  double norm = 0;
+  for (size_t i = 0; i < A->n_rows; i++) {
+    double sum = 0;
+    for (size_t j = 0; j < A->n_cols; j++) {
+      sum += fabs(MATRIX_AT(A, i, j));
+    }
+    if (!(sum <= norm)) // NaN propagates
+      norm = sum;
+  }
+  return norm;
+}
+
+// Largest normwise backward error over the columns of x:
+// ||r_j|| / (||A|| ||x_j|| + ||b_j||), max-norms, r = b - A x.
+// col holds 3 * k doubles of scratch.
+static double backward_error(const MatrixD *r, const MatrixD *x,
+                             const MatrixD *b, double norm_A, double *col) {
+  size_t n = r->n_rows, k = r->n_cols;
+  double *r_max = col, *x_max = col + k, *b_max = col + 2 * k;
+
+  for (size_t j = 0; j < 3 * k; j++) {
+    col[j] = 0;
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < k; j++) {
+      r_max[j] = fmax(r_max[j], fabs(MATRIX_AT(r, i, j)));
+      x_max[j] = fmax(x_max[j], fabs(MATRIX_AT(x, i, j)));
+      b_max[j] = fmax(b_max[j], fabs(MATRIX_AT(b, i, j)));
+    }
+  }
+
+  double err = 0;
+  for (size_t j = 0; j < k; j++) {
+    double denom = norm_A * x_max[j] + b_max[j];
+    double e = denom > 0 ? r_max[j] / denom : r_max[j];
+    if (!(e <= err)) // NaN propagates
+      err = e;
+  }
+  return err;
+}
+
+// r = b - A x
+static void residual(MatrixD *r, MatrixD *A, MatrixD *x, MatrixD *b) {
+  for (size_t i = 0; i < r->n_rows; i++) {
+    for (size_t j = 0; j < r->n_cols; j++) {
+      MATRIX_AT(r, i, j) = MATRIX_AT(b, i, j);
+    }
+  }
+  matrixd_gemm(-1.0, A, x, 1.0, r);
+}
+
+MatrixD *solve_lin_system_refined(MatrixD *A, MatrixD *b, double tolerance,
+                                  RefineInfo *info) {
+  size_t n = A->n_rows, k = b->n_cols;
+
+  if (A->n_rows != A->n_cols || b->n_rows != n) {
+    fprintf(stderr, "Error %s: A is %zu x %zu, b is %zu x %zu\n", __func__,
+            A->n_rows, A->n_cols, b->n_rows, b->n_cols);
+    return NULL;
+  }
+  if (!(tolerance > 0))
+    tolerance = DBL_EPSILON * sqrt((double)(n > 0 ? n : 1));
+
+  MatrixD *x = matrixd_create(n, k);
+  if (x == NULL)
+    return NULL;
+
+  // Float LU, a double copy of the residual and a float copy of the
+  // correction, all in the scratch arena
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  Matrix *lu = scratch_matrix(scratch, n, n);
+  Matrix *d = scratch_matrix(scratch, n, k);
+  double *r_array = scratch_alloc(scratch, (n * k + 1) * sizeof(double));
+  double *col = scratch_alloc(scratch, (3 * k + 1) * sizeof(double));
+  size_t *pivots = scratch_alloc(scratch, (n + 1) * sizeof(size_t));
+  if (lu == NULL || d == NULL || r_array == NULL || col == NULL ||
+      pivots == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    matrixd_free(x);
+    x = NULL;
+    goto done;
+  }
+  MatrixD r = matrixd_view_array(r_array, n, k, k);
+
+  double norm_A = norm_inf(A);
+  double err = INFINITY;
+  size_t iter = 0;
+  int converged = 0;
+
+  // An A that overflows float or is singular in float goes straight to
+  // the fallback
+  matrixd_to_float_into(lu, A);
+  if (lu_factorize(lu->array, n, pivots) != 0 && isfinite(norm_A)) {
+    // x0 from the float factorization, then x += A^-1 (b - A x)
+    matrixd_to_float_into(d, b);
+    lu_solve_raw(lu->array, pivots, n, d->array, k, k);
+    matrix_to_double_into(x, d);
+
+    for (;;) {
+      residual(&r, A, x, b);
+      double prev = err;
+      err = backward_error(&r, x, b, norm_A, col);
+      if (err <= tolerance) {
+        converged = 1;
+        break;
+      }
+      if (iter == REFINE_MAX_ITER || !(err < 0.5 * prev))
+        break;
+
+      matrixd_to_float_into(d, &r);
+      lu_solve_raw(lu->array, pivots, n, d->array, k, k);
+      for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < k; j++) {
+          MATRIX_AT(x, i, j) += d->array[i * k + j];
+        }
+      }
+      iter++;
+    }
+  }
+
+  if (!converged) {
+    MatrixD *fallback = matrixd_solve(A, b);
+    matrixd_free(x);
+    x = fallback;
+    if (x != NULL) {
+      residual(&r, A, x, b);
+      err = backward_error(&r, x, b, norm_A, col);
+    }
+  }
+
+  if (info != NULL) {
+    info->iterations = iter;
+    info->backward_error = err;
+    info->fell_back = !converged;
+  }
+
+done:
+  scratch_free(scratch, pivots);
+  scratch_free(scratch, col);
+  scratch_free(scratch, r_array);
+  matrix_free(d);
+  matrix_free(lu);
+  matrix_arena_reset(scratch, mark);
+  return x;
+}
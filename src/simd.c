@@ -0,0 +1,804 @@
+#include "simd.h"
+#include "matrix.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// Portable scalar path, also the fallback on non-x86 targets
+// ---------------------------------------------------------------------------
+
+#define SCALAR_MR 6
+#define SCALAR_NR 8
+
+static void add_scalar(size_t n, const float *a, const float *b, float *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = a[i] + b[i];
+}
+
+static void sub_scalar(size_t n, const float *a, const float *b, float *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = a[i] - b[i];
+}
+
+static void scale_scalar(size_t n, float scalar, const float *a, float *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = scalar * a[i];
+}
+
+static void axpy_scalar(size_t n, float scalar, const float *a, float *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] += scalar * a[i];
+}
+
+static int approx_equal_scalar(size_t n, const float *a, const float *b,
+                               float tolerance) {
+  for (size_t i = 0; i < n; i++) {
+    if (fabsf(a[i] - b[i]) > tolerance)
+      return 0;
+  }
+  return 1;
+}
+
+static void gemm_kernel_scalar(size_t kc, const float *Ap, const float *Bp,
+                               float *C, size_t rsc, float alpha,
+                               float beta) {
+  float acc[SCALAR_MR][SCALAR_NR] = {{0.0f}};
+
+  for (size_t p = 0; p < kc; p++) {
+    for (size_t i = 0; i < SCALAR_MR; i++) {
+      float a = Ap[i];
+      for (size_t j = 0; j < SCALAR_NR; j++) {
+        acc[i][j] += a * Bp[j];
+      }
+    }
+    Ap += SCALAR_MR;
+    Bp += SCALAR_NR;
+  }
+
+  for (size_t i = 0; i < SCALAR_MR; i++) {
+    float *c = &C[i * rsc];
+    if (beta == 0.0f) {
+      for (size_t j = 0; j < SCALAR_NR; j++)
+        c[j] = alpha * acc[i][j];
+    } else {
+      for (size_t j = 0; j < SCALAR_NR; j++)
+        c[j] = alpha * acc[i][j] + beta * c[j];
+    }
+  }
+}
+
+#define SCALAR_D_MR 4
+#define SCALAR_D_NR 4
+
+static void add_scalar_d(size_t n, const double *a, const double *b,
+                         double *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = a[i] + b[i];
+}
+
+static void sub_scalar_d(size_t n, const double *a, const double *b,
+                         double *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = a[i] - b[i];
+}
+
+static void scale_scalar_d(size_t n, double scalar, const double *a,
+                           double *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = scalar * a[i];
+}
+
+static int approx_equal_scalar_d(size_t n, const double *a, const double *b,
+                                 double tolerance) {
+  for (size_t i = 0; i < n; i++) {
+    if (fabs(a[i] - b[i]) > tolerance)
+      return 0;
+  }
+  return 1;
+}
+
+static void gemm_kernel_scalar_d(size_t kc, const double *Ap,
+                                 const double *Bp, double *C, size_t rsc,
+                                 double alpha, double beta) {
+  double acc[SCALAR_D_MR][SCALAR_D_NR] = {{0.0}};
+
+  for (size_t p = 0; p < kc; p++) {
+    for (size_t i = 0; i < SCALAR_D_MR; i++) {
+      double a = Ap[i];
+      for (size_t j = 0; j < SCALAR_D_NR; j++) {
+        acc[i][j] += a * Bp[j];
+      }
+    }
+    Ap += SCALAR_D_MR;
+    Bp += SCALAR_D_NR;
+  }
+
+  for (size_t i = 0; i < SCALAR_D_MR; i++) {
+    double *c = &C[i * rsc];
+    if (beta == 0.0) {
+      for (size_t j = 0; j < SCALAR_D_NR; j++)
+        c[j] = alpha * acc[i][j];
+    } else {
+      for (size_t j = 0; j < SCALAR_D_NR; j++)
+        c[j] = alpha * acc[i][j] + beta * c[j];
+    }
+  }
+}
+
+static const SimdKernelsD kernels_scalar_d = {
+    add_scalar_d, sub_scalar_d, scale_scalar_d, approx_equal_scalar_d,
+    SCALAR_D_MR,  SCALAR_D_NR,  gemm_kernel_scalar_d};
+
+static const SimdKernels kernels_scalar = {
+    "scalar",           add_scalar,          sub_scalar, scale_scalar,
+    axpy_scalar,        approx_equal_scalar, SCALAR_MR,  SCALAR_NR,
+    gemm_kernel_scalar, &kernels_scalar_d};
+
+#ifdef SIMD_X86
+
+// ---------------------------------------------------------------------------
+// SSE2: 4 floats per register, no FMA. 6x8 tile = 12 accumulators.
+// ---------------------------------------------------------------------------
+
+#define SSE2_MR 6
+#define SSE2_NR 8
+
+__attribute__((target("sse2"))) static void
+add_sse2(size_t n, const float *a, const float *b, float *out) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i,
+                  _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  for (; i < n; i++)
+    out[i] = a[i] + b[i];
+}
+
+__attribute__((target("sse2"))) static void
+sub_sse2(size_t n, const float *a, const float *b, float *out) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i,
+                  _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  for (; i < n; i++)
+    out[i] = a[i] - b[i];
+}
+
+__attribute__((target("sse2"))) static void
+scale_sse2(size_t n, float scalar, const float *a, float *out) {
+  __m128 s = _mm_set1_ps(scalar);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i, _mm_mul_ps(s, _mm_loadu_ps(a + i)));
+  for (; i < n; i++)
+    out[i] = scalar * a[i];
+}
+
+__attribute__((target("sse2"))) static void
+axpy_sse2(size_t n, float scalar, const float *a, float *out) {
+  __m128 s = _mm_set1_ps(scalar);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i),
+                                      _mm_mul_ps(s, _mm_loadu_ps(a + i))));
+  for (; i < n; i++)
+    out[i] += scalar * a[i];
+}
+
+__attribute__((target("sse2"))) static int
+approx_equal_sse2(size_t n, const float *a, const float *b, float tolerance) {
+  __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 tol = _mm_set1_ps(tolerance);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    __m128 gt = _mm_cmpgt_ps(_mm_and_ps(diff, abs_mask), tol);
+    if (_mm_movemask_ps(gt) != 0)
+      return 0;
+  }
+  return approx_equal_scalar(n - i, a + i, b + i, tolerance);
+}
+
+__attribute__((target("sse2"))) static void
+gemm_kernel_sse2(size_t kc, const float *Ap, const float *Bp, float *C,
+                 size_t rsc, float alpha, float beta) {
+  __m128 acc[SSE2_MR][2];
+  for (size_t i = 0; i < SSE2_MR; i++)
+    acc[i][0] = acc[i][1] = _mm_setzero_ps();
+
+  for (size_t p = 0; p < kc; p++) {
+    __m128 b0 = _mm_loadu_ps(Bp);
+    __m128 b1 = _mm_loadu_ps(Bp + 4);
+    for (size_t i = 0; i < SSE2_MR; i++) {
+      __m128 a = _mm_set1_ps(Ap[i]);
+      acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(a, b0));
+      acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(a, b1));
+    }
+    Ap += SSE2_MR;
+    Bp += SSE2_NR;
+  }
+
+  __m128 va = _mm_set1_ps(alpha);
+  __m128 vb = _mm_set1_ps(beta);
+  for (size_t i = 0; i < SSE2_MR; i++) {
+    float *c = &C[i * rsc];
+    for (size_t h = 0; h < 2; h++) {
+      __m128 r = _mm_mul_ps(va, acc[i][h]);
+      if (beta != 0.0f)
+        r = _mm_add_ps(r, _mm_mul_ps(vb, _mm_loadu_ps(c + 4 * h)));
+      _mm_storeu_ps(c + 4 * h, r);
+    }
+  }
+}
+
+// Doubles: 2 per register, 4x4 tile = 8 accumulators
+
+#define SSE2_D_MR 4
+#define SSE2_D_NR 4
+
+__attribute__((target("sse2"))) static void
+add_sse2_d(size_t n, const double *a, const double *b, double *out) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(out + i,
+                  _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  for (; i < n; i++)
+    out[i] = a[i] + b[i];
+}
+
+__attribute__((target("sse2"))) static void
+sub_sse2_d(size_t n, const double *a, const double *b, double *out) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(out + i,
+                  _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  for (; i < n; i++)
+    out[i] = a[i] - b[i];
+}
+
+__attribute__((target("sse2"))) static void
+scale_sse2_d(size_t n, double scalar, const double *a, double *out) {
+  __m128d s = _mm_set1_pd(scalar);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(out + i, _mm_mul_pd(s, _mm_loadu_pd(a + i)));
+  for (; i < n; i++)
+    out[i] = scalar * a[i];
+}
+
+__attribute__((target("sse2"))) static int
+approx_equal_sse2_d(size_t n, const double *a, const double *b,
+                    double tolerance) {
+  __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffff));
+  __m128d tol = _mm_set1_pd(tolerance);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d diff = _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+    __m128d gt = _mm_cmpgt_pd(_mm_and_pd(diff, abs_mask), tol);
+    if (_mm_movemask_pd(gt) != 0)
+      return 0;
+  }
+  return approx_equal_scalar_d(n - i, a + i, b + i, tolerance);
+}
+
+__attribute__((target("sse2"))) static void
+gemm_kernel_sse2_d(size_t kc, const double *Ap, const double *Bp, double *C,
+                   size_t rsc, double alpha, double beta) {
+  __m128d acc[SSE2_D_MR][2];
+  for (size_t i = 0; i < SSE2_D_MR; i++)
+    acc[i][0] = acc[i][1] = _mm_setzero_pd();
+
+  for (size_t p = 0; p < kc; p++) {
+    __m128d b0 = _mm_loadu_pd(Bp);
+    __m128d b1 = _mm_loadu_pd(Bp + 2);
+    for (size_t i = 0; i < SSE2_D_MR; i++) {
+      __m128d a = _mm_set1_pd(Ap[i]);
+      acc[i][0] = _mm_add_pd(acc[i][0], _mm_mul_pd(a, b0));
+      acc[i][1] = _mm_add_pd(acc[i][1], _mm_mul_pd(a, b1));
+    }
+    Ap += SSE2_D_MR;
+    Bp += SSE2_D_NR;
+  }
+
+  __m128d va = _mm_set1_pd(alpha);
+  __m128d vb = _mm_set1_pd(beta);
+  for (size_t i = 0; i < SSE2_D_MR; i++) {
+    double *c = &C[i * rsc];
+    for (size_t h = 0; h < 2; h++) {
+      __m128d r = _mm_mul_pd(va, acc[i][h]);
+      if (beta != 0.0)
+        r = _mm_add_pd(r, _mm_mul_pd(vb, _mm_loadu_pd(c + 2 * h)));
+      _mm_storeu_pd(c + 2 * h, r);
+    }
+  }
+}
+
+static const SimdKernelsD kernels_sse2_d = {
+    add_sse2_d, sub_sse2_d, scale_sse2_d,      approx_equal_sse2_d,
+    SSE2_D_MR,  SSE2_D_NR,  gemm_kernel_sse2_d};
+
+static const SimdKernels kernels_sse2 = {
+    "sse2",           add_sse2,          sub_sse2, scale_sse2,
+    axpy_sse2,        approx_equal_sse2, SSE2_MR,  SSE2_NR,
+    gemm_kernel_sse2, &kernels_sse2_d};
+
+// ---------------------------------------------------------------------------
+// AVX2 + FMA: 8 floats per register. 6x16 tile = 12 accumulators.
+// ---------------------------------------------------------------------------
+
+#define AVX2_MR 6
+#define AVX2_NR 16
+
+__attribute__((target("avx2,fma"))) static void
+add_avx2(size_t n, const float *a, const float *b, float *out) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(a + i),
+                                            _mm256_loadu_ps(b + i)));
+  for (; i < n; i++)
+    out[i] = a[i] + b[i];
+}
+
+__attribute__((target("avx2,fma"))) static void
+sub_avx2(size_t n, const float *a, const float *b, float *out) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_sub_ps(_mm256_loadu_ps(a + i),
+                                            _mm256_loadu_ps(b + i)));
+  for (; i < n; i++)
+    out[i] = a[i] - b[i];
+}
+
+__attribute__((target("avx2,fma"))) static void
+scale_avx2(size_t n, float scalar, const float *a, float *out) {
+  __m256 s = _mm256_set1_ps(scalar);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(s, _mm256_loadu_ps(a + i)));
+  for (; i < n; i++)
+    out[i] = scalar * a[i];
+}
+
+__attribute__((target("avx2,fma"))) static void
+axpy_avx2(size_t n, float scalar, const float *a, float *out) {
+  __m256 s = _mm256_set1_ps(scalar);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_fmadd_ps(s, _mm256_loadu_ps(a + i),
+                                              _mm256_loadu_ps(out + i)));
+  for (; i < n; i++)
+    out[i] += scalar * a[i];
+}
+
+__attribute__((target("avx2,fma"))) static int
+approx_equal_avx2(size_t n, const float *a, const float *b, float tolerance) {
+  __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  __m256 tol = _mm256_set1_ps(tolerance);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    __m256 gt =
+        _mm256_cmp_ps(_mm256_and_ps(diff, abs_mask), tol, _CMP_GT_OQ);
+    if (_mm256_movemask_ps(gt) != 0)
+      return 0;
+  }
+  return approx_equal_scalar(n - i, a + i, b + i, tolerance);
+}
+
+__attribute__((target("avx2,fma"))) static void
+gemm_kernel_avx2(size_t kc, const float *Ap, const float *Bp, float *C,
+                 size_t rsc, float alpha, float beta) {
+  __m256 acc[AVX2_MR][2];
+  for (size_t i = 0; i < AVX2_MR; i++)
+    acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+
+  for (size_t p = 0; p < kc; p++) {
+    __m256 b0 = _mm256_loadu_ps(Bp);
+    __m256 b1 = _mm256_loadu_ps(Bp + 8);
+    for (size_t i = 0; i < AVX2_MR; i++) {
+      __m256 a = _mm256_broadcast_ss(Ap + i);
+      acc[i][0] = _mm256_fmadd_ps(a, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_ps(a, b1, acc[i][1]);
+    }
+    Ap += AVX2_MR;
+    Bp += AVX2_NR;
+  }
+
+  __m256 va = _mm256_set1_ps(alpha);
+  __m256 vb = _mm256_set1_ps(beta);
+  for (size_t i = 0; i < AVX2_MR; i++) {
+    float *c = &C[i * rsc];
+    for (size_t h = 0; h < 2; h++) {
+      __m256 r = _mm256_mul_ps(va, acc[i][h]);
+      if (beta != 0.0f)
+        r = _mm256_fmadd_ps(vb, _mm256_loadu_ps(c + 8 * h), r);
+      _mm256_storeu_ps(c + 8 * h, r);
+    }
+  }
+}
+
+// Doubles: 4 per register, 6x8 tile = 12 accumulators
+
+#define AVX2_D_MR 6
+#define AVX2_D_NR 8
+
+__attribute__((target("avx2,fma"))) static void
+add_avx2_d(size_t n, const double *a, const double *b, double *out) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i),
+                                            _mm256_loadu_pd(b + i)));
+  for (; i < n; i++)
+    out[i] = a[i] + b[i];
+}
+
+__attribute__((target("avx2,fma"))) static void
+sub_avx2_d(size_t n, const double *a, const double *b, double *out) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_loadu_pd(a + i),
+                                            _mm256_loadu_pd(b + i)));
+  for (; i < n; i++)
+    out[i] = a[i] - b[i];
+}
+
+__attribute__((target("avx2,fma"))) static void
+scale_avx2_d(size_t n, double scalar, const double *a, double *out) {
+  __m256d s = _mm256_set1_pd(scalar);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(s, _mm256_loadu_pd(a + i)));
+  for (; i < n; i++)
+    out[i] = scalar * a[i];
+}
+
+__attribute__((target("avx2,fma"))) static int
+approx_equal_avx2_d(size_t n, const double *a, const double *b,
+                    double tolerance) {
+  __m256d abs_mask =
+      _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffff));
+  __m256d tol = _mm256_set1_pd(tolerance);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d diff =
+        _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    __m256d gt =
+        _mm256_cmp_pd(_mm256_and_pd(diff, abs_mask), tol, _CMP_GT_OQ);
+    if (_mm256_movemask_pd(gt) != 0)
+      return 0;
+  }
+  return approx_equal_scalar_d(n - i, a + i, b + i, tolerance);
+}
+
+__attribute__((target("avx2,fma"))) static void
+gemm_kernel_avx2_d(size_t kc, const double *Ap, const double *Bp, double *C,
+                   size_t rsc, double alpha, double beta) {
+  __m256d acc[AVX2_D_MR][2];
+  for (size_t i = 0; i < AVX2_D_MR; i++)
+    acc[i][0] = acc[i][1] = _mm256_setzero_pd();
+
+  for (size_t p = 0; p < kc; p++) {
+    __m256d b0 = _mm256_loadu_pd(Bp);
+    __m256d b1 = _mm256_loadu_pd(Bp + 4);
+    for (size_t i = 0; i < AVX2_D_MR; i++) {
+      __m256d a = _mm256_broadcast_sd(Ap + i);
+      acc[i][0] = _mm256_fmadd_pd(a, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_pd(a, b1, acc[i][1]);
+    }
+    Ap += AVX2_D_MR;
+    Bp += AVX2_D_NR;
+  }
+
+  __m256d va = _mm256_set1_pd(alpha);
+  __m256d vb = _mm256_set1_pd(beta);
+  for (size_t i = 0; i < AVX2_D_MR; i++) {
+    double *c = &C[i * rsc];
+    for (size_t h = 0; h < 2; h++) {
+      __m256d r = _mm256_mul_pd(va, acc[i][h]);
+      if (beta != 0.0)
+        r = _mm256_fmadd_pd(vb, _mm256_loadu_pd(c + 4 * h), r);
+      _mm256_storeu_pd(c + 4 * h, r);
+    }
+  }
+}
+
+static const SimdKernelsD kernels_avx2_d = {
+    add_avx2_d, sub_avx2_d, scale_avx2_d,      approx_equal_avx2_d,
+    AVX2_D_MR,  AVX2_D_NR,  gemm_kernel_avx2_d};
+
+static const SimdKernels kernels_avx2 = {
+    "avx2",           add_avx2,          sub_avx2, scale_avx2,
+    axpy_avx2,        approx_equal_avx2, AVX2_MR,  AVX2_NR,
+    gemm_kernel_avx2, &kernels_avx2_d};
+
+// ---------------------------------------------------------------------------
+// AVX-512F: 16 floats per register. 12x32 tile = 24 of the 32 registers.
+// ---------------------------------------------------------------------------
+
+#define AVX512_MR 12
+#define AVX512_NR 32
+
+__attribute__((target("avx512f"))) static void
+add_avx512(size_t n, const float *a, const float *b, float *out) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(a + i),
+                                            _mm512_loadu_ps(b + i)));
+  if (i < n) {
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(out + i, m,
+                          _mm512_add_ps(_mm512_maskz_loadu_ps(m, a + i),
+                                        _mm512_maskz_loadu_ps(m, b + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) static void
+sub_avx512(size_t n, const float *a, const float *b, float *out) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_sub_ps(_mm512_loadu_ps(a + i),
+                                            _mm512_loadu_ps(b + i)));
+  if (i < n) {
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(out + i, m,
+                          _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i),
+                                        _mm512_maskz_loadu_ps(m, b + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) static void
+scale_avx512(size_t n, float scalar, const float *a, float *out) {
+  __m512 s = _mm512_set1_ps(scalar);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(s, _mm512_loadu_ps(a + i)));
+  if (i < n) {
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(out + i, m,
+                          _mm512_mul_ps(s, _mm512_maskz_loadu_ps(m, a + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) static void
+axpy_avx512(size_t n, float scalar, const float *a, float *out) {
+  __m512 s = _mm512_set1_ps(scalar);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_fmadd_ps(s, _mm512_loadu_ps(a + i),
+                                              _mm512_loadu_ps(out + i)));
+  if (i < n) {
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(out + i, m,
+                          _mm512_fmadd_ps(s, _mm512_maskz_loadu_ps(m, a + i),
+                                          _mm512_maskz_loadu_ps(m, out + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) static int
+approx_equal_avx512(size_t n, const float *a, const float *b,
+                    float tolerance) {
+  __m512 tol = _mm512_set1_ps(tolerance);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    if (_mm512_cmp_ps_mask(_mm512_abs_ps(diff), tol, _CMP_GT_OQ) != 0)
+      return 0;
+  }
+  return approx_equal_scalar(n - i, a + i, b + i, tolerance);
+}
+
+__attribute__((target("avx512f"))) static void
+gemm_kernel_avx512(size_t kc, const float *Ap, const float *Bp, float *C,
+                   size_t rsc, float alpha, float beta) {
+  __m512 acc[AVX512_MR][2];
+  for (size_t i = 0; i < AVX512_MR; i++)
+    acc[i][0] = acc[i][1] = _mm512_setzero_ps();
+
+  for (size_t p = 0; p < kc; p++) {
+    __m512 b0 = _mm512_loadu_ps(Bp);
+    __m512 b1 = _mm512_loadu_ps(Bp + 16);
+    for (size_t i = 0; i < AVX512_MR; i++) {
+      __m512 a = _mm512_set1_ps(Ap[i]);
+      acc[i][0] = _mm512_fmadd_ps(a, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_ps(a, b1, acc[i][1]);
+    }
+    Ap += AVX512_MR;
+    Bp += AVX512_NR;
+  }
+
+  __m512 va = _mm512_set1_ps(alpha);
+  __m512 vb = _mm512_set1_ps(beta);
+  for (size_t i = 0; i < AVX512_MR; i++) {
+    float *c = &C[i * rsc];
+    for (size_t h = 0; h < 2; h++) {
+      __m512 r = _mm512_mul_ps(va, acc[i][h]);
+      if (beta != 0.0f)
+        r = _mm512_fmadd_ps(vb, _mm512_loadu_ps(c + 16 * h), r);
+      _mm512_storeu_ps(c + 16 * h, r);
+    }
+  }
+}
+
+// Doubles: 8 per register, 12x16 tile = 24 accumulators
+
+#define AVX512_D_MR 12
+#define AVX512_D_NR 16
+
+__attribute__((target("avx512f"))) static void
+add_avx512_d(size_t n, const double *a, const double *b, double *out) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(out + i, _mm512_add_pd(_mm512_loadu_pd(a + i),
+                                            _mm512_loadu_pd(b + i)));
+  if (i < n) {
+    __mmask8 m = (__mmask8)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_pd(out + i, m,
+                          _mm512_add_pd(_mm512_maskz_loadu_pd(m, a + i),
+                                        _mm512_maskz_loadu_pd(m, b + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) static void
+sub_avx512_d(size_t n, const double *a, const double *b, double *out) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(out + i, _mm512_sub_pd(_mm512_loadu_pd(a + i),
+                                            _mm512_loadu_pd(b + i)));
+  if (i < n) {
+    __mmask8 m = (__mmask8)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_pd(out + i, m,
+                          _mm512_sub_pd(_mm512_maskz_loadu_pd(m, a + i),
+                                        _mm512_maskz_loadu_pd(m, b + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) static void
+scale_avx512_d(size_t n, double scalar, const double *a, double *out) {
+  __m512d s = _mm512_set1_pd(scalar);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(out + i, _mm512_mul_pd(s, _mm512_loadu_pd(a + i)));
+  if (i < n) {
+    __mmask8 m = (__mmask8)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_pd(out + i, m,
+                          _mm512_mul_pd(s, _mm512_maskz_loadu_pd(m, a + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) static int
+approx_equal_avx512_d(size_t n, const double *a, const double *b,
+                      double tolerance) {
+  __m512d tol = _mm512_set1_pd(tolerance);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512d diff =
+        _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i));
+    if (_mm512_cmp_pd_mask(_mm512_abs_pd(diff), tol, _CMP_GT_OQ) != 0)
+      return 0;
+  }
+  return approx_equal_scalar_d(n - i, a + i, b + i, tolerance);
+}
+
+__attribute__((target("avx512f"))) static void
+gemm_kernel_avx512_d(size_t kc, const double *Ap, const double *Bp,
+                     double *C, size_t rsc, double alpha, double beta) {
+  __m512d acc[AVX512_D_MR][2];
+  for (size_t i = 0; i < AVX512_D_MR; i++)
+    acc[i][0] = acc[i][1] = _mm512_setzero_pd();
+
+  for (size_t p = 0; p < kc; p++) {
+    __m512d b0 = _mm512_loadu_pd(Bp);
+    __m512d b1 = _mm512_loadu_pd(Bp + 8);
+    for (size_t i = 0; i < AVX512_D_MR; i++) {
+      __m512d a = _mm512_set1_pd(Ap[i]);
+      acc[i][0] = _mm512_fmadd_pd(a, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_pd(a, b1, acc[i][1]);
+    }
+    Ap += AVX512_D_MR;
+    Bp += AVX512_D_NR;
+  }
+
+  __m512d va = _mm512_set1_pd(alpha);
+  __m512d vb = _mm512_set1_pd(beta);
+  for (size_t i = 0; i < AVX512_D_MR; i++) {
+    double *c = &C[i * rsc];
+    for (size_t h = 0; h < 2; h++) {
+      __m512d r = _mm512_mul_pd(va, acc[i][h]);
+      if (beta != 0.0)
+        r = _mm512_fmadd_pd(vb, _mm512_loadu_pd(c + 8 * h), r);
+      _mm512_storeu_pd(c + 8 * h, r);
+    }
+  }
+}
+
+static const SimdKernelsD kernels_avx512_d = {
+    add_avx512_d, sub_avx512_d, scale_avx512_d,      approx_equal_avx512_d,
+    AVX512_D_MR,  AVX512_D_NR,  gemm_kernel_avx512_d};
+
+static const SimdKernels kernels_avx512 = {
+    "avx512",           add_avx512,          sub_avx512, scale_avx512,
+    axpy_avx512,        approx_equal_avx512, AVX512_MR,  AVX512_NR,
+    gemm_kernel_avx512, &kernels_avx512_d};
+
+#endif // SIMD_X86
+
+// ---------------------------------------------------------------------------
+// Dispatch
+// ---------------------------------------------------------------------------
+
+static const SimdKernels *active = NULL;
+
+// Best table the CPU (and OS register state) supports, capped by `name`
+// when it is one of the known paths
+static const SimdKernels *select_kernels(const char *name) {
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  const SimdKernels *supported[4];
+  size_t n_supported = 0;
+
+  supported[n_supported++] = &kernels_scalar;
+  if (__builtin_cpu_supports("sse2"))
+    supported[n_supported++] = &kernels_sse2;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    supported[n_supported++] = &kernels_avx2;
+  if (__builtin_cpu_supports("avx512f"))
+    supported[n_supported++] = &kernels_avx512;
+
+  if (name != NULL) {
+    for (size_t i = 0; i < n_supported; i++) {
+      if (strcmp(supported[i]->name, name) == 0)
+        return supported[i];
+    }
+    return NULL;
+  }
+  return supported[n_supported - 1];
+#else
+  if (name != NULL && strcmp(name, kernels_scalar.name) != 0)
+    return NULL;
+  return &kernels_scalar;
+#endif
+}
+
+__attribute__((constructor)) static void simd_init(void) {
+  if (active != NULL)
+    return;
+
+  const char *env = getenv("MATRIX_SIMD");
+  if (env != NULL && *env != '\0') {
+    active = select_kernels(env);
+    if (active == NULL)
+      fprintf(stderr,
+              "Warning: MATRIX_SIMD=%s is not supported on this CPU, "
+              "using the best available path\n",
+              env);
+  }
+  if (active == NULL)
+    active = select_kernels(NULL);
+}
+
+const SimdKernels *simd_kernels(void) {
+  if (active == NULL)
+    simd_init();
+  return active;
+}
+
+const SimdKernelsD *simd_kernels_d(void) { return simd_kernels()->d; }
+
+const char *matrix_simd_isa(void) { return simd_kernels()->name; }
+
+int matrix_simd_select(const char *isa) {
+  const SimdKernels *kernels = select_kernels(isa);
+  if (kernels == NULL) {
+    fprintf(stderr, "Error matrix_simd_select: %s is not supported here\n",
+            isa);
+    return -1;
+  }
+  active = kernels;
+  return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+
+// Largest register tile any GEMM micro-kernel below uses, for scratch tiles
+#define SIMD_MAX_MR 12
+#define SIMD_MAX_NR 32
+
+// The same kernels on doubles, same contracts as the float ones below.
+// Each float table points to the double table of its instruction set.
+typedef struct simd_kernels_d {
+  void (*add)(size_t n, const double *a, const double *b, double *out);
+  void (*sub)(size_t n, const double *a, const double *b, double *out);
+  void (*scale)(size_t n, double scalar, const double *a, double *out);
+  int (*approx_equal)(size_t n, const double *a, const double *b,
+                      double tolerance);
+
+  size_t mr;
+  size_t nr;
+  void (*gemm_kernel)(size_t kc, const double *Ap, const double *Bp,
+                      double *C, size_t rsc, double alpha, double beta);
+} SimdKernelsD;
+
+// One instruction-set path. The table is picked once at startup from CPUID
+// (overridable with MATRIX_SIMD=scalar|sse2|avx2|avx512) and every kernel
+// in it handles any n, including the unaligned head and the tail.
+typedef struct simd_kernels {
+  const char *name;
+
+  // out[i] = a[i] + b[i]; out may alias a or b
+  void (*add)(size_t n, const float *a, const float *b, float *out);
+  // out[i] = a[i] - b[i]; out may alias a or b
+  void (*sub)(size_t n, const float *a, const float *b, float *out);
+  // out[i] = scalar * a[i]; out may alias a
+  void (*scale)(size_t n, float scalar, const float *a, float *out);
+  // out[i] += scalar * a[i]
+  void (*axpy)(size_t n, float scalar, const float *a, float *out);
+  // 1 when |a[i] - b[i]| <= tolerance for every i
+  int (*approx_equal)(size_t n, const float *a, const float *b,
+                      float tolerance);
+
+  // GEMM micro-kernel on packed slivers (see gemm.c):
+  // C[mr x nr] = alpha * Ap * Bp + beta * C, C row-major with row stride rsc.
+  // C is not read when beta == 0.
+  size_t mr;
+  size_t nr;
+  void (*gemm_kernel)(size_t kc, const float *Ap, const float *Bp, float *C,
+                      size_t rsc, float alpha, float beta);
+
+  const SimdKernelsD *d;
+} SimdKernels;
+
+const SimdKernels *simd_kernels(void);
+
+// simd_kernels()->d
+const SimdKernelsD *simd_kernels_d(void);
+
+#endif // !SIMD_H
@@ -0,0 +1,324 @@
+#include "sparse.h"
+#include "matrix.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t sparse_n_major(const SparseMatrix *sp) {
+  return sp->format == SPARSE_CSR ? sp->n_rows : sp->n_cols;
+}
+
+SparseMatrix *sparse_alloc(SparseFormat format, size_t n_rows, size_t n_cols,
+                           size_t nnz) {
+  SparseMatrix *sp = malloc(sizeof(SparseMatrix));
+  if (sp == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return NULL;
+  }
+  sp->format = format;
+  sp->n_rows = n_rows;
+  sp->n_cols = n_cols;
+  sp->nnz = nnz;
+  sp->ptr = calloc(sparse_n_major(sp) + 1, sizeof(size_t));
+  sp->idx = malloc((nnz > 0 ? nnz : 1) * sizeof(size_t));
+  sp->values = malloc((nnz > 0 ? nnz : 1) * sizeof(float));
+  if (sp->ptr == NULL || sp->idx == NULL || sp->values == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    sparse_free(sp);
+    return NULL;
+  }
+  return sp;
+}
+
+void sparse_free(SparseMatrix *sp) {
+  if (sp != NULL) {
+    free(sp->ptr);
+    free(sp->idx);
+    free(sp->values);
+    free(sp);
+  }
+}
+
+// counts[0..n) -> offsets[0..n], in place: ptr[i] becomes the start of
+// bucket i and ptr[n] the total
+static void prefix_sum(size_t *ptr, size_t n) {
+  size_t sum = 0;
+  for (size_t i = 0; i <= n; i++) {
+    size_t count = ptr[i];
+    ptr[i] = sum;
+    sum += count;
+  }
+}
+
+SparseMatrix *sparse_from_triplets(SparseFormat format, size_t n_rows,
+                                   size_t n_cols, size_t nnz,
+                                   const size_t *rows, const size_t *cols,
+                                   const float *values) {
+  for (size_t p = 0; p < nnz; p++) {
+    if (rows[p] >= n_rows || cols[p] >= n_cols) {
+      fprintf(stderr,
+              "Error %s: entry %zu at (%zu, %zu) is outside %zu x %zu\n",
+              __func__, p, rows[p], cols[p], n_rows, n_cols);
+      return NULL;
+    }
+  }
+
+  const size_t *major = format == SPARSE_CSR ? rows : cols;
+  const size_t *minor = format == SPARSE_CSR ? cols : rows;
+  size_t n_major = format == SPARSE_CSR ? n_rows : n_cols;
+  size_t n_minor = format == SPARSE_CSR ? n_cols : n_rows;
+
+  SparseMatrix *sp = sparse_alloc(format, n_rows, n_cols, nnz);
+  size_t *minor_ptr = calloc(n_minor + 1, sizeof(size_t));
+  size_t *by_minor = malloc((nnz > 0 ? nnz : 1) * sizeof(size_t));
+  if (sp == NULL || minor_ptr == NULL || by_minor == NULL) {
+    sparse_free(sp);
+    free(minor_ptr);
+    free(by_minor);
+    return NULL;
+  }
+
+  // Two stable bucket sorts, by minor index then by major index, leave
+  // every compressed row sorted without comparing anything
+  for (size_t p = 0; p < nnz; p++) {
+    minor_ptr[minor[p]]++;
+    sp->ptr[major[p]]++;
+  }
+  prefix_sum(minor_ptr, n_minor);
+  prefix_sum(sp->ptr, n_major);
+  for (size_t p = 0; p < nnz; p++) {
+    by_minor[minor_ptr[minor[p]]++] = p;
+  }
+  for (size_t q = 0; q < nnz; q++) {
+    size_t p = by_minor[q];
+    size_t dst = sp->ptr[major[p]]++;
+    sp->idx[dst] = minor[p];
+    sp->values[dst] = values[p];
+  }
+
+  // ptr[i] now holds the end of bucket i; sum the duplicates while
+  // compacting, which also restores the starts
+  size_t out = 0, start = 0;
+  for (size_t i = 0; i < n_major; i++) {
+    size_t end = sp->ptr[i];
+    sp->ptr[i] = out;
+    for (size_t p = start; p < end; p++) {
+      if (out > sp->ptr[i] && sp->idx[out - 1] == sp->idx[p]) {
+        sp->values[out - 1] += sp->values[p];
+      } else {
+        sp->idx[out] = sp->idx[p];
+        sp->values[out] = sp->values[p];
+        out++;
+      }
+    }
+    start = end;
+  }
+  sp->ptr[n_major] = out;
+  sp->nnz = out;
+
+  free(minor_ptr);
+  free(by_minor);
+  return sp;
+}
+
+SparseMatrix *sparse_from_dense(SparseFormat format, Matrix *mat,
+                                float drop_tolerance) {
+  size_t n_rows = mat->n_rows, n_cols = mat->n_cols;
+  int csr = format == SPARSE_CSR;
+
+  size_t nnz = 0;
+  for (size_t i = 0; i < n_rows; i++) {
+    for (size_t j = 0; j < n_cols; j++) {
+      nnz += fabsf(MATRIX_AT(mat, i, j)) > drop_tolerance;
+    }
+  }
+
+  SparseMatrix *sp = sparse_alloc(format, n_rows, n_cols, nnz);
+  if (sp == NULL)
+    return NULL;
+
+  // Row-major traversal: the minor indices come out in order either way
+  for (size_t i = 0; i < n_rows; i++) {
+    for (size_t j = 0; j < n_cols; j++) {
+      if (fabsf(MATRIX_AT(mat, i, j)) > drop_tolerance)
+        sp->ptr[csr ? i : j]++;
+    }
+  }
+  prefix_sum(sp->ptr, sparse_n_major(sp));
+  for (size_t i = 0; i < n_rows; i++) {
+    for (size_t j = 0; j < n_cols; j++) {
+      float value = MATRIX_AT(mat, i, j);
+      if (fabsf(value) > drop_tolerance) {
+        size_t dst = sp->ptr[csr ? i : j]++;
+        sp->idx[dst] = csr ? j : i;
+        sp->values[dst] = value;
+      }
+    }
+  }
+  // Each ptr[i] was advanced to the start of the next bucket
+  memmove(&sp->ptr[1], &sp->ptr[0], sparse_n_major(sp) * sizeof(size_t));
+  sp->ptr[0] = 0;
+  return sp;
+}
+
+Matrix *sparse_to_dense(SparseMatrix *sp) {
+  Matrix *mat = matrix_create(sp->n_rows, sp->n_cols);
+  if (mat == NULL)
+    return NULL;
+
+  memset(mat->array, 0, sp->n_rows * sp->n_cols * sizeof(float));
+  int csr = sp->format == SPARSE_CSR;
+  for (size_t i = 0; i < sparse_n_major(sp); i++) {
+    for (size_t p = sp->ptr[i]; p < sp->ptr[i + 1]; p++) {
+      size_t row = csr ? i : sp->idx[p], col = csr ? sp->idx[p] : i;
+      MATRIX_AT(mat, row, col) = sp->values[p];
+    }
+  }
+  return mat;
+}
+
+SparseMatrix *sparse_convert(SparseMatrix *sp, SparseFormat format) {
+  SparseMatrix *res = sparse_alloc(format, sp->n_rows, sp->n_cols, sp->nnz);
+  if (res == NULL)
+    return NULL;
+
+  size_t n_major = sparse_n_major(sp);
+  if (format == sp->format) {
+    memcpy(res->ptr, sp->ptr, (n_major + 1) * sizeof(size_t));
+    memcpy(res->idx, sp->idx, sp->nnz * sizeof(size_t));
+    memcpy(res->values, sp->values, sp->nnz * sizeof(float));
+    return res;
+  }
+
+  // A transpose: bucket the entries by their minor index, walking the
+  // compressed rows in order keeps every new row sorted
+  for (size_t p = 0; p < sp->nnz; p++) {
+    res->ptr[sp->idx[p]]++;
+  }
+  prefix_sum(res->ptr, sparse_n_major(res));
+  for (size_t i = 0; i < n_major; i++) {
+    for (size_t p = sp->ptr[i]; p < sp->ptr[i + 1]; p++) {
+      size_t dst = res->ptr[sp->idx[p]]++;
+      res->idx[dst] = i;
+      res->values[dst] = sp->values[p];
+    }
+  }
+  memmove(&res->ptr[1], &res->ptr[0], sparse_n_major(res) * sizeof(size_t));
+  res->ptr[0] = 0;
+  return res;
+}
+
+// Products
+
+typedef struct sparse_gemm_args {
+  float alpha;
+  const SparseMatrix *A;
+  const Matrix *B;
+  float beta;
+  Matrix *C;
+} SparseGemmArgs;
+
+// C = beta * C on rows [begin, end), without reading C when beta == 0
+static void scale_rows(Matrix *C, float beta, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    for (size_t j = 0; j < C->n_cols; j++) {
+      MATRIX_AT(C, i, j) = beta == 0 ? 0 : beta * MATRIX_AT(C, i, j);
+    }
+  }
+}
+
+// CSR: every row of C is a combination of rows of B, no two tasks write
+// the same row
+static void csr_task(void *arg, size_t begin, size_t end) {
+  SparseGemmArgs *g = arg;
+  const SparseMatrix *A = g->A;
+  const Matrix *B = g->B;
+  Matrix *C = g->C;
+  size_t k = B->n_cols;
+
+  for (size_t i = begin; i < end; i++) {
+    if (k == 1) {
+      float sum = 0;
+      for (size_t p = A->ptr[i]; p < A->ptr[i + 1]; p++) {
+        sum += A->values[p] * MATRIX_AT(B, A->idx[p], 0);
+      }
+      float *c = &MATRIX_AT(C, i, 0);
+      *c = g->beta == 0 ? g->alpha * sum : g->alpha * sum + g->beta * *c;
+      continue;
+    }
+    scale_rows(C, g->beta, i, i + 1);
+    for (size_t p = A->ptr[i]; p < A->ptr[i + 1]; p++) {
+      float a = g->alpha * A->values[p];
+      size_t row = A->idx[p];
+      for (size_t j = 0; j < k; j++) {
+        MATRIX_AT(C, i, j) += a * MATRIX_AT(B, row, j);
+      }
+    }
+  }
+}
+
+// CSC: column j of A scatters row j of B into many rows of C, so tasks
+// split the columns of B and C instead
+static void csc_task(void *arg, size_t begin, size_t end) {
+  SparseGemmArgs *g = arg;
+  const SparseMatrix *A = g->A;
+  const Matrix *B = g->B;
+  Matrix *C = g->C;
+
+  for (size_t j = 0; j < A->n_cols; j++) {
+    for (size_t p = A->ptr[j]; p < A->ptr[j + 1]; p++) {
+      float a = g->alpha * A->values[p];
+      size_t row = A->idx[p];
+      for (size_t c = begin; c < end; c++) {
+        MATRIX_AT(C, row, c) += a * MATRIX_AT(B, j, c);
+      }
+    }
+  }
+}
+
+Matrix *sparse_gemm(float alpha, SparseMatrix *A, Matrix *B, float beta,
+                    Matrix *C) {
+  PROFILE_SCOPE(PROF_SPARSE_GEMM, 2.0 * A->nnz * B->n_cols,
+                12.0 * A->nnz +
+                    4.0 * B->n_cols * (B->n_rows + 2.0 * C->n_rows));
+  if (A->n_cols != B->n_rows || C->n_rows != A->n_rows ||
+      C->n_cols != B->n_cols) {
+    fprintf(stderr,
+            "Error %s: size mismatch A(%zu x %zu) * B(%zu x %zu) -> C(%zu x "
+            "%zu)\n",
+            __func__, A->n_rows, A->n_cols, B->n_rows, B->n_cols, C->n_rows,
+            C->n_cols);
+    return NULL;
+  }
+  if (matrix_overlaps(C, B)) {
+    fprintf(stderr, "Error %s: C must not alias B\n", __func__);
+    return NULL;
+  }
+
+  SparseGemmArgs args = {alpha, A, B, beta, C};
+  size_t k = B->n_cols;
+  if (A->format == SPARSE_CSR) {
+    size_t per_row = A->nnz / (A->n_rows + 1) + 1;
+    parallel_for(A->n_rows, pool_grain(per_row * k), csr_task, &args);
+  } else {
+    scale_rows(C, beta, 0, C->n_rows);
+    parallel_for(k, pool_grain(A->nnz), csc_task, &args);
+  }
+  return C;
+}
+
+Matrix *sparse_mult(SparseMatrix *A, Matrix *B) {
+  if (A->n_cols != B->n_rows) {
+    fprintf(stderr, "Error %s: size mismatch\n", __func__);
+    return NULL;
+  }
+  Matrix *res = matrix_create(A->n_rows, B->n_cols);
+  if (res == NULL)
+    return NULL;
+
+  return sparse_gemm(1.0f, A, B, 0.0f, res);
+}
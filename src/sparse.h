@@ -0,0 +1,14 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "matrix.h"
+
+// An empty sparse matrix with room for nnz entries: ptr zeroed, idx and
+// values uninitialized. NULL (after printing an error) if out of memory.
+SparseMatrix *sparse_alloc(SparseFormat format, size_t n_rows, size_t n_cols,
+                           size_t nnz);
+
+// Number of compressed rows (CSR) or columns (CSC)
+size_t sparse_n_major(const SparseMatrix *sp);
+
+#endif // !SPARSE_H
@@ -0,0 +1,671 @@
+#include "alloc.h"
+#include "matrix.h"
+#include "profile.h"
+#include "sparse.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A row not chosen as a pivot yet
+#define NO_PIVOT SIZE_MAX
+
+// The diagonal entry is kept as the pivot while it is at least this
+// fraction of the largest candidate, so the ordering survives pivoting on
+// all but badly scaled columns
+#define DIAG_PIVOT_TOL 0.1f
+
+// Right-hand sides per solve task
+#define SOLVE_GRAIN 4
+
+// Factors of P A P^T with row pivots: row i of P A P^T is row pinv[i] of
+// L U, with row / column i of P A P^T being row / column perm[i] of A.
+// L and U are CSC with unsorted rows, L unit lower with its diagonal
+// stored first, U upper with its diagonal stored last.
+struct sparse_lu {
+  size_t n;
+  size_t *perm;
+  size_t *pinv;
+  SparseMatrix *L;
+  SparseMatrix *U;
+};
+
+void sparse_lu_free(SparseLU *lu) {
+  if (lu != NULL) {
+    free(lu->perm);
+    free(lu->pinv);
+    sparse_free(lu->L);
+    sparse_free(lu->U);
+    free(lu);
+  }
+}
+
+size_t sparse_lu_nnz(SparseLU *lu) { return lu->L->nnz + lu->U->nnz; }
+
+// Fill-reducing ordering
+
+typedef struct degree_node {
+  size_t degree;
+  size_t node;
+} DegreeNode;
+
+// The pattern of A + A^T, from A in both formats, restricted to the nodes
+// carrying one label. Neighbours may repeat, and the degree counts
+// repeats, which only blurs the tie-breaking.
+typedef struct graph {
+  const SparseMatrix *csc;
+  const SparseMatrix *csr;
+  size_t *label;   // searches stay within nodes labelled `current`
+  size_t current;
+  size_t *visited; // visited[v] == stamp: reached by the current search
+  size_t stamp;
+  size_t *levels;  // start of each level of the last search in its output
+  size_t n_levels;
+  DegreeNode *work;
+} Graph;
+
+static size_t degree(const Graph *g, size_t v) {
+  return g->csc->ptr[v + 1] - g->csc->ptr[v] + g->csr->ptr[v + 1] -
+         g->csr->ptr[v];
+}
+
+static int by_degree(const void *a, const void *b) {
+  const DegreeNode *x = a, *y = b;
+  if (x->degree != y->degree)
+    return x->degree < y->degree ? -1 : 1;
+  return x->node < y->node ? -1 : x->node > y->node;
+}
+
+// Breadth-first search from root, writing the nodes reached to order[]
+// level by level, the new neighbours of each node by increasing degree
+// when sorted is set. Returns the number of nodes reached.
+static size_t bfs(Graph *g, size_t root, size_t *order, int sorted) {
+  const SparseMatrix *halves[2] = {g->csc, g->csr};
+  size_t stamp = ++g->stamp;
+  size_t head = 0, tail = 0;
+  order[tail++] = root;
+  g->visited[root] = stamp;
+  g->n_levels = 0;
+
+  while (head < tail) {
+    size_t level_end = tail;
+    g->levels[g->n_levels++] = head;
+    for (; head < level_end; head++) {
+      size_t v = order[head], n_new = 0;
+      for (int h = 0; h < 2; h++) {
+        const SparseMatrix *s = halves[h];
+        for (size_t p = s->ptr[v]; p < s->ptr[v + 1]; p++) {
+          size_t u = s->idx[p];
+          if (g->visited[u] == stamp || g->label[u] != g->current)
+            continue;
+          g->visited[u] = stamp;
+          g->work[n_new++] = (DegreeNode){degree(g, u), u};
+        }
+      }
+      if (sorted)
+        qsort(g->work, n_new, sizeof(DegreeNode), by_degree);
+      for (size_t i = 0; i < n_new; i++) {
+        order[tail++] = g->work[i].node;
+      }
+    }
+  }
+  g->levels[g->n_levels] = tail;
+  return tail;
+}
+
+// A node of roughly maximal eccentricity in root's component (George and
+// Liu): move to the smallest-degree node of the last level for as long as
+// that makes the level structure deeper. Leaves the levels of the search
+// from the returned node in queue and g->levels.
+static size_t pseudo_peripheral(Graph *g, size_t root, size_t *queue) {
+  size_t count = bfs(g, root, queue, 0);
+
+  for (;;) {
+    size_t levels = g->n_levels;
+    size_t best = root, best_degree = SIZE_MAX;
+    for (size_t i = g->levels[levels - 1]; i < count; i++) {
+      size_t d = degree(g, queue[i]);
+      if (d < best_degree) {
+        best_degree = d;
+        best = queue[i];
+      }
+    }
+    if (best == root)
+      return root;
+
+    count = bfs(g, best, queue, 0);
+    if (g->n_levels <= levels) {
+      bfs(g, root, queue, 0);
+      return root;
+    }
+    root = best;
+  }
+}
+
+// Reverse Cuthill-McKee on the m nodes of seg, all labelled g->current:
+// each component numbered breadth first from a pseudo-peripheral node,
+// then the whole order reversed. Rewrites seg in that order and labels
+// its nodes `done`.
+static void rcm(Graph *g, size_t *seg, size_t m, size_t *tmp,
+                size_t *queue, size_t done) {
+  memcpy(tmp, seg, m * sizeof(size_t));
+  size_t pos = 0;
+  for (size_t i = 0; i < m; i++) {
+    if (g->label[tmp[i]] != g->current)
+      continue;
+    size_t root = pseudo_peripheral(g, tmp[i], queue);
+    size_t count = bfs(g, root, &seg[pos], 1);
+    for (size_t j = pos; j < pos + count; j++) {
+      g->label[seg[j]] = done;
+    }
+    pos += count;
+  }
+  for (size_t i = 0; i < m / 2; i++) {
+    size_t t = seg[i];
+    seg[i] = seg[m - 1 - i];
+    seg[m - 1 - i] = t;
+  }
+}
+
+// Parts of at most this many nodes are ordered by RCM instead of split
+#define ND_LEAF 64
+
+typedef struct nd_part {
+  size_t lo;
+  size_t size;
+  size_t label;
+} NDPart;
+
+// Nested dissection on the pattern of A + A^T. A part of the graph is cut
+// in two by a level of a breadth-first search from a pseudo-peripheral
+// node, the middle one by node count, keeping only its nodes that touch
+// the next level. The two halves are numbered first, recursively, and the
+// separator last, so eliminating one half never fills the other. On a 2D
+// mesh of n nodes the LU then holds O(n log n) entries, against
+// O(n^1.5) for a banded ordering. NULL if out of memory.
+static size_t *nd_order(const SparseMatrix *csc, const SparseMatrix *csr) {
+  size_t n = csc->n_cols;
+  size_t done = SIZE_MAX;
+  size_t *order = malloc((n + 1) * sizeof(size_t));
+  size_t *tmp = malloc((n + 1) * sizeof(size_t));
+  size_t *queue = malloc((n + 1) * sizeof(size_t));
+  NDPart *stack = malloc((n + 1) * sizeof(NDPart));
+  Graph g = {csc, csr};
+  g.label = calloc(n + 1, sizeof(size_t));
+  g.visited = calloc(n + 1, sizeof(size_t));
+  g.levels = malloc((n + 2) * sizeof(size_t));
+  g.work = malloc((2 * n + 1) * sizeof(DegreeNode));
+  if (order == NULL || tmp == NULL || queue == NULL || stack == NULL ||
+      g.label == NULL || g.visited == NULL || g.levels == NULL ||
+      g.work == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    free(order);
+    order = NULL;
+    goto out;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  size_t n_parts = 0, next_label = 1;
+  stack[n_parts++] = (NDPart){0, n, 0};
+
+  while (n_parts > 0) {
+    NDPart part = stack[--n_parts];
+    size_t *seg = &order[part.lo], m = part.size;
+    g.current = part.label;
+    if (m <= ND_LEAF) {
+      rcm(&g, seg, m, tmp, queue, done);
+      continue;
+    }
+
+    pseudo_peripheral(&g, seg[0], queue);
+    size_t count = g.levels[g.n_levels];
+    size_t a_label = next_label++, b_label = next_label++;
+    size_t sep_level = SIZE_MAX;
+    if (count == m) {
+      if (g.n_levels < 3) {
+        rcm(&g, seg, m, tmp, queue, done);
+        continue;
+      }
+      sep_level = 1;
+      while (sep_level + 2 < g.n_levels &&
+             g.levels[sep_level + 1] < count / 2) {
+        sep_level++;
+      }
+    }
+
+    // Disconnected: the component found is one half, the rest the other,
+    // no separator. Otherwise levels before sep_level go to A, after it
+    // to B, and the separator keeps the nodes touching B.
+    size_t stamp = g.stamp;
+    memcpy(tmp, seg, m * sizeof(size_t));
+    for (size_t i = 0; i < count; i++) {
+      g.label[queue[i]] = a_label;
+    }
+    for (size_t i = 0; i < m; i++) {
+      if (g.visited[tmp[i]] != stamp)
+        g.label[tmp[i]] = b_label;
+    }
+    if (sep_level != SIZE_MAX) {
+      for (size_t i = g.levels[sep_level + 1]; i < count; i++) {
+        g.label[queue[i]] = b_label;
+      }
+      const SparseMatrix *halves[2] = {csc, csr};
+      for (size_t i = g.levels[sep_level]; i < g.levels[sep_level + 1];
+           i++) {
+        size_t v = queue[i];
+        for (int h = 0; h < 2; h++) {
+          const SparseMatrix *s = halves[h];
+          for (size_t p = s->ptr[v]; p < s->ptr[v + 1]; p++) {
+            if (g.label[s->idx[p]] == b_label)
+              g.label[v] = done;
+          }
+        }
+      }
+    }
+
+    // A, then B, then the separator
+    size_t n_a = 0, n_b = 0;
+    for (size_t i = 0; i < m; i++) {
+      size_t l = g.label[tmp[i]];
+      n_a += l == a_label;
+      n_b += l == b_label;
+    }
+    size_t ia = 0, ib = n_a, is = n_a + n_b;
+    for (size_t i = 0; i < m; i++) {
+      size_t v = tmp[i], l = g.label[v];
+      if (l == a_label)
+        seg[ia++] = v;
+      else if (l == b_label)
+        seg[ib++] = v;
+      else
+        seg[is++] = v;
+    }
+    if (n_a > 0)
+      stack[n_parts++] = (NDPart){part.lo, n_a, a_label};
+    if (n_b > 0)
+      stack[n_parts++] = (NDPart){part.lo + n_a, n_b, b_label};
+  }
+
+out:
+  free(tmp);
+  free(queue);
+  free(stack);
+  free(g.label);
+  free(g.visited);
+  free(g.levels);
+  free(g.work);
+  return order;
+}
+
+// Left-looking LU (Gilbert and Peierls): column k of L and U comes from
+// one sparse triangular solve with the columns of L already computed,
+// whose nonzero pattern is found beforehand by a depth-first search in the
+// graph of L, so the work is proportional to the flops.
+
+typedef struct lu_work {
+  size_t n;
+  // L and U, grown as columns are added
+  size_t *Lp, *Li, *Up, *Ui;
+  float *Lx, *Ux;
+  size_t l_cap, u_cap;
+  size_t *pinv;
+  float *x;        // dense column being solved
+  size_t *xi;      // reach: the DFS stack, then the pattern at [top, n)
+  size_t *pstack;  // where the DFS resumes in each column of L
+  size_t *mark;    // mark[j] == stamp: j reached for the current column
+} LUWork;
+
+// Room for n more entries in L and U
+static int reserve(LUWork *w, size_t l_nnz, size_t u_nnz) {
+  if (l_nnz + w->n > w->l_cap) {
+    size_t cap = 2 * w->l_cap + w->n;
+    size_t *Li = realloc(w->Li, cap * sizeof(size_t));
+    if (Li != NULL)
+      w->Li = Li;
+    float *Lx = realloc(w->Lx, cap * sizeof(float));
+    if (Lx != NULL)
+      w->Lx = Lx;
+    if (Li == NULL || Lx == NULL)
+      return 0;
+    w->l_cap = cap;
+  }
+  if (u_nnz + w->n > w->u_cap) {
+    size_t cap = 2 * w->u_cap + w->n;
+    size_t *Ui = realloc(w->Ui, cap * sizeof(size_t));
+    if (Ui != NULL)
+      w->Ui = Ui;
+    float *Ux = realloc(w->Ux, cap * sizeof(float));
+    if (Ux != NULL)
+      w->Ux = Ux;
+    if (Ui == NULL || Ux == NULL)
+      return 0;
+    w->u_cap = cap;
+  }
+  return 1;
+}
+
+// Push every row reachable from j in the graph of L (edges from a pivot
+// row to the rows of its L column) onto xi[top..), in topological order.
+// Returns the new top.
+static size_t dfs(LUWork *w, size_t j, size_t top, size_t stamp) {
+  size_t head = 0;
+  w->xi[0] = j;
+
+  for (;;) {
+    j = w->xi[head];
+    size_t col = w->pinv[j];
+    if (w->mark[j] != stamp) {
+      w->mark[j] = stamp;
+      // Skip the diagonal, stored first
+      w->pstack[head] = col == NO_PIVOT ? 0 : w->Lp[col] + 1;
+    }
+    size_t end = col == NO_PIVOT ? 0 : w->Lp[col + 1];
+    int done = 1;
+    for (size_t p = w->pstack[head]; p < end; p++) {
+      size_t i = w->Li[p];
+      if (w->mark[i] == stamp)
+        continue;
+      w->pstack[head] = p + 1;
+      w->xi[++head] = i;
+      done = 0;
+      break;
+    }
+    if (done) {
+      w->xi[--top] = j;
+      if (head == 0)
+        return top;
+      head--;
+    }
+  }
+}
+
+// x = L \ column of P A P^T, over its nonzero pattern only. rows/values
+// hold the column, row indices already permuted. Returns top: the pattern
+// is xi[top..n).
+static size_t sparse_lower_solve(LUWork *w, const size_t *rows,
+                                 const float *values, size_t nnz,
+                                 size_t stamp) {
+  size_t n = w->n, top = n;
+  for (size_t p = 0; p < nnz; p++) {
+    if (w->mark[rows[p]] != stamp)
+      top = dfs(w, rows[p], top, stamp);
+  }
+  for (size_t p = top; p < n; p++) {
+    w->x[w->xi[p]] = 0;
+  }
+  for (size_t p = 0; p < nnz; p++) {
+    w->x[rows[p]] += values[p];
+  }
+  for (size_t px = top; px < n; px++) {
+    size_t j = w->xi[px], col = w->pinv[j];
+    if (col == NO_PIVOT)
+      continue;
+    float xj = w->x[j];
+    for (size_t p = w->Lp[col] + 1; p < w->Lp[col + 1]; p++) {
+      w->x[w->Li[p]] -= w->Lx[p] * xj;
+    }
+  }
+  return top;
+}
+
+static SparseMatrix *wrap_csc(size_t n, size_t *p, size_t *i, float *x) {
+  SparseMatrix *sp = malloc(sizeof(SparseMatrix));
+  if (sp == NULL) {
+    free(p);
+    free(i);
+    free(x);
+    return NULL;
+  }
+  *sp = (SparseMatrix){SPARSE_CSC, n, n, p[n], p, i, x};
+  return sp;
+}
+
+#ifdef MATRIX_PROFILE
+// Flops of the factorization that produced lu, known once the fill-in is:
+// each off-diagonal U(i, j) subtracts column i of L from column j, and
+// each entry of L below the diagonal is divided by its pivot
+static double factor_flops(const SparseLU *lu) {
+  const SparseMatrix *L = lu->L, *U = lu->U;
+  double flops = (double)L->nnz - lu->n;
+  for (size_t j = 0; j < lu->n; j++) {
+    for (size_t p = U->ptr[j]; p + 1 < U->ptr[j + 1]; p++) {
+      size_t i = U->idx[p];
+      flops += 2.0 * (L->ptr[i + 1] - L->ptr[i] - 1);
+    }
+  }
+  return flops;
+}
+#endif
+
+SparseLU *sparse_lu_factor(SparseMatrix *A) {
+  PROFILE_SCOPE(PROF_SPARSE_LU_FACTOR, 0.0, 12.0 * A->nnz);
+  if (A->n_rows != A->n_cols) {
+    fprintf(stderr, "Error %s: n_rows(%zu) != n_cols(%zu)\n", __func__,
+            A->n_rows, A->n_cols);
+    return NULL;
+  }
+
+  size_t n = A->n_rows;
+  SparseMatrix *csc = sparse_convert(A, SPARSE_CSC);
+  SparseMatrix *csr = sparse_convert(A, SPARSE_CSR);
+  SparseLU *lu = calloc(1, sizeof(SparseLU));
+  LUWork w = {.n = n};
+  size_t *iperm = malloc((n + 1) * sizeof(size_t));
+  size_t *rows = malloc((n + 1) * sizeof(size_t));
+  int ok = csc != NULL && csr != NULL && lu != NULL && iperm != NULL &&
+           rows != NULL;
+
+  if (ok) {
+    lu->n = n;
+    lu->perm = nd_order(csc, csr);
+    w.l_cap = w.u_cap = csc->nnz + n;
+    w.Lp = malloc((n + 1) * sizeof(size_t));
+    w.Up = malloc((n + 1) * sizeof(size_t));
+    w.Li = malloc(w.l_cap * sizeof(size_t));
+    w.Ui = malloc(w.u_cap * sizeof(size_t));
+    w.Lx = malloc(w.l_cap * sizeof(float));
+    w.Ux = malloc(w.u_cap * sizeof(float));
+    w.pinv = malloc((n + 1) * sizeof(size_t));
+    w.x = malloc((n + 1) * sizeof(float));
+    w.xi = malloc((n + 1) * sizeof(size_t));
+    w.pstack = malloc((n + 1) * sizeof(size_t));
+    w.mark = calloc(n + 1, sizeof(size_t));
+    ok = lu->perm != NULL && w.Lp != NULL && w.Up != NULL && w.Li != NULL &&
+         w.Ui != NULL && w.Lx != NULL && w.Ux != NULL && w.pinv != NULL &&
+         w.x != NULL && w.xi != NULL && w.pstack != NULL && w.mark != NULL;
+    if (!ok)
+      fprintf(stderr, "Error: memory allocation failed\n");
+  }
+
+  size_t l_nnz = 0, u_nnz = 0;
+  for (size_t i = 0; ok && i < n; i++) {
+    iperm[lu->perm[i]] = i;
+    w.pinv[i] = NO_PIVOT;
+  }
+  for (size_t k = 0; ok && k < n; k++) {
+    if (!reserve(&w, l_nnz, u_nnz)) {
+      fprintf(stderr, "Error: memory allocation failed\n");
+      ok = 0;
+      break;
+    }
+    w.Lp[k] = l_nnz;
+    w.Up[k] = u_nnz;
+
+    // Column k of P A P^T is column perm[k] of A, rows renumbered
+    size_t col = lu->perm[k], begin = csc->ptr[col];
+    size_t nnz = csc->ptr[col + 1] - begin;
+    for (size_t p = 0; p < nnz; p++) {
+      rows[p] = iperm[csc->idx[begin + p]];
+    }
+    size_t top = sparse_lower_solve(&w, rows, &csc->values[begin], nnz, k + 1);
+
+    // Rows already pivoted go to U, the largest remaining one is the pivot
+    size_t ipiv = NO_PIVOT;
+    float max = -1;
+    for (size_t p = top; p < n; p++) {
+      size_t i = w.xi[p];
+      if (w.pinv[i] != NO_PIVOT) {
+        w.Ui[u_nnz] = w.pinv[i];
+        w.Ux[u_nnz++] = w.x[i];
+      } else if (fabsf(w.x[i]) > max) {
+        max = fabsf(w.x[i]);
+        ipiv = i;
+      }
+    }
+    if (w.pinv[k] == NO_PIVOT && w.mark[k] == k + 1 &&
+        fabsf(w.x[k]) >= DIAG_PIVOT_TOL * max)
+      ipiv = k;
+    if (ipiv == NO_PIVOT || !(max > 0)) {
+      fprintf(stderr, "Error %s: matrix is singular\n", __func__);
+      ok = 0;
+      break;
+    }
+
+    float pivot = w.x[ipiv];
+    w.Ui[u_nnz] = k;
+    w.Ux[u_nnz++] = pivot;
+    w.pinv[ipiv] = k;
+    w.Li[l_nnz] = ipiv;
+    w.Lx[l_nnz++] = 1;
+    for (size_t p = top; p < n; p++) {
+      size_t i = w.xi[p];
+      if (w.pinv[i] == NO_PIVOT) {
+        w.Li[l_nnz] = i;
+        w.Lx[l_nnz++] = w.x[i] / pivot;
+      }
+    }
+  }
+
+  if (ok) {
+    w.Lp[n] = l_nnz;
+    w.Up[n] = u_nnz;
+    // L rows in pivot order, like those of U
+    for (size_t p = 0; p < l_nnz; p++) {
+      w.Li[p] = w.pinv[w.Li[p]];
+    }
+    lu->pinv = w.pinv;
+    w.pinv = NULL;
+    lu->L = wrap_csc(n, w.Lp, w.Li, w.Lx);
+    lu->U = wrap_csc(n, w.Up, w.Ui, w.Ux);
+    w.Lp = w.Li = w.Up = w.Ui = NULL;
+    w.Lx = w.Ux = NULL;
+    ok = lu->L != NULL && lu->U != NULL;
+  }
+  if (ok)
+    PROFILE_WORK(factor_flops(lu), 12.0 * (lu->L->nnz + lu->U->nnz));
+  if (!ok) {
+    sparse_lu_free(lu);
+    lu = NULL;
+  }
+
+  free(w.Lp);
+  free(w.Li);
+  free(w.Lx);
+  free(w.Up);
+  free(w.Ui);
+  free(w.Ux);
+  free(w.pinv);
+  free(w.x);
+  free(w.xi);
+  free(w.pstack);
+  free(w.mark);
+  free(iperm);
+  free(rows);
+  sparse_free(csc);
+  sparse_free(csr);
+  return lu;
+}
+
+// Solves
+
+typedef struct sparse_solve_args {
+  const SparseLU *lu;
+  const Matrix *b;
+  Matrix *x;
+  int failed; // a task could not get its scratch vector
+} SparseSolveArgs;
+
+static void solve_task(void *arg, size_t begin, size_t end) {
+  SparseSolveArgs *s = arg;
+  const SparseLU *lu = s->lu;
+  const SparseMatrix *L = lu->L, *U = lu->U;
+  size_t n = lu->n;
+
+  MatrixArena *scratch = scratch_arena();
+  size_t mark = matrix_arena_mark(scratch);
+  float *y = scratch_alloc(scratch, (n + 1) * sizeof(float));
+  if (y == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    __atomic_store_n(&s->failed, 1, __ATOMIC_RELAXED);
+    matrix_arena_reset(scratch, mark);
+    return;
+  }
+
+  for (size_t c = begin; c < end; c++) {
+    // y = P_row P b, then L \ y and U \ y, then x = P^T y
+    for (size_t i = 0; i < n; i++) {
+      y[lu->pinv[i]] = MATRIX_AT(s->b, lu->perm[i], c);
+    }
+    for (size_t j = 0; j < n; j++) {
+      float yj = y[j];
+      for (size_t p = L->ptr[j] + 1; p < L->ptr[j + 1]; p++) {
+        y[L->idx[p]] -= L->values[p] * yj;
+      }
+    }
+    for (size_t j = n; j-- > 0;) {
+      size_t diag = U->ptr[j + 1] - 1;
+      float yj = y[j] /= U->values[diag];
+      for (size_t p = U->ptr[j]; p < diag; p++) {
+        y[U->idx[p]] -= U->values[p] * yj;
+      }
+    }
+    for (size_t i = 0; i < n; i++) {
+      MATRIX_AT(s->x, lu->perm[i], c) = y[i];
+    }
+  }
+
+  scratch_free(scratch, y);
+  matrix_arena_reset(scratch, mark);
+}
+
+Matrix *sparse_lu_solve(SparseLU *lu, Matrix *b) {
+  PROFILE_SCOPE(PROF_SPARSE_LU_SOLVE,
+                2.0 * (lu->L->nnz + lu->U->nnz) * b->n_cols,
+                12.0 * (lu->L->nnz + lu->U->nnz) + 8.0 * lu->n * b->n_cols);
+  if (b->n_rows != lu->n) {
+    fprintf(stderr, "Error %s: b has %zu rows, expected %zu\n", __func__,
+            b->n_rows, lu->n);
+    return NULL;
+  }
+  Matrix *x = matrix_create(b->n_rows, b->n_cols);
+  if (x == NULL)
+    return NULL;
+
+  SparseSolveArgs args = {lu, b, x, 0};
+  parallel_for(b->n_cols, SOLVE_GRAIN, solve_task, &args);
+  if (args.failed) {
+    matrix_free(x);
+    return NULL;
+  }
+  return x;
+}
+
+Matrix *sparse_solve(SparseMatrix *A, Matrix *b) {
+  if (A->n_rows != b->n_rows) {
+    fprintf(stderr, "Error %s: A is %zu x %zu, b is %zu x %zu\n", __func__,
+            A->n_rows, A->n_cols, b->n_rows, b->n_cols);
+    return NULL;
+  }
+  SparseLU *lu = sparse_lu_factor(A);
+  if (lu == NULL)
+    return NULL;
+
+  Matrix *x = sparse_lu_solve(lu, b);
+  sparse_lu_free(lu);
+  return x;
+}
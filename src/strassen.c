@@ -0,0 +1,306 @@
+// Strassen-Winograd multiplication: per level, 7 half-size products and 15
+// block additions instead of 8 products, recursing until a dimension is at
+// or below the cutoff, where the packed GEMM takes over. Odd dimensions
+// are peeled off: the even part recurses and the last row, column and
+// rank-1 term go to the classic kernel.
+#include "gemm.h"
+#include "matrix.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+
+// The cutoff is part of the tuning, so a tuning profile can set it
+void matrix_set_strassen_cutoff(size_t cutoff) {
+  MatrixTuning tuning = matrix_get_tuning();
+  tuning.strassen_cutoff = cutoff;
+  matrix_set_tuning(&tuning);
+}
+
+size_t matrix_get_strassen_cutoff(void) {
+  return matrix_get_tuning().strassen_cutoff;
+}
+
+static size_t max_size(size_t a, size_t b) { return a > b ? a : b; }
+
+// A strided block: element (i, j) is at p[i * rs + j * cs]
+typedef struct block {
+  float *p;
+  size_t rs;
+  size_t cs;
+} Block;
+
+static Block dense(float *p, size_t n_cols) {
+  Block b = {p, n_cols, 1};
+  return b;
+}
+
+// Quadrant (i, j) of a block split into n_rows x n_cols quadrants
+static Block quadrant(Block b, size_t i, size_t j, size_t n_rows,
+                      size_t n_cols) {
+  Block q = {b.p + i * n_rows * b.rs + j * n_cols * b.cs, b.rs, b.cs};
+  return q;
+}
+
+// out = a + b or a - b; out may be a or b
+typedef struct add_args {
+  size_t n_cols;
+  Block a;
+  Block b;
+  Block out;
+  int subtract;
+} AddArgs;
+
+static void add_task(void *arg, size_t begin, size_t end) {
+  const AddArgs *x = arg;
+  const SimdKernels *k = simd_kernels();
+  int contiguous = x->a.cs == 1 && x->b.cs == 1 && x->out.cs == 1;
+  for (size_t i = begin; i < end; i++) {
+    const float *a = x->a.p + i * x->a.rs, *b = x->b.p + i * x->b.rs;
+    float *out = x->out.p + i * x->out.rs;
+    if (contiguous) {
+      (x->subtract ? k->sub : k->add)(x->n_cols, a, b, out);
+      continue;
+    }
+    for (size_t j = 0; j < x->n_cols; j++) {
+      float bj = b[j * x->b.cs];
+      out[j * x->out.cs] = x->subtract ? a[j * x->a.cs] - bj
+                                       : a[j * x->a.cs] + bj;
+    }
+  }
+}
+
+static void block_add(size_t m, size_t n, Block a, Block b, Block out) {
+  AddArgs args = {n, a, b, out, 0};
+  parallel_for(m, pool_grain(n), add_task, &args);
+}
+
+static void block_sub(size_t m, size_t n, Block a, Block b, Block out) {
+  AddArgs args = {n, a, b, out, 1};
+  parallel_for(m, pool_grain(n), add_task, &args);
+}
+
+static int is_leaf(size_t m, size_t n, size_t k, size_t cutoff) {
+  return m <= cutoff || n <= cutoff || k <= cutoff;
+}
+
+// C = A * B by the classic kernel
+static void leaf_mult(size_t m, size_t n, size_t k, Block A, Block B,
+                      Block C) {
+  gemm_strided(m, n, k, 1, A.p, A.rs, A.cs, B.p, B.rs, B.cs, 0, C.p, C.rs,
+               C.cs);
+}
+
+// Given C = A * B on the even part (rows and columns below m & ~1,
+// n & ~1, inner dimension k & ~1), complete C = A * B
+static void peel(size_t m, size_t n, size_t k, Block A, Block B, Block C) {
+  size_t me = m & ~(size_t)1, ne = n & ~(size_t)1, ke = k & ~(size_t)1;
+  if (ke < k)
+    gemm_strided(me, ne, 1, 1, A.p + ke * A.cs, A.rs, A.cs, B.p + ke * B.rs,
+                 B.rs, B.cs, 1, C.p, C.rs, C.cs);
+  if (ne < n)
+    gemm_strided(me, 1, k, 1, A.p, A.rs, A.cs, B.p + ne * B.cs, B.rs, B.cs,
+                 0, C.p + ne * C.cs, C.rs, C.cs);
+  if (me < m)
+    gemm_strided(1, n, k, 1, A.p + me * A.rs, A.rs, A.cs, B.p, B.rs, B.cs, 0,
+                 C.p + me * C.rs, C.rs, C.cs);
+}
+
+// Floats of workspace winograd() needs: two temporaries per level
+static size_t winograd_work(size_t m, size_t n, size_t k, size_t cutoff) {
+  if (is_leaf(m, n, k, cutoff))
+    return 0;
+  size_t hm = m / 2, hn = n / 2, hk = k / 2;
+  return hm * max_size(hk, hn) + hk * hn + winograd_work(hm, hn, hk, cutoff);
+}
+
+// C = A * B, C disjoint from A, B and work. The schedule of Boyer, Dumas,
+// Pernet and Zhou (2009): the products land in the quadrants of C, so
+// only X (an S, then P1) and Y (a T) are needed beside it.
+static void winograd(size_t m, size_t n, size_t k, Block A, Block B, Block C,
+                     float *work, size_t cutoff) {
+  if (is_leaf(m, n, k, cutoff)) {
+    leaf_mult(m, n, k, A, B, C);
+    return;
+  }
+
+  size_t hm = m / 2, hn = n / 2, hk = k / 2;
+  Block A11 = quadrant(A, 0, 0, hm, hk), A12 = quadrant(A, 0, 1, hm, hk);
+  Block A21 = quadrant(A, 1, 0, hm, hk), A22 = quadrant(A, 1, 1, hm, hk);
+  Block B11 = quadrant(B, 0, 0, hk, hn), B12 = quadrant(B, 0, 1, hk, hn);
+  Block B21 = quadrant(B, 1, 0, hk, hn), B22 = quadrant(B, 1, 1, hk, hn);
+  Block C11 = quadrant(C, 0, 0, hm, hn), C12 = quadrant(C, 0, 1, hm, hn);
+  Block C21 = quadrant(C, 1, 0, hm, hn), C22 = quadrant(C, 1, 1, hm, hn);
+  float *y = work + hm * max_size(hk, hn), *rest = y + hk * hn;
+  Block X = dense(work, hk), Y = dense(y, hn), P1 = dense(work, hn);
+
+  block_sub(hm, hk, A11, A21, X); // S3
+  block_sub(hk, hn, B22, B12, Y); // T3
+  winograd(hm, hn, hk, X, Y, C21, rest, cutoff); // P7
+  block_add(hm, hk, A21, A22, X); // S1
+  block_sub(hk, hn, B12, B11, Y); // T1
+  winograd(hm, hn, hk, X, Y, C22, rest, cutoff); // P5
+  block_sub(hm, hk, X, A11, X); // S2 = S1 - A11
+  block_sub(hk, hn, B22, Y, Y); // T2 = B22 - T1
+  winograd(hm, hn, hk, X, Y, C12, rest, cutoff); // P6
+  block_sub(hm, hk, A12, X, X); // S4 = A12 - S2
+  winograd(hm, hn, hk, X, B22, C11, rest, cutoff); // P3
+  winograd(hm, hn, hk, A11, B11, P1, rest, cutoff);
+  block_add(hm, hn, P1, C12, C12);  // U2 = P1 + P6
+  block_add(hm, hn, C12, C21, C21); // U3 = U2 + P7
+  block_add(hm, hn, C12, C22, C12); // U4 = U2 + P5
+  block_add(hm, hn, C21, C22, C22); // C22 = U3 + P5
+  block_add(hm, hn, C12, C11, C12); // C12 = U4 + P3
+  block_sub(hk, hn, Y, B21, Y);     // T4 = T2 - B21
+  winograd(hm, hn, hk, A22, Y, C11, rest, cutoff); // P4
+  block_sub(hm, hn, C21, C11, C21);                // C21 = U3 - P4
+  winograd(hm, hn, hk, A12, B21, C11, rest, cutoff); // P2
+  block_add(hm, hn, P1, C11, C11);                   // C11 = P1 + P2
+
+  peel(m, n, k, A, B, C);
+}
+
+// The top level with its seven products run concurrently, each into its
+// own buffer and on its own workspace, the levels below as winograd()
+typedef struct product {
+  Block a;
+  Block b;
+  float *out;
+  float *work;
+} Product;
+
+typedef struct top_args {
+  size_t hm, hn, hk;
+  size_t cutoff;
+  Product p[7];
+} TopArgs;
+
+static void product_task(void *arg, size_t begin, size_t end) {
+  const TopArgs *t = arg;
+  for (size_t i = begin; i < end; i++) {
+    const Product *p = &t->p[i];
+    winograd(t->hm, t->hn, t->hk, p->a, p->b, dense(p->out, t->hn), p->work,
+             t->cutoff);
+  }
+}
+
+static size_t parallel_work(size_t m, size_t n, size_t k, size_t cutoff) {
+  size_t hm = m / 2, hn = n / 2, hk = k / 2;
+  return 4 * hm * hk + 4 * hk * hn +
+         7 * (hm * hn + winograd_work(hm, hn, hk, cutoff));
+}
+
+static void winograd_parallel(size_t m, size_t n, size_t k, Block A,
+                              Block B, Block C, float *work, size_t cutoff) {
+  size_t hm = m / 2, hn = n / 2, hk = k / 2;
+  Block A11 = quadrant(A, 0, 0, hm, hk), A12 = quadrant(A, 0, 1, hm, hk);
+  Block A21 = quadrant(A, 1, 0, hm, hk), A22 = quadrant(A, 1, 1, hm, hk);
+  Block B11 = quadrant(B, 0, 0, hk, hn), B12 = quadrant(B, 0, 1, hk, hn);
+  Block B21 = quadrant(B, 1, 0, hk, hn), B22 = quadrant(B, 1, 1, hk, hn);
+  Block S[4], T[4], P[7];
+  for (size_t i = 0; i < 4; i++) {
+    S[i] = dense(work + i * hm * hk, hk);
+    T[i] = dense(work + 4 * hm * hk + i * hk * hn, hn);
+  }
+  float *products = work + 4 * hm * hk + 4 * hk * hn;
+  float *rest = products + 7 * hm * hn;
+  size_t child_work = winograd_work(hm, hn, hk, cutoff);
+  for (size_t i = 0; i < 7; i++) {
+    P[i] = dense(products + i * hm * hn, hn);
+  }
+
+  block_add(hm, hk, A21, A22, S[0]);  // S1
+  block_sub(hm, hk, S[0], A11, S[1]); // S2
+  block_sub(hm, hk, A11, A21, S[2]);  // S3
+  block_sub(hm, hk, A12, S[1], S[3]); // S4
+  block_sub(hk, hn, B12, B11, T[0]);  // T1
+  block_sub(hk, hn, B22, T[0], T[1]); // T2
+  block_sub(hk, hn, B22, B12, T[2]);  // T3
+  block_sub(hk, hn, T[1], B21, T[3]); // T4
+
+  TopArgs args = {hm, hn, hk, cutoff,
+                  {{A11, B11}, {A12, B21}, {S[3], B22}, {A22, T[3]},
+                   {S[0], T[0]}, {S[1], T[1]}, {S[2], T[2]}}};
+  for (size_t i = 0; i < 7; i++) {
+    args.p[i].out = P[i].p;
+    args.p[i].work = rest + i * child_work;
+  }
+  parallel_for(7, 1, product_task, &args);
+
+  Block C11 = quadrant(C, 0, 0, hm, hn), C12 = quadrant(C, 0, 1, hm, hn);
+  Block C21 = quadrant(C, 1, 0, hm, hn), C22 = quadrant(C, 1, 1, hm, hn);
+  block_add(hm, hn, P[0], P[1], C11); // P1 + P2
+  block_add(hm, hn, P[0], P[5], P[5]); // U2 = P1 + P6
+  block_add(hm, hn, P[5], P[6], P[6]); // U3 = U2 + P7
+  block_add(hm, hn, P[5], P[4], P[5]); // U4 = U2 + P5
+  block_add(hm, hn, P[5], P[2], C12); // U4 + P3
+  block_sub(hm, hn, P[6], P[3], C21); // U3 - P4
+  block_add(hm, hn, P[6], P[4], C22); // U3 + P5
+
+  peel(m, n, k, A, B, C);
+}
+
+// C = alpha * T + beta * C, or C = alpha * C when T is C
+typedef struct finish_args {
+  size_t n_cols;
+  float alpha;
+  float beta;
+  Block t;
+  Block c;
+} FinishArgs;
+
+static void finish_task(void *arg, size_t begin, size_t end) {
+  const FinishArgs *x = arg;
+  const SimdKernels *k = simd_kernels();
+  for (size_t i = begin; i < end; i++) {
+    const float *t = x->t.p + i * x->t.rs;
+    float *c = x->c.p + i * x->c.rs;
+    if (t == c) {
+      if (x->c.cs == 1) {
+        k->scale(x->n_cols, x->alpha, c, c);
+        continue;
+      }
+      for (size_t j = 0; j < x->n_cols; j++) {
+        c[j * x->c.cs] *= x->alpha;
+      }
+    } else if (x->c.cs == 1) {
+      k->scale(x->n_cols, x->beta, c, c);
+      k->axpy(x->n_cols, x->alpha, t, c);
+    } else {
+      for (size_t j = 0; j < x->n_cols; j++) {
+        c[j * x->c.cs] = x->alpha * t[j] + x->beta * c[j * x->c.cs];
+      }
+    }
+  }
+}
+
+int gemm_strassen(size_t m, size_t n, size_t k, float alpha, const float *A,
+                  size_t rsa, size_t csa, const float *B, size_t rsb,
+                  size_t csb, float beta, float *C, size_t rsc, size_t csc) {
+  size_t cutoff = matrix_get_strassen_cutoff();
+  if (cutoff == 0 || is_leaf(m, n, k, cutoff) || alpha == 0)
+    return -1;
+
+  // C itself holds the product when beta == 0, else a temporary does
+  int parallel = thread_pool_size() > 1;
+  size_t work = parallel ? parallel_work(m, n, k, cutoff)
+                         : winograd_work(m, n, k, cutoff);
+  size_t product = beta == 0 ? 0 : m * n;
+  float *buffer = malloc((work + product) * sizeof(float));
+  if (buffer == NULL)
+    return -1;
+
+  Block a = {(float *)A, rsa, csa}, b = {(float *)B, rsb, csb};
+  Block c = {C, rsc, csc};
+  Block out = beta == 0 ? c : dense(buffer + work, n);
+  if (parallel)
+    winograd_parallel(m, n, k, a, b, out, buffer, cutoff);
+  else
+    winograd(m, n, k, a, b, out, buffer, cutoff);
+
+  if (alpha != 1 || beta != 0) {
+    FinishArgs args = {n, alpha, beta, out, c};
+    parallel_for(m, pool_grain(n), finish_task, &args);
+  }
+  free(buffer);
+  return 0;
+}
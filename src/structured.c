@@ -0,0 +1,718 @@
+#include "lu.h"
+#include "matrix.h"
+#include "profile.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// structured_detect hands a dense matrix to the band solver when its band
+// is at most n / STRUCT_BAND_RATIO wide. The band LU streams rows through
+// axpy at a fraction of the blocked dense LU's flop rate: it breaks even
+// near n / 2 and is ~3x faster at n / 4.
+#define STRUCT_BAND_RATIO 4
+
+#define NO_ENTRY SIZE_MAX
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+static size_t packed_size(const StructuredMatrix *S) {
+  size_t n = S->n;
+  switch (S->kind) {
+  case STRUCT_SYMMETRIC:
+  case STRUCT_UPPER:
+  case STRUCT_LOWER:
+    return n * (n + 1) / 2;
+  case STRUCT_TRIDIAGONAL:
+    return n > 0 ? 3 * n - 2 : 0;
+  case STRUCT_BANDED:
+    return n * (S->kl + S->ku + 1);
+  }
+  return 0;
+}
+
+// Start of row i of an upper triangle packed by rows
+static size_t upper_row(size_t n, size_t i) { return i * (2 * n - i + 1) / 2; }
+
+// Position of (i, j) in S->values, NO_ENTRY outside the structure
+static size_t entry_index(const StructuredMatrix *S, size_t i, size_t j) {
+  size_t n = S->n;
+  switch (S->kind) {
+  case STRUCT_SYMMETRIC:
+    if (j < i) {
+      size_t t = i;
+      i = j;
+      j = t;
+    }
+    return upper_row(n, i) + (j - i);
+  case STRUCT_UPPER:
+    return j >= i ? upper_row(n, i) + (j - i) : NO_ENTRY;
+  case STRUCT_LOWER:
+    return j <= i ? i * (i + 1) / 2 + j : NO_ENTRY;
+  case STRUCT_TRIDIAGONAL:
+    if (i == j)
+      return i;
+    if (i == j + 1)
+      return n + j;
+    if (j == i + 1)
+      return 2 * n - 1 + i;
+    return NO_ENTRY;
+  case STRUCT_BANDED:
+    if (j + S->kl < i || j > i + S->ku)
+      return NO_ENTRY;
+    return i * (S->kl + S->ku + 1) + (j + S->kl - i);
+  }
+  return NO_ENTRY;
+}
+
+// Columns [*lo, *hi) of row i that may hold nonzeros
+static void row_span(const StructuredMatrix *S, size_t i, size_t *lo,
+                     size_t *hi) {
+  *lo = i > S->kl ? i - S->kl : 0;
+  *hi = min_size(S->n, i + S->ku + 1);
+}
+
+StructuredMatrix *structured_create(StructKind kind, size_t n, size_t kl,
+                                    size_t ku) {
+  size_t last = n > 0 ? n - 1 : 0;
+  StructuredMatrix *S = malloc(sizeof(StructuredMatrix));
+  if (S == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return NULL;
+  }
+  S->kind = kind;
+  S->n = n;
+  switch (kind) {
+  case STRUCT_SYMMETRIC:
+    S->kl = S->ku = last;
+    break;
+  case STRUCT_UPPER:
+    S->kl = 0;
+    S->ku = last;
+    break;
+  case STRUCT_LOWER:
+    S->kl = last;
+    S->ku = 0;
+    break;
+  case STRUCT_TRIDIAGONAL:
+    S->kl = S->ku = min_size(1, last);
+    break;
+  case STRUCT_BANDED:
+    S->kl = min_size(kl, last);
+    S->ku = min_size(ku, last);
+    break;
+  default:
+    fprintf(stderr, "Error %s: unknown kind %d\n", __func__, (int)kind);
+    free(S);
+    return NULL;
+  }
+
+  size_t size = packed_size(S);
+  S->values = calloc(size > 0 ? size : 1, sizeof(float));
+  if (S->values == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    free(S);
+    return NULL;
+  }
+  return S;
+}
+
+void structured_free(StructuredMatrix *S) {
+  if (S != NULL) {
+    free(S->values);
+    free(S);
+  }
+}
+
+StructuredMatrix *structured_from_dense(StructKind kind, Matrix *A,
+                                        size_t kl, size_t ku) {
+  if (A->n_rows != A->n_cols) {
+    fprintf(stderr, "Error %s: A is %zu x %zu, not square\n", __func__,
+            A->n_rows, A->n_cols);
+    return NULL;
+  }
+  StructuredMatrix *S = structured_create(kind, A->n_rows, kl, ku);
+  if (S == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < S->n; i++) {
+    size_t lo, hi;
+    row_span(S, i, &lo, &hi);
+    if (kind == STRUCT_SYMMETRIC) {
+      // The upper triangle is stored, from the lower one of A
+      for (size_t j = i; j < hi; j++) {
+        S->values[entry_index(S, i, j)] = MATRIX_AT(A, j, i);
+      }
+      continue;
+    }
+    for (size_t j = lo; j < hi; j++) {
+      S->values[entry_index(S, i, j)] = MATRIX_AT(A, i, j);
+    }
+  }
+  return S;
+}
+
+Matrix *structured_to_dense(StructuredMatrix *S) {
+  Matrix *A = matrix_create(S->n, S->n);
+  if (A == NULL)
+    return NULL;
+
+  memset(A->array, 0, S->n * S->n * sizeof(float));
+  for (size_t i = 0; i < S->n; i++) {
+    size_t lo, hi;
+    row_span(S, i, &lo, &hi);
+    for (size_t j = lo; j < hi; j++) {
+      A->array[i * S->n + j] = S->values[entry_index(S, i, j)];
+    }
+  }
+  return A;
+}
+
+StructuredMatrix *structured_detect(Matrix *A) {
+  size_t n = A->n_rows;
+  if (n == 0 || n != A->n_cols)
+    return NULL;
+
+  // Bandwidths from the first and last nonzero of each row. A dense row
+  // is settled after one element on each side, so a dense A costs O(n).
+  size_t kl = 0, ku = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t first = 0, last = n - 1;
+    while (first < i && MATRIX_AT(A, i, first) == 0.0f)
+      first++;
+    while (last > i && MATRIX_AT(A, i, last) == 0.0f)
+      last--;
+    if (i - first > kl)
+      kl = i - first;
+    if (last - i > ku)
+      ku = last - i;
+    if (kl > 0 && ku > 0 && (kl + ku + 1) * STRUCT_BAND_RATIO > n)
+      return NULL;
+  }
+
+  StructKind kind;
+  if ((kl + ku + 1) * STRUCT_BAND_RATIO <= n)
+    kind = kl == 1 && ku == 1 ? STRUCT_TRIDIAGONAL : STRUCT_BANDED;
+  else
+    kind = kl == 0 ? STRUCT_UPPER : STRUCT_LOWER;
+  return structured_from_dense(kind, A, kl, ku);
+}
+
+float structured_get(StructuredMatrix *S, size_t i, size_t j) {
+  if (i >= S->n || j >= S->n) {
+    fprintf(stderr, "Error %s: (%zu, %zu) is outside %zu x %zu\n", __func__,
+            i, j, S->n, S->n);
+    return NAN;
+  }
+  size_t idx = entry_index(S, i, j);
+  return idx == NO_ENTRY ? 0.0f : S->values[idx];
+}
+
+int structured_set(StructuredMatrix *S, size_t i, size_t j, float value) {
+  size_t idx = i < S->n && j < S->n ? entry_index(S, i, j) : NO_ENTRY;
+  if (idx == NO_ENTRY) {
+    fprintf(stderr, "Error %s: (%zu, %zu) is outside the structure\n",
+            __func__, i, j);
+    return -1;
+  }
+  S->values[idx] = value;
+  return 0;
+}
+
+typedef struct mult_args {
+  const StructuredMatrix *S;
+  const float *B;
+  size_t ldb;
+  float *C;
+  size_t k;
+} MultArgs;
+
+static void mult_task(void *arg, size_t begin, size_t end) {
+  MultArgs *a = arg;
+  const SimdKernels *simd = simd_kernels();
+  for (size_t i = begin; i < end; i++) {
+    float *c_i = &a->C[i * a->k];
+    size_t lo, hi;
+    row_span(a->S, i, &lo, &hi);
+    memset(c_i, 0, a->k * sizeof(float));
+    for (size_t j = lo; j < hi; j++) {
+      float s = a->S->values[entry_index(a->S, i, j)];
+      if (s != 0.0f)
+        simd->axpy(a->k, s, &a->B[j * a->ldb], c_i);
+    }
+  }
+}
+
+Matrix *structured_mult(StructuredMatrix *S, Matrix *B) {
+  if (B->n_rows != S->n) {
+    fprintf(stderr, "Error %s: S is %zu x %zu, B is %zu x %zu\n", __func__,
+            S->n, S->n, B->n_rows, B->n_cols);
+    return NULL;
+  }
+  size_t k = B->n_cols;
+  Matrix *C = matrix_create(S->n, k);
+  Matrix *copy = NULL;
+  if (C == NULL)
+    return NULL;
+
+  // Rows of B are read whole, a strided view is packed first
+  const float *b = B->array;
+  size_t ldb = B->row_stride;
+  if (B->col_stride != 1 && k > 1) {
+    copy = matrix_create(S->n, k);
+    if (copy == NULL) {
+      matrix_free(C);
+      return NULL;
+    }
+    matrix_pack(copy->array, B);
+    b = copy->array;
+    ldb = k;
+  }
+
+  MultArgs args = {S, b, ldb, C->array, k};
+  parallel_for(S->n, pool_grain((S->kl + S->ku + 1) * k), mult_task,
+               &args);
+  matrix_free(copy);
+  return C;
+}
+
+// The factorization behind structured_solve and structured_determinant
+typedef enum {
+  FACTOR_TRIDIAGONAL, // d, dl, du, du2 (n each) of P A = L U, as LAPACK gttrf
+  FACTOR_BAND,        // P A = L U, n rows of 2 kl + ku + 1, offsets as banded
+  FACTOR_CHOLESKY,    // A = R^T R, R packed as STRUCT_UPPER
+  FACTOR_LU,          // dense P A = L U, as lu_factorize
+  FACTOR_UPPER,       // the triangle itself, borrowed from S
+  FACTOR_LOWER,
+} FactorKind;
+
+typedef struct factor {
+  FactorKind kind;
+  size_t n;
+  size_t kl;
+  size_t ku;
+  float *values;
+  size_t *pivots;
+  int sign; // of the row permutation, 0 when A is singular
+} Factor;
+
+// Gaussian elimination on a tridiagonal matrix. A row swap is only made
+// when the pivot is smaller than the entry below it, and then fills a
+// second superdiagonal du2; without swaps this is the Thomas algorithm.
+static int tridiag_factor(size_t n, float *d, float *dl, float *du,
+                          float *du2, size_t *pivots) {
+  int sign = 1;
+  for (size_t i = 0; i + 1 < n; i++) {
+    pivots[i] = i;
+    du2[i] = 0.0f;
+    if (fabsf(d[i]) >= fabsf(dl[i])) {
+      if (d[i] == 0.0f)
+        return 0;
+      float l = dl[i] / d[i];
+      dl[i] = l;
+      d[i + 1] -= l * du[i];
+    } else {
+      float l = d[i] / dl[i];
+      float t = du[i];
+      d[i] = dl[i];
+      dl[i] = l;
+      du[i] = d[i + 1];
+      d[i + 1] = t - l * d[i + 1];
+      if (i + 2 < n) {
+        du2[i] = du[i + 1];
+        du[i + 1] = -l * du[i + 1];
+      }
+      pivots[i] = i + 1;
+      sign = -sign;
+    }
+  }
+  return n > 0 && d[n - 1] == 0.0f ? 0 : sign;
+}
+
+typedef struct band_args {
+  float *lu;
+  size_t w;
+  size_t kl;
+  size_t j;
+  size_t len; // columns j + 1 .. j + len of the pivot row are updated
+} BandArgs;
+
+static void band_task(void *arg, size_t begin, size_t end) {
+  BandArgs *a = arg;
+  const SimdKernels *simd = simd_kernels();
+  size_t j = a->j;
+  const float *pivot_row = &a->lu[j * a->w + a->kl];
+  for (size_t i = j + 1 + begin; i < j + 1 + end; i++) {
+    float *row = &a->lu[i * a->w + (j + a->kl - i)];
+    float l = row[0] / pivot_row[0];
+    row[0] = l;
+    simd->axpy(a->len, -l, &pivot_row[1], &row[1]);
+  }
+}
+
+// LU with partial pivoting on band storage of row width w = 2 kl + ku + 1,
+// (i, j) at i * w + (j + kl - i). Swaps bring rows up to kl below the
+// diagonal, so U spreads over kl + ku superdiagonals.
+static int band_factor(size_t n, size_t kl, size_t ku, float *lu,
+                       size_t *pivots) {
+  size_t w = 2 * kl + ku + 1;
+  BandArgs args = {lu, w, kl, 0, 0};
+  int sign = 1;
+  for (size_t j = 0; j < n; j++) {
+    size_t last = min_size(n - 1, j + kl);
+    size_t p = j;
+    float best = fabsf(lu[j * w + kl]);
+    for (size_t i = j + 1; i <= last; i++) {
+      float v = fabsf(lu[i * w + (j + kl - i)]);
+      if (v > best) {
+        best = v;
+        p = i;
+      }
+    }
+    pivots[j] = p;
+    if (best == 0.0f)
+      return 0;
+
+    size_t right = min_size(n - 1, j + kl + ku);
+    if (p != j) {
+      for (size_t col = j; col <= right; col++) {
+        float *a = &lu[j * w + (col + kl - j)];
+        float *b = &lu[p * w + (col + kl - p)];
+        float t = *a;
+        *a = *b;
+        *b = t;
+      }
+      sign = -sign;
+    }
+
+    args.j = j;
+    args.len = right - j;
+    parallel_for(last - j, pool_grain(args.len), band_task, &args);
+  }
+  return sign;
+}
+
+// A = R^T R on an upper triangle packed by rows: the right-looking
+// Cholesky of lstsq.c, whose row updates stay contiguous in this layout
+typedef struct cholesky_args {
+  float *R;
+  size_t n;
+  size_t j;
+} CholeskyArgs;
+
+static void cholesky_task(void *arg, size_t begin, size_t end) {
+  CholeskyArgs *c = arg;
+  const SimdKernels *simd = simd_kernels();
+  size_t n = c->n, j = c->j;
+  const float *r_j = &c->R[upper_row(n, j)];
+  for (size_t i = j + 1 + begin; i < j + 1 + end; i++) {
+    simd->axpy(n - i, -r_j[i - j], &r_j[i - j], &c->R[upper_row(n, i)]);
+  }
+}
+
+static int cholesky_packed(float *R, size_t n) {
+  CholeskyArgs args = {R, n, 0};
+  for (size_t j = 0; j < n; j++) {
+    float *r_j = &R[upper_row(n, j)];
+    if (!(r_j[0] > 0.0f))
+      return -1;
+    float d = sqrtf(r_j[0]);
+    r_j[0] = d;
+    for (size_t col = 1; col < n - j; col++) {
+      r_j[col] /= d;
+    }
+
+    args.j = j;
+    parallel_for(n - j - 1, pool_grain(n - j), cholesky_task, &args);
+  }
+  return 0;
+}
+
+static void factor_free(Factor *f) {
+  if (f != NULL) {
+    if (f->kind != FACTOR_UPPER && f->kind != FACTOR_LOWER)
+      free(f->values);
+    free(f->pivots);
+    free(f);
+  }
+}
+
+static int factor_alloc(Factor *f, size_t n_values, size_t n_pivots) {
+  f->values = malloc((n_values > 0 ? n_values : 1) * sizeof(float));
+  f->pivots = malloc((n_pivots > 0 ? n_pivots : 1) * sizeof(size_t));
+  if (f->values == NULL || f->pivots == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return -1;
+  }
+  return 0;
+}
+
+static Factor *factor(StructuredMatrix *S) {
+  size_t n = S->n;
+  Factor *f = calloc(1, sizeof(Factor));
+  if (f == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    return NULL;
+  }
+  f->n = n;
+  f->kl = S->kl;
+  f->ku = S->ku;
+  f->sign = 1;
+
+  switch (S->kind) {
+  case STRUCT_UPPER:
+  case STRUCT_LOWER:
+    f->kind = S->kind == STRUCT_UPPER ? FACTOR_UPPER : FACTOR_LOWER;
+    f->values = S->values;
+    for (size_t i = 0; i < n; i++) {
+      if (S->values[entry_index(S, i, i)] == 0.0f)
+        f->sign = 0;
+    }
+    return f;
+
+  case STRUCT_TRIDIAGONAL:
+    f->kind = FACTOR_TRIDIAGONAL;
+    if (factor_alloc(f, 4 * n, n) != 0)
+      break;
+    memset(f->values, 0, 4 * n * sizeof(float));
+    if (n > 0) {
+      memcpy(f->values, S->values, n * sizeof(float));
+      memcpy(&f->values[n], &S->values[n], (n - 1) * sizeof(float));
+      memcpy(&f->values[2 * n], &S->values[2 * n - 1],
+             (n - 1) * sizeof(float));
+    }
+    f->sign = tridiag_factor(n, f->values, &f->values[n], &f->values[2 * n],
+                             &f->values[3 * n], f->pivots);
+    return f;
+
+  case STRUCT_BANDED: {
+    f->kind = FACTOR_BAND;
+    size_t width = S->kl + S->ku + 1, w = width + S->kl;
+    if (factor_alloc(f, n * w, n) != 0)
+      break;
+    for (size_t i = 0; i < n; i++) {
+      memcpy(&f->values[i * w], &S->values[i * width],
+             width * sizeof(float));
+      memset(&f->values[i * w + width], 0, S->kl * sizeof(float));
+    }
+    f->sign = band_factor(n, S->kl, S->ku, f->values, f->pivots);
+    return f;
+  }
+
+  case STRUCT_SYMMETRIC:
+    f->kind = FACTOR_CHOLESKY;
+    if (factor_alloc(f, n * n, n) != 0)
+      break;
+    memcpy(f->values, S->values, packed_size(S) * sizeof(float));
+    if (cholesky_packed(f->values, n) == 0)
+      return f;
+
+    // Indefinite: LU on the whole matrix
+    f->kind = FACTOR_LU;
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        f->values[i * n + j] = S->values[entry_index(S, i, j)];
+      }
+    }
+    f->sign = lu_factorize(f->values, n, f->pivots);
+    return f;
+  }
+
+  factor_free(f);
+  return NULL;
+}
+
+typedef struct solve_args {
+  const Factor *f;
+  float *X;
+  size_t k;
+} SolveArgs;
+
+static void swap_rows(size_t m, float *a, float *b) {
+  for (size_t c = 0; c < m; c++) {
+    float t = a[c];
+    a[c] = b[c];
+    b[c] = t;
+  }
+}
+
+static void divide_row(size_t m, float *x, float d) {
+  for (size_t c = 0; c < m; c++) {
+    x[c] /= d;
+  }
+}
+
+// Columns [begin, end) of X, rows of X at stride k
+static void solve_task(void *arg, size_t begin, size_t end) {
+  SolveArgs *a = arg;
+  const Factor *f = a->f;
+  const SimdKernels *simd = simd_kernels();
+  const float *v = f->values;
+  size_t n = f->n, k = a->k, m = end - begin;
+  float *X = &a->X[begin];
+#define ROW(i) (&X[(i) * k])
+
+  switch (f->kind) {
+  case FACTOR_TRIDIAGONAL: {
+    const float *d = v, *dl = &v[n], *du = &v[2 * n], *du2 = &v[3 * n];
+    for (size_t i = 0; i + 1 < n; i++) {
+      if (f->pivots[i] != i)
+        swap_rows(m, ROW(i), ROW(i + 1));
+      simd->axpy(m, -dl[i], ROW(i), ROW(i + 1));
+    }
+    for (size_t i = n; i-- > 0;) {
+      if (i + 1 < n)
+        simd->axpy(m, -du[i], ROW(i + 1), ROW(i));
+      if (i + 2 < n)
+        simd->axpy(m, -du2[i], ROW(i + 2), ROW(i));
+      divide_row(m, ROW(i), d[i]);
+    }
+    break;
+  }
+
+  case FACTOR_BAND: {
+    size_t kl = f->kl, w = 2 * kl + f->ku + 1;
+    for (size_t j = 0; j < n; j++) {
+      if (f->pivots[j] != j)
+        swap_rows(m, ROW(j), ROW(f->pivots[j]));
+      size_t last = min_size(n - 1, j + kl);
+      for (size_t i = j + 1; i <= last; i++) {
+        simd->axpy(m, -v[i * w + (j + kl - i)], ROW(j), ROW(i));
+      }
+    }
+    for (size_t i = n; i-- > 0;) {
+      const float *u_i = &v[i * w + kl];
+      size_t right = min_size(n - 1, i + w - kl - 1);
+      for (size_t c = i + 1; c <= right; c++) {
+        simd->axpy(m, -u_i[c - i], ROW(c), ROW(i));
+      }
+      divide_row(m, ROW(i), u_i[0]);
+    }
+    break;
+  }
+
+  case FACTOR_CHOLESKY:
+  case FACTOR_UPPER:
+    if (f->kind == FACTOR_CHOLESKY) {
+      // R^T y = b, by the rows of R
+      for (size_t j = 0; j < n; j++) {
+        const float *r_j = &v[upper_row(n, j)];
+        divide_row(m, ROW(j), r_j[0]);
+        for (size_t i = j + 1; i < n; i++) {
+          simd->axpy(m, -r_j[i - j], ROW(j), ROW(i));
+        }
+      }
+    }
+    for (size_t i = n; i-- > 0;) {
+      const float *r_i = &v[upper_row(n, i)];
+      for (size_t c = i + 1; c < n; c++) {
+        simd->axpy(m, -r_i[c - i], ROW(c), ROW(i));
+      }
+      divide_row(m, ROW(i), r_i[0]);
+    }
+    break;
+
+  case FACTOR_LOWER:
+    for (size_t i = 0; i < n; i++) {
+      const float *l_i = &v[i * (i + 1) / 2];
+      for (size_t c = 0; c < i; c++) {
+        simd->axpy(m, -l_i[c], ROW(c), ROW(i));
+      }
+      divide_row(m, ROW(i), l_i[i]);
+    }
+    break;
+
+  case FACTOR_LU:
+    lu_solve_raw(v, f->pivots, n, X, m, k);
+    break;
+  }
+#undef ROW
+}
+
+#ifdef MATRIX_PROFILE
+// Nominal work of structured_solve, for the profiler
+static double solve_flops(const StructuredMatrix *S, size_t k) {
+  double n = S->n, kl = S->kl, ku = S->ku;
+  switch (S->kind) {
+  case STRUCT_TRIDIAGONAL:
+    return n * (3.0 + 5.0 * k);
+  case STRUCT_BANDED:
+    return 2.0 * n * kl * (kl + ku) + 2.0 * n * k * (2.0 * kl + ku + 1.0);
+  case STRUCT_SYMMETRIC:
+    return n * n * n / 3.0 + 2.0 * n * n * k;
+  case STRUCT_UPPER:
+  case STRUCT_LOWER:
+    break;
+  }
+  return n * n * k;
+}
+#endif
+
+Matrix *structured_solve(StructuredMatrix *S, Matrix *b) {
+  PROFILE_SCOPE(PROF_STRUCTURED_SOLVE, solve_flops(S, b->n_cols),
+                4.0 * (packed_size(S) + 2.0 * S->n * b->n_cols));
+  if (b->n_rows != S->n) {
+    fprintf(stderr, "Error %s: S is %zu x %zu, b is %zu x %zu\n", __func__,
+            S->n, S->n, b->n_rows, b->n_cols);
+    return NULL;
+  }
+  Factor *f = factor(S);
+  if (f == NULL)
+    return NULL;
+  if (f->sign == 0) {
+    fprintf(stderr, "Error %s: matrix is singular\n", __func__);
+    factor_free(f);
+    return NULL;
+  }
+
+  size_t k = b->n_cols;
+  Matrix *x = matrix_create(S->n, k);
+  if (x != NULL) {
+    matrix_pack(x->array, b);
+    size_t per_column = f->kind == FACTOR_TRIDIAGONAL ? 3 * S->n
+                        : f->kind == FACTOR_BAND
+                            ? S->n * (2 * S->kl + S->ku + 1)
+                            : S->n * S->n;
+    SolveArgs args = {f, x->array, k};
+    parallel_for(k, pool_grain(per_column), solve_task, &args);
+  }
+  factor_free(f);
+  return x;
+}
+
+float structured_determinant(StructuredMatrix *S) {
+  Factor *f = factor(S);
+  if (f == NULL)
+    return NAN;
+
+  size_t n = f->n;
+  float det = f->sign;
+  for (size_t i = 0; i < n && det != 0.0f; i++) {
+    switch (f->kind) {
+    case FACTOR_TRIDIAGONAL:
+      det *= f->values[i];
+      break;
+    case FACTOR_BAND:
+      det *= f->values[i * (2 * f->kl + f->ku + 1) + f->kl];
+      break;
+    case FACTOR_CHOLESKY: {
+      float r = f->values[upper_row(n, i)];
+      det *= r * r;
+      break;
+    }
+    case FACTOR_LU:
+      det *= f->values[i * n + i];
+      break;
+    case FACTOR_UPPER:
+    case FACTOR_LOWER:
+      det *= S->values[entry_index(S, i, i)];
+      break;
+    }
+  }
+  factor_free(f);
+  return det;
+}
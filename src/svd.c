@@ -0,0 +1,457 @@
+// Singular value decomposition: blocked Householder bidiagonalization,
+// then implicit-shift QR on the bidiagonal matrix (Golub and Kahan), then
+// the reflectors applied to the wanted singular vectors in blocks.
+#include "gemm.h"
+#include "householder.h"
+#include "matrix.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Columns per panel of the bidiagonalization. The panel's rows and
+// columns are reduced with matrix-vector products against the not yet
+// updated trailing matrix, which then gets one rank-2 * BRD_BLOCK update
+// in GEMM.
+#define BRD_BLOCK 32
+
+// QR sweeps allowed per singular value before giving up
+#define SVD_MAX_ITER 75
+
+// Columns per block when applying a chase's rotations to the vectors
+#define SWEEP_COLS 64
+
+// Matrices at least this much taller than wide (as a ratio 5 / 3) are
+// reduced by QR first and R is bidiagonalized instead: QR costs about half
+// as much per row, and its panels stream through the rows
+#define SVD_QR_FIRST(m, n) (3 * (m) >= 5 * (n))
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+// Bidiagonalization
+
+// Reduce the m x n a (m >= n, row stride lda) to the upper bidiagonal
+// B = Q^T A P, with diagonal d and superdiagonal e. Left reflector j is
+// left in column j of a below the diagonal with tauq[j], right reflector
+// j in row j right of the superdiagonal with taup[j]. x holds
+// m x BRD_BLOCK floats, y n x BRD_BLOCK and t BRD_BLOCK.
+static void bidiagonalize(float *a, size_t m, size_t n, size_t lda, float *d,
+                          float *e, float *tauq, float *taup, float *x,
+                          float *y, float *t) {
+  size_t nb = BRD_BLOCK;
+  for (size_t i0 = 0; i0 < n; i0 += nb) {
+    // The panel and the rest of the matrix, relative to (i0, i0)
+    float *p = &a[i0 * lda + i0];
+    size_t mp = m - i0, np = n - i0, panel = min_size(nb, np);
+
+    for (size_t i = 0; i < panel; i++) {
+      float *col = &p[i * lda + i];
+
+      // Column i, up to date: A(i:, i) -= U Y(i, :)^T + X V(:, i)
+      gemm_strided(mp - i, 1, i, -1.0f, &p[i * lda], lda, 1, &y[i * nb], 1,
+                   1, 1.0f, col, lda, 1);
+      gemm_strided(mp - i, 1, i, -1.0f, &x[i * nb], nb, 1, &p[i], lda, 1,
+                   1.0f, col, lda, 1);
+      tauq[i0 + i] = householder_make(mp - i - 1, col, &col[lda], lda);
+      d[i0 + i] = col[0];
+      col[0] = 1.0f;
+      if (i + 1 == np)
+        break;
+
+      // y = tauq (A - U Y^T - X V^T)^T u over the trailing columns
+      const float *u = col;
+      float *yc = &y[(i + 1) * nb + i];
+      gemm_strided(np - i - 1, 1, mp - i, 1.0f, &col[1], 1, lda, u, lda, 1,
+                   0.0f, yc, nb, 1);
+      gemm_strided(i, 1, mp - i, 1.0f, &p[i * lda], 1, lda, u, lda, 1, 0.0f,
+                   t, 1, 1);
+      gemm_strided(np - i - 1, 1, i, -1.0f, &y[(i + 1) * nb], nb, 1, t, 1, 1,
+                   1.0f, yc, nb, 1);
+      gemm_strided(i, 1, mp - i, 1.0f, &x[i * nb], 1, nb, u, lda, 1, 0.0f, t,
+                   1, 1);
+      gemm_strided(np - i - 1, 1, i, -1.0f, &p[i + 1], 1, lda, t, 1, 1, 1.0f,
+                   yc, nb, 1);
+      for (size_t q = 0; q < np - i - 1; q++) {
+        yc[q * nb] *= tauq[i0 + i];
+      }
+
+      // Row i, up to date: A(i, i+1:) -= U(i, :) Y^T + X(i, :) V
+      float *row = &col[1];
+      gemm_strided(np - i - 1, 1, i + 1, -1.0f, &y[(i + 1) * nb], nb, 1,
+                   &p[i * lda], 1, 1, 1.0f, row, 1, 1);
+      gemm_strided(np - i - 1, 1, i, -1.0f, &p[i + 1], 1, lda, &x[i * nb], 1,
+                   1, 1.0f, row, 1, 1);
+      taup[i0 + i] = householder_make(np - i - 2, row, &row[1], 1);
+      e[i0 + i] = row[0];
+      row[0] = 1.0f;
+
+      // x = taup (A - U Y^T - X V^T) v over the trailing rows
+      const float *v = row;
+      float *xc = &x[(i + 1) * nb + i];
+      gemm_strided(mp - i - 1, 1, np - i - 1, 1.0f, &p[(i + 1) * lda + i + 1],
+                   lda, 1, v, 1, 1, 0.0f, xc, nb, 1);
+      gemm_strided(i + 1, 1, np - i - 1, 1.0f, &y[(i + 1) * nb], 1, nb, v, 1,
+                   1, 0.0f, t, 1, 1);
+      gemm_strided(mp - i - 1, 1, i + 1, -1.0f, &p[(i + 1) * lda], lda, 1, t,
+                   1, 1, 1.0f, xc, nb, 1);
+      gemm_strided(i, 1, np - i - 1, 1.0f, &p[i + 1], lda, 1, v, 1, 1, 0.0f,
+                   t, 1, 1);
+      gemm_strided(mp - i - 1, 1, i, -1.0f, &x[(i + 1) * nb], nb, 1, t, 1, 1,
+                   1.0f, xc, nb, 1);
+      for (size_t q = 0; q < mp - i - 1; q++) {
+        xc[q * nb] *= taup[i0 + i];
+      }
+    }
+
+    // Trailing matrix: A -= U Y^T + X V
+    if (panel < np) {
+      float *trail = &p[panel * lda + panel];
+      gemm_strided(mp - panel, np - panel, panel, -1.0f, &p[panel * lda], lda,
+                   1, &y[panel * nb], 1, nb, 1.0f, trail, lda, 1);
+      gemm_strided(mp - panel, np - panel, panel, -1.0f, &x[panel * nb], nb,
+                   1, &p[panel], lda, 1, 1.0f, trail, lda, 1);
+    }
+  }
+}
+
+// Bidiagonal SVD
+
+// Rotate rows i and j of the n-column row-major z, if any
+static void rotate_rows(double *z, size_t n, size_t i, size_t j, double c,
+                        double s) {
+  if (z == NULL)
+    return;
+  double *zi = &z[i * n], *zj = &z[j * n];
+  for (size_t q = 0; q < n; q++) {
+    double a = zi[q], b = zj[q];
+    zi[q] = a * c + b * s;
+    zj[q] = b * c - a * s;
+  }
+}
+
+// One chase's rotations, j acting on rows j and j + 1 for j in [l, k),
+// applied to z (n columns) by blocks of SWEEP_COLS columns in parallel,
+// each block taking the whole sequence while it is in cache
+typedef struct sweep_args {
+  double *z;
+  size_t n;
+  size_t l;
+  size_t k;
+  const double *c;
+  const double *s;
+} SweepArgs;
+
+static void sweep_task(void *arg, size_t begin, size_t end) {
+  SweepArgs *a = arg;
+  size_t q0 = begin * SWEEP_COLS, q1 = min_size(end * SWEEP_COLS, a->n);
+  for (size_t j = a->l; j < a->k; j++) {
+    double *zi = &a->z[j * a->n], *zj = zi + a->n, c = a->c[j], s = a->s[j];
+    for (size_t q = q0; q < q1; q++) {
+      double x = zi[q], y = zj[q];
+      zi[q] = x * c + y * s;
+      zj[q] = y * c - x * s;
+    }
+  }
+}
+
+static void sweep(double *z, size_t n, size_t l, size_t k, const double *c,
+                  const double *s) {
+  SweepArgs args = {z, n, l, k, c, s};
+  size_t blocks = (n + SWEEP_COLS - 1) / SWEEP_COLS;
+  parallel_for(blocks, pool_grain((k - l) * SWEEP_COLS), sweep_task, &args);
+}
+
+// Implicit-shift QR on the upper bidiagonal (d, f), f[i] coupling i - 1
+// and i and f[0] unused. d gets the singular values, non-negative and
+// unsorted. With ut and vt (n x n, row-major), their rows are rotated
+// along, so starting from I they become the left and right singular
+// vectors (as rows); rot then holds 4 n doubles. -1 if it fails to
+// converge.
+static int bidiag_qr(size_t n, double *d, double *f, double *ut, double *vt,
+                     double *rot) {
+  double norm = 0.0;
+  f[0] = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    norm = fmax(norm, fabs(d[i]) + fabs(f[i]));
+  }
+
+  for (size_t k = n; k-- > 0;) {
+    for (size_t iter = 0;; iter++) {
+      // Split off a negligible f[l], or chase away a negligible d[l - 1]
+      size_t l = k;
+      int cancel = 1;
+      for (;; l--) {
+        if (fabs(f[l]) + norm == norm) {
+          cancel = 0;
+          break;
+        }
+        if (fabs(d[l - 1]) + norm == norm)
+          break;
+      }
+      if (cancel) {
+        double c = 0.0, s = 1.0;
+        for (size_t i = l; i <= k; i++) {
+          double g = s * f[i];
+          f[i] *= c;
+          if (fabs(g) + norm == norm)
+            break;
+          double h = hypot(g, d[i]);
+          c = d[i] / h;
+          s = -g / h;
+          d[i] = h;
+          rotate_rows(ut, n, l - 1, i, c, s);
+        }
+      }
+
+      double z = d[k];
+      if (l == k) {
+        if (z < 0.0) {
+          d[k] = -z;
+          for (size_t q = 0; vt != NULL && q < n; q++) {
+            vt[k * n + q] = -vt[k * n + q];
+          }
+        }
+        break;
+      }
+      if (iter == SVD_MAX_ITER)
+        return -1;
+
+      // Shift from the trailing 2 x 2 of B^T B, then one chase
+      double x = d[l], y = d[k - 1], g = f[k - 1], h = f[k];
+      double t = ((y - z) * (y + z) + (g - h) * (g + h)) / (2.0 * h * y);
+      g = hypot(t, 1.0);
+      t = ((x - z) * (x + z) + h * (y / (t + copysign(g, t)) - h)) / x;
+      double c = 1.0, s = 1.0;
+      for (size_t j = l; j < k; j++) {
+        size_t i = j + 1;
+        g = f[i];
+        y = d[i];
+        h = s * g;
+        g *= c;
+        z = hypot(t, h);
+        f[j] = z;
+        c = t / z;
+        s = h / z;
+        t = x * c + g * s;
+        g = g * c - x * s;
+        h = y * s;
+        y *= c;
+        if (rot != NULL) {
+          rot[j] = c;
+          rot[n + j] = s;
+        }
+        z = hypot(t, h);
+        d[j] = z;
+        if (z != 0.0) {
+          c = t / z;
+          s = h / z;
+        }
+        t = c * g + s * y;
+        x = c * y - s * g;
+        if (rot != NULL) {
+          rot[2 * n + j] = c;
+          rot[3 * n + j] = s;
+        }
+      }
+      if (rot != NULL) {
+        sweep(vt, n, l, k, rot, &rot[n]);
+        sweep(ut, n, l, k, &rot[2 * n], &rot[3 * n]);
+      }
+      f[l] = 0.0;
+      f[k] = t;
+      d[k] = x;
+    }
+  }
+  return 0;
+}
+
+// SVD of the packed m x n a (m >= n), overwritten. s gets the k largest
+// singular values, descending. With U (m x k) and V (n x k), both
+// row-major, they get the matching singular vectors. -1 if out of memory,
+// -2 if the iteration fails to converge.
+static int svd_tall(float *a, size_t m, size_t n, size_t k, float *s,
+                    float *U, float *V) {
+  if (m > n && SVD_QR_FIRST(m, n)) {
+    // A = Q R: the SVD of R, then U = Q [U_R; 0]
+    float *tau = malloc(n * sizeof(float));
+    float *R = calloc(n * n, sizeof(float));
+    int status = -1;
+    if (tau != NULL && R != NULL &&
+        qr_factor_apply(a, m, n, tau, NULL, 0) == 0) {
+      for (size_t i = 0; i < n; i++) {
+        memcpy(&R[i * n + i], &a[i * n + i], (n - i) * sizeof(float));
+      }
+      status = svd_tall(R, n, n, k, s, U, V);
+    }
+    if (status == 0 && U != NULL) {
+      memset(&U[n * k], 0, (m - n) * k * sizeof(float));
+      if (householder_apply(m, n, a, n, 1, tau, U, k, k) != 0)
+        status = -1;
+    }
+    free(tau);
+    free(R);
+    return status;
+  }
+
+  size_t nb = BRD_BLOCK;
+  float *work = malloc(((m + n + 1) * nb + 4 * n + 1) * sizeof(float));
+  double *dd = malloc((2 * n + 1) * sizeof(double));
+  size_t *order = malloc((n + 1) * sizeof(size_t));
+  double *ut = NULL;
+  int status = -1;
+  if (work == NULL || dd == NULL || order == NULL)
+    goto done;
+  float *x = work, *y = x + m * nb, *t = y + n * nb, *d = t + nb;
+  float *e = d + n, *tauq = e + n, *taup = tauq + n;
+  bidiagonalize(a, m, n, n, d, e, tauq, taup, x, y, t);
+
+  double *f = dd + n;
+  for (size_t i = 0; i < n; i++) {
+    dd[i] = d[i];
+    f[i] = i > 0 ? e[i - 1] : 0.0;
+  }
+  double *vt = NULL, *rot = NULL;
+  if (U != NULL) {
+    ut = calloc(2 * n * n + 4 * n, sizeof(double));
+    if (ut == NULL)
+      goto done;
+    vt = ut + n * n;
+    rot = vt + n * n;
+    for (size_t i = 0; i < n; i++) {
+      ut[i * n + i] = vt[i * n + i] = 1.0;
+    }
+  }
+  if (bidiag_qr(n, dd, f, ut, vt, rot) != 0) {
+    status = -2;
+    goto done;
+  }
+
+  // The k largest, by selection: k is often much less than n
+  for (size_t i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  for (size_t c = 0; c < k; c++) {
+    size_t max = c;
+    for (size_t i = c + 1; i < n; i++) {
+      if (dd[order[i]] > dd[order[max]])
+        max = i;
+    }
+    size_t tmp = order[c];
+    order[c] = order[max];
+    order[max] = tmp;
+    s[c] = (float)dd[order[c]];
+  }
+
+  if (U != NULL) {
+    // U = Q [Ub; 0] and V = P Vb, the right reflectors having their unit
+    // entries on the superdiagonal
+    memset(U, 0, m * k * sizeof(float));
+    for (size_t r = 0; r < n; r++) {
+      for (size_t c = 0; c < k; c++) {
+        U[r * k + c] = (float)ut[order[c] * n + r];
+        V[r * k + c] = (float)vt[order[c] * n + r];
+      }
+    }
+    if (householder_apply(m, n, a, n, 1, tauq, U, k, k) != 0)
+      goto done;
+    if (n > 1 &&
+        householder_apply(n - 1, n - 1, &a[1], 1, n, taup, &V[k], k, k) != 0)
+      goto done;
+  }
+  status = 0;
+
+done:
+  free(work);
+  free(dd);
+  free(order);
+  free(ut);
+  return status;
+}
+
+// Public API
+
+SVDFactor *svd_factor(Matrix *A, size_t k, int want_vectors) {
+  PROFILE_SCOPE(PROF_SVD_FACTOR,
+                (want_vectors ? 8.0 : 4.0) * A->n_rows * A->n_cols *
+                    (A->n_rows < A->n_cols ? A->n_rows : A->n_cols),
+                4.0 * A->n_rows * A->n_cols);
+  size_t m = A->n_rows, n = A->n_cols, r = min_size(m, n);
+  if (k == 0)
+    k = r;
+  if (k > r) {
+    fprintf(stderr, "Error %s: k(%zu) > min(n_rows, n_cols)(%zu)\n",
+            __func__, k, r);
+    return NULL;
+  }
+
+  // Wide matrices go through A^T = V S U^T
+  int wide = m < n;
+  Matrix At = matrix_trans_view(A);
+  Matrix *src = wide ? &At : A;
+  size_t rows = src->n_rows, cols = src->n_cols;
+
+  SVDFactor *svd = calloc(1, sizeof(SVDFactor));
+  Matrix *a = matrix_create(rows, cols);
+  float *UV = NULL;
+  if (svd == NULL || a == NULL)
+    goto oom;
+  svd->S = matrix_create(k, 1);
+  if (svd->S == NULL)
+    goto oom;
+  if (want_vectors) {
+    svd->U = matrix_create(m, k);
+    svd->Vt = matrix_create(k, n);
+    UV = malloc(((rows + cols) * k + 1) * sizeof(float));
+    if (svd->U == NULL || svd->Vt == NULL || UV == NULL)
+      goto oom;
+  }
+
+  matrix_pack(a->array, src);
+  float *Ua = UV, *Va = UV != NULL ? UV + rows * k : NULL;
+  int status = r > 0 ? svd_tall(a->array, rows, cols, k, svd->S->array, Ua,
+                                Va)
+                     : 0;
+  if (status == -1)
+    goto oom;
+  if (status == -2) {
+    fprintf(stderr, "Error %s: the bidiagonal iteration did not converge\n",
+            __func__);
+    goto fail;
+  }
+
+  if (want_vectors) {
+    // One of the two comes out transposed
+    float *u = wide ? Va : Ua, *v = wide ? Ua : Va;
+    memcpy(svd->U->array, u, m * k * sizeof(float));
+    float *vt = svd->Vt->array;
+    for (size_t i = 0; i < n; i++) {
+      for (size_t c = 0; c < k; c++) {
+        vt[c * n + i] = v[i * k + c];
+      }
+    }
+  }
+  matrix_free(a);
+  free(UV);
+  return svd;
+
+oom:
+  fprintf(stderr, "Error: memory allocation failed\n");
+fail:
+  matrix_free(a);
+  free(UV);
+  svd_factor_free(svd);
+  return NULL;
+}
+
+void svd_factor_free(SVDFactor *svd) {
+  if (svd != NULL) {
+    matrix_free(svd->S);
+    matrix_free(svd->U);
+    matrix_free(svd->Vt);
+    free(svd);
+  }
+}
@@ -0,0 +1,362 @@
+#include "thread_pool.h"
+#include "matrix.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Work-stealing pool: every worker owns a deque of tiles. A worker pops
+// the most recently pushed tile of its own deque (good cache reuse for
+// nested loops) and, when empty, steals the oldest tile of another deque
+// (the biggest chunk of remaining work). Threads that call parallel_for
+// from outside the pool push round-robin and then steal alongside the
+// workers until their loop completes.
+
+typedef struct job {
+  parallel_fn fn;
+  void *arg;
+  size_t remaining; // tiles not finished yet, decremented under lock
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+} Job;
+
+typedef struct task {
+  Job *job;
+  size_t begin;
+  size_t end;
+} Task;
+
+typedef struct pool Pool;
+
+typedef struct deque {
+  Pool *pool;
+  size_t index;
+  pthread_mutex_t lock;
+  Task *tasks; // ring buffer
+  size_t head; // oldest task, stolen by others
+  size_t size;
+  size_t cap;
+} Deque;
+
+struct pool {
+  size_t n_threads; // workers + the calling thread
+  pthread_t *workers;
+  Deque *deques; // one per worker
+  size_t next_deque;
+
+  pthread_mutex_t lock; // guards pending/shutdown for sleeping workers
+  pthread_cond_t work_available;
+  size_t pending; // tasks queued in any deque
+  int shutdown;
+};
+
+static Pool *pool = NULL;
+static size_t requested_threads = 0; // 0 = environment or core count
+static pthread_mutex_t pool_init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Index of the worker running on this thread, -1 outside the pool
+static __thread long worker_index = -1;
+
+static int deque_push(Deque *dq, Task task) {
+  pthread_mutex_lock(&dq->lock);
+  if (dq->size == dq->cap) {
+    size_t cap = dq->cap == 0 ? 64 : dq->cap * 2;
+    Task *tasks = malloc(cap * sizeof(Task));
+    if (tasks == NULL) {
+      pthread_mutex_unlock(&dq->lock);
+      return -1;
+    }
+    for (size_t i = 0; i < dq->size; i++)
+      tasks[i] = dq->tasks[(dq->head + i) % dq->cap];
+    free(dq->tasks);
+    dq->tasks = tasks;
+    dq->head = 0;
+    dq->cap = cap;
+  }
+  dq->tasks[(dq->head + dq->size) % dq->cap] = task;
+  dq->size++;
+  pthread_mutex_unlock(&dq->lock);
+  return 0;
+}
+
+// Owner side: newest task
+static int deque_pop(Deque *dq, Task *task) {
+  int found = 0;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->size > 0) {
+    dq->size--;
+    *task = dq->tasks[(dq->head + dq->size) % dq->cap];
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+// Thief side: oldest task
+static int deque_steal(Deque *dq, Task *task) {
+  int found = 0;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->size > 0) {
+    *task = dq->tasks[dq->head];
+    dq->head = (dq->head + 1) % dq->cap;
+    dq->size--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+static int find_task(Pool *p, Task *task) {
+  size_t n_deques = p->n_threads - 1;
+  size_t start = 0;
+
+  if (worker_index >= 0) {
+    if (deque_pop(&p->deques[worker_index], task))
+      goto found;
+    start = (size_t)worker_index + 1;
+  }
+  for (size_t i = 0; i < n_deques; i++) {
+    if (deque_steal(&p->deques[(start + i) % n_deques], task))
+      goto found;
+  }
+  return 0;
+
+found:
+  __atomic_fetch_sub(&p->pending, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+static void run_task(Task task) {
+  Job *job = task.job;
+  job->fn(job->arg, task.begin, task.end);
+
+  // The job lives on the waiting thread's stack: it may be gone as soon as
+  // the lock is released after the last decrement
+  pthread_mutex_lock(&job->lock);
+  if (__atomic_sub_fetch(&job->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+    pthread_cond_broadcast(&job->done);
+  pthread_mutex_unlock(&job->lock);
+}
+
+static void *worker_main(void *arg) {
+  Deque *own = arg;
+  Pool *p = own->pool;
+  worker_index = (long)own->index;
+
+  for (;;) {
+    Task task;
+    if (find_task(p, &task)) {
+      run_task(task);
+      continue;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->shutdown &&
+           __atomic_load_n(&p->pending, __ATOMIC_RELAXED) == 0)
+      pthread_cond_wait(&p->work_available, &p->lock);
+    int stop = p->shutdown;
+    pthread_mutex_unlock(&p->lock);
+
+    if (stop)
+      return NULL;
+  }
+}
+
+static size_t default_thread_count(void) {
+  const char *env = getenv("MATRIX_NUM_THREADS");
+  if (env != NULL) {
+    long n = strtol(env, NULL, 10);
+    if (n > 0)
+      return (size_t)n;
+    fprintf(stderr, "Warning: ignoring invalid MATRIX_NUM_THREADS=%s\n", env);
+  }
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (size_t)cores : 1;
+}
+
+static Pool *pool_create(size_t n_threads) {
+  Pool *p = calloc(1, sizeof(Pool));
+  if (p == NULL)
+    return NULL;
+
+  p->n_threads = n_threads;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->work_available, NULL);
+  if (n_threads == 1)
+    return p;
+
+  p->workers = calloc(n_threads - 1, sizeof(pthread_t));
+  p->deques = calloc(n_threads - 1, sizeof(Deque));
+  if (p->workers == NULL || p->deques == NULL) {
+    free(p->workers);
+    free(p->deques);
+    p->workers = NULL;
+    p->deques = NULL;
+    p->n_threads = 1;
+    return p;
+  }
+  for (size_t i = 0; i < n_threads - 1; i++) {
+    p->deques[i].pool = p;
+    p->deques[i].index = i;
+    pthread_mutex_init(&p->deques[i].lock, NULL);
+  }
+
+  for (size_t i = 0; i < n_threads - 1; i++) {
+    if (pthread_create(&p->workers[i], NULL, worker_main, &p->deques[i]) !=
+        0) {
+      fprintf(stderr,
+              "Warning: could only start %zu of %zu threads, running "
+              "single-threaded\n",
+              i + 1, n_threads);
+      // Running workers size their steal loop from n_threads, so stop them
+      // before falling back
+      pthread_mutex_lock(&p->lock);
+      p->shutdown = 1;
+      pthread_cond_broadcast(&p->work_available);
+      pthread_mutex_unlock(&p->lock);
+      for (size_t j = 0; j < i; j++)
+        pthread_join(p->workers[j], NULL);
+      for (size_t j = 0; j < n_threads - 1; j++) {
+        pthread_mutex_destroy(&p->deques[j].lock);
+        free(p->deques[j].tasks);
+      }
+      free(p->workers);
+      free(p->deques);
+      p->workers = NULL;
+      p->deques = NULL;
+      p->shutdown = 0;
+      p->n_threads = 1;
+      break;
+    }
+  }
+  return p;
+}
+
+static void pool_destroy(Pool *p) {
+  pthread_mutex_lock(&p->lock);
+  p->shutdown = 1;
+  pthread_cond_broadcast(&p->work_available);
+  pthread_mutex_unlock(&p->lock);
+
+  for (size_t i = 0; i + 1 < p->n_threads; i++)
+    pthread_join(p->workers[i], NULL);
+
+  if (p->deques != NULL) {
+    for (size_t i = 0; i + 1 < p->n_threads; i++) {
+      pthread_mutex_destroy(&p->deques[i].lock);
+      free(p->deques[i].tasks);
+    }
+  }
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->work_available);
+  free(p->workers);
+  free(p->deques);
+  free(p);
+}
+
+static Pool *get_pool(void) {
+  Pool *p = __atomic_load_n(&pool, __ATOMIC_ACQUIRE);
+  if (p != NULL)
+    return p;
+
+  pthread_mutex_lock(&pool_init_lock);
+  if (pool == NULL) {
+    size_t n = requested_threads > 0 ? requested_threads
+                                     : default_thread_count();
+    static int registered = 0;
+    if (!registered) {
+      atexit(matrix_threads_shutdown);
+      registered = 1;
+    }
+    __atomic_store_n(&pool, pool_create(n), __ATOMIC_RELEASE);
+  }
+  p = pool;
+  pthread_mutex_unlock(&pool_init_lock);
+  return p;
+}
+
+size_t thread_pool_size(void) {
+  Pool *p = get_pool();
+  return p == NULL ? 1 : p->n_threads;
+}
+
+void parallel_for(size_t n, size_t grain, parallel_fn fn, void *arg) {
+  if (n == 0)
+    return;
+  if (grain == 0)
+    grain = 1;
+
+  Pool *p = get_pool();
+  if (p == NULL || p->n_threads == 1 || n <= grain) {
+    fn(arg, 0, n);
+    return;
+  }
+
+  Job job = {fn, arg, (n + grain - 1) / grain};
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.done, NULL);
+
+  // Queue every tile but the first, which this thread starts on right away.
+  // pending counts a task before it is pushed, so a thief that takes it
+  // at once never decrements below zero.
+  size_t n_deques = p->n_threads - 1;
+  for (size_t begin = grain; begin < n; begin += grain) {
+    Task task = {&job, begin, begin + grain < n ? begin + grain : n};
+    size_t d = worker_index >= 0 ? (size_t)worker_index
+                                 : __atomic_fetch_add(&p->next_deque, 1,
+                                                      __ATOMIC_RELAXED) %
+                                       n_deques;
+    __atomic_fetch_add(&p->pending, 1, __ATOMIC_RELAXED);
+    if (deque_push(&p->deques[d], task) != 0) {
+      __atomic_fetch_sub(&p->pending, 1, __ATOMIC_RELAXED);
+      run_task(task); // out of memory: do it inline
+    }
+  }
+
+  pthread_mutex_lock(&p->lock);
+  pthread_cond_broadcast(&p->work_available);
+  pthread_mutex_unlock(&p->lock);
+
+  run_task((Task){&job, 0, grain});
+
+  // Help with whatever is queued (ours or not) until our tiles are done
+  while (__atomic_load_n(&job.remaining, __ATOMIC_ACQUIRE) > 0) {
+    Task task;
+    if (find_task(p, &task)) {
+      run_task(task);
+      continue;
+    }
+    // Nothing left to steal: the rest of our tiles are running elsewhere
+    pthread_mutex_lock(&job.lock);
+    while (__atomic_load_n(&job.remaining, __ATOMIC_ACQUIRE) > 0)
+      pthread_cond_wait(&job.done, &job.lock);
+    pthread_mutex_unlock(&job.lock);
+  }
+
+  // Wait for the thread that finished the last tile to let go of the lock
+  pthread_mutex_lock(&job.lock);
+  pthread_mutex_unlock(&job.lock);
+  pthread_mutex_destroy(&job.lock);
+  pthread_cond_destroy(&job.done);
+}
+
+void matrix_set_num_threads(size_t n_threads) {
+  pthread_mutex_lock(&pool_init_lock);
+  requested_threads = n_threads;
+  if (pool != NULL) {
+    pool_destroy(pool);
+    __atomic_store_n(&pool, NULL, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&pool_init_lock);
+}
+
+size_t matrix_get_num_threads(void) { return thread_pool_size(); }
+
+void matrix_threads_shutdown(void) {
+  pthread_mutex_lock(&pool_init_lock);
+  if (pool != NULL) {
+    pool_destroy(pool);
+    __atomic_store_n(&pool, NULL, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&pool_init_lock);
+}
@@ -0,0 +1,25 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+// Body of a parallel loop: process items [begin, end) of the range.
+typedef void (*parallel_fn)(void *arg, size_t begin, size_t end);
+
+// Split [0, n) into tiles of at most `grain` items and run `fn` on them
+// across the library thread pool. The calling thread works on the tiles
+// too and returns once all of them are done. Tiles may run in any order
+// and concurrently, so they must write disjoint data. Nested calls from
+// inside a tile are allowed.
+void parallel_for(size_t n, size_t grain, parallel_fn fn, void *arg);
+
+// Grain for items of work_per_item multiply-adds (or elements) each, so
+// that a tile does ~32K of them: enough to amortise the queueing.
+static inline size_t pool_grain(size_t work_per_item) {
+  return 1 + (1 << 15) / (work_per_item + 1);
+}
+
+// Number of threads parallel_for spreads work over, caller included.
+size_t thread_pool_size(void);
+
+#endif // !THREAD_POOL_H
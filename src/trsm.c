@@ -0,0 +1,30 @@
+#include "trsm.h"
+#include "gemm.h"
+#include "thread_pool.h"
+
+// Rows per diagonal block. The block is solved directly, then the rows
+// still to solve get a rank-TRSM_BLOCK update through the GEMM kernel,
+// where nearly all the flops go.
+#define TRSM_BLOCK 64
+
+// Right-hand sides per task of the diagonal solves, so the block of B a
+// task walks (TRSM_BLOCK x TRSM_COLS floats, 64KB) stays in L2
+#define TRSM_COLS 256
+
+static size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+#define T float
+#define FN(name) name
+#include "trsm_tmpl.h"
+
+#define T double
+#define FN(name) name##_d
+#include "trsm_tmpl.h"
+
+#define T float _Complex
+#define FN(name) name##_c
+#include "trsm_tmpl.h"
+
+#define T double _Complex
+#define FN(name) name##_z
+#include "trsm_tmpl.h"
@@ -0,0 +1,44 @@
+#ifndef TRSM_H
+#define TRSM_H
+
+#include <stddef.h>
+
+// Triangular solves with many right-hand sides, in place on B.
+// T is n x n with row stride ldt, B is n x k with row stride ldb, and only
+// the relevant triangle of T is read. B must not overlap that triangle.
+
+// L X = B, L lower triangular with an implied unit diagonal
+void trsm_lower_unit(size_t n, size_t k, const float *L, size_t ldl,
+                     float *B, size_t ldb);
+
+// U X = B, U upper triangular
+void trsm_upper(size_t n, size_t k, const float *U, size_t ldu, float *B,
+                size_t ldb);
+
+// U^T X = B, U upper triangular (a lower solve reading U transposed)
+void trsm_upper_trans(size_t n, size_t k, const float *U, size_t ldu,
+                      float *B, size_t ldb);
+
+// The same for double, complex float and complex double (trsm_tmpl.h)
+void trsm_lower_unit_d(size_t n, size_t k, const double *L, size_t ldl,
+                       double *B, size_t ldb);
+void trsm_upper_d(size_t n, size_t k, const double *U, size_t ldu, double *B,
+                  size_t ldb);
+void trsm_upper_trans_d(size_t n, size_t k, const double *U, size_t ldu,
+                        double *B, size_t ldb);
+
+void trsm_lower_unit_c(size_t n, size_t k, const float _Complex *L,
+                       size_t ldl, float _Complex *B, size_t ldb);
+void trsm_upper_c(size_t n, size_t k, const float _Complex *U, size_t ldu,
+                  float _Complex *B, size_t ldb);
+void trsm_upper_trans_c(size_t n, size_t k, const float _Complex *U,
+                        size_t ldu, float _Complex *B, size_t ldb);
+
+void trsm_lower_unit_z(size_t n, size_t k, const double _Complex *L,
+                       size_t ldl, double _Complex *B, size_t ldb);
+void trsm_upper_z(size_t n, size_t k, const double _Complex *U, size_t ldu,
+                  double _Complex *B, size_t ldb);
+void trsm_upper_trans_z(size_t n, size_t k, const double _Complex *U,
+                        size_t ldu, double _Complex *B, size_t ldb);
+
+#endif // !TRSM_H
@@ -0,0 +1,113 @@
+// Blocked triangular solves, included by trsm.c once per element type.
+// The includer defines T and FN(name), the name of this instance of
+// `name`; both are undefined again at the end. The updates go through the
+// GEMM of the same type, FN(gemm_strided).
+
+// Diagonal block of nb rows, on the columns [begin, end) of B. Element
+// (i, p) of the triangle is tri[i * rst + p * cst], so a transposed factor
+// only swaps the strides.
+typedef struct FN(diag_args) {
+  const T *tri; // at the block's top-left corner
+  size_t rst;
+  size_t cst;
+  T *B; // at the block's first row
+  size_t ldb;
+  size_t nb;
+  int upper;
+  int unit;
+} FN(DiagArgs);
+
+static void FN(diag_task)(void *arg, size_t begin, size_t end) {
+  FN(DiagArgs) *d = arg;
+  size_t nb = d->nb, rst = d->rst, cst = d->cst, ldb = d->ldb;
+
+  if (!d->upper) {
+    for (size_t i = 0; i < nb; i++) {
+      T *b_i = &d->B[i * ldb];
+      for (size_t p = 0; p < i; p++) {
+        T l = d->tri[i * rst + p * cst];
+        const T *b_p = &d->B[p * ldb];
+        for (size_t c = begin; c < end; c++) {
+          b_i[c] -= l * b_p[c];
+        }
+      }
+      if (!d->unit) {
+        T inv_diag = 1 / d->tri[i * (rst + cst)];
+        for (size_t c = begin; c < end; c++) {
+          b_i[c] *= inv_diag;
+        }
+      }
+    }
+    return;
+  }
+
+  for (size_t i = nb; i-- > 0;) {
+    T *b_i = &d->B[i * ldb];
+    for (size_t p = i + 1; p < nb; p++) {
+      T u = d->tri[i * rst + p * cst];
+      const T *b_p = &d->B[p * ldb];
+      for (size_t c = begin; c < end; c++) {
+        b_i[c] -= u * b_p[c];
+      }
+    }
+    T inv_diag = 1 / d->tri[i * (rst + cst)];
+    for (size_t c = begin; c < end; c++) {
+      b_i[c] *= inv_diag;
+    }
+  }
+}
+
+static void FN(solve_diag)(FN(DiagArgs) *d, size_t k) {
+  parallel_for(k, TRSM_COLS, FN(diag_task), d);
+}
+
+// Lower triangular tri, top block first
+static void FN(trsm_lower)(size_t n, size_t k, const T *tri, size_t rst,
+                           size_t cst, int unit, T *B, size_t ldb) {
+  for (size_t i0 = 0; i0 < n; i0 += TRSM_BLOCK) {
+    size_t nb = min_size(TRSM_BLOCK, n - i0);
+    FN(DiagArgs) d = {&tri[i0 * (rst + cst)], rst, cst, &B[i0 * ldb], ldb, nb,
+                      0, unit};
+    FN(solve_diag)(&d, k);
+
+    // B[i1:] -= tri[i1:, i0:i1] * X[i0:i1]
+    size_t i1 = i0 + nb;
+    if (i1 < n) {
+      FN(gemm_strided)(n - i1, k, nb, -1, &tri[i1 * rst + i0 * cst], rst,
+                       cst, &B[i0 * ldb], ldb, 1, 1, &B[i1 * ldb], ldb, 1);
+    }
+  }
+}
+
+void FN(trsm_lower_unit)(size_t n, size_t k, const T *L, size_t ldl, T *B,
+                         size_t ldb) {
+  FN(trsm_lower)(n, k, L, ldl, 1, 1, B, ldb);
+}
+
+void FN(trsm_upper_trans)(size_t n, size_t k, const T *U, size_t ldu, T *B,
+                          size_t ldb) {
+  FN(trsm_lower)(n, k, U, 1, ldu, 0, B, ldb);
+}
+
+void FN(trsm_upper)(size_t n, size_t k, const T *U, size_t ldu, T *B,
+                    size_t ldb) {
+  // Bottom block first; blocks are aligned on the bottom row so that
+  // the partial block, if any, is the top one
+  for (size_t i1 = n; i1 > 0;) {
+    size_t nb = min_size(TRSM_BLOCK, i1);
+    size_t i0 = i1 - nb;
+    FN(DiagArgs) d = {&U[i0 * ldu + i0], ldu, 1, &B[i0 * ldb], ldb, nb, 1,
+                      0};
+    FN(solve_diag)(&d, k);
+
+    // B[:i0] -= U[:i0, i0:i1] * X[i0:i1]
+    if (i0 > 0) {
+      FN(gemm_strided)(i0, k, nb, -1, &U[i0], ldu, 1, &B[i0 * ldb], ldb, 1, 1,
+                       B, ldb, 1);
+    }
+    i1 = i0;
+  }
+}
+
+#undef T
+#undef FN
@@ -0,0 +1,399 @@
+// Block sizes and cutoffs of the blocked kernels, the autotuner that picks
+// them for the host, and the profile file that keeps its results. The
+// kernels read the active tuning once per call.
+#include "matrix.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "view.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const MatrixTuning default_tuning = {
+    .gemm_mc = 120,  // mc x kc floats ~ 120KB in L2
+    .gemm_kc = 256,  // kc x nr sliver of B stays in L1
+    .gemm_nc = 4096, // kc x nc panel of B ~ 4MB in L3
+    .gemm_tiles_per_thread = 2,
+    .gemm_parallel_min = 0,
+    .lu_block = 64,
+    .trans_tile = 32,
+    .strassen_cutoff = 0,
+};
+
+static MatrixTuning tuning = default_tuning;
+
+// Keys of the profile file, in the order they are written
+#define TUNING_FIELDS(X)                                                       \
+  X(gemm_mc)                                                                   \
+  X(gemm_kc)                                                                   \
+  X(gemm_nc)                                                                   \
+  X(gemm_tiles_per_thread)                                                     \
+  X(gemm_parallel_min)                                                         \
+  X(lu_block)                                                                  \
+  X(trans_tile)                                                                \
+  X(strassen_cutoff)
+
+MatrixTuning matrix_default_tuning(void) { return default_tuning; }
+
+MatrixTuning matrix_get_tuning(void) { return tuning; }
+
+int matrix_set_tuning(const MatrixTuning *new_tuning) {
+  if (new_tuning->gemm_mc == 0 || new_tuning->gemm_kc == 0 ||
+      new_tuning->gemm_nc == 0 || new_tuning->gemm_tiles_per_thread == 0 ||
+      new_tuning->lu_block == 0 || new_tuning->trans_tile == 0) {
+    fprintf(stderr, "Error %s: block sizes must be non-zero\n", __func__);
+    return -1;
+  }
+  tuning = *new_tuning;
+  return 0;
+}
+
+// Cache topology
+
+// "48K", "2048K", "32M" as in sysfs, 0 if unreadable
+static size_t read_size(const char *dir, const char *name) {
+  char path[256], text[32];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  size_t size = 0;
+  if (fgets(text, sizeof(text), f) != NULL) {
+    char *unit;
+    size = strtoul(text, &unit, 10);
+    if (*unit == 'K')
+      size <<= 10;
+    else if (*unit == 'M')
+      size <<= 20;
+    else if (*unit == 'G')
+      size <<= 30;
+  }
+  fclose(f);
+  return size;
+}
+
+static int read_text(const char *dir, const char *name, char *text,
+                     size_t len) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+  int ok = fgets(text, (int)len, f) != NULL;
+  fclose(f);
+  return ok ? 0 : -1;
+}
+
+MatrixCacheInfo matrix_cache_info(void) {
+  MatrixCacheInfo info = {0, 0, 0, 0};
+
+  // The caches cpu0 sees; on hybrid parts the other cores may differ
+  for (int i = 0;; i++) {
+    char dir[128], type[32];
+    snprintf(dir, sizeof(dir), "/sys/devices/system/cpu/cpu0/cache/index%d",
+             i);
+    if (read_text(dir, "type", type, sizeof(type)) != 0)
+      break;
+    if (strncmp(type, "Instruction", 11) == 0)
+      continue;
+    size_t level = read_size(dir, "level"), size = read_size(dir, "size");
+    if (level == 1)
+      info.l1d = size;
+    else if (level == 2)
+      info.l2 = size;
+    else if (level == 3)
+      info.l3 = size;
+    if (info.line == 0)
+      info.line = read_size(dir, "coherency_line_size");
+  }
+
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+  long size;
+  if (info.l1d == 0 && (size = sysconf(_SC_LEVEL1_DCACHE_SIZE)) > 0)
+    info.l1d = (size_t)size;
+  if (info.l2 == 0 && (size = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0)
+    info.l2 = (size_t)size;
+  if (info.l3 == 0 && (size = sysconf(_SC_LEVEL3_CACHE_SIZE)) > 0)
+    info.l3 = (size_t)size;
+  if (info.line == 0 && (size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE)) > 0)
+    info.line = (size_t)size;
+#endif
+  return info;
+}
+
+// Profile file
+
+// What the tuning depends on: the micro-kernel in use and the caches
+static void machine_key(char *key, size_t len) {
+  MatrixCacheInfo info = matrix_cache_info();
+  snprintf(key, len, "%s l1d=%zu l2=%zu l3=%zu", matrix_simd_isa(), info.l1d,
+           info.l2, info.l3);
+}
+
+int matrix_tuning_save(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Error %s: cannot write %s\n", __func__, path);
+    return -1;
+  }
+
+  char key[128];
+  machine_key(key, sizeof(key));
+  fprintf(f, "# matrix tuning profile\nmachine %s\n", key);
+#define WRITE_FIELD(name) fprintf(f, #name " %zu\n", tuning.name);
+  TUNING_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+
+  if (fclose(f) != 0) {
+    fprintf(stderr, "Error %s: cannot write %s\n", __func__, path);
+    return -1;
+  }
+  return 0;
+}
+
+int matrix_tuning_load(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Error %s: cannot read %s\n", __func__, path);
+    return -1;
+  }
+
+  char line[256], key[128];
+  machine_key(key, sizeof(key));
+  MatrixTuning loaded = tuning;
+  int machine = 0, n_fields = 0, n_expected = 0, bad = 0;
+#define COUNT_FIELD(name) n_expected++;
+  TUNING_FIELDS(COUNT_FIELD)
+#undef COUNT_FIELD
+
+  while (!bad && fgets(line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '#' || line[0] == '\0')
+      continue;
+    if (strncmp(line, "machine ", 8) == 0) {
+      if (strcmp(line + 8, key) != 0) {
+        fprintf(stderr,
+                "Error %s: %s was tuned for %s, this machine is %s\n",
+                __func__, path, line + 8, key);
+        fclose(f);
+        return -1;
+      }
+      machine = 1;
+      continue;
+    }
+
+    char name[64];
+    size_t value;
+    bad = 1;
+    if (sscanf(line, "%63s %zu", name, &value) != 2)
+      continue;
+#define READ_FIELD(field)                                                      \
+  if (strcmp(name, #field) == 0) {                                             \
+    loaded.field = value;                                                      \
+    n_fields++;                                                                \
+    bad = 0;                                                                   \
+  }
+    TUNING_FIELDS(READ_FIELD)
+#undef READ_FIELD
+  }
+  fclose(f);
+
+  if (bad || !machine || n_fields != n_expected) {
+    fprintf(stderr, "Error %s: %s is not a complete tuning profile\n",
+            __func__, path);
+    return -1;
+  }
+  return matrix_set_tuning(&loaded);
+}
+
+// Startup: the profile named by MATRIX_TUNING, if any
+__attribute__((constructor)) static void tuning_init(void) {
+  const char *env = getenv("MATRIX_TUNING");
+  if (env != NULL && *env != '\0' && matrix_tuning_load(env) != 0)
+    fprintf(stderr, "Warning: ignoring MATRIX_TUNING=%s, using the defaults\n",
+            env);
+}
+
+// Autotuner
+
+// A candidate must beat the best so far by this much to replace it, so
+// timing noise does not move settings that make no difference
+#define TUNE_MARGIN 0.97
+
+// Timed runs per candidate, after one warm-up run; the fastest counts
+#define TUNE_REPS 3
+
+typedef struct tune_work {
+  Matrix *A;
+  Matrix *B;
+  Matrix *C;
+  size_t m; // rows of A and C the product uses
+  int failed;
+} TuneWork;
+
+typedef void (*tune_fn)(TuneWork *w);
+
+// The top m rows of A times B
+static void run_gemm(TuneWork *w) {
+  Matrix A = matrix_view(w->A, 0, 0, w->m, w->B->n_rows);
+  Matrix C = matrix_view(w->C, 0, 0, w->m, w->B->n_cols);
+  if (matrix_gemm(1.0f, &A, w->B, 0.0f, &C) == NULL)
+    w->failed = 1;
+}
+
+static void run_lu(TuneWork *w) {
+  LUFactor *lu = lu_factor(w->A);
+  if (lu == NULL)
+    w->failed = 1;
+  lu_factor_free(lu);
+}
+
+static void run_trans(TuneWork *w) {
+  if (matrix_trans_into(w->C, w->A) == NULL)
+    w->failed = 1;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Seconds of the fastest of TUNE_REPS runs under the candidate tuning t
+static double time_with(const MatrixTuning *t, tune_fn fn, TuneWork *w) {
+  matrix_set_tuning(t);
+  fn(w);
+  double best = 0;
+  for (int rep = 0; rep < TUNE_REPS; rep++) {
+    double start = now();
+    fn(w);
+    double elapsed = now() - start;
+    if (rep == 0 || elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+// Tries every candidate value of one field up to limit in turn, keeping
+// the others, and leaves the fastest in *best. Larger values would act
+// like limit on the benchmark, so it could not tell them apart.
+static void tune_field(MatrixTuning *best, size_t *field,
+                       const size_t *candidates, size_t n_candidates,
+                       size_t limit, tune_fn fn, TuneWork *w) {
+  double best_time = time_with(best, fn, w);
+  size_t best_value = *field;
+  for (size_t i = 0; i < n_candidates && !w->failed; i++) {
+    if (candidates[i] == 0 || candidates[i] > limit ||
+        candidates[i] == best_value)
+      continue;
+    *field = candidates[i];
+    double t = time_with(best, fn, w);
+    if (t < TUNE_MARGIN * best_time) {
+      best_time = t;
+      best_value = candidates[i];
+    }
+  }
+  *field = best_value;
+}
+
+static size_t round_down(size_t x, size_t multiple) {
+  return x < multiple ? multiple : x / multiple * multiple;
+}
+
+int matrix_autotune(const char *path, size_t max_n, int allow_strassen) {
+  size_t n = max_n == 0 ? 1024 : max_n < 64 ? 64 : max_n;
+  MatrixTuning original = tuning, best = tuning;
+  TuneWork w = {matrix_create(n, n), matrix_create(n, n),
+                matrix_create(n, n), n, 0};
+  if (w.A == NULL || w.B == NULL || w.C == NULL) {
+    fprintf(stderr, "Error: memory allocation failed\n");
+    matrix_free(w.A);
+    matrix_free(w.B);
+    matrix_free(w.C);
+    return -1;
+  }
+  // Diagonally dominant, so the LU does not pivot on noise
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < n; j++) {
+      float x = (float)((i * 7 + j * 13) % 17) / 17.0f - 0.5f;
+      MATRIX_AT(w.A, i, j) = i == j ? x + n : x;
+      MATRIX_AT(w.B, i, j) = x;
+    }
+  }
+
+  // Cache sizes the first candidates derive from; the defaults assume
+  // these when sysfs has nothing
+  MatrixCacheInfo info = matrix_cache_info();
+  size_t l1d = info.l1d > 0 ? info.l1d : 32 << 10;
+  size_t l2 = info.l2 > 0 ? info.l2 : 1 << 20;
+  size_t l3 = info.l3 > 0 ? info.l3 : 32 << 20;
+  const SimdKernels *simd = simd_kernels();
+  size_t mr = simd->mr, nr = simd->nr, n_threads = thread_pool_size();
+
+  // GEMM blocking, one level of the hierarchy at a time: a kc x nr
+  // sliver of B in half of L1, an mc x kc block of A in a fraction of L2,
+  // a kc x nc panel of B in this thread's share of L3
+  size_t kc = round_down(l1d / 2 / (nr * sizeof(float)), 8);
+  size_t kcs[] = {kc / 2, kc, 2 * kc, 128, 256, 512};
+  tune_field(&best, &best.gemm_kc, kcs, 6, n, run_gemm, &w);
+
+  size_t mc = l2 / (best.gemm_kc * sizeof(float));
+  size_t mcs[] = {round_down(mc / 8, mr), round_down(mc / 4, mr),
+                  round_down(mc / 2, mr)};
+  tune_field(&best, &best.gemm_mc, mcs, 3, n, run_gemm, &w);
+
+  size_t nc = l3 / n_threads / (best.gemm_kc * sizeof(float));
+  size_t ncs[] = {round_down(nc / 4, nr), round_down(nc / 2, nr),
+                  round_down(nc, nr)};
+  tune_field(&best, &best.gemm_nc, ncs, 3, n, run_gemm, &w);
+
+  if (n_threads > 1) {
+    // Thread split, on a product only a few row blocks tall
+    w.m = n < 2 * best.gemm_mc ? n : 2 * best.gemm_mc;
+    size_t splits[] = {1, 2, 4, 8};
+    tune_field(&best, &best.gemm_tiles_per_thread, splits, 4, 8, run_gemm, &w);
+
+    // Threading cutoff: the smallest cube where the pool pays off
+    best.gemm_parallel_min = n * n * n;
+    for (size_t s = 32; s <= n && !w.failed; s *= 2) {
+      Matrix B = matrix_view(w.B, 0, 0, s, s);
+      TuneWork cube = {w.A, &B, w.C, s, 0};
+      MatrixTuning serial = best, parallel = best;
+      serial.gemm_parallel_min = SIZE_MAX;
+      parallel.gemm_parallel_min = 0;
+      double t_serial = time_with(&serial, run_gemm, &cube);
+      double t_parallel = time_with(&parallel, run_gemm, &cube);
+      w.failed = cube.failed;
+      if (t_parallel < TUNE_MARGIN * t_serial) {
+        best.gemm_parallel_min = s * s * s;
+        break;
+      }
+    }
+    w.m = n;
+  }
+
+  size_t blocks[] = {16, 32, 64, 128, 256};
+  tune_field(&best, &best.lu_block, blocks, 5, n / 4, run_lu, &w);
+
+  size_t tiles[] = {8, 16, 32, 64, 128};
+  tune_field(&best, &best.trans_tile, tiles, 5, n / 4, run_trans, &w);
+
+  if (allow_strassen) {
+    size_t cutoffs[] = {n / 2, n / 4 >= 256 ? n / 4 : 0};
+    tune_field(&best, &best.strassen_cutoff, cutoffs, 2, n, run_gemm, &w);
+  }
+
+  matrix_free(w.A);
+  matrix_free(w.B);
+  matrix_free(w.C);
+  if (w.failed) {
+    fprintf(stderr, "Error %s: a benchmark failed\n", __func__);
+    matrix_set_tuning(&original);
+    return -1;
+  }
+  matrix_set_tuning(&best);
+  return path != NULL ? matrix_tuning_save(path) : 0;
+}
@@ -0,0 +1,145 @@
+#include "view.h"
+#include "matrix.h"
+#include <stdio.h>
+#include <string.h>
+
+static const Matrix empty_view = {NULL, 0, 0, 0, 1, NULL};
+
+Matrix matrix_view(Matrix *mat, size_t row, size_t col, size_t n_rows,
+                   size_t n_cols) {
+  if (row > mat->n_rows || n_rows > mat->n_rows - row || col > mat->n_cols ||
+      n_cols > mat->n_cols - col) {
+    fprintf(stderr,
+            "Error matrix_view: %zu x %zu block at (%zu, %zu) is outside the "
+            "%zu x %zu matrix\n",
+            n_rows, n_cols, row, col, mat->n_rows, mat->n_cols);
+    return empty_view;
+  }
+
+  Matrix view = *mat;
+  if (n_rows > 0 && n_cols > 0)
+    view.array = &MATRIX_AT(mat, row, col);
+  view.n_rows = n_rows;
+  view.n_cols = n_cols;
+  view.allocator = NULL;
+  return view;
+}
+
+Matrix matrix_row(Matrix *mat, size_t row) {
+  if (row >= mat->n_rows) {
+    fprintf(stderr, "Error matrix_row: row %zu >= n_rows (%zu)\n", row,
+            mat->n_rows);
+    return empty_view;
+  }
+  return matrix_view(mat, row, 0, 1, mat->n_cols);
+}
+
+Matrix matrix_col(Matrix *mat, size_t col) {
+  if (col >= mat->n_cols) {
+    fprintf(stderr, "Error matrix_col: col %zu >= n_cols (%zu)\n", col,
+            mat->n_cols);
+    return empty_view;
+  }
+  return matrix_view(mat, 0, col, mat->n_rows, 1);
+}
+
+Matrix matrix_trans_view(Matrix *mat) {
+  Matrix view = *mat;
+  view.n_rows = mat->n_cols;
+  view.n_cols = mat->n_rows;
+  view.row_stride = mat->col_stride;
+  view.col_stride = mat->row_stride;
+  view.allocator = NULL;
+  return view;
+}
+
+Matrix matrix_view_array(float *array, size_t n_rows, size_t n_cols,
+                         size_t row_stride) {
+  if (row_stride < n_cols && n_rows > 1) {
+    fprintf(stderr, "Error matrix_view_array: row_stride %zu < n_cols %zu\n",
+            row_stride, n_cols);
+    return empty_view;
+  }
+  Matrix view = {array, n_rows, n_cols, row_stride, 1, NULL};
+  return view;
+}
+
+int matrix_is_dense(const Matrix *mat) {
+  return (mat->n_cols <= 1 || mat->col_stride == 1) &&
+         (mat->n_rows <= 1 || mat->row_stride == mat->n_cols);
+}
+
+void matrix_pack(float *dst, const Matrix *mat) {
+  Matrix packed = {dst, mat->n_rows, mat->n_cols, mat->n_cols, 1, NULL};
+  matrix_copy(&packed, mat);
+}
+
+void matrix_unpack(Matrix *mat, const float *src) {
+  Matrix packed = {(float *)src, mat->n_rows, mat->n_cols, mat->n_cols, 1,
+                   NULL};
+  matrix_copy(mat, &packed);
+}
+
+void matrix_copy(Matrix *dst, const Matrix *src) {
+  size_t n_rows = src->n_rows, n_cols = src->n_cols;
+  if (n_rows == 0 || n_cols == 0 ||
+      (dst->array == src->array && dst->row_stride == src->row_stride &&
+       dst->col_stride == src->col_stride))
+    return;
+
+  if (matrix_is_dense(dst) && matrix_is_dense(src)) {
+    memcpy(dst->array, src->array, n_rows * n_cols * sizeof(float));
+  } else if (dst->col_stride == 1 && src->col_stride == 1) {
+    for (size_t i = 0; i < n_rows; i++) {
+      memcpy(&MATRIX_AT(dst, i, 0), &MATRIX_AT(src, i, 0),
+             n_cols * sizeof(float));
+    }
+  } else {
+    for (size_t i = 0; i < n_rows; i++) {
+      for (size_t j = 0; j < n_cols; j++) {
+        MATRIX_AT(dst, i, j) = MATRIX_AT(src, i, j);
+      }
+    }
+  }
+}
+
+// Offset of the last element, the storage spans [array, array + extent]
+static size_t extent(const StridedBlock *mat) {
+  return (mat->n_rows - 1) * mat->row_stride +
+         (mat->n_cols - 1) * mat->col_stride;
+}
+
+// Whether rows [r0, r0 + h) x cols [c0, c0 + w) meet [0, n_rows) x [0, n_cols)
+static int block_meets(const StridedBlock *mat, size_t r0, size_t h,
+                       size_t c0, size_t w) {
+  return h > 0 && w > 0 && r0 < mat->n_rows && c0 < mat->n_cols;
+}
+
+int strided_overlaps(StridedBlock a, StridedBlock b, size_t elem_size) {
+  if (a.n_rows == 0 || a.n_cols == 0 || b.n_rows == 0 || b.n_cols == 0)
+    return 0;
+  if ((const char *)a.array > (const char *)b.array) {
+    StridedBlock tmp = a;
+    a = b;
+    b = tmp;
+  }
+  size_t d = ((const char *)b.array - (const char *)a.array) / elem_size;
+  if (d > extent(&a))
+    return 0;
+
+  size_t rs = a.row_stride;
+  if (a.col_stride != 1 || b.col_stride != 1 || b.row_stride != rs ||
+      a.n_cols > rs || b.n_cols > rs)
+    return 1;
+
+  // In the frame of a, b starts at row d / rs, column d % rs; its rows may
+  // wrap past rs into the next row
+  size_t r0 = d / rs, c0 = d % rs;
+  size_t w = c0 + b.n_cols <= rs ? b.n_cols : rs - c0;
+  return block_meets(&a, r0, b.n_rows, c0, w) ||
+         block_meets(&a, r0 + 1, b.n_rows, 0, b.n_cols - w);
+}
+
+int matrix_overlaps(const Matrix *a, const Matrix *b) {
+  return strided_overlaps(STRIDED_BLOCK(a), STRIDED_BLOCK(b), sizeof(float));
+}
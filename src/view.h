@@ -0,0 +1,42 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "matrix.h"
+
+// Element (i, j) of a matrix or view
+#define MATRIX_AT(mat, i, j)                                                   \
+  ((mat)->array[(i) * (mat)->row_stride + (j) * (mat)->col_stride])
+
+// Rows are contiguous and back to back, the layout of matrix_create
+int matrix_is_dense(const Matrix *mat);
+
+// Copy mat into / out of a dense row-major buffer of its shape
+void matrix_pack(float *dst, const Matrix *mat);
+
+void matrix_unpack(Matrix *mat, const float *src);
+
+// Copy between two matrices of the same shape, any strides
+void matrix_copy(Matrix *dst, const Matrix *src);
+
+// Whether a and b may share an element. Exact for unit-column-stride
+// views with the same row stride (blocks of one matrix), conservative
+// otherwise.
+int matrix_overlaps(const Matrix *a, const Matrix *b);
+
+// The layout of a matrix of any element type, strides in elements
+typedef struct strided_block {
+  const void *array;
+  size_t n_rows;
+  size_t n_cols;
+  size_t row_stride;
+  size_t col_stride;
+} StridedBlock;
+
+#define STRIDED_BLOCK(mat)                                                     \
+  ((StridedBlock){(mat)->array, (mat)->n_rows, (mat)->n_cols,                 \
+                  (mat)->row_stride, (mat)->col_stride})
+
+// matrix_overlaps for any element type
+int strided_overlaps(StridedBlock a, StridedBlock b, size_t elem_size);
+
+#endif // !VIEW_H
@@ -1,6 +1,11 @@
 #include "matrix.h"
+#include <complex.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 // Define a small tolerance for floating-point comparisons
 #define TOLERANCE 1e-6
@@ -182,6 +187,501 @@ void test_matrix_mult() {
   matrix_free(mat2);
 }
 
+// Reference product computed with the textbook triple loop
+static Matrix *naive_gemm(float alpha, Matrix *A, Matrix *B, float beta,
+                          Matrix *C) {
+  Matrix *res = matrix_create(C->n_rows, C->n_cols);
+  for (size_t i = 0; i < A->n_rows; i++) {
+    for (size_t j = 0; j < B->n_cols; j++) {
+      double val = 0.0;
+      for (size_t k = 0; k < A->n_cols; k++) {
+        val += (double)matrix_get(A, i, k) * matrix_get(B, k, j);
+      }
+      matrix_set(res, i, j, alpha * val + beta * matrix_get(C, i, j));
+    }
+  }
+  return res;
+}
+
+static void fill_pseudo_random(Matrix *mat, unsigned int seed) {
+  for (size_t i = 0; i < mat->n_rows * mat->n_cols; i++) {
+    seed = seed * 1103515245u + 12345u;
+    mat->array[i] = (float)((seed >> 16) % 2001) / 1000.0f - 1.0f;
+  }
+}
+
+void test_matrix_gemm() {
+  printf("\n=== TESTING test_matrix_gemm ===\n");
+  // Odd sizes exercise the partial register tiles and several k blocks
+  size_t shapes[][3] = {{2, 3, 4}, {67, 53, 71}, {130, 301, 259}};
+  int success = 1;
+
+  for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+    size_t m = shapes[s][0], k = shapes[s][1], n = shapes[s][2];
+    Matrix *A = matrix_create(m, k);
+    Matrix *B = matrix_create(k, n);
+    Matrix *C = matrix_create(m, n);
+    fill_pseudo_random(A, 1);
+    fill_pseudo_random(B, 2);
+    fill_pseudo_random(C, 3);
+
+    Matrix *expected = naive_gemm(1.5f, A, B, -0.5f, C);
+    matrix_gemm(1.5f, A, B, -0.5f, C);
+
+    if (!matrices_are_approx_equal(C, expected, 1e-3)) {
+      printf("Test failed for %zu x %zu x %zu\n", m, k, n);
+      success = 0;
+    }
+
+    matrix_free(A);
+    matrix_free(B);
+    matrix_free(C);
+    matrix_free(expected);
+  }
+
+  if (success) {
+    printf("Test passed: matrix_gemm matches the reference product.\n");
+  }
+}
+
+void test_matrix_strassen() {
+  printf("\n=== TESTING test_matrix_strassen ===\n");
+  // A low cutoff recurses several levels; odd sizes are peeled at each
+  size_t shapes[][3] = {{128, 128, 128}, {67, 53, 71}, {130, 301, 259}};
+  size_t threads[] = {1, 4};
+  int success = 1;
+
+  matrix_set_strassen_cutoff(16);
+  for (size_t t = 0; t < 2; t++) {
+    matrix_set_num_threads(threads[t]);
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+      size_t m = shapes[s][0], k = shapes[s][1], n = shapes[s][2];
+      Matrix *A = matrix_create(m, k);
+      Matrix *Bt = matrix_create(n, k);
+      Matrix *C = matrix_create(m, n);
+      fill_pseudo_random(A, 1);
+      fill_pseudo_random(Bt, 2);
+      fill_pseudo_random(C, 3);
+      // B as a transposed view, so its columns are strided
+      Matrix B = matrix_trans_view(Bt);
+
+      Matrix *expected = naive_gemm(1.5f, A, &B, -0.5f, C);
+      matrix_gemm(1.5f, A, &B, -0.5f, C);
+      Matrix *product = matrix_mult(A, &B);
+      Matrix *zero = matrix_create(m, n);
+      Matrix *product_expected = naive_gemm(1.0f, A, &B, 0.0f, zero);
+      if (!matrices_are_approx_equal(C, expected, 1e-3f) ||
+          !matrices_are_approx_equal(product, product_expected, 1e-3f)) {
+        printf("Test failed for %zu x %zu x %zu on %zu threads\n", m, k, n,
+               threads[t]);
+        success = 0;
+      }
+
+      matrix_free(A);
+      matrix_free(Bt);
+      matrix_free(C);
+      matrix_free(expected);
+      matrix_free(product);
+      matrix_free(zero);
+      matrix_free(product_expected);
+    }
+  }
+  matrix_set_strassen_cutoff(0);
+  matrix_set_num_threads(0);
+
+  if (success) {
+    printf("Test passed: Strassen-Winograd matches the reference product.\n");
+  }
+}
+
+void test_simd_dispatch() {
+  printf("\n=== TESTING test_simd_dispatch ===\n");
+  printf("Selected SIMD path: %s\n", matrix_simd_isa());
+
+  // Odd sizes so every path runs its vector body and its scalar tail
+  Matrix *A = matrix_create(37, 29);
+  Matrix *B = matrix_create(37, 29);
+  Matrix *C = matrix_create(29, 41);
+  fill_pseudo_random(A, 4);
+  fill_pseudo_random(B, 5);
+  fill_pseudo_random(C, 6);
+
+  matrix_simd_select("scalar");
+  Matrix *sum_ref = matrix_add(A, B);
+  Matrix *diff_ref = matrix_subtract(A, B);
+  Matrix *scaled_ref = matrix_scale(-2.5f, A);
+  Matrix *prod_ref = matrix_mult(A, C);
+
+  const char *isas[] = {"sse2", "avx2", "avx512"};
+  int success = 1;
+  for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+    if (matrix_simd_select(isas[i]) != 0) {
+      printf("Skipping %s: not supported on this CPU\n", isas[i]);
+      continue;
+    }
+    Matrix *sum = matrix_add(A, B);
+    Matrix *diff = matrix_subtract(A, B);
+    Matrix *scaled = matrix_scale(-2.5f, A);
+    Matrix *prod = matrix_mult(A, C);
+
+    if (!matrices_are_approx_equal(sum, sum_ref, 0.0f) ||
+        !matrices_are_approx_equal(diff, diff_ref, 0.0f) ||
+        !matrices_are_approx_equal(scaled, scaled_ref, 0.0f) ||
+        !matrices_are_approx_equal(prod, prod_ref, 1e-4)) {
+      printf("Test failed: %s results differ from scalar\n", isas[i]);
+      success = 0;
+    }
+    // Last element differs: the tail of the comparison must catch it
+    sum->array[37 * 29 - 1] += 1.0f;
+    if (matrices_are_approx_equal(sum, sum_ref, 0.5f)) {
+      printf("Test failed: %s comparison missed a difference\n", isas[i]);
+      success = 0;
+    }
+
+    matrix_free(sum);
+    matrix_free(diff);
+    matrix_free(scaled);
+    matrix_free(prod);
+  }
+  matrix_simd_select(NULL);
+
+  if (success) {
+    printf("Test passed: all SIMD paths agree with the scalar path.\n");
+  }
+
+  matrix_free(A);
+  matrix_free(B);
+  matrix_free(C);
+  matrix_free(sum_ref);
+  matrix_free(diff_ref);
+  matrix_free(scaled_ref);
+  matrix_free(prod_ref);
+}
+
+void test_thread_pool() {
+  printf("\n=== TESTING test_thread_pool ===\n");
+  // Large enough that every parallel routine splits into several tiles
+  size_t n = 400;
+  Matrix *A = matrix_create(n, n);
+  Matrix *B = matrix_create(n, n);
+  fill_pseudo_random(A, 7);
+  fill_pseudo_random(B, 8);
+  // Diagonally dominant with a unit diagonal: safe to invert without
+  // pivoting and with a determinant that stays in float range
+  for (size_t i = 0; i < n * n; i++) {
+    A->array[i] /= n;
+  }
+  for (size_t i = 0; i < n; i++) {
+    A->array[i * n + i] = 1.0f;
+  }
+
+  matrix_set_num_threads(1);
+  Matrix *sum_ref = matrix_add(A, B);
+  Matrix *prod_ref = matrix_mult(A, B);
+  Matrix *trans_ref = matrix_trans(B);
+  Matrix *inv_ref = matrix_inverse(A);
+  float det_ref = matrix_determinant(A);
+
+  matrix_set_num_threads(4);
+  printf("Running with %zu threads\n", matrix_get_num_threads());
+  Matrix *sum = matrix_add(A, B);
+  Matrix *prod = matrix_mult(A, B);
+  Matrix *trans = matrix_trans(B);
+  Matrix *inv = matrix_inverse(A);
+  float det = matrix_determinant(A);
+
+  if (matrix_get_num_threads() == 4 &&
+      matrices_are_approx_equal(sum, sum_ref, 0) &&
+      matrices_are_approx_equal(prod, prod_ref, 1e-3) &&
+      matrices_are_approx_equal(trans, trans_ref, 0) &&
+      matrices_are_approx_equal(inv, inv_ref, 1e-6) &&
+      compare_floats(det, det_ref, fabsf(det_ref) * 1e-5f)) {
+    printf("Test passed: threaded results match single-threaded ones.\n");
+  } else {
+    printf("Test failed: threaded results differ\n");
+  }
+
+  matrix_set_num_threads(0);
+  matrix_free(A);
+  matrix_free(B);
+  matrix_free(sum_ref);
+  matrix_free(prod_ref);
+  matrix_free(trans_ref);
+  matrix_free(inv_ref);
+  matrix_free(sum);
+  matrix_free(prod);
+  matrix_free(trans);
+  matrix_free(inv);
+}
+
+// Trace hooks of test_profile: spans must nest like the calls
+typedef struct trace_log {
+  size_t begins;
+  size_t ends;
+  size_t depth;
+  size_t max_depth;
+  const char *first;
+} TraceLog;
+
+static void trace_begin(void *ctx, const char *name) {
+  TraceLog *log = ctx;
+  if (log->begins++ == 0)
+    log->first = name;
+  if (++log->depth > log->max_depth)
+    log->max_depth = log->depth;
+}
+
+static void trace_end(void *ctx, const char *name, unsigned long long flops,
+                      unsigned long long bytes) {
+  TraceLog *log = ctx;
+  log->ends++;
+  log->depth--;
+}
+
+void test_profile() {
+  printf("\n=== TESTING test_profile ===\n");
+  int success = 1;
+  const char *path = "test_profile.json";
+  size_t n = 64;
+  Matrix *A = matrix_create(n, n);
+  Matrix *B = matrix_create(n, n);
+  Matrix *C = matrix_create(n, n);
+  fill_pseudo_random(A, 61);
+  fill_pseudo_random(B, 62);
+
+  TraceLog log = {0, 0, 0, 0, NULL};
+  MatrixTraceHooks hooks = {trace_begin, trace_end, &log};
+  matrix_profile_reset();
+  matrix_profile_set_hooks(&hooks);
+  Matrix *x = matrix_create(n, 1);
+  matrix_gemm(1.0f, A, B, 0.0f, C);
+  Matrix *sol = solve_lin_system(A, B);
+  matrix_free(matrix_create(n, 2 * n));
+  matrix_profile_set_hooks(NULL);
+  matrix_gemm(1.0f, A, B, 0.0f, C);
+  matrix_determinant(A);
+
+  // Work only known once the call runs: CG's iterations, an expression's
+  // nodes
+  Matrix *I_n = matrix_identity(n);
+  SparseMatrix *I_sparse = sparse_from_dense(SPARSE_CSR, I_n, 0);
+  Matrix b = matrix_col(A, 0);
+  for (size_t i = 0; i < n; i++) {
+    matrix_set(x, i, 0, 0);
+  }
+  krylov_cg(sparse_operator(I_sparse), &b, x, NULL, NULL);
+  MatrixExpr *sum = expr_add(expr_matrix(A), expr_matrix(B));
+  expr_eval_into(C, sum);
+  expr_free(sum);
+
+  MatrixProfileEntry gemm, solve, factor, unknown, cg, eval;
+  MatrixProfileMemory memory = matrix_profile_memory();
+  if (matrix_profile_find("matrix_gemm", &gemm) != 0 ||
+      matrix_profile_find("solve_lin_system", &solve) != 0 ||
+      matrix_profile_find("lu_factor", &factor) != 0 ||
+      matrix_profile_find("no_such_function", &unknown) != -1 ||
+      matrix_profile_count() == 0 ||
+      strcmp(matrix_profile_entry(0).name, "matrix_scale") != 0) {
+    printf("Test failed: profile entries are missing\n");
+    success = 0;
+  } else if (matrix_profile_enabled()) {
+    // The second gemm is counted but not traced, the dense solve counts
+    // its factorization as a nested call and the determinant eliminates
+    // in scratch
+    if (gemm.calls != 2 || gemm.flops != 4 * n * n * n ||
+        solve.calls != 1 || factor.calls != 1 ||
+        solve.nanoseconds < factor.nanoseconds || memory.allocations < 3 ||
+        memory.bytes_allocated < 2 * n * n * sizeof(float) ||
+        memory.peak_scratch < n * n * sizeof(float) || log.begins != 4 ||
+        log.ends != 4 || log.max_depth != 2 || log.first == NULL ||
+        strcmp(log.first, "matrix_gemm") != 0) {
+      printf("Test failed: profile counters or trace spans\n");
+      success = 0;
+    }
+    // CG on I takes one iteration: 9n for the setup and the final
+    // residual, 17n for the iteration (a product, 3 dots and 3 axpbys)
+    if (matrix_profile_find("krylov_cg", &cg) != 0 ||
+        matrix_profile_find("expr_eval", &eval) != 0 || cg.flops != 26 * n ||
+        cg.bytes == 0 || eval.flops != n * n ||
+        eval.bytes != 3 * n * n * sizeof(float)) {
+      printf("Test failed: run-time work of CG or an expression\n");
+      success = 0;
+    }
+  } else if (gemm.calls != 0 || solve.calls != 0 || log.begins != 0 ||
+             memory.allocations != 0) {
+    // Compiled out: nothing is counted or traced
+    printf("Test failed: counters moved without MATRIX_PROFILE\n");
+    success = 0;
+  }
+
+  // The JSON lists the functions that ran
+  char text[4096] = {0};
+  FILE *f = matrix_profile_write_json(path) == 0 ? fopen(path, "r") : NULL;
+  if (f != NULL) {
+    size_t len = fread(text, 1, sizeof(text) - 1, f);
+    text[len] = '\0';
+    fclose(f);
+  }
+  int listed = strstr(text, "\"name\": \"matrix_gemm\"") != NULL;
+  if (f == NULL || strstr(text, "\"peak_scratch_bytes\"") == NULL ||
+      listed != matrix_profile_enabled()) {
+    printf("Test failed: profile JSON\n");
+    success = 0;
+  }
+
+  matrix_profile_reset();
+  if (matrix_profile_find("matrix_gemm", &gemm) != 0 || gemm.calls != 0 ||
+      matrix_profile_memory().peak_scratch != 0) {
+    printf("Test failed: profile reset\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: profiling counters and trace hooks (%s)\n",
+           matrix_profile_enabled() ? "enabled" : "compiled out");
+  }
+
+  remove(path);
+  matrix_free(A);
+  matrix_free(B);
+  matrix_free(C);
+  matrix_free(x);
+  matrix_free(sol);
+  matrix_free(I_n);
+  sparse_free(I_sparse);
+}
+
+static int same_tuning(MatrixTuning a, MatrixTuning b) {
+  return a.gemm_mc == b.gemm_mc && a.gemm_kc == b.gemm_kc &&
+         a.gemm_nc == b.gemm_nc &&
+         a.gemm_tiles_per_thread == b.gemm_tiles_per_thread &&
+         a.gemm_parallel_min == b.gemm_parallel_min &&
+         a.lu_block == b.lu_block && a.trans_tile == b.trans_tile &&
+         a.strassen_cutoff == b.strassen_cutoff;
+}
+
+// Product, LU solve and transpose of the same inputs under one tuning
+static int tuned_results_match(Matrix *A, Matrix *B, Matrix *product,
+                               Matrix *solution, Matrix *transpose) {
+  Matrix *C = matrix_mult(A, B);
+  Matrix *x = solve_lin_system(A, B);
+  Matrix *T = matrix_trans(A);
+  int match = C != NULL && x != NULL && T != NULL &&
+              matrices_are_approx_equal(C, product, 1e-3f) &&
+              matrices_are_approx_equal(x, solution, 1e-3f) &&
+              matrices_are_approx_equal(T, transpose, 0.0f);
+  matrix_free(C);
+  matrix_free(x);
+  matrix_free(T);
+  return match;
+}
+
+void test_tuning() {
+  printf("\n=== TESTING test_tuning ===\n");
+  int success = 1;
+  const char *path = "test_tuning.txt";
+  size_t n = 150;
+  Matrix *A = matrix_create(n, n);
+  Matrix *B = matrix_create(n, n);
+  fill_pseudo_random(A, 71);
+  fill_pseudo_random(B, 72);
+  for (size_t i = 0; i < n; i++) {
+    matrix_set(A, i, i, matrix_get(A, i, i) + 4.0f);
+  }
+  MatrixTuning defaults = matrix_default_tuning();
+  matrix_set_tuning(&defaults);
+  Matrix *product = matrix_mult(A, B);
+  Matrix *solution = solve_lin_system(A, B);
+  Matrix *transpose = matrix_trans(A);
+
+  MatrixCacheInfo info = matrix_cache_info();
+  if (info.l2 != 0 && info.l1d > info.l2) {
+    printf("Test failed: L1 of %zu bytes above L2 of %zu\n", info.l1d,
+           info.l2);
+    success = 0;
+  }
+
+  // Odd block sizes leave partial blocks and tiles everywhere, and a
+  // threading cutoff of 1 with 3 tiles per thread splits every product
+  MatrixTuning odd = {.gemm_mc = 20,
+                      .gemm_kc = 37,
+                      .gemm_nc = 72,
+                      .gemm_tiles_per_thread = 3,
+                      .gemm_parallel_min = 1,
+                      .lu_block = 7,
+                      .trans_tile = 5,
+                      .strassen_cutoff = 0};
+  MatrixTuning zero = odd;
+  zero.lu_block = 0;
+  matrix_set_num_threads(4);
+  if (matrix_set_tuning(&odd) != 0 || matrix_set_tuning(&zero) != -1 ||
+      !same_tuning(matrix_get_tuning(), odd) ||
+      !tuned_results_match(A, B, product, solution, transpose)) {
+    printf("Test failed: results under a non-default tuning\n");
+    success = 0;
+  }
+  matrix_set_strassen_cutoff(40);
+  if (matrix_get_tuning().strassen_cutoff != 40) {
+    printf("Test failed: the Strassen cutoff is not part of the tuning\n");
+    success = 0;
+  }
+  matrix_set_strassen_cutoff(0);
+  matrix_set_num_threads(0);
+
+  // The profile round-trips, and only loads on the machine it was made on
+  if (matrix_tuning_save(path) != 0 || matrix_set_tuning(&defaults) != 0 ||
+      matrix_tuning_load(path) != 0 ||
+      !same_tuning(matrix_get_tuning(), odd)) {
+    printf("Test failed: tuning profile round trip\n");
+    success = 0;
+  }
+  const char *bad_profiles[] = {
+      "machine elsewhere l1d=1 l2=2 l3=3\ngemm_mc 64\n",
+      "gemm_mc 64\n",
+      "gemm_mc sixty-four\n",
+  };
+  matrix_set_tuning(&defaults);
+  for (size_t i = 0; i < 3; i++) {
+    FILE *f = fopen(path, "w");
+    fputs(bad_profiles[i], f);
+    fclose(f);
+    if (matrix_tuning_load(path) != -1 ||
+        !same_tuning(matrix_get_tuning(), defaults)) {
+      printf("Test failed: bad profile %zu was loaded\n", i);
+      success = 0;
+    }
+  }
+
+  // A quick autotune saves what it applies, and the kernels stay correct
+  if (matrix_autotune(path, 64, 1) != 0) {
+    printf("Test failed: matrix_autotune\n");
+    success = 0;
+  } else {
+    MatrixTuning tuned = matrix_get_tuning();
+    matrix_set_tuning(&defaults);
+    if (matrix_tuning_load(path) != 0 ||
+        !same_tuning(matrix_get_tuning(), tuned) ||
+        !tuned_results_match(A, B, product, solution, transpose)) {
+      printf("Test failed: autotuned profile\n");
+      success = 0;
+    }
+  }
+  matrix_set_tuning(&defaults);
+
+  if (success) {
+    printf("Test passed: tuning, profiles and autotuning (L1 %zu, L2 %zu, "
+           "L3 %zu bytes)\n",
+           info.l1d, info.l2, info.l3);
+  }
+
+  remove(path);
+  matrix_free(A);
+  matrix_free(B);
+  matrix_free(product);
+  matrix_free(solution);
+  matrix_free(transpose);
+}
+
 void test_matrix_trans() {
   printf("\n=== TESTING test_matrix_trans ===\n");
   Matrix *mat = matrix_create(2, 3);
@@ -204,6 +704,542 @@ void test_matrix_trans() {
   matrix_free(mat_t);
 }
 
+void test_matrix_into_variants() {
+  printf("\n=== TESTING test_matrix_into_variants ===\n");
+  Matrix *A = matrix_create(5, 5);
+  Matrix *B = matrix_create(5, 5);
+  Matrix *dst = matrix_create(5, 5);
+  Matrix *wrong = matrix_create(4, 5);
+  fill_pseudo_random(A, 9);
+  fill_pseudo_random(B, 10);
+  int success = 1;
+
+  Matrix *sum = matrix_add(A, B);
+  Matrix *prod = matrix_mult(A, B);
+  Matrix *inv = matrix_inverse(A);
+
+  if (matrix_add_into(dst, A, B) != dst ||
+      !matrices_are_approx_equal(dst, sum, 0)) {
+    printf("Test failed: matrix_add_into\n");
+    success = 0;
+  }
+  if (matrix_mult_into(dst, A, B) != dst ||
+      !matrices_are_approx_equal(dst, prod, 0)) {
+    printf("Test failed: matrix_mult_into\n");
+    success = 0;
+  }
+  if (matrix_mult_into(A, A, B) != NULL ||
+      matrix_add_into(wrong, A, B) != NULL) {
+    printf("Test failed: aliasing or shape errors not reported\n");
+    success = 0;
+  }
+
+  // In place: dst = A, then dst += B, dst -= B, dst *= 2, dst *= 0.5
+  matrix_set_array(dst, A->array, 25);
+  matrix_add_inplace(dst, B);
+  if (!matrices_are_approx_equal(dst, sum, 0)) {
+    printf("Test failed: matrix_add_inplace\n");
+    success = 0;
+  }
+  matrix_subtract_inplace(dst, B);
+  matrix_scale_inplace(0.5f, matrix_scale_inplace(2.0f, dst));
+  if (!matrices_are_approx_equal(dst, A, 1e-6)) {
+    printf("Test failed: matrix_subtract_inplace/matrix_scale_inplace\n");
+    success = 0;
+  }
+
+  // Inverse over its own input
+  if (matrix_inverse_into(dst, dst) != dst ||
+      !matrices_are_approx_equal(dst, inv, 1e-4)) {
+    printf("Test failed: matrix_inverse_into with dst == mat\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: _into and _inplace variants match.\n");
+  }
+
+  matrix_free(A);
+  matrix_free(B);
+  matrix_free(dst);
+  matrix_free(wrong);
+  matrix_free(sum);
+  matrix_free(prod);
+  matrix_free(inv);
+}
+
+void test_matrix_trans_inplace() {
+  printf("\n=== TESTING test_matrix_trans_inplace ===\n");
+  // Square over several tiles, and rectangular shapes for cycle following
+  size_t shapes[][2] = {{70, 70}, {2, 3}, {37, 53}, {1, 9}, {64, 16}};
+  int success = 1;
+
+  for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+    Matrix *mat = matrix_create(shapes[s][0], shapes[s][1]);
+    fill_pseudo_random(mat, 11);
+    Matrix *expected = matrix_trans(mat);
+
+    matrix_trans_inplace(mat);
+    if (!matrices_are_approx_equal(mat, expected, 0)) {
+      printf("Test failed for %zu x %zu\n", shapes[s][0], shapes[s][1]);
+      success = 0;
+    }
+
+    matrix_free(mat);
+    matrix_free(expected);
+  }
+
+  if (success) {
+    printf("Test passed: in-place transposes are correct.\n");
+  }
+}
+
+void test_matrix_allocators() {
+  printf("\n=== TESTING test_matrix_allocators ===\n");
+  int success = 1;
+
+  // Default allocator: one aligned block
+  Matrix *heap = matrix_create(7, 3);
+  if ((uintptr_t)heap->array % MATRIX_ALIGNMENT != 0) {
+    printf("Test failed: heap matrix data is not aligned\n");
+    success = 0;
+  }
+
+  // Arena: a reset hands the same memory out again. The small first chunk
+  // forces the arena to chain more.
+  MatrixArena *arena = matrix_arena_create(1024);
+  const MatrixAllocator *arena_alloc = matrix_arena_allocator(arena);
+  Matrix *kept = matrix_create_with(arena_alloc, 3, 3);
+  size_t mark = matrix_arena_mark(arena);
+  Matrix *first = matrix_create_with(arena_alloc, 5, 5);
+  for (size_t i = 0; i < 20; i++) {
+    Matrix *tmp = matrix_create_with(arena_alloc, 17, 11);
+    if ((uintptr_t)tmp->array % MATRIX_ALIGNMENT != 0) {
+      printf("Test failed: arena matrix data is not aligned\n");
+      success = 0;
+    }
+    fill_pseudo_random(tmp, 12);
+  }
+  matrix_arena_reset(arena, mark);
+  Matrix *again = matrix_create_with(arena_alloc, 5, 5);
+  if (again != first || kept->n_rows != 3) {
+    printf("Test failed: arena reset did not rewind to the mark\n");
+    success = 0;
+  }
+
+  // Pool: a freed block is recycled for the next matrix of that shape
+  MatrixPool *pool = matrix_pool_create();
+  const MatrixAllocator *pool_alloc = matrix_pool_allocator(pool);
+  Matrix *pooled = matrix_create_with(pool_alloc, 9, 9);
+  matrix_free(pooled);
+  Matrix *recycled = matrix_create_with(pool_alloc, 9, 9);
+  if (recycled != pooled) {
+    printf("Test failed: pool did not recycle the freed block\n");
+    success = 0;
+  }
+
+  // Operations work on matrices from any allocator
+  fill_pseudo_random(heap, 13);
+  Matrix *heap_t = matrix_trans(heap);
+  Matrix *pooled_prod = matrix_create_with(pool_alloc, 3, 3);
+  Matrix *arena_prod = matrix_create_with(arena_alloc, 3, 3);
+  matrix_mult_into(pooled_prod, heap_t, heap);
+  matrix_mult_into(arena_prod, heap_t, heap);
+  if (!matrices_are_approx_equal(pooled_prod, arena_prod, 0)) {
+    printf("Test failed: results depend on the allocator\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: arena and pool allocators behave.\n");
+  }
+
+  matrix_free(heap);
+  matrix_free(heap_t);
+  matrix_free(recycled);
+  matrix_free(pooled_prod);
+  matrix_pool_destroy(pool);
+  matrix_arena_destroy(arena);
+}
+
+void test_matrix_views() {
+  printf("\n=== TESTING test_matrix_views ===\n");
+  int success = 1;
+
+  Matrix *big = matrix_create(70, 90);
+  fill_pseudo_random(big, 21);
+
+  // A block view reads and writes the parent in place
+  Matrix block = matrix_view(big, 3, 5, 40, 60);
+  if (matrix_get(&block, 2, 7) != matrix_get(big, 5, 12)) {
+    printf("Test failed: view does not read its parent\n");
+    success = 0;
+  }
+  matrix_set(&block, 1, 1, 42.0f);
+  Matrix row = matrix_row(&block, 1);
+  Matrix col = matrix_col(big, 6);
+  if (matrix_get(big, 4, 6) != 42.0f || matrix_get(&row, 0, 1) != 42.0f ||
+      matrix_get(&col, 4, 0) != 42.0f) {
+    printf("Test failed: view writes are not seen by the parent\n");
+    success = 0;
+  }
+  matrix_free(&block); // no-op on a view
+
+  // Element-wise ops and products on views match dense copies
+  Matrix *dense = matrix_create(40, 60);
+  for (size_t i = 0; i < 40; i++) {
+    for (size_t j = 0; j < 60; j++) {
+      matrix_set(dense, i, j, matrix_get(&block, i, j));
+    }
+  }
+  Matrix *sum_view = matrix_add(&block, &block);
+  Matrix *sum_dense = matrix_add(dense, dense);
+  Matrix block_t = matrix_trans_view(&block);
+  Matrix *dense_t = matrix_trans(dense);
+  Matrix *scaled_view = matrix_scale(2.0f, &block_t);
+  Matrix *scaled_dense = matrix_scale(2.0f, dense_t);
+  Matrix *prod_view = matrix_mult(&block_t, &block);
+  Matrix *prod_dense = matrix_mult(dense_t, dense);
+  if (!matrices_are_approx_equal(sum_view, sum_dense, 0) ||
+      !matrices_are_approx_equal(scaled_view, scaled_dense, 0) ||
+      !matrices_are_approx_equal(&block_t, dense_t, 0) ||
+      !matrices_are_approx_equal(prod_view, prod_dense, 1e-4f)) {
+    printf("Test failed: operations on views differ from dense copies\n");
+    success = 0;
+  }
+
+  // Output views: a product into a disjoint block of the same matrix is
+  // allowed, into an overlapping one it is not
+  Matrix left = matrix_view(big, 0, 0, 40, 40);
+  Matrix right = matrix_view(big, 0, 45, 40, 40);
+  Matrix corner = matrix_view(big, 0, 30, 40, 40);
+  Matrix *expected = matrix_mult(&left, &left);
+  if (matrix_mult_into(&right, &left, &left) == NULL ||
+      !matrices_are_approx_equal(&right, expected, 1e-4f)) {
+    printf("Test failed: product into a disjoint view\n");
+    success = 0;
+  }
+  if (matrix_mult_into(&corner, &left, &left) != NULL) {
+    printf("Test failed: product into an overlapping view was accepted\n");
+    success = 0;
+  }
+
+  // Solvers take views and write into them
+  Matrix sys = matrix_view(big, 10, 10, 30, 30);
+  Matrix rhs = matrix_view(big, 10, 50, 30, 3);
+  Matrix *sys_dense = matrix_create(30, 30);
+  Matrix *rhs_dense = matrix_create(30, 3);
+  matrix_scale_into(sys_dense, 1.0f, &sys);
+  matrix_scale_into(rhs_dense, 1.0f, &rhs);
+  Matrix *x_view = solve_lin_system(&sys, &rhs);
+  Matrix *x_dense = solve_lin_system(sys_dense, rhs_dense);
+  Matrix *inv = matrix_create(30, 30);
+  Matrix inv_t = matrix_trans_view(inv);
+  matrix_inverse_into(&inv_t, &sys);
+  Matrix *inv_dense = matrix_inverse(sys_dense);
+  if (!matrices_are_approx_equal(x_view, x_dense, 1e-4f) ||
+      !matrices_are_approx_equal(&inv_t, inv_dense, 1e-4f) ||
+      matrix_determinant(&sys) != matrix_determinant(sys_dense)) {
+    printf("Test failed: solvers on views differ from dense copies\n");
+    success = 0;
+  }
+
+  // Square views transpose in place, rectangular ones are refused
+  Matrix square = matrix_view(big, 50, 50, 20, 20);
+  float corner_value = matrix_get(&square, 0, 19);
+  if (matrix_trans_inplace(&square) == NULL ||
+      matrix_get(&square, 19, 0) != corner_value ||
+      matrix_trans_inplace(&block) != NULL) {
+    printf("Test failed: in-place transpose of views\n");
+    success = 0;
+  }
+
+  // Out of range
+  Matrix bad = matrix_view(big, 60, 0, 20, 10);
+  if (bad.n_rows != 0 || bad.array != NULL) {
+    printf("Test failed: out-of-range view was not empty\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: views share storage and work with every op.\n");
+  }
+
+  matrix_free(big);
+  matrix_free(dense);
+  matrix_free(sum_view);
+  matrix_free(sum_dense);
+  matrix_free(dense_t);
+  matrix_free(scaled_view);
+  matrix_free(scaled_dense);
+  matrix_free(prod_view);
+  matrix_free(prod_dense);
+  matrix_free(expected);
+  matrix_free(sys_dense);
+  matrix_free(rhs_dense);
+  matrix_free(x_view);
+  matrix_free(x_dense);
+  matrix_free(inv);
+  matrix_free(inv_dense);
+}
+
+void test_element_types() {
+  printf("\n=== TESTING test_element_types ===\n");
+  int success = 1;
+  size_t n = 150;
+
+  // Double: an ill-conditioned solve keeps far more digits than float.
+  // A is Hilbert-like plus a small diagonal, b = A * ones.
+  MatrixD *A = matrixd_create(n, n);
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < n; j++) {
+      matrixd_set(A, i, j, 1.0 / (double)(i + j + 1) + (i == j ? 1e-3 : 0));
+    }
+  }
+  MatrixD *ones = matrixd_create(n, 1);
+  for (size_t i = 0; i < n; i++) {
+    matrixd_set(ones, i, 0, 1.0);
+  }
+  MatrixD *b = matrixd_mult(A, ones);
+  MatrixD *x = matrixd_solve(A, b);
+  Matrix *Af = matrixd_to_float(A);
+  Matrix *bf = matrixd_to_float(b);
+  Matrix *xf = solve_lin_system(Af, bf);
+  MatrixD *xf_d = xf != NULL ? matrix_to_double(xf) : NULL;
+  if (x == NULL || xf_d == NULL || !matrixd_approx_equal(x, ones, 1e-8) ||
+      matrixd_approx_equal(xf_d, ones, 1e-8)) {
+    printf("Test failed: double solve is not more accurate than float\n");
+    success = 0;
+  }
+
+  // Double inverse, determinant and a strided view through gemm
+  MatrixD *inv = matrixd_inverse(A);
+  MatrixD *id = matrixd_identity(n);
+  MatrixD *prod = matrixd_mult(A, inv);
+  MatrixD A_t = matrixd_trans_view(A);
+  MatrixD *At = matrixd_trans(A);
+  MatrixD *prod_t = matrixd_mult(&A_t, A);
+  MatrixD *prod_dense = matrixd_mult(At, A);
+  double diag_2[] = {2, 0, 0, 3};
+  MatrixD *D = matrixd_create(2, 2);
+  matrixd_set_array(D, diag_2, 4);
+  // In place: mat is packed before dst is written
+  MatrixD *inv_in_place = matrixd_scale(1, A);
+  if (matrixd_inverse_into(inv_in_place, inv_in_place) == NULL ||
+      inv == NULL || !matrixd_approx_equal(inv_in_place, inv, 1e-12)) {
+    printf("Test failed: double inverse_into with dst == mat\n");
+    success = 0;
+  }
+  if (inv == NULL || !matrixd_approx_equal(prod, id, 1e-6) ||
+      !matrixd_approx_equal(prod_t, prod_dense, 1e-12) ||
+      fabs(matrixd_determinant(D) - 6.0) > 1e-12) {
+    printf("Test failed: double inverse, transposed view or determinant\n");
+    success = 0;
+  }
+
+  // Complex float: gemm with a complex alpha and beta against a naive loop
+  size_t m = 37, k = 53, p = 29;
+  MatrixC *Ac = matrixc_create(m, k);
+  MatrixC *Bc = matrixc_create(k, p);
+  MatrixC *Cc = matrixc_create(m, p);
+  MatrixC *expected = matrixc_create(m, p);
+  unsigned int seed = 5;
+  for (size_t i = 0; i < m * k; i++) {
+    seed = seed * 1103515245u + 12345u;
+    float re = (float)(seed >> 16 & 0x7fff) / 32768.0f - 0.5f;
+    seed = seed * 1103515245u + 12345u;
+    Ac->array[i] = re + (float)(seed >> 16 & 0x7fff) / 32768.0f * I;
+  }
+  for (size_t i = 0; i < k * p; i++) {
+    seed = seed * 1103515245u + 12345u;
+    float re = (float)(seed >> 16 & 0x7fff) / 32768.0f - 0.5f;
+    seed = seed * 1103515245u + 12345u;
+    Bc->array[i] = re - (float)(seed >> 16 & 0x7fff) / 32768.0f * I;
+  }
+  float _Complex alpha = 0.5f - 1.5f * I, beta = 2.0f + 0.25f * I;
+  for (size_t i = 0; i < m * p; i++) {
+    Cc->array[i] = (float)(i % 7) - (float)(i % 3) * I;
+  }
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < p; j++) {
+      double _Complex sum = 0;
+      for (size_t l = 0; l < k; l++) {
+        sum += (double _Complex)matrixc_get(Ac, i, l) * matrixc_get(Bc, l, j);
+      }
+      matrixc_set(expected, i, j,
+                  (float _Complex)(alpha * sum + beta * matrixc_get(Cc, i, j)));
+    }
+  }
+  if (matrixc_gemm(alpha, Ac, Bc, beta, Cc) == NULL ||
+      !matrixc_approx_equal(Cc, expected, 1e-3f)) {
+    printf("Test failed: complex float gemm\n");
+    success = 0;
+  }
+
+  // Complex double: solve, determinant and element-wise ops
+  double _Complex rot[] = {1 + 1 * I, 2, 0, 3 - 2 * I};
+  MatrixZ *Z = matrixz_create(2, 2);
+  matrixz_set_array(Z, rot, 4);
+  double _Complex rhs[] = {3 + 1 * I, 3 - 2 * I};
+  MatrixZ *bz = matrixz_create(2, 1);
+  matrixz_set_array(bz, rhs, 2);
+  MatrixZ *xz = matrixz_solve(Z, bz);
+  MatrixZ *twice = matrixz_add(Z, Z);
+  MatrixZ *rotated = matrixz_scale(2 * I, Z);
+  if (xz == NULL || cabs(matrixz_get(xz, 0, 0) - 1) > 1e-12 ||
+      cabs(matrixz_get(xz, 1, 0) - 1) > 1e-12 ||
+      cabs(matrixz_determinant(Z) - (1 + 1 * I) * (3 - 2 * I)) > 1e-12 ||
+      matrixz_get(twice, 1, 1) != 6 - 4 * I ||
+      matrixz_get(rotated, 0, 0) != -2 + 2 * I) {
+    printf("Test failed: complex double solve, determinant or scale\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: double and complex matrices.\n");
+  }
+
+  matrixd_free(A);
+  matrixd_free(ones);
+  matrixd_free(b);
+  matrixd_free(x);
+  matrix_free(Af);
+  matrix_free(bf);
+  matrix_free(xf);
+  matrixd_free(xf_d);
+  matrixd_free(inv);
+  matrixd_free(id);
+  matrixd_free(prod);
+  matrixd_free(At);
+  matrixd_free(prod_t);
+  matrixd_free(prod_dense);
+  matrixd_free(D);
+  matrixd_free(inv_in_place);
+  matrixc_free(Ac);
+  matrixc_free(Bc);
+  matrixc_free(Cc);
+  matrixc_free(expected);
+  matrixz_free(Z);
+  matrixz_free(bz);
+  matrixz_free(xz);
+  matrixz_free(twice);
+  matrixz_free(rotated);
+}
+
+// One checker per element type: the structured and least-squares
+// branches of solve, and the structured determinant. J is the imaginary
+// unit, 0 for a real type.
+#define TYPED_SOLVE_CHECK(T, P, E, J, TOL)                                     \
+  static int check_solve_##P(void) {                                          \
+    int ok = 1;                                                                \
+    size_t n = 64, m = 20, k = 3;                                              \
+    T *x_true = P##_create(n, k), *x_tall = P##_create(m, k);                 \
+    for (size_t i = 0; i < n; i++) {                                           \
+      for (size_t j = 0; j < k; j++) {                                         \
+        P##_set(x_true, i, j, (E)(cos(i + 2.0 * j) + J * sin(3.0 * i + j)));  \
+        if (i < m)                                                             \
+          P##_set(x_tall, i, j, (E)(sin(i + 1.0 * j) + J * cos(2.0 * i)));    \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    /* tridiagonal with a small diagonal: the band LU has to pivot */          \
+    E sub = (E)(1 + 0.5 * J), sup = (E)(-1 + 0.25 * J);                        \
+    T *band = P##_create(n, n), *lower = P##_create(n, n);                    \
+    memset(band->array, 0, n * n * sizeof(E));                                 \
+    memset(lower->array, 0, n * n * sizeof(E));                                \
+    for (size_t i = 0; i < n; i++) {                                           \
+      P##_set(band, i, i, (E)(0.1 * cos((double)i)));                          \
+      if (i > 0)                                                               \
+        P##_set(band, i, i - 1, sub);                                          \
+      if (i + 1 < n)                                                           \
+        P##_set(band, i, i + 1, sup);                                          \
+      for (size_t j = 0; j <= i; j++) {                                        \
+        P##_set(lower, i, j,                                                   \
+                (E)((i == j ? 2.0 : 0.0) + cos(1.0 * i * j) / n +             \
+                    J * sin(1.0 * i + j) / n));                                \
+      }                                                                        \
+    }                                                                          \
+    T *upper = P##_trans(lower);                                               \
+    T *square[] = {band, lower, upper};                                        \
+    for (int t = 0; t < 3; t++) {                                              \
+      T *b = P##_mult(square[t], x_true);                                      \
+      T *x = P##_solve(square[t], b);                                          \
+      ok &= x != NULL && P##_approx_equal(x, x_true, TOL);                     \
+      P##_free(b);                                                             \
+      P##_free(x);                                                             \
+    }                                                                          \
+                                                                               \
+    /* tall and consistent: least squares recovers x exactly */                \
+    T *tall = P##_create(n, m);                                                \
+    for (size_t i = 0; i < n; i++) {                                           \
+      for (size_t j = 0; j < m; j++) {                                         \
+        P##_set(tall, i, j, (E)(cos(0.3 * i * j + i) + J * sin(i + 3.0 * j))); \
+      }                                                                        \
+    }                                                                          \
+    T *b_tall = P##_mult(tall, x_tall);                                        \
+    T *x = P##_solve(tall, b_tall);                                            \
+    ok &= x != NULL && P##_approx_equal(x, x_tall, TOL);                       \
+    P##_free(x);                                                               \
+                                                                               \
+    /* the tridiagonal determinant by its three-term recurrence */             \
+    E f_prev = 1, f = P##_get(band, 0, 0);                                     \
+    for (size_t i = 1; i < n; i++) {                                           \
+      E f_next = P##_get(band, i, i) * f - sub * sup * f_prev;                 \
+      f_prev = f;                                                              \
+      f = f_next;                                                              \
+    }                                                                          \
+    E det_lower = 1;                                                           \
+    for (size_t i = 0; i < n; i++) {                                           \
+      det_lower *= P##_get(lower, i, i);                                       \
+    }                                                                          \
+    ok &= cabs(P##_determinant(band) - f) <= TOL * cabs(f);                    \
+    ok &= cabs(P##_determinant(upper) - det_lower) <= TOL * cabs(det_lower);   \
+                                                                               \
+    /* a zero on the diagonal, and more unknowns than equations */             \
+    P##_set(lower, 5, 5, 0);                                                   \
+    T *b_wide = P##_create(m, 1);                                              \
+    T *wide = P##_trans(tall);                                                 \
+    ok &= P##_solve(lower, x_true) == NULL;                                    \
+    ok &= P##_solve(wide, b_wide) == NULL;                                     \
+                                                                               \
+    P##_free(x_true);                                                          \
+    P##_free(x_tall);                                                          \
+    P##_free(band);                                                            \
+    P##_free(lower);                                                           \
+    P##_free(upper);                                                           \
+    P##_free(tall);                                                            \
+    P##_free(b_tall);                                                          \
+    P##_free(b_wide);                                                          \
+    P##_free(wide);                                                            \
+    return ok;                                                                 \
+  }
+
+TYPED_SOLVE_CHECK(MatrixD, matrixd, double, 0, 1e-9)
+TYPED_SOLVE_CHECK(MatrixC, matrixc, float _Complex, I, 1e-3)
+TYPED_SOLVE_CHECK(MatrixZ, matrixz, double _Complex, I, 1e-9)
+
+void test_typed_solve() {
+  printf("\n=== TESTING test_typed_solve ===\n");
+  int success = 1;
+  if (!check_solve_matrixd()) {
+    printf("Test failed: double structured or least-squares solve\n");
+    success = 0;
+  }
+  if (!check_solve_matrixc()) {
+    printf("Test failed: complex float structured or least-squares solve\n");
+    success = 0;
+  }
+  if (!check_solve_matrixz()) {
+    printf("Test failed: complex double structured or least-squares "
+           "solve\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: typed solve dispatch.\n");
+  }
+}
+
 void test_matrix_set_array() {
   printf("\n=== TESTING test_matrix_set_array ===\n");
   Matrix *mat = matrix_create(2, 3);
@@ -290,37 +1326,657 @@ void test_matrix_inverse() {
   matrix_free(computed_inverse);
 }
 
-// Function to test solve_lin_system for square matrix case
-void test_solve_lin_system() {
-  printf("\n=== TESTING test_solve_lin_system ===\n");
-  // Define matrix A and vector b
-  size_t n = 3;
-  Matrix *A = matrix_create(n, n);
-  Matrix *b = matrix_create(n, 1);
+void test_lu_factor() {
+  printf("\n=== TESTING test_lu_factor ===\n");
+  int success = 1;
 
-  // Example data
-  float A_data[] = {2, 1, -1, -3, -1, 2, -2, 1, 2};
-  float b_data[] = {8, -11, -3};
+  // Zero leading pivot: needs a row swap, the unpivoted loop divided by 0
+  Matrix *P = matrix_create(3, 3);
+  float P_data[] = {0, 2, 1, 1, 1, 1, 2, 1, 3};
+  matrix_set_array(P, P_data, 9);
+  LUFactor *lu = lu_factor(P);
+  if (!compare_floats(lu_det(lu), -3.0f, 1e-5)) {
+    printf("Test failed: lu_det = %f, expected -3\n", lu_det(lu));
+    success = 0;
+  }
+  lu_factor_free(lu);
 
-  matrix_set_array(A, A_data, n * n);
-  matrix_set_array(b, b_data, n);
+  // Several panels, several right-hand sides, one factorization
+  size_t n = 150, k = 7;
+  Matrix *A = matrix_create(n, n);
+  Matrix *B = matrix_create(n, k);
+  fill_pseudo_random(A, 14);
+  fill_pseudo_random(B, 15);
+  lu = lu_factor(A);
 
-  // Solve the system
-  Matrix *x = solve_lin_system(A, b);
+  Matrix *X = lu_solve(lu, B);
+  Matrix *AX = matrix_mult(A, X);
+  if (!matrices_are_approx_equal(AX, B, 1e-3)) {
+    printf("Test failed: A * lu_solve(A, B) != B\n");
+    success = 0;
+  }
 
-  // Check if the result is correct
-  if (x == NULL) {
-    fprintf(stderr, "solve_lin_system failed\n");
-    matrix_free(A);
-    matrix_free(b);
-    return;
+  Matrix *inv = lu_inverse(lu);
+  Matrix *ref = matrix_inverse(A);
+  if (!matrices_are_approx_equal(inv, ref, 1e-2)) {
+    printf("Test failed: lu_inverse differs from matrix_inverse\n");
+    success = 0;
   }
 
-  // Compute Ax
-  Matrix *Ax = matrix_mult(A, x);
+  // A singular matrix factors, but does not solve
+  Matrix *S = matrix_create(3, 3);
+  float S_data[] = {1, 2, 3, 2, 4, 6, 1, 0, 1};
+  matrix_set_array(S, S_data, 9);
+  LUFactor *lu_s = lu_factor(S);
+  Matrix *b = matrix_create(3, 1);
+  if (lu_det(lu_s) != 0.0f || lu_solve(lu_s, b) != NULL) {
+    printf("Test failed: singular matrix not detected\n");
+    success = 0;
+  }
 
-  // Check if Ax is approximately equal to b
-  if (matrices_are_approx_equal(Ax, b, TOLERANCE)) {
+  if (success) {
+    printf("Test passed: LU factorization solves, inverts and pivots.\n");
+  }
+
+  lu_factor_free(lu);
+  lu_factor_free(lu_s);
+  matrix_free(P);
+  matrix_free(A);
+  matrix_free(B);
+  matrix_free(X);
+  matrix_free(AX);
+  matrix_free(inv);
+  matrix_free(ref);
+  matrix_free(S);
+  matrix_free(b);
+}
+
+// A residual check, the structured solvers pivot differently from the
+// dense LU and random matrices are not always well conditioned
+static int solves_structured(StructuredMatrix *S, Matrix *b, float tol) {
+  Matrix *x = structured_solve(S, b);
+  Matrix *Sx = x != NULL ? structured_mult(S, x) : NULL;
+  int ok = Sx != NULL && matrices_are_approx_equal(Sx, b, tol);
+  matrix_free(x);
+  matrix_free(Sx);
+  return ok;
+}
+
+void test_structured() {
+  printf("\n=== TESTING test_structured ===\n");
+  int success = 1;
+  StructKind kinds[] = {STRUCT_SYMMETRIC, STRUCT_UPPER, STRUCT_LOWER,
+                        STRUCT_TRIDIAGONAL, STRUCT_BANDED};
+  size_t n = 37, k = 3;
+  Matrix *A = matrix_create(n, n);
+  Matrix *B = matrix_create(n, k);
+  fill_pseudo_random(A, 51);
+  fill_pseudo_random(B, 52);
+
+  // Round trips, element access and products against the dense matrix
+  // holding the same entries
+  for (size_t t = 0; t < sizeof(kinds) / sizeof(kinds[0]); t++) {
+    StructuredMatrix *S = structured_from_dense(kinds[t], A, 2, 5);
+    Matrix *D = structured_to_dense(S);
+    int ok = 1;
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        float expected = 0.0f;
+        if (kinds[t] == STRUCT_SYMMETRIC)
+          expected = i >= j ? matrix_get(A, i, j) : matrix_get(A, j, i);
+        else if (j + S->kl >= i && j <= i + S->ku)
+          expected = matrix_get(A, i, j);
+        ok = ok && matrix_get(D, i, j) == expected &&
+             structured_get(S, i, j) == expected;
+      }
+    }
+    Matrix *prod = structured_mult(S, B);
+    Matrix *expected_prod = matrix_mult(D, B);
+    if (!ok || !matrices_are_approx_equal(prod, expected_prod, 1e-4f) ||
+        structured_set(S, 0, n - 1, 1.0f) != (t < 2 ? 0 : -1)) {
+      printf("Test failed: structured kind %zu round trip or product\n", t);
+      success = 0;
+    }
+    matrix_free(D);
+    matrix_free(prod);
+    matrix_free(expected_prod);
+    structured_free(S);
+  }
+
+  // Solves on general (pivoting) matrices of each kind
+  size_t big = 300;
+  Matrix *R = matrix_create(big, big);
+  Matrix *rhs = matrix_create(big, 4);
+  fill_pseudo_random(R, 53);
+  fill_pseudo_random(rhs, 54);
+  StructuredMatrix *band = structured_from_dense(STRUCT_BANDED, R, 3, 5);
+  StructuredMatrix *tri = structured_from_dense(STRUCT_TRIDIAGONAL, R, 0, 0);
+  for (size_t i = 0; i < big; i++) {
+    // A shifted diagonal keeps the band conditioned, yet below 1 in
+    // places, where rows are still swapped
+    structured_set(band, i, i, structured_get(band, i, i) + 1.5f);
+    if (i % 7 == 0)
+      structured_set(tri, i, i, 0.0f); // only solvable with row swaps
+  }
+  if (!solves_structured(band, rhs, 1e-3f) ||
+      !solves_structured(tri, rhs, 1e-3f)) {
+    printf("Test failed: banded or tridiagonal solve\n");
+    success = 0;
+  }
+
+  // Triangular with a strong diagonal, symmetric positive definite
+  // (Cholesky) and symmetric indefinite (LU fallback)
+  StructuredMatrix *upper = structured_from_dense(STRUCT_UPPER, R, 0, 0);
+  StructuredMatrix *lower = structured_from_dense(STRUCT_LOWER, R, 0, 0);
+  StructuredMatrix *sym = structured_from_dense(STRUCT_SYMMETRIC, R, 0, 0);
+  Matrix Rt = matrix_trans_view(R);
+  Matrix *RtR = matrix_mult(&Rt, R);
+  StructuredMatrix *spd = structured_from_dense(STRUCT_SYMMETRIC, RtR, 0, 0);
+  for (size_t i = 0; i < big; i++) {
+    structured_set(upper, i, i, 20.0f);
+    structured_set(lower, i, i, -20.0f);
+    structured_set(spd, i, i, structured_get(spd, i, i) + 1.0f);
+  }
+  if (!solves_structured(upper, rhs, 1e-3f) ||
+      !solves_structured(lower, rhs, 1e-3f) ||
+      !solves_structured(spd, rhs, 1e-3f) ||
+      !solves_structured(sym, rhs, 1e-2f)) {
+    printf("Test failed: triangular or symmetric solve\n");
+    success = 0;
+  }
+
+  // Determinants against the dense LU, on a size that does not overflow
+  Matrix *small = matrix_create(12, 12);
+  fill_pseudo_random(small, 55);
+  for (size_t t = 0; t < sizeof(kinds) / sizeof(kinds[0]); t++) {
+    StructuredMatrix *S = structured_from_dense(kinds[t], small, 2, 3);
+    Matrix *D = structured_to_dense(S);
+    LUFactor *lu = lu_factor(D);
+    float det = structured_determinant(S), expected = lu_det(lu);
+    if (!compare_floats(det, expected, 1e-4f * (1.0f + fabsf(expected)))) {
+      printf("Test failed: structured kind %zu determinant %g, expected "
+             "%g\n",
+             t, det, expected);
+      success = 0;
+    }
+    lu_factor_free(lu);
+    matrix_free(D);
+    structured_free(S);
+  }
+
+  // Dispatch from the dense entry points: a banded PDE-like system (1D
+  // Laplacian plus far couplings), a tridiagonal and a triangular one
+  size_t pde = 1000;
+  Matrix *L = matrix_create(pde, pde);
+  memset(L->array, 0, pde * pde * sizeof(float));
+  for (size_t i = 0; i < pde; i++) {
+    matrix_set(L, i, i, 4.0f);
+    if (i > 0)
+      matrix_set(L, i, i - 1, -1.0f);
+    if (i + 1 < pde)
+      matrix_set(L, i, i + 1, -1.0f);
+  }
+  Matrix *b_pde = matrix_create(pde, 2);
+  fill_pseudo_random(b_pde, 56);
+  StructuredMatrix *detected_tri = structured_detect(L);
+  Matrix *x_tri = solve_lin_system(L, b_pde);
+  Matrix *check_tri = x_tri != NULL ? matrix_mult(L, x_tri) : NULL;
+  for (size_t i = 10; i < pde; i++) {
+    matrix_set(L, i, i - 10, -1.0f);
+  }
+  StructuredMatrix *detected_band = structured_detect(L);
+  Matrix *x_band = solve_lin_system(L, b_pde);
+  Matrix *check_band = x_band != NULL ? matrix_mult(L, x_band) : NULL;
+  if (detected_tri == NULL || detected_tri->kind != STRUCT_TRIDIAGONAL ||
+      detected_band == NULL || detected_band->kind != STRUCT_BANDED ||
+      detected_band->kl != 10 || detected_band->ku != 1 ||
+      check_tri == NULL ||
+      !matrices_are_approx_equal(check_tri, b_pde, 1e-4f) ||
+      check_band == NULL ||
+      !matrices_are_approx_equal(check_band, b_pde, 1e-4f)) {
+    printf("Test failed: banded dispatch from solve_lin_system\n");
+    success = 0;
+  }
+
+  Matrix *U = structured_to_dense(upper);
+  StructuredMatrix *detected_upper = structured_detect(U);
+  float det_upper = matrix_determinant(U);
+  matrix_set(U, big - 1, 0, 1.0f);
+  StructuredMatrix *detected_dense = structured_detect(U);
+  if (detected_upper == NULL || detected_upper->kind != STRUCT_UPPER ||
+      det_upper != structured_determinant(upper) || detected_dense != NULL) {
+    printf("Test failed: triangular dispatch or dense detection\n");
+    success = 0;
+  }
+
+  // Singular: an empty row
+  StructuredMatrix *singular = structured_create(STRUCT_TRIDIAGONAL, 4, 0, 0);
+  for (size_t i = 0; i < 3; i++) {
+    structured_set(singular, i, i, 1.0f);
+  }
+  Matrix *b4 = matrix_create(4, 1);
+  fill_pseudo_random(b4, 57);
+  Matrix *x_singular = structured_solve(singular, b4);
+  if (x_singular != NULL || structured_determinant(singular) != 0.0f) {
+    printf("Test failed: singular structured matrix was solved\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: structured storage, products and solvers\n");
+  }
+
+  matrix_free(A);
+  matrix_free(B);
+  matrix_free(R);
+  matrix_free(rhs);
+  matrix_free(RtR);
+  matrix_free(small);
+  matrix_free(L);
+  matrix_free(b_pde);
+  matrix_free(x_tri);
+  matrix_free(check_tri);
+  matrix_free(x_band);
+  matrix_free(check_band);
+  matrix_free(U);
+  matrix_free(b4);
+  structured_free(band);
+  structured_free(tri);
+  structured_free(upper);
+  structured_free(lower);
+  structured_free(sym);
+  structured_free(spd);
+  structured_free(detected_tri);
+  structured_free(detected_band);
+  structured_free(detected_upper);
+  structured_free(singular);
+}
+
+void test_least_squares() {
+  printf("\n=== TESTING test_least_squares ===\n");
+  // Tall enough to be split in row chunks, wide enough for two QR panels
+  size_t n = 9000, m = 45, k = 3;
+  Matrix *A = matrix_create(n, m);
+  Matrix *x_true = matrix_create(m, k);
+  Matrix *noise = matrix_create(n, k);
+  fill_pseudo_random(A, 18);
+  fill_pseudo_random(x_true, 19);
+  fill_pseudo_random(noise, 20);
+  int success = 1;
+
+  // Consistent system: both paths recover x exactly
+  Matrix *b = matrix_mult(A, x_true);
+  matrix_set_num_threads(4);
+  Matrix *x_qr = solve_least_squares(A, b);
+  Matrix *x_ne = solve_normal_equations(A, b);
+  matrix_set_num_threads(0);
+  if (x_qr == NULL || !matrices_are_approx_equal(x_qr, x_true, 1e-4) ||
+      x_ne == NULL || !matrices_are_approx_equal(x_ne, x_true, 1e-3)) {
+    printf("Test failed: least squares did not recover x\n");
+    success = 0;
+  }
+
+  // Noisy system: the residual is orthogonal to the columns of A
+  matrix_add_inplace(b, matrix_scale_inplace(0.1f, noise));
+  Matrix *x = solve_lin_system(A, b);
+  Matrix *r = matrix_subtract_inplace(matrix_mult(A, x), b);
+  Matrix *At = matrix_trans(A);
+  Matrix *Atr = matrix_mult(At, r);
+  Matrix *zero = matrix_create(m, k);
+  matrix_scale_inplace(0.0f, zero);
+  if (!matrices_are_approx_equal(Atr, zero, 1e-2)) {
+    printf("Test failed: residual not orthogonal to the columns of A\n");
+    success = 0;
+  }
+
+  // Rank deficient: a repeated column
+  for (size_t i = 0; i < n; i++) {
+    A->array[i * m + 1] = A->array[i * m];
+  }
+  Matrix *x_rd = solve_least_squares(A, b);
+  if (x_rd != NULL) {
+    printf("Test failed: rank deficiency not detected\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: QR and normal equations least squares agree.\n");
+  }
+
+  matrix_free(A);
+  matrix_free(x_true);
+  matrix_free(noise);
+  matrix_free(b);
+  matrix_free(x_qr);
+  matrix_free(x_ne);
+  matrix_free(x);
+  matrix_free(r);
+  matrix_free(At);
+  matrix_free(Atr);
+  matrix_free(zero);
+  matrix_free(x_rd);
+}
+
+// Largest |A V - V diag(values)| and |V^T V - I| over the k columns of V
+static float eigen_error(Matrix *A, EigenSym *eig) {
+  size_t k = eig->vectors->n_cols;
+  Matrix *AV = matrix_mult(A, eig->vectors);
+  Matrix *Vt = matrix_trans(eig->vectors);
+  Matrix *VtV = matrix_mult(Vt, eig->vectors);
+  float err = 0.0f;
+  for (size_t i = 0; i < AV->n_rows; i++) {
+    for (size_t j = 0; j < k; j++) {
+      float lv = eig->values->array[j] * eig->vectors->array[i * k + j];
+      err = fmaxf(err, fabsf(AV->array[i * k + j] - lv));
+    }
+  }
+  for (size_t i = 0; i < k; i++) {
+    for (size_t j = 0; j < k; j++) {
+      err = fmaxf(err, fabsf(VtV->array[i * k + j] - (i == j)));
+    }
+  }
+  matrix_free(AV);
+  matrix_free(Vt);
+  matrix_free(VtV);
+  return err;
+}
+
+void test_eigen_sym() {
+  printf("\n=== TESTING test_eigen_sym ===\n");
+  int success = 1;
+
+  // Large enough for several tridiagonalization panels and concurrent
+  // divide and conquer halves
+  size_t n = 300, k = 12;
+  Matrix *R = matrix_create(n, n);
+  fill_pseudo_random(R, 21);
+  Matrix *Rt = matrix_trans(R);
+  Matrix *A = matrix_add(R, Rt);
+  matrix_set_num_threads(4);
+  EigenSym *all = eigen_sym(A, 0, 1);
+  EigenSym *top = eigen_sym(A, k, 1);
+  EigenSym *values = eigen_sym(A, 0, 0);
+  matrix_set_num_threads(0);
+  if (all == NULL || top == NULL || values == NULL) {
+    printf("Test failed: eigen_sym returned NULL\n");
+    success = 0;
+  } else {
+    if (eigen_error(A, all) > 1e-3f || eigen_error(A, top) > 1e-3f) {
+      printf("Test failed: A V != V diag(values) or V not orthonormal\n");
+      success = 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+      float v = all->values->array[i];
+      if ((i > 0 && v > all->values->array[i - 1]) ||
+          !compare_floats(values->values->array[i], v, 1e-3) ||
+          (i < k && !compare_floats(top->values->array[i], v, 1e-3))) {
+        printf("Test failed: eigenvalue %zu = %f, inconsistent\n", i, v);
+        success = 0;
+        break;
+      }
+    }
+    if (values->vectors != NULL) {
+      printf("Test failed: vectors computed though not wanted\n");
+      success = 0;
+    }
+  }
+
+  // All 1 / n: 1 and a 0 of multiplicity n - 1, which the merges deflate
+  Matrix *ones = matrix_create(n, n);
+  for (size_t i = 0; i < n * n; i++) {
+    ones->array[i] = 1.0f / n;
+  }
+  EigenSym *flat = eigen_sym(ones, 0, 1);
+  if (flat == NULL || eigen_error(ones, flat) > 1e-3f ||
+      !compare_floats(flat->values->array[0], 1.0f, 1e-4)) {
+    printf("Test failed: repeated eigenvalues\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: eigen_sym finds all, top and value-only pairs.\n");
+  }
+
+  eigen_sym_free(all);
+  eigen_sym_free(top);
+  eigen_sym_free(values);
+  eigen_sym_free(flat);
+  matrix_free(R);
+  matrix_free(Rt);
+  matrix_free(A);
+  matrix_free(ones);
+}
+
+// Largest |U diag(S) Vt - A|, |U^T U - I| and |Vt Vt^T - I|
+static float svd_error(Matrix *A, SVDFactor *svd) {
+  size_t m = A->n_rows, n = A->n_cols, k = svd->S->n_rows;
+  Matrix *US = matrix_create(m, k);
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < k; j++) {
+      US->array[i * k + j] = svd->U->array[i * k + j] * svd->S->array[j];
+    }
+  }
+  Matrix *USVt = matrix_mult(US, svd->Vt);
+  Matrix *Ut = matrix_trans(svd->U);
+  Matrix *UtU = matrix_mult(Ut, svd->U);
+  Matrix *V = matrix_trans(svd->Vt);
+  Matrix *VtV = matrix_mult(svd->Vt, V);
+  float err = 0.0f;
+  for (size_t i = 0; i < m * n; i++) {
+    err = fmaxf(err, fabsf(USVt->array[i] - A->array[i]));
+  }
+  for (size_t i = 0; i < k; i++) {
+    for (size_t j = 0; j < k; j++) {
+      err = fmaxf(err, fabsf(UtU->array[i * k + j] - (i == j)));
+      err = fmaxf(err, fabsf(VtV->array[i * k + j] - (i == j)));
+    }
+  }
+  matrix_free(US);
+  matrix_free(USVt);
+  matrix_free(Ut);
+  matrix_free(UtU);
+  matrix_free(V);
+  matrix_free(VtV);
+  return err;
+}
+
+void test_svd_factor() {
+  printf("\n=== TESTING test_svd_factor ===\n");
+  int success = 1;
+
+  // Tall and wide, each wider than one bidiagonalization panel
+  size_t shapes[2][2] = {{90, 70}, {70, 90}}, k = 5;
+  for (size_t s = 0; s < 2; s++) {
+    Matrix *A = matrix_create(shapes[s][0], shapes[s][1]);
+    fill_pseudo_random(A, 22 + s);
+    SVDFactor *full = svd_factor(A, 0, 1);
+    SVDFactor *top = svd_factor(A, k, 1);
+    SVDFactor *values = svd_factor(A, 0, 0);
+    if (full == NULL || top == NULL || values == NULL) {
+      printf("Test failed: svd_factor returned NULL\n");
+      success = 0;
+    } else {
+      if (svd_error(A, full) > 1e-3f) {
+        printf("Test failed: %zu x %zu, A != U diag(S) Vt\n", A->n_rows,
+               A->n_cols);
+        success = 0;
+      }
+      // The top k: A V = U diag(S) on those columns
+      Matrix *V = matrix_trans(top->Vt);
+      Matrix *AV = matrix_mult(A, V);
+      for (size_t i = 0; i < A->n_rows * k; i++) {
+        float us = top->U->array[i] * top->S->array[i % k];
+        if (!compare_floats(AV->array[i], us, 1e-3)) {
+          printf("Test failed: top singular vectors\n");
+          success = 0;
+          break;
+        }
+      }
+      matrix_free(V);
+      matrix_free(AV);
+      for (size_t i = 0; i < full->S->n_rows; i++) {
+        float v = full->S->array[i];
+        if (v < 0.0f || (i > 0 && v > full->S->array[i - 1]) ||
+            !compare_floats(values->S->array[i], v, 1e-4) ||
+            (i < k && !compare_floats(top->S->array[i], v, 1e-4))) {
+          printf("Test failed: singular value %zu = %f, inconsistent\n", i,
+                 v);
+          success = 0;
+          break;
+        }
+      }
+    }
+    svd_factor_free(full);
+    svd_factor_free(top);
+    svd_factor_free(values);
+    matrix_free(A);
+  }
+
+  // Rank one: a single non-zero singular value
+  Matrix *uv = matrix_create(40, 30);
+  for (size_t i = 0; i < 40; i++) {
+    for (size_t j = 0; j < 30; j++) {
+      uv->array[i * 30 + j] = (float)(i + 1) * (float)(j % 7 + 1) / 64.0f;
+    }
+  }
+  SVDFactor *rank1 = svd_factor(uv, 0, 1);
+  if (rank1 == NULL || svd_error(uv, rank1) > 1e-3f ||
+      rank1->S->array[1] > 1e-4f * rank1->S->array[0]) {
+    printf("Test failed: rank one matrix\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: svd_factor reconstructs, orthonormal, top-k.\n");
+  }
+
+  svd_factor_free(rank1);
+  matrix_free(uv);
+}
+
+void test_randomized_svd() {
+  printf("\n=== TESTING test_randomized_svd ===\n");
+  int success = 1;
+
+  // Tall, rank 12 with decaying scales, plus a little noise
+  size_t m = 5000, n = 150, r = 12, k = 8;
+  Matrix *L = matrix_create(m, r);
+  Matrix *R = matrix_create(r, n);
+  Matrix *noise = matrix_create(m, n);
+  fill_pseudo_random(L, 24);
+  fill_pseudo_random(R, 25);
+  fill_pseudo_random(noise, 26);
+  for (size_t i = 0; i < r; i++) {
+    for (size_t j = 0; j < n; j++) {
+      R->array[i * n + j] *= powf(0.7f, (float)i);
+    }
+  }
+  Matrix *A = matrix_add_inplace(matrix_mult(L, R),
+                                 matrix_scale_inplace(1e-4f, noise));
+  SVDFactor *exact = svd_factor(A, k, 0);
+
+  // The same seed gives the same result
+  matrix_set_num_threads(4);
+  SVDFactor *rsvd = randomized_svd(A, k, 10, 2, 7);
+  SVDFactor *again = randomized_svd(A, k, 10, 2, 7);
+  matrix_set_num_threads(0);
+  SVDSketch *sk = svd_sketch_create(n, k, 10, 7);
+  for (size_t r0 = 0; r0 < m; r0 += 700) {
+    size_t rows = m - r0 < 700 ? m - r0 : 700;
+    Matrix block = matrix_view(A, r0, 0, rows, n);
+    svd_sketch_update(sk, &block);
+  }
+  SVDFactor *pass = svd_sketch_finish(sk);
+
+  if (rsvd == NULL || again == NULL || pass == NULL) {
+    printf("Test failed: randomized SVD returned NULL\n");
+    success = 0;
+  } else {
+    // The values, and A V = U diag(S) for the vectors
+    Matrix *V = matrix_trans(rsvd->Vt);
+    Matrix *AV = matrix_mult(A, V);
+    float scale = exact->S->array[0];
+    for (size_t j = 0; j < k; j++) {
+      float s = exact->S->array[j];
+      if (!compare_floats(rsvd->S->array[j], s, 1e-4f * scale) ||
+          !compare_floats(pass->S->array[j], s, 1e-3f * scale) ||
+          again->S->array[j] != rsvd->S->array[j]) {
+        printf("Test failed: singular value %zu = %f, %f, %f vs %f\n", j,
+               rsvd->S->array[j], again->S->array[j], pass->S->array[j], s);
+        success = 0;
+      }
+    }
+    for (size_t i = 0; i < m * k; i++) {
+      float us = rsvd->U->array[i] * rsvd->S->array[i % k];
+      if (!compare_floats(AV->array[i], us, 1e-3f * scale)) {
+        printf("Test failed: A V != U diag(S)\n");
+        success = 0;
+        break;
+      }
+    }
+    matrix_free(V);
+    matrix_free(AV);
+  }
+
+  // The range: orthonormal columns
+  Matrix *Q = randomized_range(A, 20, 1, 3);
+  Matrix *Qt = matrix_trans(Q);
+  Matrix *QtQ = matrix_mult(Qt, Q);
+  Matrix *eye = matrix_identity(20);
+  if (!matrices_are_approx_equal(QtQ, eye, 1e-4)) {
+    printf("Test failed: randomized_range not orthonormal\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: randomized and single-pass SVD match the top k.\n");
+  }
+
+  svd_factor_free(exact);
+  svd_factor_free(rsvd);
+  svd_factor_free(again);
+  svd_factor_free(pass);
+  matrix_free(L);
+  matrix_free(R);
+  matrix_free(noise);
+  matrix_free(A);
+  matrix_free(Q);
+  matrix_free(Qt);
+  matrix_free(QtQ);
+  matrix_free(eye);
+}
+
+// Function to test solve_lin_system for square matrix case
+void test_solve_lin_system() {
+  printf("\n=== TESTING test_solve_lin_system ===\n");
+  // Define matrix A and vector b
+  size_t n = 3;
+  Matrix *A = matrix_create(n, n);
+  Matrix *b = matrix_create(n, 1);
+
+  // Example data
+  float A_data[] = {2, 1, -1, -3, -1, 2, -2, 1, 2};
+  float b_data[] = {8, -11, -3};
+
+  matrix_set_array(A, A_data, n * n);
+  matrix_set_array(b, b_data, n);
+
+  // Solve the system
+  Matrix *x = solve_lin_system(A, b);
+
+  // Check if the result is correct
+  if (x == NULL) {
+    fprintf(stderr, "solve_lin_system failed\n");
+    matrix_free(A);
+    matrix_free(b);
+    return;
+  }
+
+  // Compute Ax
+  Matrix *Ax = matrix_mult(A, x);
+
+  // Check if Ax is approximately equal to b
+  if (matrices_are_approx_equal(Ax, b, TOLERANCE)) {
     printf("Test passed\n");
     printf("Expected b:\n");
     matrix_print(b);
@@ -339,7 +1995,970 @@ void test_solve_lin_system() {
   matrix_free(b);
   matrix_free(x);
   matrix_free(Ax);
+
+  // Many right-hand sides at once, over several TRSM blocks
+  n = 200;
+  size_t k = 300;
+  A = matrix_create(n, n);
+  b = matrix_create(n, k);
+  fill_pseudo_random(A, 16);
+  fill_pseudo_random(b, 17);
+  x = solve_lin_system(A, b);
+  Ax = x != NULL ? matrix_mult(A, x) : NULL;
+  if (Ax != NULL && matrices_are_approx_equal(Ax, b, 1e-2)) {
+    printf("Test passed: %zu right-hand sides solved at once\n", k);
+  } else {
+    printf("Test failed: multi right-hand side solve\n");
+  }
+
+  matrix_free(A);
+  matrix_free(b);
+  matrix_free(x);
+  matrix_free(Ax);
+}
+void test_solve_refined() {
+  printf("\n=== TESTING test_solve_refined ===\n");
+  int success = 1;
+  size_t n = 300, k = 3;
+
+  // Well conditioned: refinement reaches double accuracy in a few steps
+  Matrix *Af = matrix_create(n, n);
+  fill_pseudo_random(Af, 31);
+  MatrixD *A = matrix_to_double(Af);
+  for (size_t i = 0; i < n; i++) {
+    matrixd_set(A, i, i, matrixd_get(A, i, i) + 0.25 * n);
+  }
+  MatrixD *b = matrixd_create(n, k);
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < k; j++) {
+      matrixd_set(b, i, j, sin((double)(i * k + j)));
+    }
+  }
+  RefineInfo info;
+  MatrixD *x = solve_lin_system_refined(A, b, 0, &info);
+  MatrixD *x_ref = matrixd_solve(A, b);
+  if (x == NULL || info.fell_back || info.iterations == 0 ||
+      info.iterations > 5 || info.backward_error > 1e-15 ||
+      !matrixd_approx_equal(x, x_ref, 1e-12)) {
+    printf("Test failed: refined solve (iterations %zu, backward error %g, "
+           "fell back %d)\n",
+           info.iterations, info.backward_error, info.fell_back);
+    success = 0;
+  }
+
+  // Hilbert, cond ~1e16: float is hopeless, the double fallback takes over
+  size_t h = 12;
+  MatrixD *H = matrixd_create(h, h);
+  MatrixD *hb = matrixd_create(h, 1);
+  for (size_t i = 0; i < h; i++) {
+    for (size_t j = 0; j < h; j++) {
+      matrixd_set(H, i, j, 1.0 / (double)(i + j + 1));
+    }
+    matrixd_set(hb, i, 0, 1.0);
+  }
+  MatrixD *hx = solve_lin_system_refined(H, hb, 0, &info);
+  if (hx == NULL || !info.fell_back || info.backward_error > 1e-12) {
+    printf("Test failed: ill-conditioned system did not fall back\n");
+    success = 0;
+  }
+
+  // Singular
+  MatrixD *Z = matrixd_scale(0.0, H);
+  MatrixD *zx = solve_lin_system_refined(Z, hb, 0, NULL);
+  if (zx != NULL) {
+    printf("Test failed: singular system was solved\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: mixed-precision refinement.\n");
+  }
+
+  matrix_free(Af);
+  matrixd_free(A);
+  matrixd_free(b);
+  matrixd_free(x);
+  matrixd_free(x_ref);
+  matrixd_free(H);
+  matrixd_free(hb);
+  matrixd_free(hx);
+  matrixd_free(Z);
+  matrixd_free(zx);
+}
+
+// 5-point Laplacian on a height x side grid plus a skew (convection)
+// term, as triplets: diagonally dominant, symmetric positive definite
+// when skew is 0
+static SparseMatrix *grid_matrix(SparseFormat format, size_t height,
+                                 size_t side, float skew) {
+  size_t n = height * side, nnz = 0;
+  size_t *rows = malloc(5 * n * sizeof(size_t));
+  size_t *cols = malloc(5 * n * sizeof(size_t));
+  float *values = malloc(5 * n * sizeof(float));
+  for (size_t i = 0; i < height; i++) {
+    for (size_t j = 0; j < side; j++) {
+      size_t v = i * side + j;
+      rows[nnz] = v, cols[nnz] = v, values[nnz++] = 4.5f;
+      if (j > 0)
+        rows[nnz] = v, cols[nnz] = v - 1, values[nnz++] = -1 - skew;
+      if (j + 1 < side)
+        rows[nnz] = v, cols[nnz] = v + 1, values[nnz++] = -1 + skew;
+      if (i > 0)
+        rows[nnz] = v, cols[nnz] = v - side, values[nnz++] = -1.0f;
+      if (i + 1 < height)
+        rows[nnz] = v, cols[nnz] = v + side, values[nnz++] = -1.0f;
+    }
+  }
+  SparseMatrix *sp =
+      sparse_from_triplets(format, n, n, nnz, rows, cols, values);
+  free(rows);
+  free(cols);
+  free(values);
+  return sp;
+}
+
+void test_sparse() {
+  printf("\n=== TESTING test_sparse ===\n");
+  int success = 1;
+
+  // Triplets in any order, duplicates summed, both formats
+  size_t rows[] = {2, 0, 1, 2, 0, 2};
+  size_t cols[] = {3, 1, 0, 3, 1, 0};
+  float values[] = {1, 2, 3, 4, 5, 6};
+  float expected[] = {0, 7, 0, 0, 3, 0, 0, 0, 6, 0, 0, 5};
+  Matrix *E = matrix_create(3, 4);
+  matrix_set_array(E, expected, 12);
+  SparseMatrix *csr =
+      sparse_from_triplets(SPARSE_CSR, 3, 4, 6, rows, cols, values);
+  SparseMatrix *csc =
+      sparse_from_triplets(SPARSE_CSC, 3, 4, 6, rows, cols, values);
+  SparseMatrix *converted = sparse_convert(csr, SPARSE_CSC);
+  Matrix *D1 = sparse_to_dense(csr);
+  Matrix *D2 = sparse_to_dense(csc);
+  Matrix *D3 = sparse_to_dense(converted);
+  if (csr->nnz != 4 || csc->nnz != 4 || csr->idx[2] != 0 ||
+      csr->idx[3] != 3 || !matrices_are_approx_equal(D1, E, 0) ||
+      !matrices_are_approx_equal(D2, E, 0) ||
+      !matrices_are_approx_equal(D3, E, 0) ||
+      memcmp(csc->ptr, converted->ptr, 5 * sizeof(size_t)) != 0) {
+    printf("Test failed: triplets, conversions or dense round trip\n");
+    success = 0;
+  }
+  size_t bad_row[] = {3};
+  if (sparse_from_triplets(SPARSE_CSR, 3, 4, 1, bad_row, cols, values) !=
+      NULL) {
+    printf("Test failed: out-of-range triplet was accepted\n");
+    success = 0;
+  }
+
+  // SpMV and SpMM in both formats against the dense product
+  size_t side = 40, n = side * side, k = 7;
+  SparseMatrix *A = grid_matrix(SPARSE_CSR, side, side, 0.2f);
+  SparseMatrix *A_csc = sparse_convert(A, SPARSE_CSC);
+  Matrix *dense = sparse_to_dense(A);
+  SparseMatrix *from_dense = sparse_from_dense(SPARSE_CSR, dense, 0);
+  Matrix *B = matrix_create(n, k);
+  fill_pseudo_random(B, 41);
+  Matrix *expected_prod = matrix_mult(dense, B);
+  Matrix *prod = sparse_mult(A, B);
+  Matrix *prod_csc = sparse_mult(A_csc, B);
+  Matrix b_col = matrix_col(B, 2);
+  Matrix *y = matrix_create(n, 1);
+  fill_pseudo_random(y, 42);
+  Matrix *y_expected = matrix_scale(0.5f, y);
+  Matrix *Ab = matrix_mult(dense, &b_col);
+  matrix_scale_inplace(2.0f, Ab);
+  matrix_add_inplace(y_expected, Ab);
+  sparse_gemm(2.0f, A, &b_col, 0.5f, y);
+  if (from_dense->nnz != A->nnz ||
+      memcmp(from_dense->idx, A->idx, A->nnz * sizeof(size_t)) != 0 ||
+      !matrices_are_approx_equal(prod, expected_prod, 1e-4f) ||
+      !matrices_are_approx_equal(prod_csc, expected_prod, 1e-4f) ||
+      !matrices_are_approx_equal(y, y_expected, 1e-4f)) {
+    printf("Test failed: sparse products differ from dense ones\n");
+    success = 0;
+  }
+
+  // Direct solve: reordering keeps the fill far below dense, and the
+  // solution matches the dense LU
+  SparseLU *lu = sparse_lu_factor(A_csc);
+  Matrix *x = lu != NULL ? sparse_lu_solve(lu, B) : NULL;
+  Matrix *x_dense = solve_lin_system(dense, B);
+  if (lu == NULL || x == NULL || sparse_lu_nnz(lu) > n * 2 * side + 2 * n ||
+      !matrices_are_approx_equal(x, x_dense, 1e-4f)) {
+    printf("Test failed: sparse LU solve\n");
+    success = 0;
+  }
+
+  // 100000 unknowns: a dense matrix would need 40GB
+  SparseMatrix *big = grid_matrix(SPARSE_CSR, 10000, 10, 0.2f);
+  Matrix *ones = matrix_create(100000, 1);
+  for (size_t i = 0; i < 100000; i++) {
+    ones->array[i] = 1.0f;
+  }
+  Matrix *rhs = sparse_mult(big, ones);
+  Matrix *x_big = sparse_solve(big, rhs);
+  if (x_big == NULL || !matrices_are_approx_equal(x_big, ones, 1e-3f)) {
+    printf("Test failed: large sparse solve\n");
+    success = 0;
+  }
+
+  // Structurally singular: column 1 is empty
+  size_t sr[] = {0, 1};
+  size_t sc[] = {0, 0};
+  SparseMatrix *singular =
+      sparse_from_triplets(SPARSE_CSC, 2, 2, 2, sr, sc, values);
+  if (sparse_lu_factor(singular) != NULL) {
+    printf("Test failed: singular sparse matrix was factored\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: sparse formats, products and LU solve.\n");
+  }
+
+  matrix_free(E);
+  sparse_free(csr);
+  sparse_free(csc);
+  sparse_free(converted);
+  matrix_free(D1);
+  matrix_free(D2);
+  matrix_free(D3);
+  sparse_free(A);
+  sparse_free(A_csc);
+  matrix_free(dense);
+  sparse_free(from_dense);
+  matrix_free(B);
+  matrix_free(expected_prod);
+  matrix_free(prod);
+  matrix_free(prod_csc);
+  matrix_free(y);
+  matrix_free(y_expected);
+  matrix_free(Ab);
+  sparse_lu_free(lu);
+  matrix_free(x);
+  matrix_free(x_dense);
+  sparse_free(big);
+  matrix_free(ones);
+  matrix_free(rhs);
+  matrix_free(x_big);
+  sparse_free(singular);
+}
+
+// Records the residuals the solver reports
+typedef struct residual_log {
+  size_t count;
+  float first, last;
+} ResidualLog;
+
+static int log_residual(void *ctx, size_t iteration, float residual) {
+  ResidualLog *log = ctx;
+  if (log->count++ == 0)
+    log->first = residual;
+  log->last = residual;
+  return 0;
+}
+
+static int stop_at_three(void *ctx, size_t iteration, float residual) {
+  return iteration >= 3;
+}
+
+void test_krylov() {
+  printf("\n=== TESTING test_krylov ===\n");
+  int success = 1;
+  size_t side = 40, n = side * side;
+
+  SparseMatrix *spd = grid_matrix(SPARSE_CSR, side, side, 0);
+  SparseMatrix *skewed = grid_matrix(SPARSE_CSC, side, side, 0.6f);
+  Matrix *ones = matrix_create(n, 1);
+  for (size_t i = 0; i < n; i++) {
+    ones->array[i] = 1.0f;
+  }
+  Matrix *b_spd = sparse_mult(spd, ones);
+  Matrix *b_skewed = sparse_mult(skewed, ones);
+  Matrix *x = matrix_create(n, 1);
+
+  // CG, unpreconditioned and with each preconditioner; a better M must
+  // not take more iterations
+  Preconditioner *jacobi = precond_jacobi(spd);
+  Preconditioner *ilu = precond_ilu0(spd);
+  Preconditioner *block = precond_block_jacobi(spd, 2 * side);
+  const Preconditioner *spd_precond[] = {NULL, jacobi, ilu, block};
+  size_t iterations[4];
+  for (size_t p = 0; p < 4; p++) {
+    KrylovOptions options = {0};
+    options.tolerance = 1e-5f;
+    options.precond = spd_precond[p];
+    ResidualLog log = {0};
+    options.monitor = log_residual;
+    options.monitor_ctx = &log;
+    KrylovInfo info;
+    matrix_scale_inplace(0.0f, x);
+    if (krylov_cg(sparse_operator(spd), b_spd, x, &options, &info) == NULL ||
+        !info.converged || info.residual > 1e-5f ||
+        log.count != info.iterations || !(log.last < log.first) ||
+        !matrices_are_approx_equal(x, ones, 1e-3f)) {
+      printf("Test failed: CG with preconditioner %zu\n", p);
+      success = 0;
+    }
+    iterations[p] = info.iterations;
+  }
+  if (!(iterations[2] < iterations[0] && iterations[2] < iterations[1])) {
+    printf("Test failed: ILU(0) did not speed up CG (%zu vs %zu, %zu)\n",
+           iterations[2], iterations[0], iterations[1]);
+    success = 0;
+  }
+
+  // Nonsymmetric: GMRES and BiCGSTAB, against the direct solver
+  Preconditioner *skewed_ilu = precond_ilu0(skewed);
+  Preconditioner *skewed_block = precond_block_jacobi(skewed, side);
+  Matrix *x_direct = sparse_solve(skewed, b_skewed);
+  const Preconditioner *skewed_precond[] = {NULL, skewed_ilu, skewed_block};
+  for (size_t p = 0; p < 3; p++) {
+    KrylovOptions options = {0};
+    options.tolerance = 1e-5f;
+    options.restart = 20;
+    options.precond = skewed_precond[p];
+    KrylovInfo info;
+    matrix_scale_inplace(0.0f, x);
+    if (krylov_gmres(sparse_operator(skewed), b_skewed, x, &options, &info) ==
+            NULL ||
+        !info.converged || !matrices_are_approx_equal(x, x_direct, 1e-3f)) {
+      printf("Test failed: GMRES with preconditioner %zu\n", p);
+      success = 0;
+    }
+    matrix_scale_inplace(0.0f, x);
+    if (krylov_bicgstab(sparse_operator(skewed), b_skewed, x, &options,
+                        &info) == NULL ||
+        !info.converged || !matrices_are_approx_equal(x, x_direct, 1e-3f)) {
+      printf("Test failed: BiCGSTAB with preconditioner %zu\n", p);
+      success = 0;
+    }
+  }
+
+  // A dense operator, a good initial guess and an early stop
+  Matrix *dense = sparse_to_dense(skewed);
+  KrylovInfo info;
+  Matrix *guess = matrix_scale(1.0f, x_direct);
+  if (krylov_gmres(matrix_operator(dense), b_skewed, guess, NULL, &info) ==
+          NULL ||
+      info.iterations != 0) {
+    printf("Test failed: GMRES from the solution\n");
+    success = 0;
+  }
+  KrylovOptions stopped = {0};
+  stopped.monitor = stop_at_three;
+  matrix_scale_inplace(0.0f, x);
+  if (krylov_bicgstab(matrix_operator(dense), b_skewed, x, &stopped,
+                      &info) != NULL ||
+      info.converged || info.iterations != 3) {
+    printf("Test failed: monitor did not stop BiCGSTAB\n");
+    success = 0;
+  }
+
+  // CG refuses an indefinite matrix
+  Matrix *neg = matrix_scale(-1.0f, dense);
+  matrix_scale_inplace(0.0f, x);
+  if (krylov_cg(matrix_operator(neg), b_skewed, x, NULL, &info) != NULL ||
+      info.converged) {
+    printf("Test failed: CG accepted a negative definite matrix\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: CG, GMRES and BiCGSTAB with preconditioners.\n");
+  }
+
+  sparse_free(spd);
+  sparse_free(skewed);
+  matrix_free(ones);
+  matrix_free(b_spd);
+  matrix_free(b_skewed);
+  matrix_free(x);
+  precond_free(jacobi);
+  precond_free(ilu);
+  precond_free(block);
+  precond_free(skewed_ilu);
+  precond_free(skewed_block);
+  matrix_free(x_direct);
+  matrix_free(dense);
+  matrix_free(guess);
+  matrix_free(neg);
+}
+
+void test_matrix_batch() {
+  printf("\n=== TESTING test_matrix_batch ===\n");
+  int success = 1;
+  // 37 is not a multiple of the lane count; 11 takes the kernels for any
+  // size
+  size_t count = 37, sizes[] = {3, 4, 6, 11};
+
+  for (size_t s = 0; s < 4; s++) {
+    size_t n = sizes[s];
+    MatrixBatch *A = matrix_batch_create(count, n, n);
+    MatrixBatch *B = matrix_batch_create(count, n, 2);
+    Matrix *a = matrix_create(n, n);
+    Matrix *b = matrix_create(n, 2);
+    for (size_t e = 0; e < count; e++) {
+      fill_pseudo_random(a, 100 + e);
+      fill_pseudo_random(b, 200 + e);
+      matrix_batch_set(A, e, a);
+      matrix_batch_set(B, e, b);
+    }
+    // One exactly singular entry, which must not affect the others
+    Matrix *zero = matrix_create(n, n);
+    matrix_scale_inplace(0.0f, zero);
+    matrix_batch_set(A, 5, zero);
+
+    float det[37], det_inv[37], det_solve[37];
+    MatrixBatch *AA = matrix_batch_mult(A, A);
+    MatrixBatch *inv = matrix_batch_inverse(A, det_inv);
+    MatrixBatch *x = matrix_batch_solve(A, B, det_solve);
+    matrix_batch_determinant(A, det);
+
+    Matrix *got = matrix_create(n, n);
+    Matrix *got_x = matrix_create(n, 2);
+    for (size_t e = 0; e < count; e++) {
+      matrix_batch_get(A, e, a);
+      matrix_batch_get(B, e, b);
+      float expected_det = matrix_determinant(a);
+      float scale = fabsf(expected_det) > 1 ? fabsf(expected_det) : 1;
+      if (!compare_floats(det[e], expected_det, 1e-4f * scale) ||
+          !compare_floats(det_inv[e], expected_det, 1e-4f * scale) ||
+          !compare_floats(det_solve[e], expected_det, 1e-4f * scale)) {
+        printf("Test failed: %zu x %zu determinant %zu\n", n, n, e);
+        success = 0;
+      }
+
+      Matrix *expected_AA = matrix_mult(a, a);
+      matrix_batch_get(AA, e, got);
+      if (!matrices_are_approx_equal(got, expected_AA, 1e-4f)) {
+        printf("Test failed: %zu x %zu product %zu\n", n, n, e);
+        success = 0;
+      }
+      matrix_free(expected_AA);
+
+      if (e == 5) {
+        matrix_batch_get(inv, e, got);
+        if (det[e] != 0 || isfinite(got->array[0])) {
+          printf("Test failed: singular entry\n");
+          success = 0;
+        }
+        continue;
+      }
+      // Random matrices can be ill conditioned: check the residuals
+      matrix_batch_get(inv, e, got);
+      Matrix *id = matrix_mult(a, got);
+      Matrix *expected_id = matrix_identity(n);
+      matrix_batch_get(x, e, got_x);
+      Matrix *ax = matrix_mult(a, got_x);
+      if (!matrices_are_approx_equal(id, expected_id, 1e-2f) ||
+          !matrices_are_approx_equal(ax, b, 1e-2f)) {
+        printf("Test failed: %zu x %zu inverse or solve %zu\n", n, n, e);
+        success = 0;
+      }
+      matrix_free(id);
+      matrix_free(expected_id);
+      matrix_free(ax);
+    }
+
+    matrix_batch_free(A);
+    matrix_batch_free(B);
+    matrix_batch_free(AA);
+    matrix_batch_free(inv);
+    matrix_batch_free(x);
+    matrix_free(a);
+    matrix_free(b);
+    matrix_free(zero);
+    matrix_free(got);
+    matrix_free(got_x);
+  }
+
+  // Rectangular GEMM with beta, against the single-matrix one
+  MatrixBatch *A = matrix_batch_create(20, 3, 5);
+  MatrixBatch *B = matrix_batch_create(20, 5, 2);
+  MatrixBatch *C = matrix_batch_create(20, 3, 2);
+  Matrix *a = matrix_create(3, 5), *b = matrix_create(5, 2);
+  Matrix *c = matrix_create(3, 2), *got = matrix_create(3, 2);
+  for (size_t e = 0; e < 20; e++) {
+    fill_pseudo_random(a, 300 + e);
+    fill_pseudo_random(b, 400 + e);
+    fill_pseudo_random(c, 500 + e);
+    matrix_batch_set(A, e, a);
+    matrix_batch_set(B, e, b);
+    matrix_batch_set(C, e, c);
+  }
+  matrix_batch_gemm(2.0f, A, B, -0.5f, C);
+  for (size_t e = 0; e < 20; e++) {
+    fill_pseudo_random(a, 300 + e);
+    fill_pseudo_random(b, 400 + e);
+    fill_pseudo_random(c, 500 + e);
+    matrix_gemm(2.0f, a, b, -0.5f, c);
+    matrix_batch_get(C, e, got);
+    if (!matrices_are_approx_equal(got, c, 1e-4f)) {
+      printf("Test failed: batched GEMM %zu\n", e);
+      success = 0;
+    }
+  }
+  if (matrix_batch_gemm(1.0f, A, A, 0.0f, C) != NULL ||
+      matrix_batch_create(4, 17, 17) != NULL) {
+    printf("Test failed: bad batch shapes were accepted\n");
+    success = 0;
+  }
+
+  if (success) {
+    printf("Test passed: batched GEMM, determinant, inverse and solve.\n");
+  }
+
+  matrix_batch_free(A);
+  matrix_batch_free(B);
+  matrix_batch_free(C);
+  matrix_free(a);
+  matrix_free(b);
+  matrix_free(c);
+  matrix_free(got);
+}
+
+// One checker per fixed size, against the Matrix functions on the same data
+#define FIXED_SIZE_CHECK(N)                                                    \
+  static int check_fixed_##N(unsigned int seed) {                             \
+    int ok = 1;                                                                \
+    Matrix *A = matrix_create(N, N), *B = matrix_create(N, N);                \
+    fill_pseudo_random(A, seed);                                               \
+    fill_pseudo_random(B, seed + 1);                                           \
+    Matrix##N a, b, c;                                                         \
+    matrix##N##_from_matrix(&a, A);                                            \
+    matrix##N##_from_matrix(&b, B);                                            \
+    Matrix cv = matrix##N##_view(&c);                                          \
+                                                                               \
+    Matrix *AB = matrix_mult(A, B);                                            \
+    matrix##N##_mult(&c, &a, &b);                                              \
+    ok &= matrices_are_approx_equal(&cv, AB, 1e-5f);                          \
+    Matrix *At = matrix_trans(A);                                              \
+    matrix##N##_trans(&c, &a);                                                 \
+    ok &= matrices_are_approx_equal(&cv, At, 0);                              \
+    float det = matrix_determinant(A);                                         \
+    ok &= compare_floats(matrix##N##_determinant(&a), det,                     \
+                         1e-4f * (fabsf(det) > 1 ? fabsf(det) : 1));          \
+                                                                               \
+    /* in place: a = a^-1, then a a^-1 = I */                                  \
+    Matrix##N inv = a;                                                         \
+    ok &= matrix##N##_inverse(&inv, &inv) == &inv;                             \
+    Matrix##N id;                                                              \
+    matrix##N##_mult(&c, &a, &inv);                                            \
+    Matrix idv = matrix##N##_view(matrix##N##_identity(&id));                 \
+    ok &= matrices_are_approx_equal(&cv, &idv, 1e-3f);                        \
+                                                                               \
+    float x[N], y[N];                                                          \
+    for (int i = 0; i < N; i++) {                                              \
+      x[i] = (float)i - 1.5f;                                                  \
+    }                                                                          \
+    matrix##N##_mult_vec(y, &a, x);                                            \
+    matrix##N##_solve(y, &a, y);                                               \
+    for (int i = 0; i < N; i++) {                                              \
+      ok &= compare_floats(y[i], x[i], 1e-3f);                                 \
+    }                                                                          \
+                                                                               \
+    /* exactly singular: a zero row */                                         \
+    for (int j = 0; j < N; j++) {                                              \
+      a.m[1][j] = 0;                                                           \
+    }                                                                          \
+    ok &= matrix##N##_determinant(&a) == 0;                                    \
+    ok &= matrix##N##_inverse(&inv, &a) == NULL;                               \
+    ok &= matrix##N##_solve(y, &a, x) == NULL;                                 \
+                                                                               \
+    matrix_free(A);                                                            \
+    matrix_free(B);                                                            \
+    matrix_free(AB);                                                           \
+    matrix_free(At);                                                           \
+    return ok;                                                                 \
+  }
+
+FIXED_SIZE_CHECK(2)
+FIXED_SIZE_CHECK(3)
+FIXED_SIZE_CHECK(4)
+FIXED_SIZE_CHECK(5)
+FIXED_SIZE_CHECK(6)
+FIXED_SIZE_CHECK(7)
+FIXED_SIZE_CHECK(8)
+
+void test_matrix_fixed() {
+  printf("\n=== TESTING test_matrix_fixed ===\n");
+  int success = 1;
+  int (*checks[])(unsigned int) = {check_fixed_2, check_fixed_3,
+                                   check_fixed_4, check_fixed_5,
+                                   check_fixed_6, check_fixed_7,
+                                   check_fixed_8};
+  int sizes[] = {2, 3, 4, 5, 6, 7, 8};
+  for (size_t c = 0; c < 7; c++) {
+    for (unsigned int seed = 0; seed < 20; seed++) {
+      if (!checks[c](600 + 10 * seed)) {
+        printf("Test failed: %d x %d fixed-size matrix, seed %u\n", sizes[c],
+               sizes[c], seed);
+        success = 0;
+      }
+    }
+  }
+
+  Matrix *wrong = matrix_create(3, 4);
+  Matrix3 m3;
+  if (matrix3_from_matrix(&m3, wrong) != NULL) {
+    printf("Test failed: 3 x 4 matrix copied into a Matrix3\n");
+    success = 0;
+  }
+  matrix_free(wrong);
+
+  if (success) {
+    printf("Test passed: fixed-size mult, trans, determinant, inverse and "
+           "solve.\n");
+  }
+}
+
+void test_matrix_expr() {
+  printf("\n=== TESTING test_matrix_expr ===\n");
+  int success = 1;
+  // Rows longer than one chunk of the fused pass, and not a multiple of it
+  size_t m = 37, k = 53, n = 1100;
+  Matrix *X = matrix_create(m, n), *C = matrix_create(m, n);
+  Matrix *Y = matrix_create(m, k), *Z = matrix_create(k, n);
+  fill_pseudo_random(X, 1);
+  fill_pseudo_random(C, 2);
+  fill_pseudo_random(Y, 3);
+  fill_pseudo_random(Z, 4);
+
+  // 0.5 (X + Y Z) - C: one pass for X and C, one GEMM
+  MatrixExpr *e = expr_subtract(
+      expr_scale(0.5f, expr_add(expr_matrix(X),
+                                expr_mult(expr_matrix(Y), expr_matrix(Z)))),
+      expr_matrix(C));
+  Matrix *got = expr_eval(e);
+  Matrix *YZ = naive_gemm(1.0f, Y, Z, 0.0f, C);
+  Matrix *sum = matrix_add(X, YZ);
+  Matrix *half = matrix_scale(0.5f, sum);
+  Matrix *expected = matrix_subtract(half, C);
+  if (got == NULL || !matrices_are_approx_equal(got, expected, 1e-4f)) {
+    printf("Test failed: 0.5 (X + Y Z) - C\n");
+    success = 0;
+  }
+  expr_free(e);
+  matrix_free(got);
+  matrix_free(sum);
+  matrix_free(half);
+  matrix_free(expected);
+
+  // The transpose of it all, into a transposed view of a matrix
+  e = expr_trans(expr_add(expr_matrix(X),
+                          expr_mult(expr_scale(2.0f, expr_matrix(Y)),
+                                    expr_matrix(Z))));
+  Matrix *out = matrix_create(m, n);
+  Matrix out_t = matrix_trans_view(out);
+  Matrix *twice = matrix_scale(2.0f, YZ);
+  expected = matrix_add(X, twice);
+  if (expr_eval_into(&out_t, e) == NULL ||
+      !matrices_are_approx_equal(out, expected, 1e-4f)) {
+    printf("Test failed: (X + 2 Y Z)^T\n");
+    success = 0;
+  }
+  expr_free(e);
+  matrix_free(twice);
+  matrix_free(expected);
+
+  // C = 3 Y Z - 2 C in place, as one GEMM
+  expected = naive_gemm(3.0f, Y, Z, -2.0f, C);
+  e = expr_subtract(expr_scale(3.0f, expr_mult(expr_matrix(Y),
+                                               expr_matrix(Z))),
+                    expr_scale(2.0f, expr_matrix(C)));
+  if (expr_eval_into(C, e) != C ||
+      !matrices_are_approx_equal(C, expected, 1e-4f)) {
+    printf("Test failed: C = 3 Y Z - 2 C in place\n");
+    success = 0;
+  }
+  expr_free(e);
+  matrix_free(expected);
+
+  // A product of sums: both operands are evaluated first, from views
+  size_t s = m < k ? m : k;
+  Matrix Yk = matrix_view(Y, 0, 0, s, s);
+  Matrix Xs = matrix_view(X, 0, 5, s, 40);
+  Matrix Zs = matrix_view(Z, 0, 7, s, 40);
+  e = expr_mult(expr_add(expr_matrix(&Yk), expr_trans(expr_matrix(&Yk))),
+                expr_subtract(expr_matrix(&Xs), expr_matrix(&Zs)));
+  got = expr_eval(e);
+  Matrix *Ykt = matrix_create(s, s);
+  matrix_trans_into(Ykt, &Yk);
+  Matrix *Ysum = matrix_add(&Yk, Ykt);
+  Matrix *diff = matrix_subtract(&Xs, &Zs);
+  expected = naive_gemm(1.0f, Ysum, diff, 0.0f, diff);
+  if (got == NULL || !matrices_are_approx_equal(got, expected, 1e-4f)) {
+    printf("Test failed: (Y + Y^T) (X - Z) on views\n");
+    success = 0;
+  }
+  expr_free(e);
+  matrix_free(got);
+  matrix_free(Ykt);
+  matrix_free(Ysum);
+  matrix_free(diff);
+  matrix_free(expected);
+
+  // S = S^T + S reads S transposed while writing it: through a temporary
+  Matrix *S = matrix_create(s, s);
+  fill_pseudo_random(S, 5);
+  Matrix *St = matrix_create(s, s);
+  matrix_trans_into(St, S);
+  expected = matrix_add(St, S);
+  e = expr_add(expr_trans(expr_matrix(S)), expr_matrix(S));
+  if (expr_eval_into(S, e) != S ||
+      !matrices_are_approx_equal(S, expected, 1e-5f)) {
+    printf("Test failed: S = S^T + S\n");
+    success = 0;
+  }
+  expr_free(e);
+  matrix_free(St);
+  matrix_free(expected);
+
+  // Errors propagate through the nesting
+  e = expr_add(expr_matrix(X), expr_mult(expr_matrix(Y), expr_matrix(X)));
+  if (e != NULL) {
+    printf("Test failed: Y X accepted\n");
+    success = 0;
+  }
+  e = expr_matrix(X);
+  if (expr_eval_into(S, e) != NULL) {
+    printf("Test failed: evaluated into a dst of the wrong shape\n");
+    success = 0;
+  }
+  expr_free(e);
+
+  matrix_free(S);
+  matrix_free(out);
+  matrix_free(YZ);
+  matrix_free(X);
+  matrix_free(C);
+  matrix_free(Y);
+  matrix_free(Z);
+  if (success) {
+    printf("Test passed: fused sums, GEMM products, transposes and "
+           "aliasing.\n");
+  }
+}
+
+void test_matrix_files() {
+  printf("\n=== TESTING test_matrix_files ===\n");
+  int success = 1;
+  const char *path = "test_matrix_files.bin";
+
+  // A strided view goes out dense and comes back exactly, copied and mapped
+  Matrix *A = matrix_create(70, 90);
+  fill_pseudo_random(A, 7);
+  Matrix v = matrix_view(A, 3, 5, 41, 37);
+  Matrix vt = matrix_trans_view(&v);
+  Matrix *loaded = NULL;
+  if (matrix_save(path, &vt) != 0 || (loaded = matrix_load(path)) == NULL ||
+      !matrices_are_approx_equal(loaded, &vt, 0.0f)) {
+    printf("Test failed: save and load of a transposed view\n");
+    success = 0;
+  }
+  matrix_free(loaded);
+
+  MatrixFile *file = matrix_file_open(path, 1);
+  Matrix mapped = file != NULL ? matrix_file_view(file) : v;
+  if (file == NULL || matrix_file_elem_type(file) != MATRIX_ELEM_FLOAT ||
+      !matrices_are_approx_equal(&mapped, &vt, 0.0f) ||
+      (uintptr_t)mapped.array % MATRIX_ALIGNMENT != 0) {
+    printf("Test failed: mapped view\n");
+    success = 0;
+  }
+  // Another type's view of it is refused
+  if (file != NULL && matrixd_file_view(file).array != NULL) {
+    printf("Test failed: float file viewed as doubles\n");
+    success = 0;
+  }
+  matrix_file_close(file);
+
+  MatrixZ *Z = matrixz_create(5, 3);
+  for (size_t i = 0; i < 5; i++) {
+    for (size_t j = 0; j < 3; j++) {
+      matrixz_set(Z, i, j, (double)i + I * (double)j / 3.0);
+    }
+  }
+  MatrixZ *Z_loaded = NULL;
+  if (matrixz_save(path, Z) != 0 || (Z_loaded = matrixz_load(path)) == NULL ||
+      !matrixz_approx_equal(Z_loaded, Z, 0.0) ||
+      matrix_load(path) != NULL) {
+    printf("Test failed: complex double round trip\n");
+    success = 0;
+  }
+  matrixz_free(Z);
+  matrixz_free(Z_loaded);
+
+  // Corruption: one flipped bit in the data fails the checksum, which
+  // only a verified open reads; a truncated file fails either way
+  matrix_save(path, A);
+  FILE *f = fopen(path, "r+b");
+  fseek(f, 64 + 1000, SEEK_SET);
+  int byte = fgetc(f);
+  fseek(f, 64 + 1000, SEEK_SET);
+  fputc(byte ^ 1, f);
+  fclose(f);
+  file = matrix_file_open(path, 0);
+  if (file == NULL || matrix_file_open(path, 1) != NULL ||
+      matrix_load(path) != NULL) {
+    printf("Test failed: corrupted file\n");
+    success = 0;
+  }
+  matrix_file_close(file);
+  if (truncate(path, 64 + 4 * 70 * 90 - 4) != 0 ||
+      matrix_file_open(path, 0) != NULL) {
+    printf("Test failed: truncated file\n");
+    success = 0;
+  }
+  f = fopen(path, "wb");
+  fputs("1.0, 2.0\n", f);
+  fclose(f);
+  if (matrix_file_open(path, 0) != NULL) {
+    printf("Test failed: text file opened\n");
+    success = 0;
+  }
+
+  // A header claiming alignment 1 with the data at offset 65 would map
+  // misaligned floats
+  matrix_save(path, A);
+  f = fopen(path, "r+b");
+  unsigned char alignment_1[4] = {1, 0, 0, 0};
+  unsigned char offset_65[8] = {65, 0, 0, 0, 0, 0, 0, 0};
+  fseek(f, 20, SEEK_SET);
+  fwrite(alignment_1, 1, sizeof(alignment_1), f);
+  fseek(f, 48, SEEK_SET);
+  fwrite(offset_65, 1, sizeof(offset_65), f);
+  fseek(f, 0, SEEK_END);
+  fputc(0, f); // so the data still fits after the shift
+  fclose(f);
+  if (matrix_file_open(path, 0) != NULL || matrix_load(path) != NULL) {
+    printf("Test failed: misaligned data offset accepted\n");
+    success = 0;
+  }
+
+  remove(path);
+  matrix_free(A);
+  if (success) {
+    printf("Test passed: binary save, load, mapped views and checksums.\n");
+  }
 }
+
+void test_matrix_out_of_core() {
+  printf("\n=== TESTING test_matrix_out_of_core ===\n");
+  int success = 1;
+  const char *a_path = "test_ooc_a.bin", *b_path = "test_ooc_b.bin";
+  const char *c_path = "test_ooc_c.bin";
+
+  // Budgets of a few KB force many tiles, none of the sizes a multiple of
+  // the tile side
+  Matrix *A = matrix_create(150, 200);
+  Matrix *B = matrix_create(200, 130);
+  fill_pseudo_random(A, 11);
+  fill_pseudo_random(B, 12);
+  matrix_save(a_path, A);
+  matrix_save(b_path, B);
+  Matrix *C = NULL, *expected = matrix_mult(A, B);
+  if (matrix_file_mult(c_path, a_path, b_path, 5 * 32 * 32 * 4) != 0 ||
+      (C = matrix_load(c_path)) == NULL ||
+      !matrices_are_approx_equal(C, expected, 1e-3f)) {
+    printf("Test failed: out-of-core product\n");
+    success = 0;
+  }
+  matrix_free(C);
+  matrix_free(expected);
+  if (matrix_file_mult(c_path, a_path, a_path, 0) == 0) {
+    printf("Test failed: product of mismatched files\n");
+    success = 0;
+  }
+
+  // P A = L U, checked by multiplying the factors back, then a solve
+  size_t n = 157, budget = 3 * 157 * 4 * 48;
+  Matrix *M = matrix_create(n, n);
+  fill_pseudo_random(M, 13);
+  matrix_save(a_path, M);
+  size_t *pivots = malloc(n * sizeof(size_t));
+  Matrix *LU = NULL;
+  if (matrix_file_lu(c_path, a_path, pivots, budget) != 0 ||
+      (LU = matrix_load(c_path)) == NULL) {
+    printf("Test failed: out-of-core LU\n");
+    success = 0;
+  } else {
+    Matrix *L = matrix_create(n, n), *U = matrix_create(n, n);
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        float v = matrix_get(LU, i, j);
+        matrix_set(L, i, j, i > j ? v : i == j ? 1.0f : 0.0f);
+        matrix_set(U, i, j, i <= j ? v : 0.0f);
+      }
+    }
+    Matrix *PA = matrix_create(n, n);
+    memcpy(PA->array, M->array, n * n * sizeof(float));
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        float tmp = matrix_get(PA, i, j);
+        matrix_set(PA, i, j, matrix_get(PA, pivots[i], j));
+        matrix_set(PA, pivots[i], j, tmp);
+      }
+    }
+    Matrix *product = matrix_mult(L, U);
+    if (!matrices_are_approx_equal(product, PA, 1e-3f)) {
+      printf("Test failed: out-of-core LU factors\n");
+      success = 0;
+    }
+    matrix_free(L);
+    matrix_free(U);
+    matrix_free(PA);
+    matrix_free(product);
+
+    Matrix *b = matrix_create(n, 3);
+    fill_pseudo_random(b, 14);
+    Matrix *x = matrix_file_lu_solve(c_path, pivots, b, budget);
+    Matrix *x_expected = solve_lin_system(M, b);
+    if (x == NULL || !matrices_are_approx_equal(x, x_expected, 1e-2f)) {
+      printf("Test failed: out-of-core LU solve\n");
+      success = 0;
+    }
+    matrix_free(b);
+    matrix_free(x);
+    matrix_free(x_expected);
+  }
+  matrix_free(LU);
+
+  // A zero row makes A exactly singular
+  for (size_t j = 0; j < n; j++) {
+    matrix_set(M, 90, j, 0.0f);
+  }
+  matrix_save(a_path, M);
+  if (matrix_file_lu(c_path, a_path, pivots, budget) == 0) {
+    printf("Test failed: singular matrix factored\n");
+    success = 0;
+  }
+
+  // An output naming an input would truncate it before it is read
+  Matrix *M_kept = NULL;
+  if (matrix_file_mult(a_path, a_path, a_path, budget) == 0 ||
+      matrix_file_lu(a_path, a_path, pivots, budget) == 0 ||
+      (M_kept = matrix_load(a_path)) == NULL ||
+      !matrices_are_approx_equal(M_kept, M, 0.0f)) {
+    printf("Test failed: output overwriting an input\n");
+    success = 0;
+  }
+  matrix_free(M_kept);
+
+  remove(a_path);
+  remove(b_path);
+  remove(c_path);
+  free(pivots);
+  matrix_free(A);
+  matrix_free(B);
+  matrix_free(M);
+  if (success) {
+    printf("Test passed: out-of-core GEMM, LU and solve.\n");
+  }
+}
+
 int main() {
   test_matrix_create_free();
   test_matrix_set_get();
@@ -348,11 +2967,37 @@ int main() {
   test_matrix_add();
   test_matrix_subtract();
   test_matrix_mult();
+  test_matrix_gemm();
+  test_matrix_strassen();
+  test_simd_dispatch();
+  test_thread_pool();
+  test_profile();
+  test_tuning();
   test_matrix_trans();
   test_matrix_set_array();
+  test_matrix_into_variants();
+  test_matrix_trans_inplace();
+  test_matrix_allocators();
+  test_matrix_views();
+  test_element_types();
+  test_typed_solve();
   test_matrix_determinant();
   test_matrix_inverse();
+  test_lu_factor();
   test_solve_lin_system();
+  test_solve_refined();
+  test_sparse();
+  test_structured();
+  test_krylov();
+  test_matrix_batch();
+  test_matrix_fixed();
+  test_matrix_expr();
+  test_matrix_files();
+  test_matrix_out_of_core();
+  test_least_squares();
+  test_eigen_sym();
+  test_svd_factor();
+  test_randomized_svd();
 
   return 0;
 }